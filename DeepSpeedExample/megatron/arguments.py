@@ -564,9 +564,23 @@ def _add_zero_args(parser):
                      help='Use CSD for update phase of ZeRO')
     group.add_argument('--comp-ratio', type=float, default=1.0,
                      help='Compression ratio of SmartComp')
+    group.add_argument('--error-feedback', type=int, default=0,
+                     help='Carry gradients dropped by SmartComp over to the next step')
+    group.add_argument('--topk-block', type=int, default=0,
+                     help='Block size of block-local SmartComp top-k, 0 for global top-k')
+    group.add_argument('--grad-bits', type=int, default=16, choices=[16, 8, 4],
+                     help='Bits per SmartComp gradient value, 8 or 4 quantize with per-block steps')
+    group.add_argument('--grad-stochastic-round', type=int, default=0,
+                     help='Round quantized SmartComp gradient values stochastically')
     
     group.add_argument('--opt-type', type=int, default=0,
-                     help='Various Optimizer of SmartComp') # 0: Adam, 1: Adagrad 2: Momentum 
+                     help='Various Optimizer of SmartComp') # 0: Adam, 1: Adagrad 2: Momentum 3: Lion 4: Adafactor 5: LAMB 
+    group.add_argument('--state-bits', type=int, default=32,
+                     help='Bits per optimizer state element, 8 for blockwise quantized Adam states')
+    group.add_argument('--ema-decay', type=float, default=0.0,
+                     help='Decay of an exponential moving average of the weights kept by Adam, 0 disables it')
+    group.add_argument('--bf16-master-weights', action='store_true',
+                     help='Keep Adam master weights as bf16 with stochastic rounding')
 
 
 
@@ -190,7 +190,10 @@ def get_optimizer(model):
                 optimizer = cpu_adam_optimizer( param_groups,
                                                lr=args.lr,
                                                weight_decay=args.weight_decay,
-                                               opt_type = args.opt_type )
+                                               opt_type = args.opt_type,
+                                               state_bits = args.state_bits,
+                                               ema_decay = args.ema_decay,
+                                               master_weights_bf16 = args.bf16_master_weights )
             elif args.opt_type == 1: # Adagrad
                 if args.use_fpga == 1:
                     from deepspeed.ops.adam import DeepSpeedCPUAdam
@@ -213,6 +216,29 @@ def get_optimizer(model):
                                                lr=args.lr,
                                                weight_decay=args.weight_decay,
                                                opt_type = args.opt_type )
+            elif args.opt_type == 3: # Lion
+                from deepspeed.ops.adam import DeepSpeedCPUAdam
+                cpu_adam_optimizer = DeepSpeedCPUAdam
+                optimizer = cpu_adam_optimizer( param_groups,
+                                               lr=args.lr,
+                                               betas=(0.9, 0.99),
+                                               weight_decay=args.weight_decay,
+                                               opt_type = args.opt_type )
+            elif args.opt_type == 4: # Adafactor
+                from deepspeed.ops.adam import DeepSpeedCPUAdam
+                cpu_adam_optimizer = DeepSpeedCPUAdam
+                optimizer = cpu_adam_optimizer( param_groups,
+                                               lr=args.lr,
+                                               eps=1e-30,
+                                               weight_decay=args.weight_decay,
+                                               opt_type = args.opt_type )
+            elif args.opt_type == 5: # LAMB
+                from deepspeed.ops.adam import DeepSpeedCPUAdam
+                cpu_adam_optimizer = DeepSpeedCPUAdam
+                optimizer = cpu_adam_optimizer( param_groups,
+                                               lr=args.lr,
+                                               weight_decay=args.weight_decay,
+                                               opt_type = args.opt_type )
             else:
                 raise NotImplementedError
                 
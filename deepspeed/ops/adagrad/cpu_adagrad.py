@@ -62,6 +62,8 @@ class DeepSpeedCPUAdagrad(torch.optim.Optimizer):
         device = torch.device('cpu')
 
         for group_id, group in enumerate(self.param_groups):
+            # tensors of the group by step, updated together by adagrad_update_multi
+            batches = {}
             for param_id, p in enumerate(group['params']):
 
                 if p.grad is None:
@@ -86,7 +88,12 @@ class DeepSpeedCPUAdagrad(torch.optim.Optimizer):
 
                 state['step'] += 1
 
-                self.ds_opt_adagrad.adagrad_update(self.opt_id, state['step'], group['lr'], group['eps'],
-                                                           group['weight_decay'], p.data, p.grad.data,
-                                                           state['exp_avg_sq'])
+                params, grads, exp_avg_sq = batches.setdefault(state['step'], ([], [], []))
+                params.append(p.data)
+                grads.append(p.grad.data)
+                exp_avg_sq.append(state['exp_avg_sq'])
+
+            for step, (params, grads, exp_avg_sq) in batches.items():
+                self.ds_opt_adagrad.adagrad_update_multi(self.opt_id, step, group['lr'], group['eps'],
+                                                         group['weight_decay'], params, grads, exp_avg_sq)
         return loss
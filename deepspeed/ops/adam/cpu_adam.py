@@ -3,12 +3,19 @@
 
 # DeepSpeed Team
 
+import math
+import zlib
 import torch
 from cpuinfo import get_cpu_info
 from deepspeed.utils import logger
 from deepspeed.utils.logging import should_log_le
 from deepspeed.ops.op_builder import CPUAdamBuilder
 
+# Phases of lamb_update, lamb_update_fpga and adafactor_update, see PHASE_* in cpu_adam.cpp
+PHASE_NORM, PHASE_UPDATE, PHASE_ALL = 0, 1, 2
+# Smallest fp32 state that holds a parameter's 8-bit codes and scales, see quantized_scale_offset
+QUANTIZED_MIN_NUMEL = 17
+
 #from deepspeed.runtime.utils import see_memory_usage
 #from deepspeed.runtime.swap_tensor.utils import get_sized_buffers, get_sized_buffer
 
@@ -26,7 +33,17 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
                  amsgrad=False,
                  adamw_mode=True,
                  fp32_optimizer_states=True,
-                 opt_type = 0):
+                 opt_type = 0,
+                 max_coeff=10.0,
+                 min_coeff=0.01,
+                 state_bits=32,
+                 ema_decay=0.0,
+                 master_weights_bf16=False,
+                 nesterov=False,
+                 dampening=None,
+                 moment_dtype=None,
+                 stochastic_moments=False,
+                 lazy_block=16):
         """Fast vectorized implementation of two variations of Adam optimizer on CPU:
 
         * Adam: A Method for Stochastic Optimization: (https://arxiv.org/abs/1412.6980);
@@ -69,8 +86,70 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
             adamw_mode: select between Adam and AdamW implementations (default: AdamW)
             full_precision_optimizer_states: creates momentum and variance in full precision regardless of
                         the precision of the parameters (default: True)
+            max_coeff(float, optional): maximum value of the lamb coefficient (default: 10.0)
+            min_coeff(float, optional): minimum value of the lamb coefficient (default: 0.01)
+            state_bits(int, optional): 8 keeps Adam's exp_avg/exp_avg_sq as blockwise 8-bit codes
+                        with absmax scales inside the fp32 state tensors, so the near-storage
+                        path moves about a quarter of the moment bytes. The codes of sqrt(v) are
+                        square-root spaced so small second moments are not rounded to 0
+                        (default: 32)
+            ema_decay(float, optional): > 0 keeps state['ema'], an exponential moving average of
+                        the fp32 weights for evaluation, updated in the same pass as the
+                        parameters. Adam with fp32 states only. It is swapped like the moments,
+                        so offload_optimizer needs buffer_count >= 5 (default: 0.0)
+            master_weights_bf16(bool, optional): keep the master weights as bf16 with stochastic
+                        rounding on write-back, moments stay fp32. On the near-storage path the
+                        param swap file is rewritten as bf16 on the first step and read back as
+                        the forward copy; on the host path bfloat16 params are updated in place.
+                        Adam with fp32 states, or momentum SGD on the host path (default: False)
+            nesterov(bool, optional): Nesterov momentum for momentum SGD (opt_type 2), host path
+                        only (default: False)
+            dampening(float, optional): momentum SGD scales the gradient by 1 - dampening before
+                        adding it to the momentum buffer. None uses betas[0], the near-storage
+                        kernel's behaviour; only that value is supported there (default: None)
+            moment_dtype(torch.dtype, optional): torch.bfloat16 keeps Adam's exp_avg/exp_avg_sq
+                        in bf16, which halves their memory and the bytes a step moves. The update
+                        still runs in fp32. fp16 is rejected: exp_avg_sq underflows to zero for
+                        gradients below ~1e-2. Host path only; None follows fp32_optimizer_states,
+                        which gives fp16 params bf16 moments (default: None)
+            stochastic_moments(bool, optional): round bf16 moments stochastically instead of to
+                        nearest, so small updates to them are not lost (default: False)
+            lazy_block(int, optional): a sparse ``p.grad`` (torch sparse COO) updates Adam
+                        lazily: only the blocks of lazy_block elements holding a selected
+                        index are touched, and the moment decays a block skipped are applied in
+                        closed form when it is next touched or by flush_lazy_states(). The
+                        skipped steps do not move the weights, as in torch.optim.SparseAdam.
+                        This is a standalone sparse gradient API: the SmartComp top-k swap-out
+                        hands its (indices, values) to the near-storage kernel and never gives
+                        the host a sparse gradient. Adam with fp32 params and states, host path
+                        only. 16 fp32 elements are one cache line (default: 16)
         """
         self.opt_type = opt_type
+        if state_bits not in (8, 32) or (state_bits == 8 and opt_type != 0):
+            raise NotImplementedError(f"state_bits={state_bits} is not supported for opt_type {opt_type}")
+        self.state_bits = state_bits
+        if ema_decay > 0 and (opt_type != 0 or state_bits != 32):
+            raise NotImplementedError("ema_decay is only supported for Adam with fp32 states")
+        self.ema_decay = ema_decay
+        if master_weights_bf16 and (opt_type not in (0, 2) or state_bits != 32 or ema_decay > 0):
+            raise NotImplementedError("master_weights_bf16 is only supported for Adam and SGD with fp32 states")
+        self.master_weights_bf16 = master_weights_bf16
+        self.nesterov = nesterov
+        self.dampening = dampening
+        if moment_dtype == torch.float16:
+            raise NotImplementedError("fp16 Adam moments underflow, use moment_dtype=torch.bfloat16")
+        if moment_dtype not in (None, torch.float, torch.bfloat16):
+            raise NotImplementedError(f"moment_dtype={moment_dtype} is not supported")
+        if moment_dtype == torch.bfloat16 and \
+                (opt_type != 0 or state_bits != 32 or ema_decay > 0 or master_weights_bf16):
+            raise NotImplementedError("bf16 moments are only supported for plain Adam")
+        if stochastic_moments and moment_dtype != torch.bfloat16:
+            raise NotImplementedError("stochastic_moments needs moment_dtype=torch.bfloat16")
+        self.moment_dtype = moment_dtype
+        self.stochastic_moments = stochastic_moments
+        if lazy_block < 1:
+            raise ValueError(f"lazy_block={lazy_block} must be positive")
+        self.lazy_block = lazy_block
         default_args = dict(lr=lr,
                             betas=betas,
                             eps=eps,
@@ -100,6 +179,19 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
         
         self.adam_w_mode = adamw_mode
         self.fp32_optimizer_states = fp32_optimizer_states
+
+        # Adafactor row/column factors, kept out of self.state so they are not swapped
+        self.factored_states = {}
+        self.param_segments = {}
+        # LAMB per-segment trust ratio bounds and (begin, end) tables
+        self.max_coeff = max_coeff
+        self.min_coeff = min_coeff
+        self.segment_tables = {}
+        self.norm_reduce = None
+        self.check_crc = False
+        # inf/NaN check and norm of the last step(combined_unscale=...)
+        self.grad_overflow = False
+        self.grad_norm = None
         self.ds_opt_adam = CPUAdamBuilder().load()
 
         self.ds_opt_adam.create_adam(self.opt_id, lr, betas[0], betas[1], eps, weight_decay, adamw_mode,
@@ -117,7 +209,7 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
             group.setdefault('amsgrad', False)
 
     @torch.no_grad()
-    def step(self, closure=None, fp16_param_groups=None):
+    def step(self, closure=None, fp16_param_groups=None, combined_unscale=None, clip_grad=0.):
         """Update the model parameters.
 
         .. note::
@@ -129,8 +221,21 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
         Args:
             closure (callable, optional): closure to compute the loss.
                 Defaults to ``None``.
-            fp16_param_groups: FP16 GPU parameters to update. Performing the
-                copy here reduces communication time. Defaults to ``None``.
+            fp16_param_groups: fp16 or bf16 CPU copies of the parameters, laid out like
+                ``param_groups``. Adam writes the updated parameters to them in the
+                update pass, which saves the separate ``copy_()`` sweep. Only when
+                ``copies_lp_params()``. Defaults to ``None``.
+            combined_unscale (float, optional): the gradients are still loss
+                scaled; the Adam kernel multiplies them by this factor as it
+                loads them. A first pass over the gradients of every group
+                checks them for inf/NaN and takes their global norm, kept in
+                ``self.grad_norm``. An overflow skips the whole step and keeps
+                the step counts; ``self.grad_overflow`` reports it. Only when
+                ``takes_scaled_grads()``, with dense gradients. Defaults to
+                ``None`` (unscaled gradients).
+            clip_grad (float, optional): with ``combined_unscale``, clip the
+                global norm to this value, folded into the unscale of the
+                update pass. Defaults to ``0.`` (no clipping).
 
         Returns:
             loss: if ``closure`` is provided. Otherwise ``None``.
@@ -151,9 +256,19 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
         elif fp16_param_groups is not None:
             fp16_param_groups = [[fp16_param_groups]]
     
+        if combined_unscale is not None and (not self.takes_scaled_grads() or any(
+                p.grad is not None and p.grad.is_sparse for group in self.param_groups for p in group['params'])):
+            raise NotImplementedError("loss scaled gradients are only supported for plain Adam with dense gradients")
+
+        self.grad_overflow = False
+        self.grad_norm = None
+        # (group, batches) of every group, checked together before any is updated
+        scaled_batches = []
         #print("group_id: ", self.param_groups )
         for group_id, group in enumerate(self.param_groups):
             #print("group_id: ", group_id )
+            # plain Adam and SGD tensors of the group, updated together by *_update_multi
+            batches = {}
             for param_id, p in enumerate(group['params']):
                 #print("param_id: ", group_id )
                 if p.grad is None:
@@ -172,18 +287,38 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
 
                     #use full precision by default unless self.fp32_optimizer_states is off
                     state_dtype = torch.float if self.fp32_optimizer_states else p.dtype
+                    if self.moment_dtype is not None:
+                        state_dtype = self.moment_dtype
+                    elif self.opt_type == 0 and state_dtype == torch.half:
+                        # fp16 exp_avg_sq underflows; bf16 has the fp32 exponent range
+                        state_dtype = torch.bfloat16
 
                     # gradient momentums
                     #memory_format=torch.preserve_format)
                     # gradient variances
-                    if self.opt_type == 0:
+                    if self.opt_type == 0 and self.state_bits == 8 and p.numel() < QUANTIZED_MIN_NUMEL:
+                        # the cache line aligned codes and the scales outgrow a tiny tensor
+                        state['exp_avg'] = torch.zeros(QUANTIZED_MIN_NUMEL, dtype=torch.float, device=device)
+                        state['exp_avg_sq'] = torch.zeros(QUANTIZED_MIN_NUMEL, dtype=torch.float, device=device)
+                    elif self.opt_type == 0:
                         state['exp_avg'] = torch.zeros_like(p.data, dtype=state_dtype, device=device)
                         state['exp_avg_sq'] = torch.zeros_like(p.data, dtype=state_dtype, device=device)
+                        if self.ema_decay > 0:
+                            state['ema'] = p.data.clone().float()
                     elif self.opt_type == 1:
                         state['exp_avg_sq'] = torch.zeros_like(p.data, dtype=state_dtype, device=device)
                     elif self.opt_type == 2:
                         state['exp_avg'] = torch.zeros_like(p.data, dtype=state_dtype, device=device)
                         pass # Momuentum SGD
+                    elif self.opt_type == 3:
+                        state['exp_avg'] = torch.zeros_like(p.data, dtype=state_dtype, device=device)
+                        pass # Lion
+                    elif self.opt_type == 4:
+                        state['exp_avg'] = torch.zeros_like(p.data, dtype=state_dtype, device=device)
+                        self._init_factored_state(p)
+                    elif self.opt_type == 5:
+                        state['exp_avg'] = torch.zeros_like(p.data, dtype=state_dtype, device=device)
+                        state['exp_avg_sq'] = torch.zeros_like(p.data, dtype=state_dtype, device=device)
                     else:
                         raise NotImplementedError
                         
@@ -195,42 +330,291 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
                 state['step'] += 1
                 beta1, beta2 = group['betas']
 
-                if fp16_param_groups is not None:
+                if fp16_param_groups is not None and not self.copies_lp_params():
                     raise NotImplementedError
-                    self.ds_opt_adam.adam_update_copy(self.opt_id, state['step'], group['lr'], beta1, beta2,
-                                                      group['eps'], group['weight_decay'], group['bias_correction'],
-                                                      p.data, p.grad.data, state['exp_avg'], state['exp_avg_sq'],
-                                                      fp16_param_groups[group_id][param_id].data)
+                elif p.grad.is_sparse:
+                    self._lazy_step(group, group_id, param_id, p, state)
                 else:
-                    if self.opt_type == 0:
-                        self.ds_opt_adam.adam_update(self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'],
-                                                 group['weight_decay'], group['bias_correction'], 
+                    if 'lazy_step' in state:
+                        self._flush_lazy_state(group, p, state, state['step'] - 1)
+                    if self.opt_type == 0 and self.state_bits == 8:
+                        self.ds_opt_adam.adam8bit_update(self.opt_id, state['step'], group['lr'], beta1, beta2,
+                                                 group['eps'], group['weight_decay'], group['bias_correction'],
                                                  p.data, p.grad.data,
                                                 state['exp_avg'], state['exp_avg_sq'])
+                    elif self.opt_type == 0 and self.master_weights_bf16 and p.dtype == torch.bfloat16:
+                        self.ds_opt_adam.adam_bf16_update(self.opt_id, state['step'], group['lr'], beta1, beta2,
+                                                 group['eps'], group['weight_decay'], group['bias_correction'],
+                                                 group_id << 16 | param_id, p.data, p.grad.data.float(),
+                                                state['exp_avg'], state['exp_avg_sq'])
+                    elif self.opt_type == 0 and self.ema_decay > 0:
+                        self.ds_opt_adam.adam_ema_update(self.opt_id, state['step'], group['lr'], beta1, beta2,
+                                                 group['eps'], group['weight_decay'], group['bias_correction'],
+                                                 self.ema_decay, p.data, p.grad.data,
+                                                state['exp_avg'], state['exp_avg_sq'], state['ema'])
+                    elif self.opt_type == 0 and state['exp_avg'].dtype != torch.float:
+                        assert p.dtype in (torch.float, torch.half), "bf16 moments need fp32 or fp16 params"
+                        self.ds_opt_adam.adam_bf16_moments_update(self.opt_id, state['step'], group['lr'], beta1, beta2,
+                                                 group['eps'], group['weight_decay'], group['bias_correction'],
+                                                 self.stochastic_moments, group_id << 16 | param_id,
+                                                 p.data, p.grad.data, state['exp_avg'], state['exp_avg_sq'])
+                    elif self.opt_type == 0:
+                        lp = fp16_param_groups[group_id][param_id].data if fp16_param_groups is not None else None
+                        self._add_to_batch(batches, state, p, state['exp_avg'], state['exp_avg_sq'], lp=lp)
                     elif self.opt_type == 1:
                         pass
+                    elif self.opt_type == 2 and self.master_weights_bf16 and p.dtype == torch.bfloat16:
+                        self.ds_opt_adam.sgd_bf16_update(self.opt_id, state['step'], group['lr'], beta1,
+                                                 group['weight_decay'], self._sgd_dampening(beta1), self.nesterov,
+                                                 group_id << 16 | param_id, p.data, p.grad.data.float(),
+                                                 state['exp_avg'])
                     elif self.opt_type == 2:
-                        self.ds_opt_adam.sgd_update(self.opt_id, state['step'], group['lr'], beta1,
+                        self._add_to_batch(batches, state, p, state['exp_avg'])
+                    elif self.opt_type == 3:
+                        if p.dtype not in (torch.float, torch.half) or state['exp_avg'].dtype != torch.float:
+                            raise NotImplementedError("Lion needs fp32 or fp16 params and an fp32 momentum")
+                        self.ds_opt_adam.lion_update(self.opt_id, state['step'], group['lr'], beta1, beta2,
                                                  group['weight_decay'], 
                                                  p.data, p.grad.data,
                                                 state['exp_avg'])
+                    elif self.opt_type == 4:
+                        factors, segments, n_sums = self.factored_states[id(p)]
+                        self._two_phase_step(lambda sums, phase: self.ds_opt_adam.adafactor_update(
+                            self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'],
+                            group['weight_decay'], p.data, p.grad.data, state['exp_avg'], factors, segments, sums,
+                            phase), torch.zeros(max(n_sums, 1), dtype=torch.float))
+                    elif self.opt_type == 5:
+                        segment_table = self._segment_table(p)
+                        self._two_phase_step(lambda norms, phase: self.ds_opt_adam.lamb_update(
+                            self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'],
+                            group['weight_decay'], self.max_coeff, self.min_coeff, p.data, p.grad.data,
+                            state['exp_avg'], state['exp_avg_sq'], segment_table, norms, phase),
+                                             torch.zeros(len(segment_table), 2, dtype=torch.float))
                     else:
                         raise NotImplementedError
+
+            if combined_unscale is not None:
+                scaled_batches.append((group, batches))
+                continue
+            beta1, beta2 = group['betas']
+            for (step, _, _), (states, tensors, params_lp) in batches.items():
+                if self.opt_type == 0:
+                    self.ds_opt_adam.adam_update_multi(self.opt_id, step, group['lr'], beta1, beta2, group['eps'],
+                                                       group['weight_decay'], group['bias_correction'], *tensors,
+                                                       params_lp)
+                else:
+                    self.ds_opt_adam.sgd_update_multi(self.opt_id, step, group['lr'], beta1, group['weight_decay'],
+                                                      self._sgd_dampening(beta1), self.nesterov, *tensors)
+        if combined_unscale is not None:
+            self._scaled_step(scaled_batches, combined_unscale, clip_grad)
         return loss
 
+    def _scaled_step(self, scaled_batches, combined_unscale, clip_grad):
+        """Adam update of the loss scaled batches of every group: one inf/NaN check and norm over
+        all of them first, then the update with a single clip, or no update on overflow."""
+        result = torch.zeros(2, dtype=torch.float)
+        grads = [g for _, batches in scaled_batches for _, tensors, _ in batches.values() for g in tensors[1]]
+        self.ds_opt_adam.adam_grad_check_multi(self.opt_id, combined_unscale, grads, result)
+        sumsq, overflow = result.tolist()
+        if overflow:
+            self.grad_overflow = True
+            self.grad_norm = float('inf')
+            for _, batches in scaled_batches:
+                for states, _, _ in batches.values():
+                    for state in states:
+                        state['step'] -= 1
+            return
+        self.grad_norm = math.sqrt(sumsq)
+        unscale = combined_unscale
+        if clip_grad > 0.:
+            clip = (self.grad_norm + 1e-6) / clip_grad
+            if clip > 1:
+                unscale = combined_unscale / clip
+        for group, batches in scaled_batches:
+            beta1, beta2 = group['betas']
+            for (step, _, _), (_, tensors, params_lp) in batches.items():
+                self.ds_opt_adam.adam_update_multi_scaled(self.opt_id, step, group['lr'], beta1, beta2,
+                                                          group['eps'], group['weight_decay'],
+                                                          group['bias_correction'], unscale, *tensors, params_lp)
+
+    def _lazy_step(self, group, group_id, param_id, p, state):
+        """Lazy Adam step of p from its sparse gradient, see lazy_block.
+
+        A host top-k (indices, values) pair steps lazily as
+        ``p.grad = torch.sparse_coo_tensor(indices.long().unsqueeze(0), values.float(), (p.numel(), ))``
+        on a flat p.
+        """
+        if self.opt_type != 0 or self.state_bits != 32 or self.ema_decay > 0 or p.dtype != torch.float \
+                or state['exp_avg'].dtype != torch.float or not p.is_contiguous():
+            raise NotImplementedError("sparse gradients need Adam with contiguous fp32 params and states")
+        if 'lazy_step' not in state:
+            # the steps before were dense, so every block is up to date with the last one
+            n_blocks = -(-p.numel() // self.lazy_block)
+            state['lazy_step'] = torch.full((n_blocks, ), state['step'] - 1, dtype=torch.int32)
+        grad = p.grad.coalesce()
+        # flat indices of the coalesced (sorted, distinct) entries and of their dense dims
+        dense_numel = math.prod(grad.shape[grad.sparse_dim():])
+        rows = torch.zeros(grad._nnz(), dtype=torch.long)
+        for dim, index in enumerate(grad.indices()):
+            rows = rows * grad.shape[dim] + index
+        grad_idx = (rows.unsqueeze(1) * dense_numel + torch.arange(dense_numel)).view(-1)
+        beta1, beta2 = group['betas']
+        self.ds_opt_adam.adam_lazy_update(self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'],
+                                          group['weight_decay'], group['bias_correction'], self.lazy_block,
+                                          p.data, grad_idx, grad.values().reshape(-1).float(),
+                                          state['exp_avg'], state['exp_avg_sq'], state['lazy_step'])
+
+    def _flush_lazy_state(self, group, p, state, step):
+        beta1, beta2 = group['betas']
+        self.ds_opt_adam.adam_lazy_flush(self.opt_id, step, group['lr'], beta1, beta2, group['weight_decay'],
+                                         self.lazy_block, p.data, state['exp_avg'], state['exp_avg_sq'],
+                                         state['lazy_step'])
+        del state['lazy_step']
+
+    @torch.no_grad()
+    def flush_lazy_states(self):
+        """Apply the decays the lazy steps skipped, so the weights and moments are the dense ones.
+
+        Only needed to read them as dense tensors, e.g. to evaluate or export the model; a dense
+        step flushes its param first. state_dict() saves the lazy state as it is, with
+        ``state['lazy_step']``, and a loaded optimizer carries on from it.
+        """
+        for group in self.param_groups:
+            for p in group['params']:
+                state = self.state.get(p, {})
+                if 'lazy_step' in state:
+                    self._flush_lazy_state(group, p, state, state['step'])
+
+    def _sgd_dampening(self, beta1):
+        return beta1 if self.dampening is None else self.dampening
+
+    def _plain_adam(self):
+        """Whether every dense gradient goes through the adam_update_multi batches."""
+        return self.opt_type == 0 and self.state_bits == 32 and self.ema_decay == 0 and not self.master_weights_bf16 \
+            and self.moment_dtype in (None, torch.float) and self.fp32_optimizer_states
+
+    def copies_lp_params(self):
+        """Whether step(fp16_param_groups=...) writes the low precision copies in the update pass."""
+        return self._plain_adam()
+
+    def takes_scaled_grads(self):
+        """Whether step(combined_unscale=...) can unscale, check and clip the gradients. The other
+        kernels would update with the loss scaled gradients, so they raise instead."""
+        return self._plain_adam()
+
+    def _add_to_batch(self, batches, state, p, *states, lp=None):
+        """Queue p for the multi-tensor update of its group, keyed by step, dtype and the dtype of
+        its low precision copy lp, if any."""
+        if lp is not None:
+            assert lp.device.type == 'cpu' and lp.is_contiguous() and lp.numel() == p.numel() \
+                and lp.dtype in (torch.half, torch.bfloat16), \
+                "the low precision copy of a CPUAdam param must be a contiguous fp16/bf16 CPU tensor of its size"
+        key = (state['step'], p.dtype, lp.dtype if lp is not None else None)
+        queued, tensors, params_lp = batches.setdefault(key, ([], tuple([] for _ in range(2 + len(states))), []))
+        queued.append(state)
+        for lst, t in zip(tensors, (p.data, p.grad.data) + states):
+            lst.append(t)
+        if lp is not None:
+            params_lp.append(lp)
+
     def _io_aligned_numel(self, numel, optimizer_swapper):
         remainder = numel % optimizer_swapper.numel_alignment
         return numel if remainder == 0 else (numel + optimizer_swapper.numel_alignment - remainder)
 
+    def set_param_segments(self, p, segments):
+        """Register the (offset, numel, cols, col0) of every parameter flattened into p."""
+        self.param_segments[id(p)] = segments
+
+    def set_norm_reduce(self, norm_reduce):
+        """Sum the per-segment statistics of LAMB and Adafactor across ranks with norm_reduce(t).
+
+        t is an fp32 tensor laid out by the entries of set_param_segments, the same on every rank:
+        LAMB's (n_segments, 2) ||w||^2 and ||update||^2, so the trust ratio of a partitioned
+        parameter is that of the whole one, and Adafactor's column sums, so are its column
+        factors. The near-storage Adafactor kernel has no phases and factors each partition on
+        its own.
+        """
+        self.norm_reduce = norm_reduce
+
+    def _two_phase_step(self, update, buf, sync=None):
+        """Run update(buf, phase), reducing buf between the two phases if asked to."""
+        if self.norm_reduce is None:
+            update(buf, PHASE_ALL)
+            return
+        update(buf, PHASE_NORM)
+        if sync is not None:
+            sync()
+        self.norm_reduce(buf)
+        update(buf, PHASE_UPDATE)
+
+    def _init_factored_state(self, p):
+        """Build the adafactor segment table and zeroed factors for p.
+
+        A segment keeps a row and a column factor when its rows fit the kernel (multiple of 16,
+        at most 16384 wide) and factoring saves memory; otherwise (e.g. biases) it keeps a full
+        second moment. Once the column sums are reduced across ranks the choice must not depend
+        on the size of the local partition, so every rank factors all the wide enough segments.
+        A factored segment gets cols + 2 floats of the sums the host kernel hands to the reduce.
+        """
+        cols = p.shape[-1] if p.dim() > 1 else 0
+        segments = self.param_segments.get(id(p), [(0, p.numel(), cols, 0)])
+
+        table = []
+        n_factors = 0
+        n_sums = 0
+        for offset, numel, cols, col0 in segments:
+            rows = (col0 + numel + cols - 1) // cols if cols > 0 else 0
+            if cols < 16 or cols % 16 != 0 or cols > 16384 or (rows + cols >= numel and self.norm_reduce is None):
+                table.append([offset, offset + numel, 0, 0, 0, n_factors, n_factors, 0])
+                n_factors += numel
+            else:
+                table.append([offset, offset + numel, cols, col0, rows, n_factors, n_factors + rows, n_sums])
+                n_factors += rows + cols
+                n_sums += cols + 2
+
+        factors = torch.zeros(n_factors, dtype=torch.float, device='cpu')
+        self.factored_states[id(p)] = (factors, torch.tensor(table, dtype=torch.int32), n_sums)
+
+    def _segment_table(self, p):
+        """(begin, end) of every parameter flattened into p, in the adafactor table layout."""
+        if id(p) not in self.segment_tables:
+            segments = self.param_segments.get(id(p), [(0, p.numel(), 0, 0)])
+            table = [[offset, offset + numel, 0, 0, 0, 0, 0, 0] for offset, numel, _, _ in segments]
+            self.segment_tables[id(p)] = torch.tensor(table, dtype=torch.int32)
+        return self.segment_tables[id(p)]
+
     def sync_thread(self):
         self.ds_opt_adam.sync_thread();
+        if self.check_crc:
+            n_errors = self.ds_opt_adam.crc_errors()
+            if n_errors > 0:
+                raise RuntimeError(f"{n_errors} swapped optimizer state file(s) failed their CRC32C check")
+
+    def enable_crc(self):
+        """Checksum the swapped Adam state on the device and check it against the aio sidecars.
+
+        Needs an optimizer xclbin linked with CRC=1, otherwise the device step only warns.
+        """
+        self.check_crc = True
+        self.ds_opt_adam.set_crc(True)
 
     def topk(self, tensor, top_size):
         pass
 
+    def grad_norm_with_fpga(self, p32, device_id, optimizer_swapper, result):
+        """Queue the sum of squares and inf/NaN check of the swapped gradients of p32.
+
+        result[0] and result[1] are valid after sync_thread(). Gradients are still loss scaled.
+        """
+        swap_info = optimizer_swapper.swap_params_info.get(id(p32), None)
+        assert swap_info is not None and swap_info.has_gradients
+        aligned_numel = self._io_aligned_numel(swap_info.numel(), optimizer_swapper)
+        grad_path = swap_info.swapped_gradients[0].path
+        self.ds_opt_adam.grad_norm_fpga(grad_path, swap_info.numel(), aligned_numel, device_id, result)
+
 
     @torch.no_grad()
-    def step_with_fpga(self, device_id, optimizer_swapper, combined_unscale, largest_numel, compression_ratio = 1. ):
+    def step_with_fpga(self, device_id, optimizer_swapper, combined_unscale, largest_numel, compression_ratio = 1., topk_block = 0, grad_bits = 16 ):
         """Update the model parameters.
 
         .. note::
@@ -243,6 +627,9 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
             subgroup_id  :  For prefetch, offload optimizer states
             combined_unscale: 1. / Combined grad norm
         """
+        # the swap files and device kernels keep fp32 moments
+        if self.moment_dtype not in (None, torch.float):
+            raise NotImplementedError
         # intended device for step
         device = torch.device('cpu')
         
@@ -268,10 +655,23 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
                 if self.opt_type == 0:
                     exp_avg_path = swap_info.swap_paths[1]
                     exp_avg_sq_path = swap_info.swap_paths[2]
+                    if self.ema_decay > 0:
+                        ema_path = swap_info.swap_paths[3]
                 elif self.opt_type == 1:
                     exp_avg_sq_path = swap_info.swap_paths[1]
                 elif self.opt_type == 2: # SGD
                     exp_avg_path = swap_info.swap_paths[1]
+                elif self.opt_type == 3: # Lion
+                    exp_avg_path = swap_info.swap_paths[1]
+                elif self.opt_type == 4: # Adafactor
+                    exp_avg_path = swap_info.swap_paths[1]
+                    if compression_ratio < 0.5:
+                        raise NotImplementedError
+                elif self.opt_type == 5: # LAMB
+                    exp_avg_path = swap_info.swap_paths[1]
+                    exp_avg_sq_path = swap_info.swap_paths[2]
+                    if compression_ratio < 0.5:
+                        raise NotImplementedError
                 else:
                     raise NotImplementedError
 
@@ -293,10 +693,22 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
                     if self.opt_type == 0:# Adadm
                         state['exp_avg'] = torch.zeros_like(p32.data, dtype=state_dtype, device=device)
                         state['exp_avg_sq'] = torch.zeros_like(p32.data, dtype=state_dtype, device=device)
-                    if self.opt_type == 1:# Adagrad
+                        if self.ema_decay > 0:
+                            state['ema'] = p32.data.clone().float()
+                        if self.master_weights_bf16:
+                            self.ds_opt_adam.bf16_master_pack(param_path, aligned_numel)
+                    elif self.opt_type == 1:# Adagrad
                         state['exp_avg_sq'] = torch.zeros_like(p32.data, dtype=state_dtype, device=device)
                     elif self.opt_type == 2:# Momentum SGD
                         state['exp_avg'] = torch.zeros_like(p32.data, dtype=state_dtype, device=device)
+                    elif self.opt_type == 3:# Lion
+                        state['exp_avg'] = torch.zeros_like(p32.data, dtype=state_dtype, device=device)
+                    elif self.opt_type == 4:# Adafactor
+                        state['exp_avg'] = torch.zeros_like(p32.data, dtype=state_dtype, device=device)
+                        self._init_factored_state(p32)
+                    elif self.opt_type == 5:# LAMB
+                        state['exp_avg'] = torch.zeros_like(p32.data, dtype=state_dtype, device=device)
+                        state['exp_avg_sq'] = torch.zeros_like(p32.data, dtype=state_dtype, device=device)
                     else:
                         raise NotImplementedError
 
@@ -305,22 +717,64 @@ class DeepSpeedCPUAdam(torch.optim.Optimizer):
                 beta1, beta2 = group['betas']
 
                 assert(p32 is not None)
-                if self.opt_type == 0:
+                if self.opt_type == 0 and self.state_bits == 8:
+                    if compression_ratio < 0.5:
+                        raise NotImplementedError
+                    self.ds_opt_adam.adam8bit_update_fpga(self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'],
+                                             group['weight_decay'], group['bias_correction'], combined_unscale,
+                                            param_path, exp_avg_path, exp_avg_sq_path, grad_path, aligned_numel,
+                                            p16.data, device_id, largest_numel)
+                elif self.opt_type == 0 and self.master_weights_bf16:
+                    if compression_ratio < 0.5:
+                        raise NotImplementedError
+                    self.ds_opt_adam.adam_bf16_update_fpga(self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'],
+                                             group['weight_decay'], group['bias_correction'], combined_unscale,
+                                            param_path, exp_avg_path, exp_avg_sq_path, grad_path, aligned_numel,
+                                            p16.data, device_id, largest_numel, zlib.crc32(param_path.encode()))
+                elif self.opt_type == 0 and self.ema_decay > 0:
+                    if compression_ratio < 0.5:
+                        raise NotImplementedError
+                    self.ds_opt_adam.adam_ema_update_fpga(self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'],
+                                             group['weight_decay'], group['bias_correction'], combined_unscale,
+                                            param_path, exp_avg_path, exp_avg_sq_path, ema_path, grad_path, aligned_numel,
+                                            p16.data, device_id, largest_numel, self.ema_decay)
+                elif self.opt_type == 0:
                     self.ds_opt_adam.adam_update_fpga(self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'],
                                              group['weight_decay'], group['bias_correction'], combined_unscale,
                                             param_path, exp_avg_path, exp_avg_sq_path, grad_path, aligned_numel, 
-                                            p16.data, device_id, largest_numel, compression_ratio, idx.data)
+                                            p16.data, device_id, largest_numel, compression_ratio, idx.data, topk_block, grad_bits)
                 elif self.opt_type == 1:
                     self.ds_opt_adam.adagrad_update_fpga(self.opt_id, state['step'], group['lr'], group['eps'],
                                              group['weight_decay'], combined_unscale,
                                             param_path, exp_avg_sq_path, grad_path, aligned_numel, 
-                                            p16.data, device_id, largest_numel, compression_ratio, idx.data)
+                                            p16.data, device_id, largest_numel, compression_ratio, idx.data, topk_block, grad_bits)
                 elif self.opt_type == 2:
+                    if self.nesterov or self.master_weights_bf16 or self._sgd_dampening(beta1) != beta1:
+                        raise NotImplementedError
                     self.ds_opt_adam.sgd_update_fpga(self.opt_id, state['step'], group['lr'], beta1,
                                              group['weight_decay'], combined_unscale,
                                             param_path, exp_avg_path, grad_path, aligned_numel, 
-                                            p16.data, device_id, largest_numel, compression_ratio, idx.data)
-
+                                            p16.data, device_id, largest_numel, compression_ratio, idx.data, topk_block, grad_bits)
+                elif self.opt_type == 3:
+                    self.ds_opt_adam.lion_update_fpga(self.opt_id, state['step'], group['lr'], beta1, beta2,
+                                             group['weight_decay'], combined_unscale,
+                                            param_path, exp_avg_path, grad_path, aligned_numel, 
+                                            p16.data, device_id, largest_numel, compression_ratio, idx.data, topk_block, grad_bits)
+
+                elif self.opt_type == 4:
+                    factors, segment_table, _ = self.factored_states[id(p32)]
+                    self.ds_opt_adam.adafactor_update_fpga(self.opt_id, state['step'], group['lr'], beta1, beta2,
+                                             group['eps'], group['weight_decay'], combined_unscale,
+                                            param_path, exp_avg_path, grad_path, aligned_numel,
+                                            p16.data, device_id, largest_numel, factors, segment_table)
+                elif self.opt_type == 5:
+                    segment_table = self._segment_table(p32)
+                    self._two_phase_step(lambda norms, phase: self.ds_opt_adam.lamb_update_fpga(
+                        self.opt_id, state['step'], group['lr'], beta1, beta2, group['eps'], group['weight_decay'],
+                        self.max_coeff, self.min_coeff, combined_unscale, param_path, exp_avg_path,
+                        exp_avg_sq_path, grad_path, aligned_numel, p16.data, device_id, largest_numel,
+                        segment_table, norms, phase), torch.zeros(len(segment_table), 2, dtype=torch.float),
+                                         sync=self.ds_opt_adam.sync_thread)
                 else:
                     raise NotImplementedError
 
@@ -29,54 +29,40 @@ void Adagrad_Optimizer::Step_cpu(float* _params,
                                ds_half_precision_t* dev_params,
                                bool half_precision)
 {
-	int p_n = 0;
-	
 	for (size_t t = 0; t < _param_size; t += TILE) {
 		size_t copy_size = TILE;
 		if ((t + TILE) > _param_size) copy_size = _param_size - t;
 		size_t offset = copy_size + t;
-#pragma omp parallel for
-		for (size_t k = t; k < offset; k++) {
-			//half h_g = (half)grads[k];
-			//float grad = (float)h_g;
-			float grad = grads[k];
+		CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+			for (size_t k = lo; k < hi; k++) {
+				//half h_g = (half)grads[k];
+				//float grad = (float)h_g;
+				float grad = grads[k];
 			
-			float step_size = -1 * _alpha;
+				float step_size = -1 * _alpha;
 			
 			
-			float param = _params[k];
-			float momentum = grad;
-			float variance = _exp_avg_sq[k];
-
-			if (t + k  <  p_n)
-			{
-				std::cout <<  "Before G: " << grad << std::endl;
-				std::cout <<  "Before P: " << param << std::endl;
-				std::cout <<  "Before V: " << variance << std::endl;
-			}
+				float param = _params[k];
+				float momentum = grad;
+				float variance = _exp_avg_sq[k];
 
-			if (_weight_decay > 0) { grad = param * _weight_decay + grad; }
+				if (_weight_decay > 0) { grad = param * _weight_decay + grad; }
 
-			variance += grad * grad;
+				variance += grad * grad;
 
-			grad = sqrt(variance);
-			grad += _eps;
-			grad = momentum / grad;
-			param = grad * step_size + param;
-			
-			//half h_p = (half) param;
-			//_params[k] = (float) h_p;
-			_params[k] = param;
-			// STORE UPDATE TERM TO GRAD'S MEMORY
-			//grads[k] = grad * step_size;
-			_exp_avg_sq[k] = variance;
+				grad = sqrt(variance);
+				grad += _eps;
+				grad = momentum / grad;
+				param = grad * step_size + param;
 			
-			if (t + k  <  p_n)
-			{
-				std::cout <<  "After P: " << param << std::endl;
-				std::cout <<  "After V: " << variance << std::endl;
+				//half h_p = (half) param;
+				//_params[k] = (float) h_p;
+				_params[k] = param;
+				// STORE UPDATE TERM TO GRAD'S MEMORY
+				//grads[k] = grad * step_size;
+				_exp_avg_sq[k] = variance;
 			}
-		}
+		});
     }
 }
 
@@ -88,17 +74,15 @@ void Adagrad_Optimizer::Step_1(float* _params,
                                bool half_precision)
 {
     size_t rounded_size = 0;
-#if defined(__AVX512__) or defined(__AVX256__)
-    Step_AVX<1>(
+    Step_SIMD<1>(
         &rounded_size, _params, grads, _exp_avg_sq, _param_size, dev_params, half_precision);
-#endif
     if (_param_size > rounded_size) {
         float step_size = -1 * _alpha;
-        ds_half_precision_t* grads_cast_h;
-        ds_half_precision_t* params_cast_h;
+        uint16_t* grads_cast_h;
+        uint16_t* params_cast_h;
         if (half_precision) {
-            grads_cast_h = reinterpret_cast<ds_half_precision_t*>(grads);
-            params_cast_h = reinterpret_cast<ds_half_precision_t*>(_params);
+            grads_cast_h = reinterpret_cast<uint16_t*>(grads);
+            params_cast_h = reinterpret_cast<uint16_t*>(_params);
         }
         for (size_t t = rounded_size; t < _param_size; t += TILE) {
             size_t copy_size = TILE;
@@ -107,31 +91,32 @@ void Adagrad_Optimizer::Step_1(float* _params,
 #if defined(__ENABLE_CUDA__)
             if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
 #endif
-#pragma omp parallel for
-            for (size_t k = t; k < offset; k++) {
-                float grad = half_precision ? (float)grads_cast_h[k] : grads[k];
-                float param = half_precision ? (float)params_cast_h[k] : _params[k];
-                float momentum = grads[k];
-                float variance = _exp_avg_sq[k];
-                if (_weight_decay > 0) { grad = param * _weight_decay + grad; }
-
-                variance += grad * grad;
-
-                grad = sqrt(variance);
-                grad += _eps;
-                grad = momentum / grad;
-                param = grad * step_size + param;
+            CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+                for (size_t k = lo; k < hi; k++) {
+                    float grad = half_precision ? ds_half_to_float(grads_cast_h[k]) : grads[k];
+                    float param = half_precision ? ds_half_to_float(params_cast_h[k]) : _params[k];
+                    float momentum = grads[k];
+                    float variance = _exp_avg_sq[k];
+                    if (_weight_decay > 0) { grad = param * _weight_decay + grad; }
+
+                    variance += grad * grad;
+
+                    grad = sqrt(variance);
+                    grad += _eps;
+                    grad = momentum / grad;
+                    param = grad * step_size + param;
 #if defined(__ENABLE_CUDA__)
-                if (dev_params) _doubled_buffer[_buf_index][k - t] = param;
+                    if (dev_params) _doubled_buffer[_buf_index][k - t] = param;
 #endif
-                if (half_precision)
-                    params_cast_h[k] = (ds_half_precision_t)param;
-                else
-                    _params[k] = param;
-                // STORE UPDATE TERM TO GRAD'S MEMORY
-                grads[k] = grad * step_size;
-                _exp_avg_sq[k] = variance;
-            }
+                    if (half_precision)
+                        params_cast_h[k] = ds_float_to_half(param);
+                    else
+                        _params[k] = param;
+                    // STORE UPDATE TERM TO GRAD'S MEMORY
+                    grads[k] = grad * step_size;
+                    _exp_avg_sq[k] = variance;
+                }
+            });
 #if defined(__ENABLE_CUDA__)
             if (dev_params) {
                 launch_param_update(
@@ -151,10 +136,8 @@ void Adagrad_Optimizer::Step_4(float* _params,
                                bool half_precision)
 {
     size_t rounded_size = 0;
-#if defined(__AVX512__) or defined(__AVX256__)
-    Step_AVX<4>(
+    Step_SIMD<4>(
         &rounded_size, _params, grads, _exp_avg_sq, _param_size, dev_params, half_precision);
-#endif
     if (_param_size > rounded_size)
         Step_1((_params + rounded_size),
                (grads + rounded_size),
@@ -175,20 +158,10 @@ int create_adagrad_optimizer(int optimizer_id,
     s_optimizers[optimizer_id] = opt;
 
     if (should_log) {
-        std::string avx_type = "";
-#if defined(__AVX512__)
-        avx_type = "AVX512";
-#else
-#if defined(__AVX256__)
-        avx_type = "AVX2";
-#else
-        avx_type = "scalar";
-#endif
-#endif
-
-        printf("Adagrad Optimizer #%d is created with %s arithmetic capability.\n",
+        printf("Adagrad Optimizer #%d is created with %s arithmetic capability%s.\n",
                optimizer_id,
-               avx_type.c_str());
+               ds_simd_isa_name(ds_simd_isa()),
+               ds_simd_isa_extras());
         printf("Config: alpha=%f, weight_decay=%f\n", alpha, weight_decay);
     }
 
@@ -203,10 +176,8 @@ void Adagrad_Optimizer::Step_8(float* _params,
                                bool half_precision)
 {
     size_t rounded_size = 0;
-#if defined(__AVX512__) or defined(__AVX256__)
-    Step_AVX<8>(
+    Step_SIMD<8>(
         &rounded_size, _params, grads, _exp_avg_sq, _param_size, dev_params, half_precision);
-#endif
     if (_param_size > rounded_size)
         Step_4((_params + rounded_size),
                (grads + rounded_size),
@@ -250,6 +221,54 @@ int ds_adagrad_step(int optimizer_id,
     return 0;
 }
 
+// ds_adagrad_step over a list of tensors. The tensors are cut into balanced slices of their
+// concatenation and updated in a single round of the thread pool.
+int ds_adagrad_step_multi(int optimizer_id,
+                          size_t step,
+                          float lr,
+                          float epsilon,
+                          float weight_decay,
+                          std::vector<torch::Tensor>& params,
+                          std::vector<torch::Tensor>& grads,
+                          std::vector<torch::Tensor>& exp_avg_sq)
+{
+    const size_t n_tensors = params.size();
+    if (n_tensors == 0) return 0;
+    assert(grads.size() == n_tensors && exp_avg_sq.size() == n_tensors);
+
+    std::vector<torch::Tensor> params_c, grads_c, exp_avg_sq_c;
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < n_tensors; i++) {
+        params_c.push_back(params[i].contiguous());
+        grads_c.push_back(grads[i].contiguous());
+        exp_avg_sq_c.push_back(exp_avg_sq[i].contiguous());
+        sizes.push_back(params_c[i].numel());
+    }
+
+    std::shared_ptr<Adagrad_Optimizer> opt =
+        std::static_pointer_cast<Adagrad_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step);
+    opt->update_state(lr, epsilon, weight_decay);
+
+    // a slice runs on a pool worker, where the kernel's own parallel_for runs inline
+    CPU_Thread_Pool::Instance().parallel_for_batch(
+        sizes.data(), n_tensors, [&](size_t i, size_t lo, size_t hi) {
+            float* params_ptr = (float*)params_c[i].data_ptr() + lo;
+            float* grads_ptr = (float*)grads_c[i].data_ptr() + lo;
+            float* exp_avg_sq_ptr = (float*)exp_avg_sq_c[i].data_ptr() + lo;
+#if CPU == 0
+            opt->Step_8(params_ptr, grads_ptr, exp_avg_sq_ptr, hi - lo);
+#else
+            opt->Step_cpu(params_ptr, grads_ptr, exp_avg_sq_ptr, hi - lo);
+#endif
+        });
+
+#if defined(__ENABLE_CUDA__)
+    opt->SynchronizeStreams();
+#endif
+    return 0;
+}
+
 int ds_adagrad_step_plus_copy(int optimizer_id,
                               size_t step,
                               float lr,
@@ -299,6 +318,9 @@ int destroy_adagrad_optimizer(int optimizer_id)
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 {
     m.def("adagrad_update", &ds_adagrad_step, "DeepSpeed CPU Adagrad update (C++)");
+    m.def("adagrad_update_multi",
+          &ds_adagrad_step_multi,
+          "DeepSpeed CPU Adagrad update of a list of tensors (C++)");
     m.def("adagrad_update_copy",
           &ds_adagrad_step_plus_copy,
           "DeepSpeed CPU Adagrad update and param copy (C++)");
@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+// The vector Adagrad steps compiled for AVX2 (with FMA and F16C), run through Step_SIMD when
+// ds_simd_isa() picks this level.
+
+#if (__x86_64__ || __i386__)
+
+#undef __AVX512__
+#define __AVX256__
+#include "cpu_adagrad.h"
+
+template void Adagrad_Optimizer::Step_AVX<1, DS_SIMD_LEVEL>(
+    size_t*, float*, float*, float*, size_t, ds_half_precision_t*, bool);
+template void Adagrad_Optimizer::Step_AVX<4, DS_SIMD_LEVEL>(
+    size_t*, float*, float*, float*, size_t, ds_half_precision_t*, bool);
+template void Adagrad_Optimizer::Step_AVX<8, DS_SIMD_LEVEL>(
+    size_t*, float*, float*, float*, size_t, ds_half_precision_t*, bool);
+
+#endif
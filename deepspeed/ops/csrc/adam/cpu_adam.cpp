@@ -34,6 +34,8 @@ static std::unordered_map<int, std::shared_ptr<void>> s_optimizers;
 #include <fstream>
 #include <CL/cl_ext_xilinx.h>
 #include <unistd.h>
+#include <cerrno>
+#include <stdexcept>
 #include <limits.h>
 #include <sys/stat.h>
 #include <cmath>
@@ -44,6 +46,7 @@ static std::unordered_map<int, std::shared_ptr<void>> s_optimizers;
 #include <CL/cl_ext.h>
 
 #include <thread>
+#include <atomic>
 
 # define DS_CPU 0
 # define CPU 1
@@ -51,6 +54,9 @@ static std::unordered_map<int, std::shared_ptr<void>> s_optimizers;
 # define FPGA 3
 # define ACC_TYPE DS_CPU
 #include "vadd.h"
+#include "idx_pack.h"
+#include "val_quant.h"
+#include "crc32c.h"
 
 #define TILE (128 * 1024 * 1024)
 
@@ -83,6 +89,34 @@ struct aligned_allocator
 
 #define MAX_DEVICE 16
 
+// Adafactor segment table, see hls_smartInfinity/src/kernel_cpp/adafactor.cpp
+#define MAX_SEGMENTS 4096
+#define SEG_FIELDS 8
+#define SEG_BEGIN 0
+#define SEG_END 1
+#define SEG_COLS 2
+#define SEG_COL0 3
+#define SEG_ROWS 4
+#define SEG_ROW_BASE 5
+#define SEG_COL_BASE 6
+// Host only: offset of the segment's cols column sums, row factor total and element count in
+// the buffer the phases of Step_Adafactor_cpu hand to the caller
+#define SEG_SUM_BASE 7
+
+// LAMB kernel phases, see hls_smartInfinity/src/kernel_cpp/lamb.cpp, also used by the host Adafactor
+#define PHASE_NORM 0
+#define PHASE_UPDATE 1
+// Host only: both phases in one call, the norms are not reduced across ranks in between
+#define PHASE_ALL 2
+
+// Gradient norm kernel results, see hls_smartInfinity/src/kernel_cpp/grad_norm.cpp
+#define HALF_MAX 65504.0f
+#define RESULT_SUMSQ 0
+#define RESULT_OVERFLOW 1
+
+// O_DIRECT granularity, used to read a header page of the packed gradient index stream
+#define IO_ALIGN 4096
+
 std::vector<cl::Platform> platforms[MAX_DEVICE];
 std::vector<cl::Device> devices[MAX_DEVICE];
 static bool init[MAX_DEVICE] = {false,};
@@ -92,6 +126,22 @@ cl::Context contexts[MAX_DEVICE];
 cl::Program programs[MAX_DEVICE];
 cl::CommandQueue queues[MAX_DEVICE];
 cl::Kernel krnls[MAX_DEVICE];
+cl::Kernel norm_krnls[MAX_DEVICE];
+static bool norm_init[MAX_DEVICE] = {false,};
+static bool has_norm_krnl[MAX_DEVICE] = {false,};
+
+// Chunked CRC32C of param, exp_avg and exp_avg_sq (deepspeed/ops/csrc/includes/crc32c.h).
+// krnl_crc checksums the P2P buffers after the reads and again after the update, so the
+// sidecars are checked and rewritten without extra file I/O. Pools [0, 3) hold the checksums of
+// the reads, [3, 6) those of the update.
+#define CRC_STREAMS 3
+static bool check_crc = false;
+static std::atomic<long long> crc_errors(0);
+cl::Kernel crc_krnls[MAX_DEVICE];
+static bool crc_init[MAX_DEVICE] = {false,};
+static bool has_crc_krnl[MAX_DEVICE] = {false,};
+static size_t crc_pool_chunks[MAX_DEVICE] = {0,};
+cl::Buffer crc_pool[MAX_DEVICE][2 * CRC_STREAMS];
 
 cl::Buffer param16_pool[MAX_DEVICE];
 cl::Buffer param_pool[MAX_DEVICE];
@@ -100,6 +150,11 @@ cl::Buffer exp_avg_sq_pool[MAX_DEVICE];
 cl::Buffer grad_pool[MAX_DEVICE];
 cl::Buffer grad_idx_pool[MAX_DEVICE];
 cl::Buffer grad_val_pool[MAX_DEVICE];
+cl::Buffer factor_pool[MAX_DEVICE];
+cl::Buffer segment_pool[MAX_DEVICE];
+cl::Buffer norm_pool[MAX_DEVICE];
+cl::Buffer grad_norm_pool[MAX_DEVICE];
+cl::Buffer ema_pool[MAX_DEVICE];
 
 float* _p2p_params[MAX_DEVICE] = {nullptr, };
 float* p2p_params[MAX_DEVICE] = {nullptr, };
@@ -108,15 +163,40 @@ float* p2p_exp_avg_sqs[MAX_DEVICE] = {nullptr, };
 half* p2p_grads[MAX_DEVICE] = {nullptr, };
 int* p2p_grads_idx[MAX_DEVICE] = {nullptr, };
 half* p2p_grads_val[MAX_DEVICE] = {nullptr, };
+float* p2p_emas[MAX_DEVICE] = {nullptr, };
+
+// Compute units of the Adam kernel (krnl_vadd_1 ... krnl_vadd_<CU>, see hls_smartInfinity/run.cfg).
+// A sub group is split into one slice per CU. Slices start on CU_ALIGN elements so that the fp32
+// and fp16 file offsets stay IO_ALIGN aligned.
+#define MAX_CU 4
+#define CU_ALIGN 2048
+
+int n_cus[MAX_DEVICE] = {0, };
+cl::Kernel cu_krnls[MAX_DEVICE][MAX_CU];
+cl::CommandQueue cu_queues[MAX_DEVICE][MAX_CU];
+cl::Buffer cu_param16_pool[MAX_DEVICE][MAX_CU];
+cl::Buffer cu_param_pool[MAX_DEVICE][MAX_CU];
+cl::Buffer cu_exp_avg_pool[MAX_DEVICE][MAX_CU];
+cl::Buffer cu_exp_avg_sq_pool[MAX_DEVICE][MAX_CU];
+cl::Buffer cu_grad_pool[MAX_DEVICE][MAX_CU];
+float* p2p_cu_params[MAX_DEVICE][MAX_CU];
+float* p2p_cu_exp_avgs[MAX_DEVICE][MAX_CU];
+float* p2p_cu_exp_avg_sqs[MAX_DEVICE][MAX_CU];
+half* p2p_cu_grads[MAX_DEVICE][MAX_CU];
 
 int nvmeFd_exp_avgs[MAX_DEVICE] = {-1, };
 int nvmeFd_exp_avg_sqs[MAX_DEVICE] = { -1, };
 
+// LAMB phase 1 leaves the files open and the tensors in device memory for phase 2
+int lamb_fds[MAX_DEVICE][4];
+std::vector<float> lamb_norms[MAX_DEVICE];
+
 std::vector<std::thread> threads;
 
 std::thread* write_param[MAX_DEVICE] = { nullptr,  };
 std::thread* write_exp_avg[MAX_DEVICE] = { nullptr,  };
 std::thread* write_exp_avg_sq[MAX_DEVICE] = {nullptr, };
+std::thread* write_ema[MAX_DEVICE] = {nullptr, };
 
 void sync_thread()
 {
@@ -135,6 +215,54 @@ void write_thread(int nvmeFd, float* p2p_ptr, size_t nbytes, bool cls)
 	if (cls) { (void)close(nvmeFd); }
 }
 
+// write_thread, then records the checksums of the new contents in the sidecar of path
+void write_thread_crc(int nvmeFd, float* p2p_ptr, size_t nbytes, std::string path, std::vector<uint32_t> crcs)
+{
+	write_thread(nvmeFd, p2p_ptr, nbytes, true);
+	if (!write_crc_sidecar(path.c_str(), crcs.data(), nbytes)) { std::cout << "CRC: write of " << crc_sidecar_path(path) << " failed" << std::endl; }
+}
+
+// Writes the slices of the compute units back to their offsets in the file
+void write_cu_thread(int nvmeFd, std::vector<float*> p2p_ptrs, std::vector<size_t> nbytes, std::vector<size_t> offsets)
+{
+	int ret = - 1;
+	for (size_t c = 0 ; c < p2p_ptrs.size(); c++) {
+		ret = pwrite(nvmeFd, (void*)p2p_ptrs[c], nbytes[c], offsets[c]);
+		if (ret == -1) { std::cout << "P2P: write() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	}
+	(void)close(nvmeFd);
+}
+
+// Bytes of the packed index stream in fd, from the header of its last block. The file can
+// hold a longer stream of an earlier step, which must not be read.
+size_t packed_idx_nbytes(int nvmeFd, size_t n_elements_compressed, size_t comp_nbytes)
+{
+	size_t n_blocks = idx_n_blocks(n_elements_compressed);
+	size_t last = IDX_HEADER_WORDS * (n_blocks - 1) * sizeof(uint32_t);
+	size_t page = last / IO_ALIGN * IO_ALIGN;
+
+	std::vector<uint32_t, aligned_allocator<uint32_t>> header(IO_ALIGN / sizeof(uint32_t));
+	int ret = pread(nvmeFd, (void*)&header[0], IO_ALIGN, page);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; return comp_nbytes; }
+
+	uint32_t word1 = header[(last - page) / sizeof(uint32_t) + 1];
+	size_t words = IDX_HEADER_WORDS * n_blocks + (word1 >> IDX_WIDTH_BITS) + (word1 & IDX_WIDTH_MASK) * IDX_BLOCK / 32 + IDX_PAD_WORDS;
+	return std::min(comp_nbytes, (words * sizeof(uint32_t) + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN);
+}
+
+// Block-local top-k swaps n_elements_compressed 16-bit offsets and as many fp16 values, each
+// file padded to IO_ALIGN. Sized like comp_nbytes: offsets take the first half.
+size_t local_comp_nbytes(size_t n_elements_compressed)
+{
+	return (n_elements_compressed * sizeof(uint16_t) + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN * 2;
+}
+
+// Bytes of the quantized value stream of val_quant.h, within val_nbytes of fp16 values
+size_t quant_val_nbytes(size_t n_elements_compressed, int val_bits, size_t val_nbytes)
+{
+	return std::min(val_nbytes, (val_quant_words(n_elements_compressed, val_bits) * sizeof(uint32_t) + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN);
+}
+
 void thread_work_adagrad_comp(
 		std::string param_path,
 		std::string exp_avg_sq_path,
@@ -146,7 +274,9 @@ void thread_work_adagrad_comp(
 		float _alpha,
 	    float _eps,
 	    float _weight_decay,
-		float compression_ratio
+		float compression_ratio,
+		int topk_block,
+		int val_bits
 	)
 {
 	assert( int(_param_size) % (16) == 0);
@@ -168,9 +298,19 @@ void thread_work_adagrad_comp(
 	int comp_grad_size = int (_param_size * compression_ratio);
 	int padded_comp_grad_size = ((comp_grad_size - 1)/1024 + 1 ) * 1024;
 	int comp_nbytes = padded_comp_grad_size * sizeof(float);
+	int block_k = 0;
+	if (topk_block > 0) {
+		block_k = topk_block_k(topk_block, compression_ratio);
+		padded_comp_grad_size = topk_block_total(_param_size, topk_block, compression_ratio);
+		comp_nbytes = local_comp_nbytes(padded_comp_grad_size);
+	}
 
 	int cnt = 2;
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, int(padded_comp_grad_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, topk_block));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, block_k));
+	cnt++; // grad_val_q
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, val_bits));
 	cnt++; // grad16
 	cnt++; // param16
 	cnt++; // param
@@ -211,10 +351,10 @@ void thread_work_adagrad_comp(
 	//q.enqueueWriteBuffer ( grad_idx_pool[device_id], CL_FALSE, 0, comp_nbytes, grad_idx_ptr);
 
 		
-	ret = pread(nvmeFd_grad_idx, (void*)p2p_grad_idx, comp_nbytes, 0);
+	ret = pread(nvmeFd_grad_idx, (void*)p2p_grad_idx, topk_block > 0 ? comp_nbytes/2 : packed_idx_nbytes(nvmeFd_grad_idx, padded_comp_grad_size, comp_nbytes), 0);
 	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 	
-	ret = pread(nvmeFd_grad_val, (void*)p2p_grad_val, comp_nbytes/2, 0);
+	ret = pread(nvmeFd_grad_val, (void*)p2p_grad_val, val_bits < 16 ? quant_val_nbytes(padded_comp_grad_size, val_bits, comp_nbytes/2) : comp_nbytes/2, 0);
 	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 	
 	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
@@ -250,7 +390,9 @@ void thread_work_sgd_comp(
 	    float _betta1,
 	    float _weight_decay,
 		float compression_ratio,
-		int* grad_idx_ptr
+		int* grad_idx_ptr,
+		int topk_block,
+		int val_bits
 	)
 {
 	assert( int(_param_size) % (16) == 0);
@@ -272,9 +414,19 @@ void thread_work_sgd_comp(
 	int comp_grad_size = int (_param_size * compression_ratio);
 	int padded_comp_grad_size = ((comp_grad_size - 1)/1024 + 1 ) * 1024;
 	int comp_nbytes = padded_comp_grad_size * sizeof(float);
+	int block_k = 0;
+	if (topk_block > 0) {
+		block_k = topk_block_k(topk_block, compression_ratio);
+		padded_comp_grad_size = topk_block_total(_param_size, topk_block, compression_ratio);
+		comp_nbytes = local_comp_nbytes(padded_comp_grad_size);
+	}
 
 	int cnt = 2;
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, int(padded_comp_grad_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, topk_block));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, block_k));
+	cnt++; // grad_val_q
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, val_bits));
 	cnt++; // grad16
 	cnt++; // param16
 	cnt++; // param
@@ -313,10 +465,10 @@ void thread_work_sgd_comp(
 	}
 	
 		
-	ret = pread(nvmeFd_grad_idx, (void*)p2p_grad_idx, comp_nbytes, 0);
+	ret = pread(nvmeFd_grad_idx, (void*)p2p_grad_idx, topk_block > 0 ? comp_nbytes/2 : packed_idx_nbytes(nvmeFd_grad_idx, padded_comp_grad_size, comp_nbytes), 0);
 	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 	
-	ret = pread(nvmeFd_grad_val, (void*)p2p_grad_val, comp_nbytes/2, 0);
+	ret = pread(nvmeFd_grad_val, (void*)p2p_grad_val, val_bits < 16 ? quant_val_nbytes(padded_comp_grad_size, val_bits, comp_nbytes/2) : comp_nbytes/2, 0);
 	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 	
 	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
@@ -343,6 +495,122 @@ void thread_work_sgd_comp(
 
 
 
+void thread_work_lion_comp(
+		std::string param_path,
+		std::string exp_avg_path,
+		std::string grad_path,
+		size_t _param_size ,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		int device_id,
+		float _alpha,
+	    float _betta1,
+	    float _betta2,
+	    float _weight_decay,
+		float compression_ratio,
+		int* grad_idx_ptr,
+		int topk_block,
+		int val_bits
+	)
+{
+	assert( int(_param_size) % (16) == 0);
+	
+	auto context = contexts[device_id];
+	auto q = queues[device_id];
+
+	auto krnl_adam = krnls[device_id];	
+
+	int ret;
+
+	size_t nbytes = _param_size * sizeof(float);
+	
+	float step_size = -1 * _alpha ;
+	float w_decay = -1 * _alpha * _weight_decay;
+
+	cl_int err;
+			
+	int comp_grad_size = int (_param_size * compression_ratio);
+	int padded_comp_grad_size = ((comp_grad_size - 1)/1024 + 1 ) * 1024;
+	int comp_nbytes = padded_comp_grad_size * sizeof(float);
+	int block_k = 0;
+	if (topk_block > 0) {
+		block_k = topk_block_k(topk_block, compression_ratio);
+		padded_comp_grad_size = topk_block_total(_param_size, topk_block, compression_ratio);
+		comp_nbytes = local_comp_nbytes(padded_comp_grad_size);
+	}
+
+	int cnt = 2;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, int(padded_comp_grad_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, topk_block));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, block_k));
+	cnt++; // grad_val_q
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, val_bits));
+	cnt++; // grad16
+	cnt++; // param16
+	cnt++; // param
+	cnt++; // exp_avg
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, int(_param_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, w_decay));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
+
+	size_t offset = 0;	
+	
+	int* p2p_grad_idx = p2p_grads_idx[device_id];	
+	half* p2p_grad_val = p2p_grads_val[device_id];	
+	float* p2p_param = p2p_params[device_id];	
+	float* p2p_exp_avg = p2p_exp_avgs[device_id];	
+
+	int nvmeFd_grad_idx = -1;
+	int nvmeFd_grad_val = -1;
+	int nvmeFd_param = -1;
+	int nvmeFd_exp_avg = nvmeFd_exp_avgs[device_id];
+
+	std::string idx_offset_str = "0";
+	std::string val_offset_str = "1";
+
+	nvmeFd_grad_idx = open((grad_path + idx_offset_str).c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
+	nvmeFd_grad_val = open((grad_path + val_offset_str).c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
+
+	nvmeFd_param = open(param_path.c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
+	nvmeFd_exp_avg = open(exp_avg_path.c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
+
+
+	if (nvmeFd_grad_val < 0 || nvmeFd_grad_idx < 0){
+		std::cerr << "ERROR: open " << grad_path << " failed with " << std::endl;
+		assert(false);
+	}
+	
+		
+	ret = pread(nvmeFd_grad_idx, (void*)p2p_grad_idx, topk_block > 0 ? comp_nbytes/2 : packed_idx_nbytes(nvmeFd_grad_idx, padded_comp_grad_size, comp_nbytes), 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	
+	ret = pread(nvmeFd_grad_val, (void*)p2p_grad_val, val_bits < 16 ? quant_val_nbytes(padded_comp_grad_size, val_bits, comp_nbytes/2) : comp_nbytes/2, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	
+	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
+	ret = pread(nvmeFd_param, (void*)p2p_param, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+	if (write_exp_avg[device_id] != nullptr) {  write_exp_avg[device_id]->join(); write_exp_avg[device_id] = nullptr; }
+	ret = pread(nvmeFd_exp_avg, (void*)p2p_exp_avg, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+    //Launch the Kernel
+	q.enqueueTask(krnl_adam, nullptr, nullptr);
+	
+	q.enqueueReadBuffer ( param16_pool[device_id], CL_FALSE, 0, nbytes/2, fp16_params_ptr);
+	q.finish();
+
+	(void)close(nvmeFd_grad_idx);
+	(void)close(nvmeFd_grad_val);
+	
+	write_param[device_id] = new std::thread(write_thread, nvmeFd_param, p2p_param, nbytes, true);
+	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, nbytes, true);
+
+}
 void thread_work_comp(
 		std::string param_path,
 		std::string exp_avg_path,
@@ -360,7 +628,9 @@ void thread_work_comp(
 		float _bias_correction1,
         float _bias_correction2,
 		float compression_ratio,
-		int* grad_idx_ptr
+		int* grad_idx_ptr,
+		int topk_block,
+		int val_bits
 	)
 {
 	assert( int(_param_size) % (16) == 0);
@@ -382,9 +652,19 @@ void thread_work_comp(
 	int comp_grad_size = int (_param_size * compression_ratio);
 	int padded_comp_grad_size = ((comp_grad_size - 1)/1024 + 1 ) * 1024;
 	int comp_nbytes = padded_comp_grad_size * sizeof(float);
+	int block_k = 0;
+	if (topk_block > 0) {
+		block_k = topk_block_k(topk_block, compression_ratio);
+		padded_comp_grad_size = topk_block_total(_param_size, topk_block, compression_ratio);
+		comp_nbytes = local_comp_nbytes(padded_comp_grad_size);
+	}
 
 	int cnt = 2;
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, int(padded_comp_grad_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, topk_block));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, block_k));
+	cnt++; // grad_val_q
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, val_bits));
 	cnt++; // grad16
 	cnt++; // param16
 	cnt++; // param
@@ -430,10 +710,10 @@ void thread_work_comp(
 	}
 	
 		
-	ret = pread(nvmeFd_grad_idx, (void*)p2p_grad_idx, comp_nbytes, 0);
+	ret = pread(nvmeFd_grad_idx, (void*)p2p_grad_idx, topk_block > 0 ? comp_nbytes/2 : packed_idx_nbytes(nvmeFd_grad_idx, padded_comp_grad_size, comp_nbytes), 0);
 	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 	
-	ret = pread(nvmeFd_grad_val, (void*)p2p_grad_val, comp_nbytes/2, 0);
+	ret = pread(nvmeFd_grad_val, (void*)p2p_grad_val, val_bits < 16 ? quant_val_nbytes(padded_comp_grad_size, val_bits, comp_nbytes/2) : comp_nbytes/2, 0);
 	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 	
 	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
@@ -611,10 +891,9 @@ void thread_work_sgd(
 	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, nbytes, true);
 }
 
-void thread_work(
+void thread_work_lion(
 		std::string param_path,
 		std::string exp_avg_path,
-		std::string exp_avg_sq_path,
 		std::string grad_path,
 		size_t _param_size ,
 		float combined_unscale,
@@ -623,10 +902,7 @@ void thread_work(
 		float _alpha,
 	    float _betta1,
 	    float _betta2,
-	    float _eps,
-	    float _weight_decay,
-		float _bias_correction1,
-        float _bias_correction2
+	    float _weight_decay
 	)
 {
 	assert( int(_param_size) % (16) == 0);
@@ -640,32 +916,27 @@ void thread_work(
 
 	size_t nbytes = _param_size * sizeof(float);
 	
-	float step_size = -1 * _alpha / _bias_correction1;
+	float step_size = -1 * _alpha;
 	float w_decay = -1 * _alpha * _weight_decay;
 
 	cl_int err;
 	
-	unsigned int cnt = 5;
+	unsigned int cnt = 4;
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(_param_size)));
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
-	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _bias_correction2));
-	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _eps));
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, w_decay));
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
 
-
 	size_t offset = 0;	
 
 	float* p2p_param = p2p_params[device_id];	
 	half* p2p_grad = p2p_grads[device_id];	
 	float* p2p_exp_avg = p2p_exp_avgs[device_id];	
-	float* p2p_exp_avg_sq = p2p_exp_avg_sqs[device_id];	
 
 	int nvmeFd_param = -1;
 	int nvmeFd_exp_avg = -1;
-	int nvmeFd_exp_avg_sq = -1;
 	int nvmeFd_grad = -1;
 	
 
@@ -685,11 +956,6 @@ void thread_work(
 	ret = pread(nvmeFd_exp_avg, (void*)p2p_exp_avg, nbytes, 0);
 	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-	if (write_exp_avg_sq[device_id] != nullptr) {  write_exp_avg_sq[device_id]->join(); write_exp_avg_sq[device_id] = nullptr ;}
-	nvmeFd_exp_avg_sq = open(exp_avg_sq_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
-	ret = pread(nvmeFd_exp_avg_sq, (void*)p2p_exp_avg_sq, nbytes, 0);
-	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
-	
     //Launch the Kernel
 	q.enqueueTask(krnl_adam, nullptr, nullptr);
 	q.enqueueReadBuffer ( param16_pool[device_id], CL_FALSE, 0, nbytes/2, fp16_params_ptr);
@@ -700,1227 +966,4318 @@ void thread_work(
 	write_param[device_id] = new std::thread(write_thread, nvmeFd_param, p2p_param, nbytes, true);
 
 	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, nbytes, true);
-	
-	write_exp_avg_sq[device_id] = new std::thread(write_thread, nvmeFd_exp_avg_sq, p2p_exp_avg_sq, nbytes, true);
-	
 }
-
-void Adam_Optimizer::Step_fpga_comp( 
-				std::string param_path,
-                std::string exp_avg_path,
-                std::string exp_avg_sq_path,
-                std::string grad_path,
-				size_t _param_size ,
-				float combined_unscale,
-				half* fp16_params_ptr,
-				int device_id,
-				int largest_numel,
-				float compression_ratio,
-				int* grad_idx_ptr
-				)
+void thread_work_adafactor(
+		std::string param_path,
+		std::string exp_avg_path,
+		std::string grad_path,
+		size_t _param_size ,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		int device_id,
+		float _alpha,
+	    float _betta1,
+	    float _betta2,
+	    float _eps,
+	    float _weight_decay,
+		float* factors_ptr,
+		size_t n_factors,
+		int* segments_ptr,
+		int n_segments
+	)
 {
-	//device_id = (MAX_DEVICE - 1) - device_id;
-	int i;
+	assert( int(_param_size) % (16) == 0);
 	
-	if (!(init[device_id])){	
-		cl::Platform::get(&platforms[device_id]);
-		cl::Platform platform;
-		const std::string vendor_name = "Xilinx";
-		for (i  = 0 ; i < platforms[device_id].size(); i++){
-			platform = platforms[device_id][i];
-			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
-			if (platformName == vendor_name){
-				break;
-			}
-		}
-		if (i == platforms[device_id].size()) {
-			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
-			exit(EXIT_FAILURE);
-		}
-		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
-		devices[device_id][0] = devices[device_id][device_id];
-		devices[device_id].resize(1);
-		cl_int err;
-		char device_bdf[20];
-        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
-		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
-		
-		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/topk_adam_fp16.xclbin";
-		
-		// Load xclbin 
-		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
-		bin_file.seekg(0, bin_file.end);
-		auto nb = bin_file.tellg();
-		file_bufs[device_id] = new char [nb];
-		bin_file.seekg(0, bin_file.beg);
-		bin_file.read(file_bufs[device_id], nb);
-		bin_file.close();
-		std::cout << "Bin file read success " << std::endl;
-
-		bins[device_id].push_back({file_bufs[device_id], nb});
-		
-		contexts[device_id] = cl::Context(devices[device_id]); 
-		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+	auto context = contexts[device_id];
+	auto q = queues[device_id];
 
-		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
-		
-		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
-		
-		cl_mem_ext_ptr_t outExt = {0};
-		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+	auto krnl_adam = krnls[device_id];	
 
-		size_t nbytes = largest_numel * sizeof(float);
-		size_t remainder = int( largest_numel * compression_ratio ) % 1024
-		size_t comp_nbytes = ( (int( largest_numel * compression_ratio ) + 1024) -remainder ) * sizeof(float);
+	int ret;
 
-		OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes, &outExt, &err));
+	size_t nbytes = _param_size * sizeof(float);
+	
+	float step_size = -1 * _alpha;
+	float w_decay = -1 * _alpha * _weight_decay;
 
-		OCL_CHECK(err, grad_val_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes/2, &outExt, &err));
-		
-		OCL_CHECK(err, grad_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+	cl_int err;
+	
+	assert( n_segments <= MAX_SEGMENTS );
+	assert( n_factors <= _param_size );
 
-		OCL_CHECK(err, param16_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+	unsigned int cnt = 6;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(n_segments)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _eps));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, w_decay));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
 
-		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+	size_t offset = 0;	
 
-		std::cout << "Buffer initilized success " << std::endl;
+	float* p2p_param = p2p_params[device_id];	
+	half* p2p_grad = p2p_grads[device_id];	
+	float* p2p_exp_avg = p2p_exp_avgs[device_id];	
 
-		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-											param_pool[device_id],						// buffer
-											CL_FALSE,						// blocking call
-											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-											0,							// buffer offset
-											nbytes,			// size in bytes
-										    nullptr,          // waiting events vector
-											nullptr,          // mapping event
-											&err);
+	int nvmeFd_param = -1;
+	int nvmeFd_exp_avg = -1;
+	int nvmeFd_grad = -1;
 	
 
-		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-									  exp_avg_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-	
-		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-									  exp_avg_sq_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
+	//std::cout<<"read starts..."<<std::endl;
 		
-		p2p_grads_idx[device_id] = (int*)queues[device_id].enqueueMapBuffer(
-									  grad_idx_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
-									  0,							// buffer offset
-									  comp_nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
+	nvmeFd_grad = open(grad_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_grad, (void*)p2p_grad, nbytes/2, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		p2p_grads_val[device_id] = (half*)queues[device_id].enqueueMapBuffer(
-									  grad_val_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
-									  0,							// buffer offset
-									  comp_nbytes/2,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-		
+	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
+	nvmeFd_param = open(param_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_param, (void*)p2p_param, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		int cnt = 0;
+	if (write_exp_avg[device_id] != nullptr) {  write_exp_avg[device_id]->join(); write_exp_avg[device_id] = nullptr; }
+	nvmeFd_exp_avg = open(exp_avg_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg, (void*)p2p_exp_avg, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_idx_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));
-		cnt++;	// Param size
+	// Row/column factors stay in host memory, only the small tables cross PCIe
+	q.enqueueWriteBuffer ( factor_pool[device_id], CL_FALSE, 0, n_factors * sizeof(float), factors_ptr);
+	q.enqueueWriteBuffer ( segment_pool[device_id], CL_FALSE, 0, n_segments * SEG_FIELDS * sizeof(int), segments_ptr);
 
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+    //Launch the Kernel
+	q.enqueueTask(krnl_adam, nullptr, nullptr);
+	q.enqueueReadBuffer ( param16_pool[device_id], CL_FALSE, 0, nbytes/2, fp16_params_ptr);
+	q.enqueueReadBuffer ( factor_pool[device_id], CL_FALSE, 0, n_factors * sizeof(float), factors_ptr);
+	q.finish();
 
-		std::cout << "OpenCL initialize finished" << std::endl;
-		init[device_id] = true;
-	}
+	(void)close(nvmeFd_grad);
+	
+	write_param[device_id] = new std::thread(write_thread, nvmeFd_param, p2p_param, nbytes, true);
 
-	threads.push_back(std::thread(thread_work_comp,
-		param_path,
-		exp_avg_path,
-		exp_avg_sq_path,
-		grad_path,
-		_param_size ,
-		combined_unscale,
-		fp16_params_ptr,
-		device_id,
-		_alpha,
-	    _betta1,
-	    _betta2,
-	    _eps,
-	    _weight_decay,
-		_bias_correction1,
-        _bias_correction2,
-		compression_ratio,
-		grad_idx_ptr
-		));
+	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, nbytes, true);
 }
 
-void Adam_Optimizer::Step_fpga_sgd_comp( 
-				std::string param_path,
-                std::string exp_avg_path,
-                std::string grad_path,
-				size_t _param_size ,
-				float combined_unscale,
-				half* fp16_params_ptr,
-				int device_id,
-				int largest_numel,
-				float compression_ratio,
-				int* grad_idx_ptr
-				)
+// ||w|| / ||update|| from squared norms, clamped like FusedLamb
+static float lamb_trust_ratio(float w_norm2, float u_norm2, float max_coeff, float min_coeff)
 {
-	//device_id = (MAX_DEVICE - 1) - device_id;
-	int i;
+	float w_norm = sqrt(w_norm2);
+	float u_norm = sqrt(u_norm2);
+	if (w_norm == 0.0f || u_norm == 0.0f) return 1.0f;
+	return std::min(std::max(w_norm / u_norm, min_coeff), max_coeff);
+}
+
+void thread_work_lamb(
+		std::string param_path,
+		std::string exp_avg_path,
+		std::string exp_avg_sq_path,
+		std::string grad_path,
+		size_t _param_size ,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		int device_id,
+		float _alpha,
+	    float _betta1,
+	    float _betta2,
+	    float _eps,
+	    float _weight_decay,
+		float _bias_correction1,
+        float _bias_correction2,
+		float max_coeff,
+		float min_coeff,
+		int* segments_ptr,
+		int n_segments,
+		int phase,
+		float* norms_ptr
+	)
+{
+	assert( int(_param_size) % (16) == 0);
 	
-	if (!(init[device_id])){	
-		cl::Platform::get(&platforms[device_id]);
-		cl::Platform platform;
-		const std::string vendor_name = "Xilinx";
-		for (i  = 0 ; i < platforms[device_id].size(); i++){
-			platform = platforms[device_id][i];
-			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
-			if (platformName == vendor_name){
-				break;
-			}
-		}
-		if (i == platforms[device_id].size()) {
-			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
-			exit(EXIT_FAILURE);
-		}
-		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
-		devices[device_id][0] = devices[device_id][device_id];
-		devices[device_id].resize(1);
-		cl_int err;
-		char device_bdf[20];
-        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
-		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
-		
-		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/topk_sgd.xclbin";
-		
-		// Load xclbin 
-		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
-		bin_file.seekg(0, bin_file.end);
-		auto nb = bin_file.tellg();
-		file_bufs[device_id] = new char [nb];
-		bin_file.seekg(0, bin_file.beg);
-		bin_file.read(file_bufs[device_id], nb);
-		bin_file.close();
-		std::cout << "Bin file read success " << std::endl;
+	auto context = contexts[device_id];
+	auto q = queues[device_id];
 
-		bins[device_id].push_back({file_bufs[device_id], nb});
-		
-		contexts[device_id] = cl::Context(devices[device_id]); 
-		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+	auto krnl_adam = krnls[device_id];	
 
-		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
-		
-		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
-		
-		cl_mem_ext_ptr_t outExt = {0};
-		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+	int ret;
 
-		size_t nbytes = largest_numel * sizeof(float);
-		size_t comp_nbytes = ( (int( largest_numel * compression_ratio ) - 1) / 1024  + 1) * 1024 * sizeof(float);
-		//size_t comp_nbytes = ( ( - 1) / 1024  + 1) * 1024 * sizeof(float);
+	size_t nbytes = _param_size * sizeof(float);
+	
+	float step_size = -1 * _alpha;
 
-		//OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, comp_nbytes ));
-		OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes, &outExt, &err));
+	cl_int err;
+	
+	assert( n_segments <= MAX_SEGMENTS );
 
-		OCL_CHECK(err, grad_val_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes/2, &outExt, &err));
-		
-		OCL_CHECK(err, grad_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+	unsigned int cnt = 7;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(n_segments)));
+	unsigned int phase_arg = cnt;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(phase == PHASE_UPDATE ? PHASE_UPDATE : PHASE_NORM)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _bias_correction1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _bias_correction2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _eps));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _weight_decay));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
 
-		OCL_CHECK(err, param16_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+	float* p2p_param = p2p_params[device_id];	
+	half* p2p_grad = p2p_grads[device_id];	
+	float* p2p_exp_avg = p2p_exp_avgs[device_id];	
+	float* p2p_exp_avg_sq = p2p_exp_avg_sqs[device_id];	
 
-		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+	int& nvmeFd_param = lamb_fds[device_id][0];
+	int& nvmeFd_exp_avg = lamb_fds[device_id][1];
+	int& nvmeFd_exp_avg_sq = lamb_fds[device_id][2];
+	int& nvmeFd_grad = lamb_fds[device_id][3];
 
-		std::cout << "Buffer initilized success " << std::endl;
+	if (phase != PHASE_UPDATE) {
+		//std::cout<<"read starts..."<<std::endl;
+			
+		nvmeFd_grad = open(grad_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+		ret = pread(nvmeFd_grad, (void*)p2p_grad, nbytes/2, 0);
+		if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+		if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
+		nvmeFd_param = open(param_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+		ret = pread(nvmeFd_param, (void*)p2p_param, nbytes, 0);
+		if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+		if (write_exp_avg[device_id] != nullptr) {  write_exp_avg[device_id]->join(); write_exp_avg[device_id] = nullptr; }
+		nvmeFd_exp_avg = open(exp_avg_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+		ret = pread(nvmeFd_exp_avg, (void*)p2p_exp_avg, nbytes, 0);
+		if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+		if (write_exp_avg_sq[device_id] != nullptr) {  write_exp_avg_sq[device_id]->join(); write_exp_avg_sq[device_id] = nullptr ;}
+		nvmeFd_exp_avg_sq = open(exp_avg_sq_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+		ret = pread(nvmeFd_exp_avg_sq, (void*)p2p_exp_avg_sq, nbytes, 0);
+		if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+		q.enqueueWriteBuffer ( segment_pool[device_id], CL_FALSE, 0, n_segments * SEG_FIELDS * sizeof(int), segments_ptr);
+
+	    //Launch phase 1: moments and squared norms of w and of the update per segment
+		q.enqueueTask(krnl_adam, nullptr, nullptr);
+		q.enqueueReadBuffer ( norm_pool[device_id], CL_TRUE, 0, 2 * n_segments * sizeof(float), norms_ptr);
+
+		// The caller reduces the norms across ranks and comes back with PHASE_UPDATE
+		if (phase == PHASE_NORM) return;
+		OCL_CHECK(err, err = krnl_adam.setArg(phase_arg, uint32_t(PHASE_UPDATE)));
+	}
 
-		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-											param_pool[device_id],						// buffer
-											CL_FALSE,						// blocking call
-											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-											0,							// buffer offset
-											nbytes,			// size in bytes
-										    nullptr,          // waiting events vector
-											nullptr,          // mapping event
-											&err);
+	std::vector<float> norms(norms_ptr, norms_ptr + 2 * n_segments);
+	for (int s = 0; s < n_segments; s++) {
+		norms[2 * s] = lamb_trust_ratio(norms[2 * s], norms[2 * s + 1], max_coeff, min_coeff);
+	}
+	q.enqueueWriteBuffer ( norm_pool[device_id], CL_FALSE, 0, norms.size() * sizeof(float), norms.data());
+
+    //Launch phase 2: trust ratio scaled update, the tensors are still in device memory
+	q.enqueueTask(krnl_adam, nullptr, nullptr);
+	q.enqueueReadBuffer ( param16_pool[device_id], CL_FALSE, 0, nbytes/2, fp16_params_ptr);
+	q.finish();
+
+	(void)close(nvmeFd_grad);
 	
+	write_param[device_id] = new std::thread(write_thread, nvmeFd_param, p2p_param, nbytes, true);
 
-		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-									  exp_avg_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
+	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, nbytes, true);
 	
-		p2p_grads_idx[device_id] = (int*)queues[device_id].enqueueMapBuffer(
-									  grad_idx_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
-									  0,							// buffer offset
-									  comp_nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
+	write_exp_avg_sq[device_id] = new std::thread(write_thread, nvmeFd_exp_avg_sq, p2p_exp_avg_sq, nbytes, true);
+}
+// Elements per compute unit slice of an n element sub group
+static size_t cu_slice(size_t n, int n_cu)
+{
+	if (n_cu == 1) return n;
+	return ((n + n_cu - 1) / n_cu + CU_ALIGN - 1) / CU_ALIGN * CU_ALIGN;
+}
 
-		p2p_grads_val[device_id] = (half*)queues[device_id].enqueueMapBuffer(
-									  grad_val_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
-									  0,							// buffer offset
-									  comp_nbytes/2,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-		
+// Finds the compute units of krnl_vadd and gives each its own buffers, allocated against the
+// CU's ports so they are placed in the memory bank that CU is connected to. CU 0 is aliased
+// into the device pools, which keeps the single CU path and the norm kernel unchanged.
+static void init_adam_cus(int device_id, int largest_numel)
+{
+	cl_int err;
+	int n_cu = 1;
+	while (n_cu < MAX_CU) {
+		std::string name = "krnl_vadd:{krnl_vadd_" + std::to_string(n_cu + 1) + "}";
+		cl::Kernel probe(programs[device_id], name.c_str(), &err);
+		if (err != CL_SUCCESS) break;
+		n_cu++;
+	}
+	n_cus[device_id] = n_cu;
+	std::cout << "Device id: " << device_id << " has " << n_cu << " compute unit(s)" << std::endl;
+
+	size_t nbytes = cu_slice(largest_numel, n_cu) * sizeof(float);
+
+	for (int c = 0 ; c < n_cu; c++) {
+		std::string name = (n_cu == 1) ? "krnl_vadd" : "krnl_vadd:{krnl_vadd_" + std::to_string(c + 1) + "}";
+		OCL_CHECK(err, cu_krnls[device_id][c] = cl::Kernel(programs[device_id], name.c_str(), &err));
+		// an in-order queue per CU, so the CUs run concurrently
+		if (c == 0) cu_queues[device_id][c] = queues[device_id];
+		else OCL_CHECK(err, cu_queues[device_id][c] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, &err));
+
+		cl::Kernel& krnl = cu_krnls[device_id][c];
+		auto q = cu_queues[device_id][c];
+
+		// flags carry the argument index whose bank the buffer goes to
+		cl_mem_ext_ptr_t gradExt = {0};
+		gradExt.flags = 0 | XCL_MEM_EXT_P2P_BUFFER;
+		gradExt.param = krnl();
+		cl_mem_ext_ptr_t param16Ext = {0};
+		param16Ext.flags = 1;
+		param16Ext.param = krnl();
+		cl_mem_ext_ptr_t paramExt = {0};
+		paramExt.flags = 2 | XCL_MEM_EXT_P2P_BUFFER;
+		paramExt.param = krnl();
+		cl_mem_ext_ptr_t expAvgExt = {0};
+		expAvgExt.flags = 3 | XCL_MEM_EXT_P2P_BUFFER;
+		expAvgExt.param = krnl();
+		cl_mem_ext_ptr_t expAvgSqExt = {0};
+		expAvgSqExt.flags = 4 | XCL_MEM_EXT_P2P_BUFFER;
+		expAvgSqExt.param = krnl();
+
+		OCL_CHECK(err, cu_grad_pool[device_id][c] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &gradExt, &err));
+		OCL_CHECK(err, cu_param16_pool[device_id][c] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &param16Ext, &err));
+		OCL_CHECK(err, cu_param_pool[device_id][c] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &paramExt, &err));
+		OCL_CHECK(err, cu_exp_avg_pool[device_id][c] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &expAvgExt, &err));
+		OCL_CHECK(err, cu_exp_avg_sq_pool[device_id][c] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &expAvgSqExt, &err));
+
+		p2p_cu_params[device_id][c] = (float*)q.enqueueMapBuffer(cu_param_pool[device_id][c], CL_FALSE, CL_MAP_WRITE | CL_MAP_READ, 0, nbytes, nullptr, nullptr, &err);
+		p2p_cu_exp_avgs[device_id][c] = (float*)q.enqueueMapBuffer(cu_exp_avg_pool[device_id][c], CL_FALSE, CL_MAP_WRITE | CL_MAP_READ, 0, nbytes, nullptr, nullptr, &err);
+		p2p_cu_exp_avg_sqs[device_id][c] = (float*)q.enqueueMapBuffer(cu_exp_avg_sq_pool[device_id][c], CL_FALSE, CL_MAP_WRITE | CL_MAP_READ, 0, nbytes, nullptr, nullptr, &err);
+		p2p_cu_grads[device_id][c] = (half*)q.enqueueMapBuffer(cu_grad_pool[device_id][c], CL_FALSE, CL_MAP_READ, 0, nbytes / 2, nullptr, nullptr, &err);
 
 		int cnt = 0;
-
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_idx_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));
-		cnt++;	// Param size
-
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
-
-		std::cout << "OpenCL initialize finished" << std::endl;
-		init[device_id] = true;
+		OCL_CHECK(err, err = krnl.setArg(cnt++, cu_grad_pool[device_id][c]));
+		OCL_CHECK(err, err = krnl.setArg(cnt++, cu_param16_pool[device_id][c]));
+		OCL_CHECK(err, err = krnl.setArg(cnt++, cu_param_pool[device_id][c]));
+		OCL_CHECK(err, err = krnl.setArg(cnt++, cu_exp_avg_pool[device_id][c]));
+		OCL_CHECK(err, err = krnl.setArg(cnt++, cu_exp_avg_sq_pool[device_id][c]));
 	}
 
-	threads.push_back(std::thread(thread_work_sgd_comp,
-		param_path,
-		exp_avg_path,
-		grad_path,
-		_param_size ,
-		combined_unscale,
-		fp16_params_ptr,
-		device_id,
-		_alpha,
-	    _betta1,
-	    _weight_decay,
-		compression_ratio,
-		grad_idx_ptr
-		));
+	krnls[device_id] = cu_krnls[device_id][0];
+	grad_pool[device_id] = cu_grad_pool[device_id][0];
+	param16_pool[device_id] = cu_param16_pool[device_id][0];
+	param_pool[device_id] = cu_param_pool[device_id][0];
+	exp_avg_pool[device_id] = cu_exp_avg_pool[device_id][0];
+	exp_avg_sq_pool[device_id] = cu_exp_avg_sq_pool[device_id][0];
+	p2p_grads[device_id] = p2p_cu_grads[device_id][0];
+	p2p_params[device_id] = p2p_cu_params[device_id][0];
+	p2p_exp_avgs[device_id] = p2p_cu_exp_avgs[device_id][0];
+	p2p_exp_avg_sqs[device_id] = p2p_cu_exp_avg_sqs[device_id][0];
 }
 
-
-
-void Adam_Optimizer::Step_fpga_adagrad_comp( 
-				std::string param_path,
-                std::string exp_avg_sq_path,
-                std::string grad_path,
-				size_t _param_size ,
-				float combined_unscale,
-				half* fp16_params_ptr,
-				int device_id,
-				int largest_numel,
-				float compression_ratio
-				)
+// One compute unit: elements [start, start + len) of the sub group
+static void cu_work(
+		int nvmeFd_param,
+		int nvmeFd_exp_avg,
+		int nvmeFd_exp_avg_sq,
+		int nvmeFd_grad,
+		size_t start,
+		size_t len,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		int device_id,
+		int c,
+	    float _betta1,
+	    float _betta2,
+	    float _eps,
+	    float w_decay,
+		float step_size,
+        float _bias_correction2
+	)
 {
-	//device_id = (MAX_DEVICE - 1) - device_id;
-	int i;
-	
-	if (!(init[device_id])){	
-		cl::Platform::get(&platforms[device_id]);
-		cl::Platform platform;
-		const std::string vendor_name = "Xilinx";
-		for (i  = 0 ; i < platforms[device_id].size(); i++){
-			platform = platforms[device_id][i];
-			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
-			if (platformName == vendor_name){
-				break;
-			}
-		}
-		if (i == platforms[device_id].size()) {
-			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
-			exit(EXIT_FAILURE);
-		}
-		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
-		devices[device_id][0] = devices[device_id][device_id];
-		devices[device_id].resize(1);
-		cl_int err;
-		char device_bdf[20];
-        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
-		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
-		
-		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/topk_adagrad.xclbin";
-		
-		// Load xclbin 
-		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
-		bin_file.seekg(0, bin_file.end);
-		auto nb = bin_file.tellg();
-		file_bufs[device_id] = new char [nb];
-		bin_file.seekg(0, bin_file.beg);
-		bin_file.read(file_bufs[device_id], nb);
-		bin_file.close();
-		std::cout << "Bin file read success " << std::endl;
+	auto q = cu_queues[device_id][c];
+	auto krnl_adam = cu_krnls[device_id][c];
 
-		bins[device_id].push_back({file_bufs[device_id], nb});
-		
-		contexts[device_id] = cl::Context(devices[device_id]); 
-		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+	int ret;
+	cl_int err;
+	size_t nbytes = len * sizeof(float);
 
-		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
-		
-		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
-		
-		cl_mem_ext_ptr_t outExt = {0};
-		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+	unsigned int cnt = 5;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(len)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _bias_correction2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _eps));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, w_decay));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
 
-		size_t nbytes = largest_numel * sizeof(float);
-		size_t comp_nbytes = ( (int( largest_numel * compression_ratio ) - 1) / 1024  + 1) * 1024 * sizeof(float);
+	ret = pread(nvmeFd_grad, (void*)p2p_cu_grads[device_id][c], nbytes/2, start * sizeof(half));
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	ret = pread(nvmeFd_param, (void*)p2p_cu_params[device_id][c], nbytes, start * sizeof(float));
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	ret = pread(nvmeFd_exp_avg, (void*)p2p_cu_exp_avgs[device_id][c], nbytes, start * sizeof(float));
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	ret = pread(nvmeFd_exp_avg_sq, (void*)p2p_cu_exp_avg_sqs[device_id][c], nbytes, start * sizeof(float));
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		//OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, comp_nbytes ));
-		OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes, &outExt, &err));
+	q.enqueueTask(krnl_adam, nullptr, nullptr);
+	q.enqueueReadBuffer ( cu_param16_pool[device_id][c], CL_FALSE, 0, nbytes/2, fp16_params_ptr + start);
+	q.finish();
+}
 
-		OCL_CHECK(err, grad_val_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes/2, &outExt, &err));
-		
-		OCL_CHECK(err, grad_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+// Splits the sub group across the compute units of the device, one host thread per CU
+void thread_work_cus(
+		std::string param_path,
+		std::string exp_avg_path,
+		std::string exp_avg_sq_path,
+		std::string grad_path,
+		size_t _param_size ,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		int device_id,
+		float _alpha,
+	    float _betta1,
+	    float _betta2,
+	    float _eps,
+	    float _weight_decay,
+		float _bias_correction1,
+        float _bias_correction2
+	)
+{
+	float step_size = -1 * _alpha / _bias_correction1;
+	float w_decay = -1 * _alpha * _weight_decay;
 
-		OCL_CHECK(err, param16_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+	size_t slice = cu_slice(_param_size, n_cus[device_id]);
 
-		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+	// every CU reads from all three state files, so the previous write back has to be done
+	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
+	if (write_exp_avg[device_id] != nullptr) {  write_exp_avg[device_id]->join(); write_exp_avg[device_id] = nullptr; }
+	if (write_exp_avg_sq[device_id] != nullptr) {  write_exp_avg_sq[device_id]->join(); write_exp_avg_sq[device_id] = nullptr ;}
 
-		std::cout << "Buffer initilized success " << std::endl;
+	int nvmeFd_grad = open(grad_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	int nvmeFd_param = open(param_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	int nvmeFd_exp_avg = open(exp_avg_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	int nvmeFd_exp_avg_sq = open(exp_avg_sq_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+
+	std::vector<std::thread> cu_threads;
+	std::vector<float*> params, exp_avgs, exp_avg_sqs;
+	std::vector<size_t> nbytes, offsets;
+	for (int c = 0 ; c < n_cus[device_id]; c++) {
+		size_t start = c * slice;
+		if (start >= _param_size) break;
+		size_t len = std::min(slice, _param_size - start);
+
+		cu_threads.push_back(std::thread(cu_work, nvmeFd_param, nvmeFd_exp_avg, nvmeFd_exp_avg_sq, nvmeFd_grad,
+				start, len, combined_unscale, fp16_params_ptr, device_id, c,
+				_betta1, _betta2, _eps, w_decay, step_size, _bias_correction2));
+
+		params.push_back(p2p_cu_params[device_id][c]);
+		exp_avgs.push_back(p2p_cu_exp_avgs[device_id][c]);
+		exp_avg_sqs.push_back(p2p_cu_exp_avg_sqs[device_id][c]);
+		nbytes.push_back(len * sizeof(float));
+		offsets.push_back(start * sizeof(float));
+	}
+	for (auto& thread : cu_threads) thread.join();
 
-		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-											param_pool[device_id],						// buffer
-											CL_FALSE,						// blocking call
-											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-											0,							// buffer offset
-											nbytes,			// size in bytes
-										    nullptr,          // waiting events vector
-											nullptr,          // mapping event
-											&err);
-	
+	(void)close(nvmeFd_grad);
 
-		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-									  exp_avg_sq_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-		
-		p2p_grads_idx[device_id] = (int*)queues[device_id].enqueueMapBuffer(
-									  grad_idx_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
-									  0,							// buffer offset
-									  comp_nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
+	write_param[device_id] = new std::thread(write_cu_thread, nvmeFd_param, params, nbytes, offsets);
 
-		p2p_grads_val[device_id] = (half*)queues[device_id].enqueueMapBuffer(
-									  grad_val_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
-									  0,							// buffer offset
-									  comp_nbytes/2,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-		
+	write_exp_avg[device_id] = new std::thread(write_cu_thread, nvmeFd_exp_avg, exp_avgs, nbytes, offsets);
 
-		int cnt = 0;
+	write_exp_avg_sq[device_id] = new std::thread(write_cu_thread, nvmeFd_exp_avg_sq, exp_avg_sqs, nbytes, offsets);
+}
 
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_idx_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));
-		cnt++;	// Param size
+// krnl_crc is only present when the optimizer xclbin was linked with CRC=1
+static bool crc_krnl_ready(int device_id, size_t nbytes)
+{
+	// the pools only hold the slice of CU 0
+	if (!check_crc || n_cus[device_id] > 1) return false;
 
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+	cl_int err;
+	if (!crc_init[device_id]) {
+		crc_krnls[device_id] = cl::Kernel(programs[device_id], "krnl_crc", &err);
+		has_crc_krnl[device_id] = (err == CL_SUCCESS);
+		if (!has_crc_krnl[device_id]) {
+			std::cout << "Device id: " << device_id << " has no krnl_crc, swapped state is not checksummed" << std::endl;
+		}
+		crc_init[device_id] = true;
+	}
+	if (!has_crc_krnl[device_id]) return false;
 
-		std::cout << "OpenCL initialize finished" << std::endl;
-		init[device_id] = true;
+	size_t n_chunks = crc_n_chunks(nbytes);
+	if (n_chunks > crc_pool_chunks[device_id]) {
+		for (int s = 0 ; s < 2 * CRC_STREAMS; s++) {
+			OCL_CHECK(err, crc_pool[device_id][s] = cl::Buffer(contexts[device_id], CL_MEM_WRITE_ONLY, n_chunks * sizeof(uint32_t), nullptr, &err));
+		}
+		crc_pool_chunks[device_id] = n_chunks;
 	}
+	return true;
+}
 
-	threads.push_back(std::thread(thread_work_adagrad_comp,
-		param_path,
-		exp_avg_sq_path,
-		grad_path,
-		_param_size ,
-		combined_unscale,
-		fp16_params_ptr,
-		device_id,
-		_alpha,
-	    _eps,
-	    _weight_decay,
-		compression_ratio
-		));
+// Queues krnl_crc over the first nbytes of every buffer, checksums of bufs[s] go to crcs[s]
+static void enqueue_crc(int device_id, cl::Buffer* bufs, int first_pool, size_t nbytes, std::vector<uint32_t>* crcs)
+{
+	auto q = queues[device_id];
+	auto krnl_crc = crc_krnls[device_id];
+	size_t n_chunks = crc_n_chunks(nbytes);
+
+	cl_int err;
+	for (int s = 0 ; s < CRC_STREAMS; s++) {
+		crcs[s].resize(n_chunks);
+		OCL_CHECK(err, err = krnl_crc.setArg(0, bufs[s]));
+		OCL_CHECK(err, err = krnl_crc.setArg(1, crc_pool[device_id][first_pool + s]));
+		OCL_CHECK(err, err = krnl_crc.setArg(2, uint32_t(nbytes / sizeof(float))));
+		q.enqueueTask(krnl_crc, nullptr, nullptr);
+		q.enqueueReadBuffer ( crc_pool[device_id][first_pool + s], CL_FALSE, 0, n_chunks * sizeof(uint32_t), crcs[s].data());
+	}
 }
 
-void Adam_Optimizer::Step_fpga_adagrad( 
-				std::string param_path,
-                std::string exp_avg_sq_path,
-                std::string grad_path,
-				size_t _param_size ,
-				float combined_unscale,
-				half* fp16_params_ptr,
-				int device_id,
-				int largest_numel
-				)
+void thread_work(
+		std::string param_path,
+		std::string exp_avg_path,
+		std::string exp_avg_sq_path,
+		std::string grad_path,
+		size_t _param_size ,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		int device_id,
+		float _alpha,
+	    float _betta1,
+	    float _betta2,
+	    float _eps,
+	    float _weight_decay,
+		float _bias_correction1,
+        float _bias_correction2
+	)
 {
-	//device_id = (MAX_DEVICE - 1) - device_id;
-	int i;
-	if (!(init[device_id])){	
-		cl::Platform::get(&platforms[device_id]);
-		cl::Platform platform;
-		const std::string vendor_name = "Xilinx";
-		for (i  = 0 ; i < platforms[device_id].size(); i++){
-			platform = platforms[device_id][i];
-			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
-			if (platformName == vendor_name){
-				break;
-			}
-		}
-		if (i == platforms[device_id].size()) {
-			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
-			exit(EXIT_FAILURE);
-		}
-		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
-		devices[device_id][0] = devices[device_id][device_id];
-		devices[device_id].resize(1);
-		cl_int err;
-		char device_bdf[20];
-        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
-		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
-		
-		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adagrad.xclbin";
-		
-		// Load xclbin 
-		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
-		bin_file.seekg(0, bin_file.end);
-		auto nb = bin_file.tellg();
-		file_bufs[device_id] = new char [nb];
-		bin_file.seekg(0, bin_file.beg);
-		bin_file.read(file_bufs[device_id], nb);
-		bin_file.close();
-
-		bins[device_id].push_back({file_bufs[device_id], nb});
-		
-		contexts[device_id] = cl::Context(devices[device_id]); 
-		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
-
-		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
-		
-		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
-		
-		cl_mem_ext_ptr_t outExt = {0};
-		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
-
-		size_t nbytes = largest_numel * sizeof(float);
+	assert( int(_param_size) % (16) == 0);
 
-		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+	if (n_cus[device_id] > 1) {
+		thread_work_cus(param_path, exp_avg_path, exp_avg_sq_path, grad_path, _param_size, combined_unscale, fp16_params_ptr, device_id,
+				_alpha, _betta1, _betta2, _eps, _weight_decay, _bias_correction1, _bias_correction2);
+		return;
+	}
+	
+	auto context = contexts[device_id];
+	auto q = queues[device_id];
 
-		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		
-		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+	auto krnl_adam = krnls[device_id];	
 
-		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+	int ret;
 
-		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-											param_pool[device_id],						// buffer
-											CL_FALSE,						// blocking call
-											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-											0,							// buffer offset
-											nbytes,			// size in bytes
-										    nullptr,          // waiting events vector
-											nullptr,          // mapping event
-											&err);
+	size_t nbytes = _param_size * sizeof(float);
 	
-		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-									  exp_avg_sq_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-
-		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
-									  grad_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes/2,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-
-		int cnt = 0;
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+	float step_size = -1 * _alpha / _bias_correction1;
+	float w_decay = -1 * _alpha * _weight_decay;
 
-		init[device_id] = true;
-	}
+	cl_int err;
+	
+	unsigned int cnt = 5;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(_param_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _bias_correction2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _eps));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, w_decay));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
 
-	threads.push_back(std::thread(thread_work_adagrad,
-		param_path,
-		exp_avg_sq_path,
-		grad_path,
-		_param_size ,
-		combined_unscale,
-		fp16_params_ptr,
-		device_id,
-		_alpha,
-	    _eps,
-	    _weight_decay
-		));
-}
 
-void Adam_Optimizer::Step_fpga_sgd( 
-				std::string param_path,
-                std::string exp_avg_path,
-                std::string grad_path,
-				size_t _param_size ,
-				float combined_unscale,
-				half* fp16_params_ptr,
-				int device_id,
-				int largest_numel
-				)
-{
-	//device_id = (MAX_DEVICE - 1) - device_id;
+	size_t offset = 0;	
 
-	int i;
-	if (!(init[device_id])){	
-			
-		cl::Platform::get(&platforms[device_id]);
-		cl::Platform platform;
-		const std::string vendor_name = "Xilinx";
-		for (i  = 0 ; i < platforms[device_id].size(); i++){
-			platform = platforms[device_id][i];
-			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
-			if (platformName == vendor_name){
-				break;
-			}
-		}
-		if (i == platforms[device_id].size()) {
-			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
-			exit(EXIT_FAILURE);
-		}
-		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
-		devices[device_id][0] = devices[device_id][device_id];
-		devices[device_id].resize(1);
-		cl_int err;
-		char device_bdf[20];
-        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
-		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
-		
-		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/sgd.xclbin";
-		
-		// Load xclbin 
-		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
-		bin_file.seekg(0, bin_file.end);
-		auto nb = bin_file.tellg();
-		file_bufs[device_id] = new char [nb];
-		bin_file.seekg(0, bin_file.beg);
-		bin_file.read(file_bufs[device_id], nb);
-		bin_file.close();
+	float* p2p_param = p2p_params[device_id];	
+	half* p2p_grad = p2p_grads[device_id];	
+	float* p2p_exp_avg = p2p_exp_avgs[device_id];	
+	float* p2p_exp_avg_sq = p2p_exp_avg_sqs[device_id];	
 
-		bins[device_id].push_back({file_bufs[device_id], nb});
-		
-		contexts[device_id] = cl::Context(devices[device_id]); 
-		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+	int nvmeFd_param = -1;
+	int nvmeFd_exp_avg = -1;
+	int nvmeFd_exp_avg_sq = -1;
+	int nvmeFd_grad = -1;
+	
 
-		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
-		
-		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+	//std::cout<<"read starts..."<<std::endl;
 		
-		cl_mem_ext_ptr_t outExt = {0};
-		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
-
-		size_t nbytes = largest_numel * sizeof(float);
+	nvmeFd_grad = open(grad_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_grad, (void*)p2p_grad, nbytes/2, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
+	nvmeFd_param = open(param_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_param, (void*)p2p_param, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		
-		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		
-		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+	if (write_exp_avg[device_id] != nullptr) {  write_exp_avg[device_id]->join(); write_exp_avg[device_id] = nullptr; }
+	nvmeFd_exp_avg = open(exp_avg_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg, (void*)p2p_exp_avg, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
+	if (write_exp_avg_sq[device_id] != nullptr) {  write_exp_avg_sq[device_id]->join(); write_exp_avg_sq[device_id] = nullptr ;}
+	nvmeFd_exp_avg_sq = open(exp_avg_sq_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg_sq, (void*)p2p_exp_avg_sq, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-											param_pool[device_id],						// buffer
-											CL_FALSE,						// blocking call
-											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-											0,							// buffer offset
-											nbytes,			// size in bytes
-										    nullptr,          // waiting events vector
-											nullptr,          // mapping event
-											&err);
+	bool crc = crc_krnl_ready(device_id, nbytes);
+	cl::Buffer crc_bufs[CRC_STREAMS] = { param_pool[device_id], exp_avg_pool[device_id], exp_avg_sq_pool[device_id] };
+	std::vector<uint32_t> crcs_read[CRC_STREAMS];
+	std::vector<uint32_t> crcs_write[CRC_STREAMS];
+	if (crc) { enqueue_crc(device_id, crc_bufs, 0, nbytes, crcs_read); }
 	
+    //Launch the Kernel
+	q.enqueueTask(krnl_adam, nullptr, nullptr);
+	q.enqueueReadBuffer ( param16_pool[device_id], CL_FALSE, 0, nbytes/2, fp16_params_ptr);
+	if (crc) { enqueue_crc(device_id, crc_bufs, CRC_STREAMS, nbytes, crcs_write); }
+	q.finish();
 
-		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-									  exp_avg_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-	
+	(void)close(nvmeFd_grad);
 
-		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
-									  grad_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes/2,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
+	if (crc) {
+		std::string paths[CRC_STREAMS] = { param_path, exp_avg_path, exp_avg_sq_path };
+		for (int s = 0 ; s < CRC_STREAMS; s++) {
+			if (verify_crc_sidecar(paths[s].c_str(), crcs_read[s].data(), nbytes) > 0) { crc_errors++; }
+		}
 
-		int cnt = 0;
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+		write_param[device_id] = new std::thread(write_thread_crc, nvmeFd_param, p2p_param, nbytes, param_path, crcs_write[0]);
 
-		init[device_id] = true;
+		write_exp_avg[device_id] = new std::thread(write_thread_crc, nvmeFd_exp_avg, p2p_exp_avg, nbytes, exp_avg_path, crcs_write[1]);
+
+		write_exp_avg_sq[device_id] = new std::thread(write_thread_crc, nvmeFd_exp_avg_sq, p2p_exp_avg_sq, nbytes, exp_avg_sq_path, crcs_write[2]);
+		return;
 	}
+	
+	write_param[device_id] = new std::thread(write_thread, nvmeFd_param, p2p_param, nbytes, true);
 
-	threads.push_back(std::thread(thread_work_sgd,
-		param_path,
-		exp_avg_path,
-		grad_path,
-		_param_size ,
-		combined_unscale,
-		fp16_params_ptr,
-		device_id,
-		_alpha,
-	    _betta1,
-	    _weight_decay
-		));
+	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, nbytes, true);
+	
+	write_exp_avg_sq[device_id] = new std::thread(write_thread, nvmeFd_exp_avg_sq, p2p_exp_avg_sq, nbytes, true);
+	
 }
 
-
-void Adam_Optimizer::Step_fpga( 
-				std::string param_path,
-                std::string exp_avg_path,
-                std::string exp_avg_sq_path,
-                std::string grad_path,
-				size_t _param_size ,
-				float combined_unscale,
-				half* fp16_params_ptr,
-				int device_id,
-				int largest_numel
-				)
+void thread_work_ema(
+		std::string param_path,
+		std::string exp_avg_path,
+		std::string exp_avg_sq_path,
+		std::string ema_path,
+		std::string grad_path,
+		size_t _param_size ,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		int device_id,
+		float _alpha,
+	    float _betta1,
+	    float _betta2,
+	    float _eps,
+	    float _weight_decay,
+		float _bias_correction1,
+        float _bias_correction2,
+		float ema_decay
+	)
 {
-	//device_id = (MAX_DEVICE - 1) - device_id;
+	assert( int(_param_size) % (16) == 0);
 
-	int i;
-	if (!(init[device_id])){	
-			
-		cl::Platform::get(&platforms[device_id]);
-		cl::Platform platform;
-		const std::string vendor_name = "Xilinx";
-		for (i  = 0 ; i < platforms[device_id].size(); i++){
-			platform = platforms[device_id][i];
-			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
-			if (platformName == vendor_name){
-				break;
-			}
-		}
-		if (i == platforms[device_id].size()) {
-			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
-			exit(EXIT_FAILURE);
-		}
-		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
-		devices[device_id][0] = devices[device_id][device_id];
-		devices[device_id].resize(1);
-		cl_int err;
-		char device_bdf[20];
-        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
-		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
-		
-		//const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adam_fp16.xclbin";
-		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/slow_adam.xclbin";
-		//const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adam.xclbin";
-		
-		// Load xclbin 
-		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
-		bin_file.seekg(0, bin_file.end);
-		auto nb = bin_file.tellg();
-		file_bufs[device_id] = new char [nb];
-		bin_file.seekg(0, bin_file.beg);
-		bin_file.read(file_bufs[device_id], nb);
-		bin_file.close();
+	
+	auto context = contexts[device_id];
+	auto q = queues[device_id];
 
-		bins[device_id].push_back({file_bufs[device_id], nb});
-		
-		contexts[device_id] = cl::Context(devices[device_id]); 
-		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+	auto krnl_adam = krnls[device_id];	
 
-		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
-		
-		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
-		
-		cl_mem_ext_ptr_t outExt = {0};
-		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+	int ret;
 
-		size_t nbytes = largest_numel * sizeof(float);
+	size_t nbytes = _param_size * sizeof(float);
+	
+	float step_size = -1 * _alpha / _bias_correction1;
+	float w_decay = -1 * _alpha * _weight_decay;
 
-		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+	cl_int err;
+	
+	unsigned int cnt = 6;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(_param_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _bias_correction2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _eps));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, w_decay));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, ema_decay));
 
-		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		
-		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
-		
-		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
 
-		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+	size_t offset = 0;	
 
+	float* p2p_param = p2p_params[device_id];	
+	half* p2p_grad = p2p_grads[device_id];	
+	float* p2p_exp_avg = p2p_exp_avgs[device_id];	
+	float* p2p_exp_avg_sq = p2p_exp_avg_sqs[device_id];	
+	float* p2p_ema = p2p_emas[device_id];
 
-		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-											param_pool[device_id],						// buffer
-											CL_FALSE,						// blocking call
-											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-											0,							// buffer offset
-											nbytes,			// size in bytes
-										    nullptr,          // waiting events vector
-											nullptr,          // mapping event
-											&err);
+	int nvmeFd_param = -1;
+	int nvmeFd_exp_avg = -1;
+	int nvmeFd_exp_avg_sq = -1;
+	int nvmeFd_grad = -1;
+	int nvmeFd_ema = -1;
 	
 
-		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-									  exp_avg_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
-	
-		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
-									  exp_avg_sq_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
+	//std::cout<<"read starts..."<<std::endl;
+		
+	nvmeFd_grad = open(grad_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_grad, (void*)p2p_grad, nbytes/2, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
-									  grad_pool[device_id],						// buffer
-									  CL_FALSE,						// blocking call
-									  CL_MAP_READ,	//Indicates we will write
-									  0,							// buffer offset
-									  nbytes/2,			// size in bytes
-									  nullptr, 
-									  nullptr,
-									  &err);
+	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
+	nvmeFd_param = open(param_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_param, (void*)p2p_param, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		int cnt = 0;
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
-		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+	if (write_exp_avg[device_id] != nullptr) {  write_exp_avg[device_id]->join(); write_exp_avg[device_id] = nullptr; }
+	nvmeFd_exp_avg = open(exp_avg_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg, (void*)p2p_exp_avg, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-		init[device_id] = true;
-	}
+	if (write_exp_avg_sq[device_id] != nullptr) {  write_exp_avg_sq[device_id]->join(); write_exp_avg_sq[device_id] = nullptr ;}
+	nvmeFd_exp_avg_sq = open(exp_avg_sq_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg_sq, (void*)p2p_exp_avg_sq, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-	threads.push_back(std::thread(thread_work,
-		param_path,
-		exp_avg_path,
-		exp_avg_sq_path,
-		grad_path,
-		_param_size ,
-		combined_unscale,
-		fp16_params_ptr,
-		device_id,
-		_alpha,
-	    _betta1,
-	    _betta2,
-	    _eps,
-	    _weight_decay,
-		_bias_correction1,
-        _bias_correction2
-		));
-}
+	if (write_ema[device_id] != nullptr) {  write_ema[device_id]->join(); write_ema[device_id] = nullptr ;}
+	nvmeFd_ema = open(ema_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_ema, (void*)p2p_ema, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	
+    //Launch the Kernel
+	q.enqueueTask(krnl_adam, nullptr, nullptr);
+	q.enqueueReadBuffer ( param16_pool[device_id], CL_FALSE, 0, nbytes/2, fp16_params_ptr);
+	q.finish();
 
+	(void)close(nvmeFd_grad);
+	
+	write_param[device_id] = new std::thread(write_thread, nvmeFd_param, p2p_param, nbytes, true);
 
+	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, nbytes, true);
+	
+	write_exp_avg_sq[device_id] = new std::thread(write_thread, nvmeFd_exp_avg_sq, p2p_exp_avg_sq, nbytes, true);
 
-void Adam_Optimizer::Step_gpu(float* _params,
-                            float* grads,
-                            float* _exp_avg,
-                            float* _exp_avg_sq,
-                            size_t _param_size,
-                            ds_half_precision_t* dev_params,
-                            bool half_precision)
+	write_ema[device_id] = new std::thread(write_thread, nvmeFd_ema, p2p_ema, nbytes, true);
+	
+}
+
+// Adam on bf16 master weights (adam_bf16.cpp): the param file holds _param_size bf16 values,
+// and the updated weights are read back as the forward copy. bf16_params says whether
+// fp16_params_ptr points to a bf16 model copy, otherwise the weights are converted to fp16.
+void thread_work_bf16(
+		std::string param_path,
+		std::string exp_avg_path,
+		std::string exp_avg_sq_path,
+		std::string grad_path,
+		size_t _param_size ,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		bool bf16_params,
+		int device_id,
+		float _alpha,
+	    float _betta1,
+	    float _betta2,
+	    float _eps,
+	    float _weight_decay,
+		float _bias_correction1,
+        float _bias_correction2,
+		uint32_t seed
+	)
 {
-	float betta1_minus1 = 1 - _betta1;
-	float betta2_minus1 = 1 - _betta2;
+	assert( int(_param_size) % (16) == 0);
+
+	auto context = contexts[device_id];
+	auto q = queues[device_id];
+
+	auto krnl_adam = krnls[device_id];	
 
+	int ret;
+
+	size_t nbytes = _param_size * sizeof(float);
+	size_t pbytes = _param_size * sizeof(uint16_t);
+	
 	float step_size = -1 * _alpha / _bias_correction1;
 	float w_decay = -1 * _alpha * _weight_decay;
 
-	for (size_t offset = 0; offset < _param_size; offset += TILE) {
-			
-        size_t copy_size = TILE;
-        if ((offset + TILE) > _param_size) copy_size = _param_size - offset;
-		
-		adam_gpu(_params + offset, grads + offset,
-				_exp_avg + offset, _exp_avg_sq + offset, 
-				
-				copy_size,
+	cl_int err;
+	
+	unsigned int cnt = 4;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(_param_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _bias_correction2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _eps));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, w_decay));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, seed));
 
-				step_size, w_decay,
-				_betta1, _betta2,
-				_eps,
-				_bias_correction1, _bias_correction2);
+	float* p2p_param = p2p_params[device_id];	
+	half* p2p_grad = p2p_grads[device_id];	
+	float* p2p_exp_avg = p2p_exp_avgs[device_id];	
+	float* p2p_exp_avg_sq = p2p_exp_avg_sqs[device_id];	
+
+	int nvmeFd_param = -1;
+	int nvmeFd_exp_avg = -1;
+	int nvmeFd_exp_avg_sq = -1;
+	int nvmeFd_grad = -1;
+
+	nvmeFd_grad = open(grad_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_grad, (void*)p2p_grad, nbytes/2, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
+	nvmeFd_param = open(param_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_param, (void*)p2p_param, pbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+	if (write_exp_avg[device_id] != nullptr) {  write_exp_avg[device_id]->join(); write_exp_avg[device_id] = nullptr; }
+	nvmeFd_exp_avg = open(exp_avg_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg, (void*)p2p_exp_avg, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+	if (write_exp_avg_sq[device_id] != nullptr) {  write_exp_avg_sq[device_id]->join(); write_exp_avg_sq[device_id] = nullptr ;}
+	nvmeFd_exp_avg_sq = open(exp_avg_sq_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg_sq, (void*)p2p_exp_avg_sq, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+	std::vector<uint16_t> master;
+	if (!bf16_params) { master.resize(_param_size); }
+	
+    //Launch the Kernel
+	q.enqueueTask(krnl_adam, nullptr, nullptr);
+	q.enqueueReadBuffer ( param_pool[device_id], CL_FALSE, 0, pbytes, bf16_params ? (void*)fp16_params_ptr : (void*)master.data());
+	q.finish();
+
+	(void)close(nvmeFd_grad);
+	
+	write_param[device_id] = new std::thread(write_thread, nvmeFd_param, p2p_param, pbytes, true);
+
+	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, nbytes, true);
+	
+	write_exp_avg_sq[device_id] = new std::thread(write_thread, nvmeFd_exp_avg_sq, p2p_exp_avg_sq, nbytes, true);
+
+	if (!bf16_params) {
+		uint16_t* fp16_params = (uint16_t*)fp16_params_ptr;
+#pragma omp parallel for
+		for (size_t k = 0; k < _param_size; k++) { fp16_params[k] = ds_float_to_half(bf16_to_float(master[k])); }
 	}
 }
 
-void Adam_Optimizer::Step_SGD_cpu(float* _params,
-                            float* grads,
-                            float* _exp_avg,
-                            float* _exp_avg_sq,
-                            size_t _param_size,
-                            ds_half_precision_t* dev_params,
-                            bool half_precision)
+void thread_work_8bit(
+		std::string param_path,
+		std::string exp_avg_path,
+		std::string exp_avg_sq_path,
+		std::string grad_path,
+		size_t _param_size ,
+		float combined_unscale,
+		half* fp16_params_ptr,
+		int device_id,
+		float _alpha,
+	    float _betta1,
+	    float _betta2,
+	    float _eps,
+	    float _weight_decay,
+		float _bias_correction1,
+        float _bias_correction2
+	)
 {
-	//std::cout << "is half?" << half_precision << std::endl;
+	assert( int(_param_size) % (16) == 0);
+	
+	auto context = contexts[device_id];
+	auto q = queues[device_id];
 
-    size_t rounded_size = 0;
-    if (_param_size > rounded_size) {
-        float betta1_minus1 = 1 - _betta1;
-        float step_size = -1 * _alpha;
-        float w_decay = _weight_decay;
+	auto krnl_adam = krnls[device_id];	
 
-        for (size_t t = rounded_size; t < _param_size; t += TILE) {
-            size_t copy_size = TILE;
-            if ((t + TILE) > _param_size) copy_size = _param_size - t;
-            size_t offset = copy_size + t;
-#pragma omp parallel for
-            for (size_t k = t; k < offset; k++) {
-                float grad = grads[k];
-                float param = _params[k];
-                float momentum = _exp_avg[k];
-                //float variance = _exp_avg_sq[k];
-				
-                grad = param * w_decay + grad;
-                momentum = momentum * _betta1;
-                momentum = grad * betta1_minus1 + momentum;
+	int ret;
 
-                param = momentum * step_size + param;
-                _params[k] = param;
-                _exp_avg[k] = momentum;
-            }
-        }
+	size_t nbytes = _param_size * sizeof(float);
+	
+	float step_size = -1 * _alpha / _bias_correction1;
+	float w_decay = -1 * _alpha * _weight_decay;
 
-    }
-}
+	// moments move as QBLOCK-wise 8-bit codes plus scales, see cpu_adam.h
+	size_t qbytes = quantized_state_bytes(_param_size);
+
+	cl_int err;
+	
+	unsigned int cnt = 7;
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, uint32_t(_param_size)));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta1));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _betta2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _bias_correction2));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, _eps));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, w_decay));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, step_size));
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, combined_unscale));
 
 
-void Adam_Optimizer::Step_cpu(float* _params,
-                            float* grads,
-                            float* _exp_avg,
-                            float* _exp_avg_sq,
-                            size_t _param_size,
-                            ds_half_precision_t* dev_params,
-                            bool half_precision)
-{
-    size_t rounded_size = 0;
-    if (_param_size > rounded_size) {
-        float betta1_minus1 = 1 - _betta1;
-        float betta2_minus1 = 1 - _betta2;
+	size_t offset = 0;	
 
-        float step_size = -1 * _alpha / _bias_correction1;
-        float w_decay = -1 * _alpha * _weight_decay;
-        ds_half_precision_t* grads_cast_h;
-        ds_half_precision_t* params_cast_h;
-        if (half_precision) {
-            grads_cast_h = reinterpret_cast<ds_half_precision_t*>(grads);
-            params_cast_h = reinterpret_cast<ds_half_precision_t*>(_params);
-        }
+	float* p2p_param = p2p_params[device_id];	
+	half* p2p_grad = p2p_grads[device_id];	
+	float* p2p_exp_avg = p2p_exp_avgs[device_id];	
+	float* p2p_exp_avg_sq = p2p_exp_avg_sqs[device_id];	
 
-        for (size_t t = rounded_size; t < _param_size; t += TILE) {
-            size_t copy_size = TILE;
-            if ((t + TILE) > _param_size) copy_size = _param_size - t;
-            size_t offset = copy_size + t;
-#if defined(__ENABLE_CUDA__)
-            if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
-#endif // ENABLE_CUDA
+	int nvmeFd_param = -1;
+	int nvmeFd_exp_avg = -1;
+	int nvmeFd_exp_avg_sq = -1;
+	int nvmeFd_grad = -1;
+	
 
-#pragma omp parallel for
-            for (size_t k = t; k < offset; k++) {
-                float grad = half_precision ? (float)grads_cast_h[k] : grads[k];
-                float param = half_precision ? (float)params_cast_h[k] : _params[k];
-                float momentum = _exp_avg[k];
-                float variance = _exp_avg_sq[k];
-                if (_weight_decay > 0 && !_adamw_mode) { grad = param * _weight_decay + grad; }
-                momentum = momentum * _betta1;
-                momentum = grad * betta1_minus1 + momentum;
+	//std::cout<<"read starts..."<<std::endl;
+		
+	nvmeFd_grad = open(grad_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_grad, (void*)p2p_grad, nbytes/2, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-                variance = variance * _betta2;
-                grad = grad * grad;
-                variance = grad * betta2_minus1 + variance;
+	if (write_param[device_id] != nullptr) {  write_param[device_id]->join(); write_param[device_id] = nullptr; }
+	nvmeFd_param = open(param_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_param, (void*)p2p_param, nbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-                grad = sqrt(variance);
-                grad = grad * _bias_correction2 + _eps;
-                grad = momentum / grad;
-                if (_weight_decay > 0 && _adamw_mode) { param += w_decay * param; }
-                param = grad * step_size + param;
-#if defined(__ENABLE_CUDA__)
-                if (dev_params) _doubled_buffer[_buf_index][k - t] = param;
-#endif // ENABLE_CUDA
-                if (half_precision)
-                    params_cast_h[k] = (ds_half_precision_t)param;
-                else
-                    _params[k] = param;
-                _exp_avg[k] = momentum;
-                _exp_avg_sq[k] = variance;
-            }
+	if (write_exp_avg[device_id] != nullptr) {  write_exp_avg[device_id]->join(); write_exp_avg[device_id] = nullptr; }
+	nvmeFd_exp_avg = open(exp_avg_path.c_str(), O_RDWR | O_SYNC  | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg, (void*)p2p_exp_avg, qbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
 
-#if defined(__ENABLE_CUDA__)
-            if (dev_params) {
-                launch_param_update(
-                    _doubled_buffer[_buf_index], dev_params + t, (copy_size), _streams[_buf_index]);
+	if (write_exp_avg_sq[device_id] != nullptr) {  write_exp_avg_sq[device_id]->join(); write_exp_avg_sq[device_id] = nullptr ;}
+	nvmeFd_exp_avg_sq = open(exp_avg_sq_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_exp_avg_sq, (void*)p2p_exp_avg_sq, qbytes, 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	
+    //Launch the Kernel
+	q.enqueueTask(krnl_adam, nullptr, nullptr);
+	q.enqueueReadBuffer ( param16_pool[device_id], CL_FALSE, 0, nbytes/2, fp16_params_ptr);
+	q.finish();
 
-                _buf_index = !_buf_index;
-            }
-#endif // ENABLE_CUDA
-        }
+	(void)close(nvmeFd_grad);
+	
+	write_param[device_id] = new std::thread(write_thread, nvmeFd_param, p2p_param, nbytes, true);
 
-    }
+	write_exp_avg[device_id] = new std::thread(write_thread, nvmeFd_exp_avg, p2p_exp_avg, qbytes, true);
+	
+	write_exp_avg_sq[device_id] = new std::thread(write_thread, nvmeFd_exp_avg_sq, p2p_exp_avg_sq, qbytes, true);
+	
 }
 
-void Adam_Optimizer::Step_1(float* _params,
-                            float* grads,
-                            float* _exp_avg,
-                            float* _exp_avg_sq,
-                            size_t _param_size,
-                            ds_half_precision_t* dev_params,
-                            bool half_precision)
+// krnl_norm is only present when the optimizer xclbin was linked with NORM=1
+static bool norm_krnl_ready(int device_id)
 {
-    size_t rounded_size = 0;
-#if defined(__AVX512__) or defined(__AVX256__)
-    Step_AVX<1>(&rounded_size,
-                _params,
-                grads,
-                _exp_avg,
-                _exp_avg_sq,
-                _param_size,
-                dev_params,
-                half_precision);
-#endif
-    if (_param_size > rounded_size) {
-        float betta1_minus1 = 1 - _betta1;
-        float betta2_minus1 = 1 - _betta2;
+	if (!init[device_id] || p2p_grads[device_id] == nullptr) return false;
+	// grad_pool only holds the slice of CU 0
+	if (n_cus[device_id] > 1) return false;
 
-        float step_size = -1 * _alpha / _bias_correction1;
-        float w_decay = -1 * _alpha * _weight_decay;
-        ds_half_precision_t* grads_cast_h;
-        ds_half_precision_t* params_cast_h;
-        if (half_precision) {
-            grads_cast_h = reinterpret_cast<ds_half_precision_t*>(grads);
-            params_cast_h = reinterpret_cast<ds_half_precision_t*>(_params);
-        }
+	if (!norm_init[device_id]) {
+		cl_int err;
+		norm_krnls[device_id] = cl::Kernel(programs[device_id], "krnl_norm", &err);
+		has_norm_krnl[device_id] = (err == CL_SUCCESS);
+		if (has_norm_krnl[device_id]) {
+			OCL_CHECK(err, grad_norm_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_WRITE_ONLY, 2 * sizeof(float), nullptr, &err));
+			OCL_CHECK(err, err = norm_krnls[device_id].setArg(0, grad_pool[device_id]));
+			OCL_CHECK(err, err = norm_krnls[device_id].setArg(1, grad_norm_pool[device_id]));
+		} else {
+			std::cout << "Device id: " << device_id << " has no krnl_norm, gradient norm runs on the host" << std::endl;
+		}
+		norm_init[device_id] = true;
+	}
+	return has_norm_krnl[device_id];
+}
 
-        for (size_t t = rounded_size; t < _param_size; t += TILE) {
-            size_t copy_size = TILE;
-            if ((t + TILE) > _param_size) copy_size = _param_size - t;
-            size_t offset = copy_size + t;
-#if defined(__ENABLE_CUDA__)
-            if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
-#endif
-#pragma omp parallel for
-            for (size_t k = t; k < offset; k++) {
-                float grad = half_precision ? (float)grads_cast_h[k] : grads[k];
-                float param = half_precision ? (float)params_cast_h[k] : _params[k];
-                float momentum = _exp_avg[k];
-                float variance = _exp_avg_sq[k];
-                if (_weight_decay > 0 && !_adamw_mode) { grad = param * _weight_decay + grad; }
-                momentum = momentum * _betta1;
-                momentum = grad * betta1_minus1 + momentum;
+// Software twin of krnl_norm
+static void grad_norm_cpu(std::string grad_path, size_t _param_size, size_t aligned_size, float* result)
+{
+	std::vector<half, aligned_allocator<half>> grad(aligned_size);
 
-                variance = variance * _betta2;
+	int nvmeFd_grad = open(grad_path.c_str(), O_RDONLY | O_DIRECT);
+	int ret = pread(nvmeFd_grad, (void*)&grad[0], aligned_size * sizeof(half), 0);
+	if (ret == -1) { std::cout << "read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+	(void)close(nvmeFd_grad);
+
+	float sumsq = 0.0f;
+	int overflow = 0;
+#pragma omp parallel for reduction(+ : sumsq) reduction(| : overflow)
+	for (size_t k = 0; k < _param_size; k++) {
+		float g = ds_half_to_float(grad[k]);
+		if (!(fabsf(g) <= HALF_MAX)) overflow = 1;
+		sumsq += g * g;
+	}
+	result[RESULT_SUMSQ] = sumsq;
+	result[RESULT_OVERFLOW] = overflow;
+}
+
+void thread_work_grad_norm(
+		std::string grad_path,
+		size_t _param_size,
+		size_t aligned_size,
+		int device_id,
+		float* result
+	)
+{
+	if (!norm_krnl_ready(device_id)) {
+		grad_norm_cpu(grad_path, _param_size, aligned_size, result);
+		return;
+	}
+
+	auto q = queues[device_id];
+	auto krnl_norm = norm_krnls[device_id];
+
+	cl_int err;
+	OCL_CHECK(err, err = krnl_norm.setArg(2, uint32_t(_param_size)));
+
+	int ret;
+	int nvmeFd_grad = open(grad_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	ret = pread(nvmeFd_grad, (void*)p2p_grads[device_id], aligned_size * sizeof(half), 0);
+	if (ret == -1) { std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl; }
+
+    //Launch the Kernel
+	q.enqueueTask(krnl_norm, nullptr, nullptr);
+	q.enqueueReadBuffer ( grad_norm_pool[device_id], CL_FALSE, 0, 2 * sizeof(float), result);
+	q.finish();
+
+	(void)close(nvmeFd_grad);
+}
+
+void Adam_Optimizer::Step_fpga_comp( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float compression_ratio,
+				int* grad_idx_ptr,
+				int topk_block,
+				int val_bits
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+	int i;
+	
+	if (!(init[device_id])){	
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/topk_adam_fp16.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+		std::cout << "Bin file read success " << std::endl;
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+		size_t remainder = int( largest_numel * compression_ratio ) % 1024
+		size_t comp_nbytes = ( (int( largest_numel * compression_ratio ) + 1024) -remainder ) * sizeof(float);
+		if (topk_block > 0) comp_nbytes = std::max(comp_nbytes, local_comp_nbytes(topk_block_total(largest_numel, topk_block, compression_ratio)));
+
+		OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes, &outExt, &err));
+
+		OCL_CHECK(err, grad_val_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes/2, &outExt, &err));
+		
+		OCL_CHECK(err, grad_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+
+		OCL_CHECK(err, param16_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		std::cout << "Buffer initilized success " << std::endl;
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_sq_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+		
+		p2p_grads_idx[device_id] = (int*)queues[device_id].enqueueMapBuffer(
+									  grad_idx_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
+									  0,							// buffer offset
+									  comp_nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_grads_val[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_val_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
+									  0,							// buffer offset
+									  comp_nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+		
+
+		int cnt = 0;
+
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_idx_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));
+		cnt++;	// Param size
+		cnt++;	// topk_block
+		cnt++;	// topk_block_k
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));	// grad_val_q
+		cnt++;	// val_bits
+
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+
+		std::cout << "OpenCL initialize finished" << std::endl;
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_comp,
+		param_path,
+		exp_avg_path,
+		exp_avg_sq_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _eps,
+	    _weight_decay,
+		_bias_correction1,
+        _bias_correction2,
+		compression_ratio,
+		grad_idx_ptr,
+		topk_block,
+		val_bits
+		));
+}
+
+void Adam_Optimizer::Step_fpga_sgd_comp( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float compression_ratio,
+				int* grad_idx_ptr,
+				int topk_block,
+				int val_bits
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+	int i;
+	
+	if (!(init[device_id])){	
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/topk_sgd.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+		std::cout << "Bin file read success " << std::endl;
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+		size_t comp_nbytes = ( (int( largest_numel * compression_ratio ) - 1) / 1024  + 1) * 1024 * sizeof(float);
+		if (topk_block > 0) comp_nbytes = std::max(comp_nbytes, local_comp_nbytes(topk_block_total(largest_numel, topk_block, compression_ratio)));
+		//size_t comp_nbytes = ( ( - 1) / 1024  + 1) * 1024 * sizeof(float);
+
+		//OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, comp_nbytes ));
+		OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes, &outExt, &err));
+
+		OCL_CHECK(err, grad_val_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes/2, &outExt, &err));
+		
+		OCL_CHECK(err, grad_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+
+		OCL_CHECK(err, param16_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		std::cout << "Buffer initilized success " << std::endl;
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+		p2p_grads_idx[device_id] = (int*)queues[device_id].enqueueMapBuffer(
+									  grad_idx_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
+									  0,							// buffer offset
+									  comp_nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_grads_val[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_val_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
+									  0,							// buffer offset
+									  comp_nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+		
+
+		int cnt = 0;
+
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_idx_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));
+		cnt++;	// Param size
+		cnt++;	// topk_block
+		cnt++;	// topk_block_k
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));	// grad_val_q
+		cnt++;	// val_bits
+
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+
+		std::cout << "OpenCL initialize finished" << std::endl;
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_sgd_comp,
+		param_path,
+		exp_avg_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _weight_decay,
+		compression_ratio,
+		grad_idx_ptr,
+		topk_block,
+		val_bits
+		));
+}
+
+
+
+void Adam_Optimizer::Step_fpga_lion_comp( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float compression_ratio,
+				int* grad_idx_ptr,
+				int topk_block,
+				int val_bits
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+	int i;
+	
+	if (!(init[device_id])){	
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/topk_lion.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+		std::cout << "Bin file read success " << std::endl;
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+		size_t comp_nbytes = ( (int( largest_numel * compression_ratio ) - 1) / 1024  + 1) * 1024 * sizeof(float);
+		if (topk_block > 0) comp_nbytes = std::max(comp_nbytes, local_comp_nbytes(topk_block_total(largest_numel, topk_block, compression_ratio)));
+		//size_t comp_nbytes = ( ( - 1) / 1024  + 1) * 1024 * sizeof(float);
+
+		//OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, comp_nbytes ));
+		OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes, &outExt, &err));
+
+		OCL_CHECK(err, grad_val_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes/2, &outExt, &err));
+		
+		OCL_CHECK(err, grad_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+
+		OCL_CHECK(err, param16_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		std::cout << "Buffer initilized success " << std::endl;
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+		p2p_grads_idx[device_id] = (int*)queues[device_id].enqueueMapBuffer(
+									  grad_idx_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
+									  0,							// buffer offset
+									  comp_nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_grads_val[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_val_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
+									  0,							// buffer offset
+									  comp_nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+		
+
+		int cnt = 0;
+
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_idx_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));
+		cnt++;	// Param size
+		cnt++;	// topk_block
+		cnt++;	// topk_block_k
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));	// grad_val_q
+		cnt++;	// val_bits
+
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+
+		std::cout << "OpenCL initialize finished" << std::endl;
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_lion_comp,
+		param_path,
+		exp_avg_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _weight_decay,
+		compression_ratio,
+		grad_idx_ptr,
+		topk_block,
+		val_bits
+		));
+}
+
+
+
+void Adam_Optimizer::Step_fpga_adagrad_comp( 
+				std::string param_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float compression_ratio,
+				int topk_block,
+				int val_bits
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+	int i;
+	
+	if (!(init[device_id])){	
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/topk_adagrad.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+		std::cout << "Bin file read success " << std::endl;
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+		size_t comp_nbytes = ( (int( largest_numel * compression_ratio ) - 1) / 1024  + 1) * 1024 * sizeof(float);
+		if (topk_block > 0) comp_nbytes = std::max(comp_nbytes, local_comp_nbytes(topk_block_total(largest_numel, topk_block, compression_ratio)));
+
+		//OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, comp_nbytes ));
+		OCL_CHECK(err, grad_idx_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes, &outExt, &err));
+
+		OCL_CHECK(err, grad_val_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, comp_nbytes/2, &outExt, &err));
+		
+		OCL_CHECK(err, grad_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+
+		OCL_CHECK(err, param16_pool[device_id] =  cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		std::cout << "Buffer initilized success " << std::endl;
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_sq_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+		
+		p2p_grads_idx[device_id] = (int*)queues[device_id].enqueueMapBuffer(
+									  grad_idx_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
+									  0,							// buffer offset
+									  comp_nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_grads_val[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_val_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ | CL_MAP_WRITE,	//Indicates we will write
+									  0,							// buffer offset
+									  comp_nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+		
+
+		int cnt = 0;
+
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_idx_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));
+		cnt++;	// Param size
+		cnt++;	// topk_block
+		cnt++;	// topk_block_k
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_val_pool[device_id]));	// grad_val_q
+		cnt++;	// val_bits
+
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+
+		std::cout << "OpenCL initialize finished" << std::endl;
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_adagrad_comp,
+		param_path,
+		exp_avg_sq_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _eps,
+	    _weight_decay,
+		compression_ratio,
+		topk_block,
+		val_bits
+		));
+}
+
+void Adam_Optimizer::Step_fpga_adagrad( 
+				std::string param_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+	int i;
+	if (!(init[device_id])){	
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adagrad.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+
+		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_sq_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		int cnt = 0;
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_adagrad,
+		param_path,
+		exp_avg_sq_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _eps,
+	    _weight_decay
+		));
+}
+
+void Adam_Optimizer::Step_fpga_sgd( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+
+	int i;
+	if (!(init[device_id])){	
+			
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/sgd.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+
+		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+
+		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		int cnt = 0;
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_sgd,
+		param_path,
+		exp_avg_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _weight_decay
+		));
+}
+
+
+void Adam_Optimizer::Step_fpga_lion( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+
+	int i;
+	if (!(init[device_id])){	
+			
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/lion.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+
+		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+
+		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		int cnt = 0;
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_lion,
+		param_path,
+		exp_avg_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _weight_decay
+		));
+}
+
+
+void Adam_Optimizer::Step_fpga_adafactor( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float* factors_ptr,
+				size_t n_factors,
+				int* segments_ptr,
+				int n_segments
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+
+	int i;
+	if (!(init[device_id])){	
+			
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adafactor.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+
+		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+
+		OCL_CHECK(err, factor_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes, nullptr, &err));
+		OCL_CHECK(err, segment_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_ONLY, MAX_SEGMENTS * SEG_FIELDS * sizeof(int), nullptr, &err));
+
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+
+		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		int cnt = 0;
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, factor_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, segment_pool[device_id]));
+
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_adafactor,
+		param_path,
+		exp_avg_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _eps,
+	    _weight_decay,
+		factors_ptr,
+		n_factors,
+		segments_ptr,
+		n_segments
+		));
+}
+
+
+void Adam_Optimizer::Step_fpga_lamb( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float max_coeff,
+				float min_coeff,
+				int* segments_ptr,
+				int n_segments,
+				int phase,
+				float* norms_ptr
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+
+	int i;
+	if (!(init[device_id])){	
+			
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/lamb.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+
+		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+
+		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		OCL_CHECK(err, norm_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, 2 * MAX_SEGMENTS * sizeof(float), nullptr, &err));
+		OCL_CHECK(err, segment_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_ONLY, MAX_SEGMENTS * SEG_FIELDS * sizeof(int), nullptr, &err));
+
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_sq_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+
+		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		int cnt = 0;
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, norm_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, segment_pool[device_id]));
+
+		init[device_id] = true;
+	}
+
+	// Phase 2 may run after the caller dropped its norms
+	if (phase != PHASE_NORM) {
+		lamb_norms[device_id].resize(2 * n_segments);
+		if (phase == PHASE_UPDATE) std::copy(norms_ptr, norms_ptr + 2 * n_segments, lamb_norms[device_id].begin());
+		norms_ptr = lamb_norms[device_id].data();
+	}
+
+	threads.push_back(std::thread(thread_work_lamb,
+		param_path,
+		exp_avg_path,
+		exp_avg_sq_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _eps,
+	    _weight_decay,
+		_bias_correction1,
+		_bias_correction2,
+		max_coeff,
+		min_coeff,
+		segments_ptr,
+		n_segments,
+		phase,
+		norms_ptr
+		));
+}
+
+
+void Adam_Optimizer::Step_fpga( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+
+	int i;
+	if (!(init[device_id])){	
+			
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		//const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adam_fp16.xclbin";
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/slow_adam.xclbin";
+		//const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adam.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		init_adam_cus(device_id, largest_numel);
+
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work,
+		param_path,
+		exp_avg_path,
+		exp_avg_sq_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _eps,
+	    _weight_decay,
+		_bias_correction1,
+        _bias_correction2
+		));
+}
+
+
+
+void Adam_Optimizer::Step_fpga_8bit( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+
+	int i;
+	if (!(init[device_id])){	
+			
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adam_8bit.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+
+		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_sq_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		int cnt = 0;
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		// code and scale pointers of a moment share one buffer
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_8bit,
+		param_path,
+		exp_avg_path,
+		exp_avg_sq_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _eps,
+	    _weight_decay,
+		_bias_correction1,
+        _bias_correction2
+		));
+}
+
+
+
+void Adam_Optimizer::Step_fpga_ema( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string ema_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float ema_decay
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+
+	int i;
+	if (!(init[device_id])){	
+			
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adam_ema.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+
+		OCL_CHECK(err, param16_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE, nbytes/2, nullptr, &err));
+
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		OCL_CHECK(err, ema_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_sq_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_emas[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  ema_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		int cnt = 0;
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param16_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, ema_pool[device_id]));
+
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_ema,
+		param_path,
+		exp_avg_path,
+		exp_avg_sq_path,
+		ema_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _eps,
+	    _weight_decay,
+		_bias_correction1,
+        _bias_correction2,
+		ema_decay
+		));
+}
+
+
+
+void Adam_Optimizer::Step_fpga_bf16( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size ,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				bool bf16_params,
+				int device_id,
+				int largest_numel,
+				uint32_t seed
+				)
+{
+	//device_id = (MAX_DEVICE - 1) - device_id;
+
+	int i;
+	if (!(init[device_id])){	
+			
+		cl::Platform::get(&platforms[device_id]);
+		cl::Platform platform;
+		const std::string vendor_name = "Xilinx";
+		for (i  = 0 ; i < platforms[device_id].size(); i++){
+			platform = platforms[device_id][i];
+			std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(nullptr);
+			if (platformName == vendor_name){
+				break;
+			}
+		}
+		if (i == platforms[device_id].size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices[device_id]);
+		devices[device_id][0] = devices[device_id][device_id];
+		devices[device_id].resize(1);
+		cl_int err;
+		char device_bdf[20];
+        OCL_CHECK(err, err = devices[device_id][0].getInfo(CL_DEVICE_PCIE_BDF, &device_bdf));
+		std:: cout << "Device id: " << device_id <<"=>"<< device_bdf << std::endl;
+		
+		const char* xclbin_file_name = "/mnt/home/hsjang0918/bins/adam_bf16.xclbin";
+		
+		// Load xclbin 
+		std::ifstream bin_file(xclbin_file_name, std::ifstream::binary);
+		bin_file.seekg(0, bin_file.end);
+		auto nb = bin_file.tellg();
+		file_bufs[device_id] = new char [nb];
+		bin_file.seekg(0, bin_file.beg);
+		bin_file.read(file_bufs[device_id], nb);
+		bin_file.close();
+
+		bins[device_id].push_back({file_bufs[device_id], nb});
+		
+		contexts[device_id] = cl::Context(devices[device_id]); 
+		queues[device_id] = cl::CommandQueue(contexts[device_id], devices[device_id][0], 0, NULL);
+
+		programs[device_id] = cl::Program(contexts[device_id], devices[device_id], bins[device_id]);
+		
+		krnls[device_id] = cl::Kernel(programs[device_id], "krnl_vadd");
+		
+		cl_mem_ext_ptr_t outExt = {0};
+		outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+		size_t nbytes = largest_numel * sizeof(float);
+
+		// bf16 weights, no separate param16 copy
+		OCL_CHECK(err, param_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes/2, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+		
+		OCL_CHECK(err, exp_avg_sq_pool[device_id] = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, &err));
+
+		OCL_CHECK(err, grad_pool[device_id]  = cl::Buffer(contexts[device_id], CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes / 2, &outExt, &err));
+
+
+		p2p_params[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+											param_pool[device_id],						// buffer
+											CL_FALSE,						// blocking call
+											CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+											0,							// buffer offset
+											nbytes/2,			// size in bytes
+										    nullptr,          // waiting events vector
+											nullptr,          // mapping event
+											&err);
+	
+
+		p2p_exp_avgs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+	
+		p2p_exp_avg_sqs[device_id] = (float*)queues[device_id].enqueueMapBuffer(
+									  exp_avg_sq_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		p2p_grads[device_id] = (half*)queues[device_id].enqueueMapBuffer(
+									  grad_pool[device_id],						// buffer
+									  CL_FALSE,						// blocking call
+									  CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes/2,			// size in bytes
+									  nullptr, 
+									  nullptr,
+									  &err);
+
+		int cnt = 0;
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, grad_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, param_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_pool[device_id]));
+		OCL_CHECK(err, err = krnls[device_id].setArg(cnt++, exp_avg_sq_pool[device_id]));
+
+		init[device_id] = true;
+	}
+
+	threads.push_back(std::thread(thread_work_bf16,
+		param_path,
+		exp_avg_path,
+		exp_avg_sq_path,
+		grad_path,
+		_param_size ,
+		combined_unscale,
+		fp16_params_ptr,
+		bf16_params,
+		device_id,
+		_alpha,
+	    _betta1,
+	    _betta2,
+	    _eps,
+	    _weight_decay,
+		_bias_correction1,
+        _bias_correction2,
+		seed
+		));
+}
+
+void Adam_Optimizer::Step_gpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            ds_half_precision_t* dev_params,
+                            bool half_precision)
+{
+	float betta1_minus1 = 1 - _betta1;
+	float betta2_minus1 = 1 - _betta2;
+
+	float step_size = -1 * _alpha / _bias_correction1;
+	float w_decay = -1 * _alpha * _weight_decay;
+
+	for (size_t offset = 0; offset < _param_size; offset += TILE) {
+			
+        size_t copy_size = TILE;
+        if ((offset + TILE) > _param_size) copy_size = _param_size - offset;
+		
+		adam_gpu(_params + offset, grads + offset,
+				_exp_avg + offset, _exp_avg_sq + offset, 
+				
+				copy_size,
+
+				step_size, w_decay,
+				_betta1, _betta2,
+				_eps,
+				_bias_correction1, _bias_correction2);
+	}
+}
+
+void Adam_Optimizer::Step_SGD_cpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            ds_half_precision_t* dev_params,
+                            bool half_precision)
+{
+    size_t rounded_size = 0;
+    Step_SIMD_SGD<8>(
+        &rounded_size, _params, grads, _exp_avg, _param_size, dev_params, half_precision);
+    if (_param_size > rounded_size) {
+        float dampening_minus1 = 1 - _sgd_dampening;
+        float step_size = -1 * _alpha;
+        uint16_t* grads_cast_h;
+        uint16_t* params_cast_h;
+        if (half_precision) {
+            grads_cast_h = reinterpret_cast<uint16_t*>(grads);
+            params_cast_h = reinterpret_cast<uint16_t*>(_params);
+        }
+
+        for (size_t t = rounded_size; t < _param_size; t += TILE) {
+            size_t copy_size = TILE;
+            if ((t + TILE) > _param_size) copy_size = _param_size - t;
+            size_t offset = copy_size + t;
+#if defined(__ENABLE_CUDA__)
+            if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
+#endif
+            CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+                for (size_t k = lo; k < hi; k++) {
+                    float grad = half_precision ? ds_half_to_float(grads_cast_h[k]) : grads[k];
+                    float param = half_precision ? ds_half_to_float(params_cast_h[k]) : _params[k];
+                    float momentum = _exp_avg[k];
+
+                    if (_weight_decay > 0) { grad = param * _weight_decay + grad; }
+                    momentum = momentum * _betta1;
+                    momentum = grad * dampening_minus1 + momentum;
+                    if (_sgd_nesterov) {
+                        grad = momentum * _betta1 + grad;
+                        param = grad * step_size + param;
+                    } else {
+                        param = momentum * step_size + param;
+                    }
+#if defined(__ENABLE_CUDA__)
+                    if (dev_params) _doubled_buffer[_buf_index][k - t] = param;
+#endif
+                    if (half_precision)
+                        params_cast_h[k] = ds_float_to_half(param);
+                    else
+                        _params[k] = param;
+                    _exp_avg[k] = momentum;
+                }
+            });
+#if defined(__ENABLE_CUDA__)
+            if (dev_params) {
+                launch_param_update(
+                    _doubled_buffer[_buf_index], dev_params + t, (copy_size), _streams[_buf_index]);
+
+                _buf_index = !_buf_index;
+            }
+#endif
+        }
+    }
+}
+
+void Adam_Optimizer::Step_SGD_bf16_cpu(uint16_t* _params,
+                                       float* grads,
+                                       float* _exp_avg,
+                                       size_t _param_size,
+                                       uint32_t seed)
+{
+    size_t rounded_size = 0;
+    Step_SIMD_SGD_bf16<8>(&rounded_size, _params, grads, _exp_avg, _param_size, seed);
+    if (_param_size > rounded_size) {
+        float dampening_minus1 = 1 - _sgd_dampening;
+        float step_size = -1 * _alpha;
+
+        CPU_Thread_Pool::Instance().parallel_for(rounded_size, _param_size, [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; k++) {
+                float grad = grads[k];
+                float param = bf16_to_float(_params[k]);
+                float momentum = _exp_avg[k];
+
+                if (_weight_decay > 0) { grad = param * _weight_decay + grad; }
+                momentum = momentum * _betta1;
+                momentum = grad * dampening_minus1 + momentum;
+                if (_sgd_nesterov) {
+                    grad = momentum * _betta1 + grad;
+                    param = grad * step_size + param;
+                } else {
+                    param = momentum * step_size + param;
+                }
+
+                _params[k] = float_to_bf16_sr(param, seed, (uint32_t)k);
+                _exp_avg[k] = momentum;
+            }
+        });
+    }
+}
+
+void Adam_Optimizer::Step_Lion_cpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            ds_half_precision_t* dev_params,
+                            bool half_precision)
+{
+    float betta1_minus1 = 1 - _betta1;
+    float betta2_minus1 = 1 - _betta2;
+    float step_size = -1 * _alpha;
+    float w_decay = -1 * _alpha * _weight_decay;
+    // fp16 params and grads hold _param_size halves, the momentum stays fp32
+    uint16_t* grads_cast_h = reinterpret_cast<uint16_t*>(grads);
+    uint16_t* params_cast_h = reinterpret_cast<uint16_t*>(_params);
+
+    for (size_t t = 0; t < _param_size; t += TILE) {
+        size_t copy_size = TILE;
+        if ((t + TILE) > _param_size) copy_size = _param_size - t;
+        size_t offset = copy_size + t;
+        CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; k++) {
+                float grad = half_precision ? ds_half_to_float(grads_cast_h[k]) : grads[k];
+                float param = half_precision ? ds_half_to_float(params_cast_h[k]) : _params[k];
+                float momentum = _exp_avg[k];
+
+                float update = grad * betta1_minus1 + momentum * _betta1;
+                momentum = grad * betta2_minus1 + momentum * _betta2;
+
+                float sign = (update > 0) ? 1.0f : ((update < 0) ? -1.0f : 0.0f);
+                param = param * (1 + w_decay) + sign * step_size;
+                if (half_precision)
+                    params_cast_h[k] = ds_float_to_half(param);
+                else
+                    _params[k] = param;
+                _exp_avg[k] = momentum;
+            }
+        });
+    }
+}
+
+// Same arithmetic as the adam_ema kernel: the moving average follows the updated parameter
+// in the same pass.
+void Adam_Optimizer::Step_AdamEma_cpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            float* _ema,
+                            float ema_decay,
+                            size_t _param_size)
+{
+    float betta1_minus1 = 1 - _betta1;
+    float betta2_minus1 = 1 - _betta2;
+    float ema_decay_minus1 = 1 - ema_decay;
+
+    float step_size = -1 * _alpha / _bias_correction1;
+    float w_decay = -1 * _alpha * _weight_decay;
+
+    for (size_t t = 0; t < _param_size; t += TILE) {
+        size_t copy_size = TILE;
+        if ((t + TILE) > _param_size) copy_size = _param_size - t;
+        size_t offset = copy_size + t;
+        CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; k++) {
+                float grad = grads[k];
+                float param = _params[k];
+                float momentum = _exp_avg[k];
+                float variance = _exp_avg_sq[k];
+                if (_weight_decay > 0 && !_adamw_mode) { grad = param * _weight_decay + grad; }
+                momentum = momentum * _betta1;
+                momentum = grad * betta1_minus1 + momentum;
+
+                variance = variance * _betta2;
+                grad = grad * grad;
+                variance = grad * betta2_minus1 + variance;
+
+                grad = sqrt(variance);
+                grad = grad * _bias_correction2 + _eps;
+                grad = momentum / grad;
+                if (_weight_decay > 0 && _adamw_mode) { param += w_decay * param; }
+                param = grad * step_size + param;
+
+                _params[k] = param;
+                _exp_avg[k] = momentum;
+                _exp_avg_sq[k] = variance;
+                _ema[k] = param * ema_decay_minus1 + _ema[k] * ema_decay;
+            }
+        });
+    }
+}
+
+void Adam_Optimizer::Step_Bf16_cpu(uint16_t* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            uint32_t seed)
+{
+    size_t rounded_size = 0;
+    Step_SIMD_bf16<8>(&rounded_size, _params, grads, _exp_avg, _exp_avg_sq, _param_size, seed);
+    if (_param_size > rounded_size) {
+        float betta1_minus1 = 1 - _betta1;
+        float betta2_minus1 = 1 - _betta2;
+
+        float step_size = -1 * _alpha / _bias_correction1;
+        float w_decay = -1 * _alpha * _weight_decay;
+
+        CPU_Thread_Pool::Instance().parallel_for(rounded_size, _param_size, [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; k++) {
+                float grad = grads[k];
+                float param = bf16_to_float(_params[k]);
+                float momentum = _exp_avg[k];
+                float variance = _exp_avg_sq[k];
+                if (_weight_decay > 0 && !_adamw_mode) { grad = param * _weight_decay + grad; }
+                momentum = momentum * _betta1;
+                momentum = grad * betta1_minus1 + momentum;
+
+                variance = variance * _betta2;
+                grad = grad * grad;
+                variance = grad * betta2_minus1 + variance;
+
+                grad = sqrt(variance);
+                grad = grad * _bias_correction2 + _eps;
+                grad = momentum / grad;
+                if (_weight_decay > 0 && _adamw_mode) { param += w_decay * param; }
+                param = grad * step_size + param;
+
+                _params[k] = float_to_bf16_sr(param, seed, (uint32_t)k);
+                _exp_avg[k] = momentum;
+                _exp_avg_sq[k] = variance;
+            }
+        });
+    }
+}
+
+void Adam_Optimizer::Step_Bf16Moments_cpu(float* _params,
+                                          float* grads,
+                                          uint16_t* _exp_avg,
+                                          uint16_t* _exp_avg_sq,
+                                          size_t _param_size,
+                                          bool half_precision,
+                                          bool stochastic,
+                                          uint32_t seed)
+{
+    size_t rounded_size = 0;
+    Step_SIMD_bf16_moments<8>(&rounded_size, _params, grads, _exp_avg, _exp_avg_sq, _param_size,
+                              half_precision, stochastic, seed);
+    if (_param_size > rounded_size) {
+        float betta1_minus1 = 1 - _betta1;
+        float betta2_minus1 = 1 - _betta2;
+
+        float step_size = -1 * _alpha / _bias_correction1;
+        float w_decay = -1 * _alpha * _weight_decay;
+        uint16_t* grads_cast_h = reinterpret_cast<uint16_t*>(grads);
+        uint16_t* params_cast_h = reinterpret_cast<uint16_t*>(_params);
+        auto narrow = [&](float f, uint32_t s, size_t k) -> uint16_t {
+            return stochastic ? float_to_bf16_sr(f, s, (uint32_t)k) : float_to_bf16_rne(f);
+        };
+
+        CPU_Thread_Pool::Instance().parallel_for(rounded_size, _param_size, [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; k++) {
+                float grad = half_precision ? ds_half_to_float(grads_cast_h[k]) : grads[k];
+                float param = half_precision ? ds_half_to_float(params_cast_h[k]) : _params[k];
+                float momentum = bf16_to_float(_exp_avg[k]);
+                float variance = bf16_to_float(_exp_avg_sq[k]);
+                if (_weight_decay > 0 && !_adamw_mode) { grad = param * _weight_decay + grad; }
+                momentum = momentum * _betta1;
+                momentum = grad * betta1_minus1 + momentum;
+
+                variance = variance * _betta2;
                 grad = grad * grad;
                 variance = grad * betta2_minus1 + variance;
 
-                grad = sqrt(variance);
-                grad = grad * _bias_correction2 + _eps;
-                grad = momentum / grad;
-                if (_weight_decay > 0 && _adamw_mode) { param += w_decay * param; }
-                param = grad * step_size + param;
-#if defined(__ENABLE_CUDA__)
-                if (dev_params) _doubled_buffer[_buf_index][k - t] = param;
-#endif
-                if (half_precision)
-                    params_cast_h[k] = (ds_half_precision_t)param;
-                else
-                    _params[k] = param;
+                grad = sqrt(variance);
+                grad = grad * _bias_correction2 + _eps;
+                grad = momentum / grad;
+                if (_weight_decay > 0 && _adamw_mode) { param += w_decay * param; }
+                param = grad * step_size + param;
+
+                if (half_precision)
+                    params_cast_h[k] = ds_float_to_half(param);
+                else
+                    _params[k] = param;
+                _exp_avg[k] = narrow(momentum, seed, k);
+                _exp_avg_sq[k] = narrow(variance, ~seed, k);
+            }
+        });
+    }
+}
+
+// Lazy Adam: a step reads and writes only the blocks of lazy_block elements that hold one of
+// the n_grads increasing grad_idx, so it costs O(n_grads * lazy_block) instead of
+// O(_param_size). last_step[b] is the step block b is up to date with. The steps a block
+// skipped had zero gradients: its moments decay by beta^skipped and AdamW decays its weights
+// by (1 - lr * weight_decay)^skipped at the current lr. What the decaying moments would have
+// added to the weights is dropped, as in torch.optim.SparseAdam. With every index selected
+// at every step this is the dense update.
+void Adam_Optimizer::Lazy_Powers()
+{
+    float w_decay = (_weight_decay > 0 && _adamw_mode) ? 1 - _alpha * _weight_decay : 1.0f;
+    _lazy_pow[0][0] = _lazy_pow[0][1] = _lazy_pow[0][2] = 1.0f;
+    for (int s = 1; s < LAZY_POWERS; s++) {
+        _lazy_pow[s][0] = _lazy_pow[s - 1][0] * _betta1;
+        _lazy_pow[s][1] = _lazy_pow[s - 1][1] * _betta2;
+        _lazy_pow[s][2] = _lazy_pow[s - 1][2] * w_decay;
+    }
+}
+
+void Adam_Optimizer::Lazy_CatchUp(float* _params,
+                                  float* _exp_avg,
+                                  float* _exp_avg_sq,
+                                  int* last_step,
+                                  size_t lazy_block,
+                                  size_t _param_size,
+                                  size_t block)
+{
+    int skipped = int(_step) - last_step[block];
+    if (skipped <= 0) return;
+    float decay1, decay2, w_decay;
+    if (skipped < LAZY_POWERS) {
+        decay1 = _lazy_pow[skipped][0];
+        decay2 = _lazy_pow[skipped][1];
+        w_decay = _lazy_pow[skipped][2];
+    } else {
+        decay1 = std::pow(_betta1, skipped);
+        decay2 = std::pow(_betta2, skipped);
+        w_decay = std::pow(_lazy_pow[1][2], skipped);
+    }
+
+    size_t hi = std::min(_param_size, (block + 1) * lazy_block);
+    for (size_t k = block * lazy_block; k < hi; k++) {
+        _params[k] = _params[k] * w_decay;
+        _exp_avg[k] = _exp_avg[k] * decay1;
+        _exp_avg_sq[k] = _exp_avg_sq[k] * decay2;
+    }
+    last_step[block] = int(_step);
+}
+
+void Adam_Optimizer::Step_Lazy_cpu(float* _params,
+                                   const int64_t* grad_idx,
+                                   const float* grad_val,
+                                   size_t n_grads,
+                                   float* _exp_avg,
+                                   float* _exp_avg_sq,
+                                   int* last_step,
+                                   size_t lazy_block,
+                                   size_t _param_size)
+{
+    float betta1_minus1 = 1 - _betta1;
+    float betta2_minus1 = 1 - _betta2;
+    float step_size = -1 * _alpha / _bias_correction1;
+    Lazy_Powers();
+
+    auto block_of = [&](size_t j) { return size_t(grad_idx[j]) / lazy_block; };
+    CPU_Thread_Pool::Instance().parallel_for(0, n_grads, [&](size_t lo, size_t hi) {
+        // a block belongs to the slice holding its first index, so one thread catches it up
+        // before updating its elements
+        while (lo > 0 && lo < n_grads && block_of(lo) == block_of(lo - 1)) lo++;
+        while (hi < n_grads && block_of(hi) == block_of(hi - 1)) hi++;
+        for (size_t j = lo; j < hi; j++) {
+            // the indices are scattered, load the lines of the ones ahead
+            if (j + LAZY_PREFETCH < hi) {
+                size_t ahead = size_t(grad_idx[j + LAZY_PREFETCH]);
+                ds_prefetch(_params + ahead);
+                ds_prefetch(_exp_avg + ahead);
+                ds_prefetch(_exp_avg_sq + ahead);
+            }
+            size_t k = size_t(grad_idx[j]);
+            if (j == lo || block_of(j - 1) != k / lazy_block)
+                Lazy_CatchUp(_params, _exp_avg, _exp_avg_sq, last_step, lazy_block, _param_size, k / lazy_block);
+
+            float grad = grad_val[j];
+            float param = _params[k];
+            float momentum = _exp_avg[k];
+            float variance = _exp_avg_sq[k];
+            if (_weight_decay > 0 && !_adamw_mode) { grad = param * _weight_decay + grad; }
+            momentum = grad * betta1_minus1 + momentum;
+
+            grad = grad * grad;
+            variance = grad * betta2_minus1 + variance;
+
+            grad = sqrt(variance);
+            grad = grad * _bias_correction2 + _eps;
+            grad = momentum / grad;
+            param = grad * step_size + param;
+
+            _params[k] = param;
+            _exp_avg[k] = momentum;
+            _exp_avg_sq[k] = variance;
+        }
+    });
+}
+
+// Brings every block up to the current step, before the states are read as dense tensors
+void Adam_Optimizer::Lazy_Flush_cpu(float* _params,
+                                    float* _exp_avg,
+                                    float* _exp_avg_sq,
+                                    int* last_step,
+                                    size_t lazy_block,
+                                    size_t _param_size)
+{
+    Lazy_Powers();
+    size_t n_blocks = (_param_size + lazy_block - 1) / lazy_block;
+    CPU_Thread_Pool::Instance().parallel_for(0, n_blocks, [&](size_t lo, size_t hi) {
+        for (size_t b = lo; b < hi; b++)
+            Lazy_CatchUp(_params, _exp_avg, _exp_avg_sq, last_step, lazy_block, _param_size, b);
+    });
+}
+
+// Same arithmetic as the adam_8bit kernel: each QBLOCK of m and sqrt(v) is dequantized,
+// updated in fp32 and requantized against its new absmax.
+void Adam_Optimizer::Step_Adam8bit_cpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            ds_half_precision_t* dev_params,
+                            bool half_precision)
+{
+    float betta1_minus1 = 1 - _betta1;
+    float betta2_minus1 = 1 - _betta2;
+    float step_size = -1 * _alpha / _bias_correction1;
+    float w_decay = -1 * _alpha * _weight_decay;
+
+    int8_t* m_codes = (int8_t*)_exp_avg;
+    uint8_t* v_codes = (uint8_t*)_exp_avg_sq;
+    float* m_scales = (float*)((char*)_exp_avg + quantized_scale_offset(_param_size));
+    float* v_scales = (float*)((char*)_exp_avg_sq + quantized_scale_offset(_param_size));
+
+    // the last block may be partial, the kernel only sees 1024-aligned sizes. The pool splits
+    // the range of blocks.
+    const size_t n_blocks = (_param_size + QBLOCK - 1) / QBLOCK;
+    auto update_blocks = [&](size_t lo, size_t hi) {
+        for (size_t b = lo; b < hi; b++) {
+            size_t block_size = std::min((size_t)QBLOCK, _param_size - b * QBLOCK);
+            float momentum[QBLOCK];
+            float variance[QBLOCK];
+            float m_step = m_scales[b] / 127.0f;
+            float v_step = v_scales[b] / (255.0f * 255.0f);
+            float m_absmax = 0.0f;
+            float v_absmax = 0.0f;
+
+            for (size_t j = 0; j < block_size; j++) {
+                size_t k = b * QBLOCK + j;
+                float grad = grads[k];
+                float v_code = std::max((float)v_codes[k], 1.0f);
+                float s_old = v_code * v_code * v_step;
+                float m_new = _betta1 * (m_codes[k] * m_step) + betta1_minus1 * grad;
+                float s_new = sqrtf(_betta2 * s_old * s_old + betta2_minus1 * grad * grad);
+                _params[k] = _params[k] * (1 + w_decay) + (m_new / (s_new * _bias_correction2 + _eps)) * step_size;
+                momentum[j] = m_new;
+                variance[j] = s_new;
+                m_absmax = std::max(m_absmax, fabsf(m_new));
+                v_absmax = std::max(v_absmax, s_new);
+            }
+
+            m_scales[b] = m_absmax;
+            v_scales[b] = v_absmax;
+            float m_inv = (m_absmax > 0.0f) ? 127.0f / m_absmax : 0.0f;
+            float v_inv = (v_absmax > 0.0f) ? (255.0f * 255.0f) / v_absmax : 0.0f;
+            for (size_t j = 0; j < block_size; j++) {
+                m_codes[b * QBLOCK + j] = (int8_t)roundf(momentum[j] * m_inv);
+                v_codes[b * QBLOCK + j] = (uint8_t)roundf(sqrtf(variance[j] * v_inv));
+            }
+        }
+    };
+    CPU_Thread_Pool::Instance().parallel_for(0, n_blocks, update_blocks, 1, CPU_POOL_MIN_WORK / QBLOCK);
+}
+
+// Reference for the adafactor kernel: factors holds, per segment, a row factor (rows) and a
+// column factor (cols), or the full second moment when the segment is not factored (cols == 0).
+// A segment may be one rank's partition of a parameter. PHASE_NORM updates the row factor of
+// the local rows and writes the column sums of the squared gradients, the row factor total and
+// the element count to sums + seg[SEG_SUM_BASE]; PHASE_UPDATE updates the column factor from
+// the sums it is given, which the caller may have summed over the ranks holding the other
+// partitions, and applies the step. A row split between two partitions still only sees the
+// local part of its row factor.
+void Adam_Optimizer::Step_Adafactor_cpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* factors,
+                            int* segments,
+                            int n_segments,
+                            float* sums,
+                            int phase)
+{
+    float betta1_minus1 = 1 - _betta1;
+    float betta2_minus1 = 1 - _betta2;
+    float step_size = -1 * _alpha;
+    float w_decay = -1 * _alpha * _weight_decay;
+
+    for (int s = 0; s < n_segments && phase != PHASE_UPDATE; s++) {
+        int* seg = segments + s * SEG_FIELDS;
+        size_t begin = seg[SEG_BEGIN];
+        size_t end = seg[SEG_END];
+        size_t cols = seg[SEG_COLS];
+        size_t col0 = seg[SEG_COL0];
+        size_t rows = seg[SEG_ROWS];
+        float* row_factor = factors + seg[SEG_ROW_BASE];
+        if (cols == 0) continue;
+
+        // Rows are independent, the column sums of a slice of rows are merged at its end
+        float* col_sum = sums + seg[SEG_SUM_BASE];
+        std::fill(col_sum, col_sum + cols, 0.0f);
+        std::mutex col_mutex;
+        CPU_Thread_Pool::Instance().parallel_for(0, rows, [&](size_t r_lo, size_t r_hi) {
+            std::vector<float> part(cols, 0.0f);
+            for (size_t r = r_lo; r < r_hi; r++) {
+                size_t lo = std::max(r * cols, col0);
+                size_t hi = std::min((r + 1) * cols, col0 + end - begin);
+                float row_sum = 0.0f;
+                for (size_t e = lo; e < hi; e++) {
+                    float grad = grads[begin + e - col0];
+                    float grad2 = grad * grad + _eps;
+                    row_sum += grad2;
+                    part[e - r * cols] += grad2;
+                }
+                row_factor[r] = row_factor[r] * _betta2 + (row_sum / cols) * betta2_minus1;
+            }
+            std::lock_guard<std::mutex> lock(col_mutex);
+            for (size_t c = 0; c < cols; c++) col_sum[c] += part[c];
+        }, 1, std::max(CPU_POOL_MIN_WORK / cols, (size_t)1));
+
+        float row_total = 0.0f;
+        for (size_t r = 0; r < rows; r++) row_total += row_factor[r];
+        col_sum[cols] = row_total;
+        col_sum[cols + 1] = end - begin;
+    }
+    if (phase == PHASE_NORM) return;
+
+    for (int s = 0; s < n_segments; s++) {
+        int* seg = segments + s * SEG_FIELDS;
+        size_t begin = seg[SEG_BEGIN];
+        size_t end = seg[SEG_END];
+        size_t cols = seg[SEG_COLS];
+        size_t col0 = seg[SEG_COL0];
+        float* row_factor = factors + seg[SEG_ROW_BASE];
+        float* col_factor = factors + seg[SEG_COL_BASE];
+
+        if (cols == 0) {
+            CPU_Thread_Pool::Instance().parallel_for(begin, end, [&](size_t lo, size_t hi) {
+                for (size_t k = lo; k < hi; k++) {
+                    float grad = grads[k];
+                    float variance = col_factor[k - begin] * _betta2;
+                    variance = (grad * grad + _eps) * betta2_minus1 + variance;
+                    col_factor[k - begin] = variance;
+
+                    float momentum = _exp_avg[k] * _betta1 + (grad / sqrt(variance)) * betta1_minus1;
+                    _params[k] = _params[k] * (1 + w_decay) + momentum * step_size;
+                    _exp_avg[k] = momentum;
+                }
+            });
+            continue;
+        }
+
+        // Rows of the whole parameter once the sums are reduced, of this segment otherwise
+        float* col_sum = sums + seg[SEG_SUM_BASE];
+        float total_rows = col_sum[cols + 1] / cols;
+        for (size_t c = 0; c < cols; c++) {
+            col_factor[c] = col_factor[c] * _betta2 + (col_sum[c] / total_rows) * betta2_minus1;
+        }
+        float inv_row_mean = total_rows / col_sum[cols];
+
+        CPU_Thread_Pool::Instance().parallel_for(begin, end, [&](size_t lo, size_t hi) {
+            for (size_t k = lo; k < hi; k++) {
+                size_t e = k - begin + col0;
+                float variance = row_factor[e / cols] * col_factor[e % cols] * inv_row_mean;
+
+                float momentum = _exp_avg[k] * _betta1 + (grads[k] / sqrt(variance)) * betta1_minus1;
+                _params[k] = _params[k] * (1 + w_decay) + momentum * step_size;
                 _exp_avg[k] = momentum;
-                _exp_avg_sq[k] = variance;
             }
+        });
+    }
+}
+
+// Reference for the lamb kernel: one trust ratio per segment (parameter partition).
+// PHASE_NORM updates the moments and writes the squared norms of w and of the update to
+// norms[2 * s], norms[2 * s + 1]; PHASE_UPDATE applies the trust ratio of the norms it is
+// given, which the caller may have summed over the ranks holding the other partitions.
+void Adam_Optimizer::Step_Lamb_cpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            int* segments,
+                            int n_segments,
+                            float max_coeff,
+                            float min_coeff,
+                            float* norms,
+                            int phase)
+{
+    float betta1_minus1 = 1 - _betta1;
+    float betta2_minus1 = 1 - _betta2;
+    float step_size = -1 * _alpha;
+
+    for (int s = 0; s < n_segments && phase != PHASE_UPDATE; s++) {
+        size_t begin = segments[s * SEG_FIELDS + SEG_BEGIN];
+        size_t end = segments[s * SEG_FIELDS + SEG_END];
+
+        float w_norm2 = 0.0f;
+        float u_norm2 = 0.0f;
+#pragma omp parallel for reduction(+ : w_norm2, u_norm2)
+        for (size_t k = begin; k < end; k++) {
+            float grad = grads[k];
+            float momentum = _exp_avg[k] * _betta1 + grad * betta1_minus1;
+            float variance = _exp_avg_sq[k] * _betta2 + grad * grad * betta2_minus1;
+            _exp_avg[k] = momentum;
+            _exp_avg_sq[k] = variance;
+
+            float u = (momentum / _bias_correction1) / (sqrt(variance) * _bias_correction2 + _eps) +
+                      _weight_decay * _params[k];
+            w_norm2 += _params[k] * _params[k];
+            u_norm2 += u * u;
+        }
+        norms[2 * s] = w_norm2;
+        norms[2 * s + 1] = u_norm2;
+    }
+    if (phase == PHASE_NORM) return;
+
+    // The update is recomputed from the stored moments, w has not moved since phase 1
+    for (int s = 0; s < n_segments; s++) {
+        size_t begin = segments[s * SEG_FIELDS + SEG_BEGIN];
+        size_t end = segments[s * SEG_FIELDS + SEG_END];
+
+        float trust_step = step_size * lamb_trust_ratio(norms[2 * s], norms[2 * s + 1], max_coeff, min_coeff);
+#pragma omp parallel for
+        for (size_t k = begin; k < end; k++) {
+            float u = (_exp_avg[k] / _bias_correction1) / (sqrt(_exp_avg_sq[k]) * _bias_correction2 + _eps) +
+                      _weight_decay * _params[k];
+            _params[k] += trust_step * u;
+        }
+    }
+}
+
+
+void Adam_Optimizer::Step_cpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            ds_half_precision_t* dev_params,
+                            bool half_precision)
+{
+    size_t rounded_size = 0;
+    if (_param_size > rounded_size) {
+        float betta1_minus1 = 1 - _betta1;
+        float betta2_minus1 = 1 - _betta2;
+
+        float step_size = -1 * _alpha / _bias_correction1;
+        float w_decay = -1 * _alpha * _weight_decay;
+        uint16_t* grads_cast_h;
+        uint16_t* params_cast_h;
+        if (half_precision) {
+            grads_cast_h = reinterpret_cast<uint16_t*>(grads);
+            params_cast_h = reinterpret_cast<uint16_t*>(_params);
+        }
+
+        for (size_t t = rounded_size; t < _param_size; t += TILE) {
+            size_t copy_size = TILE;
+            if ((t + TILE) > _param_size) copy_size = _param_size - t;
+            size_t offset = copy_size + t;
+#if defined(__ENABLE_CUDA__)
+            if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
+#endif // ENABLE_CUDA
+
+            CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+                for (size_t k = lo; k < hi; k++) {
+                    float grad = half_precision ? ds_half_to_float(grads_cast_h[k]) : grads[k];
+                    grad *= _grad_unscale;
+                    if (!std::isfinite(grad)) _grad_overflow = 1;
+                    float param = half_precision ? ds_half_to_float(params_cast_h[k]) : _params[k];
+                    float momentum = _exp_avg[k];
+                    float variance = _exp_avg_sq[k];
+                    if (_weight_decay > 0 && !_adamw_mode) { grad = param * _weight_decay + grad; }
+                    momentum = momentum * _betta1;
+                    momentum = grad * betta1_minus1 + momentum;
+
+                    variance = variance * _betta2;
+                    grad = grad * grad;
+                    variance = grad * betta2_minus1 + variance;
+
+                    grad = sqrt(variance);
+                    grad = grad * _bias_correction2 + _eps;
+                    grad = momentum / grad;
+                    if (_weight_decay > 0 && _adamw_mode) { param += w_decay * param; }
+                    param = grad * step_size + param;
+#if defined(__ENABLE_CUDA__)
+                    if (dev_params) _doubled_buffer[_buf_index][k - t] = param;
+#endif // ENABLE_CUDA
+                    if (half_precision)
+                        params_cast_h[k] = ds_float_to_half(param);
+                    else
+                        _params[k] = param;
+                    _exp_avg[k] = momentum;
+                    _exp_avg_sq[k] = variance;
+                }
+            });
+
+#if defined(__ENABLE_CUDA__)
+            if (dev_params) {
+                launch_param_update(
+                    _doubled_buffer[_buf_index], dev_params + t, (copy_size), _streams[_buf_index]);
+
+                _buf_index = !_buf_index;
+            }
+#endif // ENABLE_CUDA
+        }
+
+    }
+}
+
+void Adam_Optimizer::Step_1(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            ds_half_precision_t* dev_params,
+                            bool half_precision,
+                            uint16_t* param_lp,
+                            bool lp_bf16)
+{
+    size_t rounded_size = 0;
+    Step_SIMD<1>(&rounded_size,
+                 _params,
+                 grads,
+                 _exp_avg,
+                 _exp_avg_sq,
+                 _param_size,
+                 dev_params,
+                 half_precision,
+                 param_lp,
+                 lp_bf16);
+    if (_param_size > rounded_size) {
+        float betta1_minus1 = 1 - _betta1;
+        float betta2_minus1 = 1 - _betta2;
+
+        float step_size = -1 * _alpha / _bias_correction1;
+        float w_decay = -1 * _alpha * _weight_decay;
+        uint16_t* grads_cast_h;
+        uint16_t* params_cast_h;
+        if (half_precision) {
+            grads_cast_h = reinterpret_cast<uint16_t*>(grads);
+            params_cast_h = reinterpret_cast<uint16_t*>(_params);
+        }
+
+        for (size_t t = rounded_size; t < _param_size; t += TILE) {
+            size_t copy_size = TILE;
+            if ((t + TILE) > _param_size) copy_size = _param_size - t;
+            size_t offset = copy_size + t;
+#if defined(__ENABLE_CUDA__)
+            if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
+#endif
+            CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+                for (size_t k = lo; k < hi; k++) {
+                    float grad = half_precision ? ds_half_to_float(grads_cast_h[k]) : grads[k];
+                    grad *= _grad_unscale;
+                    if (!std::isfinite(grad)) _grad_overflow = 1;
+                    float param = half_precision ? ds_half_to_float(params_cast_h[k]) : _params[k];
+                    float momentum = _exp_avg[k];
+                    float variance = _exp_avg_sq[k];
+                    if (_weight_decay > 0 && !_adamw_mode) { grad = param * _weight_decay + grad; }
+                    momentum = momentum * _betta1;
+                    momentum = grad * betta1_minus1 + momentum;
+
+                    variance = variance * _betta2;
+                    grad = grad * grad;
+                    variance = grad * betta2_minus1 + variance;
+
+                    grad = sqrt(variance);
+                    grad = grad * _bias_correction2 + _eps;
+                    grad = momentum / grad;
+                    if (_weight_decay > 0 && _adamw_mode) { param += w_decay * param; }
+                    param = grad * step_size + param;
+#if defined(__ENABLE_CUDA__)
+                    if (dev_params) _doubled_buffer[_buf_index][k - t] = param;
+#endif
+                    if (half_precision)
+                        params_cast_h[k] = ds_float_to_half(param);
+                    else
+                        _params[k] = param;
+                    if (param_lp) param_lp[k] = lp_bf16 ? float_to_bf16_rne(param) : ds_float_to_half(param);
+                    _exp_avg[k] = momentum;
+                    _exp_avg_sq[k] = variance;
+                }
+            });
 #if defined(__ENABLE_CUDA__)
             if (dev_params) {
                 launch_param_update(
                     _doubled_buffer[_buf_index], dev_params + t, (copy_size), _streams[_buf_index]);
 
-                _buf_index = !_buf_index;
-            }
-#endif
-        }
-    }
+                _buf_index = !_buf_index;
+            }
+#endif
+        }
+    }
+}
+
+double Adam_Optimizer::GradSumSq_cpu(float* grads, size_t _param_size, bool half_precision)
+{
+    size_t rounded_size = 0;
+    double sumsq = 0.0;
+    GradSumSq_SIMD<8>(&rounded_size, grads, _param_size, half_precision, &sumsq);
+    uint16_t* grads_cast_h = reinterpret_cast<uint16_t*>(grads);
+    for (size_t k = rounded_size; k < _param_size; k++) {
+        float grad = (half_precision ? ds_half_to_float(grads_cast_h[k]) : grads[k]) * _grad_unscale;
+        if (!std::isfinite(grad)) _grad_overflow = 1;
+        sumsq += grad * grad;
+    }
+    return sumsq;
+}
+
+void Adam_Optimizer::Step_4(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            ds_half_precision_t* dev_params,
+                            bool half_precision,
+                            uint16_t* param_lp,
+                            bool lp_bf16)
+{
+    size_t rounded_size = 0;
+    Step_SIMD<4>(&rounded_size,
+                 _params,
+                 grads,
+                 _exp_avg,
+                 _exp_avg_sq,
+                 _param_size,
+                 dev_params,
+                 half_precision,
+                 param_lp,
+                 lp_bf16);
+    if (_param_size > rounded_size)
+        Step_1((_params + rounded_size),
+               (grads + rounded_size),
+               (_exp_avg + rounded_size),
+               (_exp_avg_sq + rounded_size),
+               (_param_size - rounded_size),
+               (dev_params != nullptr ? (dev_params + rounded_size) : dev_params),
+               half_precision,
+               (param_lp != nullptr ? (param_lp + rounded_size) : param_lp),
+               lp_bf16);
+}
+
+
+int create_adam_optimizer(int optimizer_id,
+                          float alpha = 1e-3,
+                          float betta1 = 0.9,
+                          float betta2 = 0.999,
+                          float eps = 1e-8,
+                          float weight_decay = 0,
+                          bool adamw_mode = true,
+                          bool should_log = false)
+{
+    auto opt =
+        std::make_shared<Adam_Optimizer>(alpha, betta1, betta2, eps, weight_decay, adamw_mode);
+
+    s_optimizers[optimizer_id] = opt;
+
+	if (should_log) {
+        printf("Adam Optimizer #%d is created with %s arithmetic capability%s.\n",
+               optimizer_id,
+               ds_simd_isa_name(ds_simd_isa()),
+               ds_simd_isa_extras());
+        printf("Config: alpha=%f, betas=(%f, %f), weight_decay=%f, adam_w=%d\n",
+               alpha,
+               betta1,
+               betta2,
+               weight_decay,
+               (int)adamw_mode);
+    }
+
+    return 0;
+}
+
+void Adam_Optimizer::Step_8(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* _exp_avg_sq,
+                            size_t _param_size,
+                            ds_half_precision_t* dev_params,
+                            bool half_precision,
+                            uint16_t* param_lp,
+                            bool lp_bf16)
+{
+    size_t rounded_size = 0;
+    Step_SIMD<8>(&rounded_size,
+                 _params,
+                 grads,
+                 _exp_avg,
+                 _exp_avg_sq,
+                 _param_size,
+                 dev_params,
+                 half_precision,
+                 param_lp,
+                 lp_bf16);
+    if (_param_size > rounded_size)
+        Step_4((_params + rounded_size),
+               (grads + rounded_size),
+               (_exp_avg + rounded_size),
+               (_exp_avg_sq + rounded_size),
+               (_param_size - rounded_size),
+               (dev_params != nullptr ? (dev_params + rounded_size) : dev_params),
+               half_precision,
+               (param_lp != nullptr ? (param_lp + rounded_size) : param_lp),
+               lp_bf16);
+}
+
+int ds_adagrad_step_fpga(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float epsilon,
+                 float weight_decay,
+				 float combined_unscale,
+				 std::string param_path,
+				 std::string exp_avg_sq_path,
+				 std::string grad_path,
+				 size_t _param_size, 
+				 torch::Tensor& fp16_params,
+				 int device_id,
+				 int largest_numel,
+				 float compression_ratio,
+				 torch::Tensor& grad_idx,
+				 int topk_block,
+				 int val_bits
+				 )
+{
+    //auto fp32_params_c = fp32_params.contiguous();
+	//float* fp32_params_ptr = (float*)fp32_params_c.data_ptr();
+    
+	auto fp16_params_c = fp16_params.contiguous();
+	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
+
+	std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    
+	//opt->IncrementStep(step, beta1, beta2);
+	opt->IncrementStep_(step);
+	//opt->update_state(lr, epsilon, weight_decay, bias_correction);
+    opt->update_state(lr, epsilon, weight_decay, false);
+	
+	if (compression_ratio < 0.5){
+		int* grad_idx_ptr = (int*)grad_idx.data_ptr();
+		opt->Step_fpga_adagrad_comp(
+				param_path,
+                exp_avg_sq_path,
+                grad_path,
+                _param_size,
+				combined_unscale,
+				fp16_params_ptr,
+				device_id,
+				largest_numel,
+				compression_ratio,
+				topk_block,
+				val_bits
+				);
+	}else{
+		opt->Step_fpga_adagrad(
+				param_path,
+                exp_avg_sq_path,
+                grad_path,
+                _param_size,
+				combined_unscale,
+				fp16_params_ptr,
+				device_id,
+				largest_numel
+				);
+	}
+    return 0;
+}
+
+int ds_sgd_step_fpga(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float weight_decay,
+				 float combined_unscale,
+				 std::string param_path,
+				 std::string exp_avg_path,
+				 std::string grad_path,
+				 size_t _param_size, 
+				 torch::Tensor& fp16_params,
+				 int device_id,
+				 int largest_numel,
+				 float compression_ratio,
+				 torch::Tensor& grad_idx,
+				 int topk_block,
+				 int val_bits
+				 )
+{
+    //auto fp32_params_c = fp32_params.contiguous();
+	//float* fp32_params_ptr = (float*)fp32_params_c.data_ptr();
+    
+	auto fp16_params_c = fp16_params.contiguous();
+	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
+
+	std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep_( step, beta1 );
+    opt->update_state(lr, 0.0, weight_decay, false);
+	
+	if (compression_ratio < 0.5){
+		int* grad_idx_ptr = (int*)grad_idx.data_ptr();
+		opt->Step_fpga_sgd_comp(
+				param_path,
+                exp_avg_path,
+                grad_path,
+                _param_size,
+				combined_unscale,
+				fp16_params_ptr,
+				device_id,
+				largest_numel,
+				compression_ratio,
+				grad_idx_ptr,
+				topk_block,
+				val_bits
+				);
+	}else{
+		opt->Step_fpga_sgd(
+				param_path,
+                exp_avg_path,
+                grad_path,
+                _param_size,
+				combined_unscale,
+				fp16_params_ptr,
+				device_id,
+				largest_numel
+				);
+	}
+    return 0;
 }
 
-void Adam_Optimizer::Step_4(float* _params,
-                            float* grads,
-                            float* _exp_avg,
-                            float* _exp_avg_sq,
-                            size_t _param_size,
-                            ds_half_precision_t* dev_params,
-                            bool half_precision)
+int ds_lion_step_fpga(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float weight_decay,
+				 float combined_unscale,
+				 std::string param_path,
+				 std::string exp_avg_path,
+				 std::string grad_path,
+				 size_t _param_size, 
+				 torch::Tensor& fp16_params,
+				 int device_id,
+				 int largest_numel,
+				 float compression_ratio,
+				 torch::Tensor& grad_idx,
+				 int topk_block,
+				 int val_bits
+				 )
 {
-    size_t rounded_size = 0;
-#if defined(__AVX512__) or defined(__AVX256__)
-    Step_AVX<4>(&rounded_size,
-                _params,
-                grads,
-                _exp_avg,
-                _exp_avg_sq,
+    //auto fp32_params_c = fp32_params.contiguous();
+	//float* fp32_params_ptr = (float*)fp32_params_c.data_ptr();
+    
+	auto fp16_params_c = fp16_params.contiguous();
+	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
+
+	std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, 0.0, weight_decay, false);
+	
+	if (compression_ratio < 0.5){
+		int* grad_idx_ptr = (int*)grad_idx.data_ptr();
+		opt->Step_fpga_lion_comp(
+				param_path,
+                exp_avg_path,
+                grad_path,
                 _param_size,
-                dev_params,
-                half_precision);
-#endif
-    if (_param_size > rounded_size)
-        Step_1((_params + rounded_size),
-               (grads + rounded_size),
-               (_exp_avg + rounded_size),
-               (_exp_avg_sq + rounded_size),
-               (_param_size - rounded_size),
-               (dev_params != nullptr ? (dev_params + rounded_size) : dev_params),
-               half_precision);
+				combined_unscale,
+				fp16_params_ptr,
+				device_id,
+				largest_numel,
+				compression_ratio,
+				grad_idx_ptr,
+				topk_block,
+				val_bits
+				);
+	}else{
+		opt->Step_fpga_lion(
+				param_path,
+                exp_avg_path,
+                grad_path,
+                _param_size,
+				combined_unscale,
+				fp16_params_ptr,
+				device_id,
+				largest_numel
+				);
+	}
+    return 0;
+}
+
+int ds_adafactor_step_fpga(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float epsilon,
+                 float weight_decay,
+				 float combined_unscale,
+				 std::string param_path,
+				 std::string exp_avg_path,
+				 std::string grad_path,
+				 size_t _param_size, 
+				 torch::Tensor& fp16_params,
+				 int device_id,
+				 int largest_numel,
+				 torch::Tensor& factors,
+				 torch::Tensor& segments
+				 )
+{
+	auto fp16_params_c = fp16_params.contiguous();
+	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
+
+	float* factors_ptr = (float*)factors.data_ptr();
+	int* segments_ptr = (int*)segments.data_ptr();
+
+	std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, false);
+
+	opt->Step_fpga_adafactor(
+			param_path,
+			exp_avg_path,
+			grad_path,
+			_param_size,
+			combined_unscale,
+			fp16_params_ptr,
+			device_id,
+			largest_numel,
+			factors_ptr,
+			factors.numel(),
+			segments_ptr,
+			segments.size(0)
+			);
+    return 0;
 }
 
+int ds_lamb_step_fpga(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float epsilon,
+                 float weight_decay,
+                 float max_coeff,
+                 float min_coeff,
+				 float combined_unscale,
+				 std::string param_path,
+				 std::string exp_avg_path,
+				 std::string exp_avg_sq_path,
+				 std::string grad_path,
+				 size_t _param_size, 
+				 torch::Tensor& fp16_params,
+				 int device_id,
+				 int largest_numel,
+				 torch::Tensor& segments,
+				 torch::Tensor& norms,
+				 int phase
+				 )
+{
+	auto fp16_params_c = fp16_params.contiguous();
+	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
 
-int create_adam_optimizer(int optimizer_id,
-                          float alpha = 1e-3,
-                          float betta1 = 0.9,
-                          float betta2 = 0.999,
-                          float eps = 1e-8,
-                          float weight_decay = 0,
-                          bool adamw_mode = true,
-                          bool should_log = false)
+	int* segments_ptr = (int*)segments.data_ptr();
+
+	std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, true);
+
+	opt->Step_fpga_lamb(
+			param_path,
+			exp_avg_path,
+			exp_avg_sq_path,
+			grad_path,
+			_param_size,
+			combined_unscale,
+			fp16_params_ptr,
+			device_id,
+			largest_numel,
+			max_coeff,
+			min_coeff,
+			segments_ptr,
+			segments.size(0),
+			phase,
+			(float*)norms.data_ptr()
+			);
+    return 0;
+}
+
+
+int ds_adam8bit_step_fpga(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float epsilon,
+                 float weight_decay,
+                 bool bias_correction, 
+				 float combined_unscale,
+				 std::string param_path,
+				 std::string exp_avg_path,
+				 std::string exp_avg_sq_path,
+				 std::string grad_path,
+				 size_t _param_size, 
+				 torch::Tensor& fp16_params,
+				 int device_id,
+				 int largest_numel
+				 )
 {
-    auto opt =
-        std::make_shared<Adam_Optimizer>(alpha, betta1, betta2, eps, weight_decay, adamw_mode);
+	auto fp16_params_c = fp16_params.contiguous();
+	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
 
-    s_optimizers[optimizer_id] = opt;
+	std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
 
-	if (should_log) {
-        std::string avx_type = "";
-#if defined(__AVX512__)
-        avx_type = "AVX512";
-#else
-#if defined(__AVX256__)
-        avx_type = "AVX2";
-#else
-        avx_type = "scalar";
-#endif
-#endif
+	opt->Step_fpga_8bit(
+			param_path,
+			exp_avg_path,
+			exp_avg_sq_path,
+			grad_path,
+			_param_size,
+			combined_unscale,
+			fp16_params_ptr,
+			device_id,
+			largest_numel
+			);
+    return 0;
+}
+
+
+int ds_adam_ema_step_fpga(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float epsilon,
+                 float weight_decay,
+                 bool bias_correction, 
+				 float combined_unscale,
+				 std::string param_path,
+				 std::string exp_avg_path,
+				 std::string exp_avg_sq_path,
+				 std::string ema_path,
+				 std::string grad_path,
+				 size_t _param_size, 
+				 torch::Tensor& fp16_params,
+				 int device_id,
+				 int largest_numel,
+				 float ema_decay
+				 )
+{
+	auto fp16_params_c = fp16_params.contiguous();
+	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
+
+	std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
+
+	opt->Step_fpga_ema(
+			param_path,
+			exp_avg_path,
+			exp_avg_sq_path,
+			ema_path,
+			grad_path,
+			_param_size,
+			combined_unscale,
+			fp16_params_ptr,
+			device_id,
+			largest_numel,
+			ema_decay
+			);
+    return 0;
+}
+
+
+// chunk identifies the sub group, the rounding stream is seeded with (step, chunk)
+int ds_adam_bf16_step_fpga(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float epsilon,
+                 float weight_decay,
+                 bool bias_correction, 
+				 float combined_unscale,
+				 std::string param_path,
+				 std::string exp_avg_path,
+				 std::string exp_avg_sq_path,
+				 std::string grad_path,
+				 size_t _param_size, 
+				 torch::Tensor& fp16_params,
+				 int device_id,
+				 int largest_numel,
+				 uint32_t chunk
+				 )
+{
+	auto fp16_params_c = fp16_params.contiguous();
+	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
+	bool bf16_params = (fp16_params.options().dtype() == at::kBFloat16);
 
-        printf("Adam Optimizer #%d is created with %s arithmetic capability.\n",
-               optimizer_id,
-               avx_type.c_str());
-        printf("Config: alpha=%f, betas=(%f, %f), weight_decay=%f, adam_w=%d\n",
-               alpha,
-               betta1,
-               betta2,
-               weight_decay,
-               (int)adamw_mode);
-    }
+	std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
 
+	opt->Step_fpga_bf16(
+			param_path,
+			exp_avg_path,
+			exp_avg_sq_path,
+			grad_path,
+			_param_size,
+			combined_unscale,
+			fp16_params_ptr,
+			bf16_params,
+			device_id,
+			largest_numel,
+			sr_seed(step, chunk)
+			);
     return 0;
 }
 
-void Adam_Optimizer::Step_8(float* _params,
-                            float* grads,
-                            float* _exp_avg,
-                            float* _exp_avg_sq,
-                            size_t _param_size,
-                            ds_half_precision_t* dev_params,
-                            bool half_precision)
+// pread/pwrite of the first len bytes of a file, looping on short transfers. Reads stop early at
+// the end of the file only, and fail unless at least need bytes came back. The offsets stay
+// IO_ALIGN aligned for O_DIRECT as long as every transfer moves whole pages.
+static void pread_full(int fd, void* buf, size_t len, size_t need, const std::string& path)
 {
-    size_t rounded_size = 0;
-#if defined(__AVX512__) or defined(__AVX256__)
-    Step_AVX<8>(&rounded_size,
-                _params,
-                grads,
-                _exp_avg,
-                _exp_avg_sq,
-                _param_size,
-                dev_params,
-                half_precision);
-#endif
-    if (_param_size > rounded_size)
-        Step_4((_params + rounded_size),
-               (grads + rounded_size),
-               (_exp_avg + rounded_size),
-               (_exp_avg_sq + rounded_size),
-               (_param_size - rounded_size),
-               (dev_params != nullptr ? (dev_params + rounded_size) : dev_params),
-               half_precision);
+	size_t done = 0;
+	while (done < len) {
+		ssize_t ret = pread(fd, (char*)buf + done, len - done, done);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret < 0) throw std::runtime_error("read of " + path + " failed: " + strerror(errno));
+		if (ret == 0) break;
+		done += ret;
+	}
+	if (done < need)
+		throw std::runtime_error("short read of " + path + ": " + std::to_string(done) + " of " +
+		                         std::to_string(need) + " bytes");
 }
 
-int ds_adagrad_step_fpga(int optimizer_id,
+static void pwrite_full(int fd, const void* buf, size_t len, const std::string& path)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t ret = pwrite(fd, (const char*)buf + done, len - done, done);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret <= 0)
+			throw std::runtime_error("write of " + path + " failed after " + std::to_string(done) + " of " +
+			                         std::to_string(len) + " bytes: " + strerror(errno));
+		done += ret;
+	}
+}
+
+// Rewrites the fp32 weights of a param swap file as bf16 master weights (round to nearest even)
+// in the first _param_size * 2 bytes. Done once, before the first bf16 step.
+void ds_bf16_master_pack(std::string param_path, size_t _param_size)
+{
+	size_t nbytes = _param_size * sizeof(float);
+	size_t rbytes = (nbytes + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+	size_t pbytes = (_param_size * sizeof(uint16_t) + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+	std::vector<float, aligned_allocator<float>> param(rbytes / sizeof(float));
+	std::vector<uint16_t, aligned_allocator<uint16_t>> master(pbytes / sizeof(uint16_t), 0);
+
+	int nvmeFd = open(param_path.c_str(), O_RDWR | O_SYNC | O_DIRECT, 0644);
+	if (nvmeFd < 0) throw std::runtime_error("open of " + param_path + " failed: " + strerror(errno));
+	try {
+		pread_full(nvmeFd, (void*)&param[0], rbytes, nbytes, param_path);
+		CPU_Thread_Pool::Instance().parallel_for(0, _param_size, [&](size_t lo, size_t hi) {
+			for (size_t k = lo; k < hi; k++) { master[k] = float_to_bf16_rne(param[k]); }
+		});
+		pwrite_full(nvmeFd, (void*)&master[0], pbytes, param_path);
+	} catch (...) {
+		(void)close(nvmeFd);
+		throw;
+	}
+	(void)close(nvmeFd);
+}
+
+int ds_adam_step_fpga(int optimizer_id,
                  size_t step,
                  float lr,
+                 float beta1,
+                 float beta2,
                  float epsilon,
                  float weight_decay,
+                 bool bias_correction, 
 				 float combined_unscale,
 				 std::string param_path,
+				 std::string exp_avg_path,
 				 std::string exp_avg_sq_path,
 				 std::string grad_path,
 				 size_t _param_size, 
+				 //torch::Tensor& fp32_params,
 				 torch::Tensor& fp16_params,
 				 int device_id,
 				 int largest_numel,
 				 float compression_ratio,
-				 torch::Tensor& grad_idx
+				 torch::Tensor& grad_idx,
+				 int topk_block,
+				 int val_bits
 				 )
 {
     //auto fp32_params_c = fp32_params.contiguous();
@@ -1931,16 +5288,14 @@ int ds_adagrad_step_fpga(int optimizer_id,
 
 	std::shared_ptr<Adam_Optimizer> opt =
         std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
-    
-	//opt->IncrementStep(step, beta1, beta2);
-	opt->IncrementStep_(step);
-	//opt->update_state(lr, epsilon, weight_decay, bias_correction);
-    opt->update_state(lr, epsilon, weight_decay, false);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
 	
 	if (compression_ratio < 0.5){
 		int* grad_idx_ptr = (int*)grad_idx.data_ptr();
-		opt->Step_fpga_adagrad_comp(
+		opt->Step_fpga_comp(
 				param_path,
+                exp_avg_path,
                 exp_avg_sq_path,
                 grad_path,
                 _param_size,
@@ -1948,11 +5303,15 @@ int ds_adagrad_step_fpga(int optimizer_id,
 				fp16_params_ptr,
 				device_id,
 				largest_numel,
-				compression_ratio
+				compression_ratio,
+				grad_idx_ptr,
+				topk_block,
+				val_bits
 				);
 	}else{
-		opt->Step_fpga_adagrad(
+		opt->Step_fpga(
 				param_path,
+                exp_avg_path,
                 exp_avg_sq_path,
                 grad_path,
                 _param_size,
@@ -1965,161 +5324,522 @@ int ds_adagrad_step_fpga(int optimizer_id,
     return 0;
 }
 
-int ds_sgd_step_fpga(int optimizer_id,
+int ds_sgd_step(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta,
+                 float weight_decay,
+                 float dampening,
+                 bool nesterov,
+                 torch::Tensor& params,
+                 torch::Tensor& grads,
+                 torch::Tensor& exp_avg)
+{
+    auto params_c = params.contiguous();
+    auto grads_c = grads.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+
+    float* params_ptr = (float*)params_c.data_ptr();
+    float* grads_ptr = (float*)grads_c.data_ptr();
+    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep_(step, beta);
+    opt->update_state(lr, 0.0, weight_decay, false);
+    opt->update_sgd_state(dampening, nesterov);
+
+    opt->Step_SGD_cpu(params_ptr,
+                grads_ptr,
+                exp_avg_ptr,
+                nullptr,
+                params_c.numel(),
+                nullptr,
+                (params.options().dtype() == at::kHalf));
+
+#if defined(__ENABLE_CUDA__)
+    opt->SynchronizeStreams();
+#endif
+
+    return 0;
+}
+
+// ds_sgd_step over a list of tensors in one round of the thread pool, see ds_adam_step_multi
+int ds_sgd_step_multi(int optimizer_id,
+                      size_t step,
+                      float lr,
+                      float beta,
+                      float weight_decay,
+                      float dampening,
+                      bool nesterov,
+                      std::vector<torch::Tensor>& params,
+                      std::vector<torch::Tensor>& grads,
+                      std::vector<torch::Tensor>& exp_avg)
+{
+    const size_t n_tensors = params.size();
+    if (n_tensors == 0) return 0;
+    assert(grads.size() == n_tensors && exp_avg.size() == n_tensors);
+
+    std::vector<torch::Tensor> params_c, grads_c, exp_avg_c;
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < n_tensors; i++) {
+        params_c.push_back(params[i].contiguous());
+        grads_c.push_back(grads[i].contiguous());
+        exp_avg_c.push_back(exp_avg[i].contiguous());
+        sizes.push_back(params_c[i].numel());
+    }
+    const bool half_precision = (params[0].options().dtype() == at::kHalf);
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep_(step, beta);
+    opt->update_state(lr, 0.0, weight_decay, false);
+    opt->update_sgd_state(dampening, nesterov);
+
+    CPU_Thread_Pool::Instance().parallel_for_batch(
+        sizes.data(), n_tensors, [&](size_t i, size_t lo, size_t hi) {
+            opt->Step_SGD_cpu((float*)params_c[i].data_ptr() + lo,
+                              (float*)grads_c[i].data_ptr() + lo,
+                              (float*)exp_avg_c[i].data_ptr() + lo,
+                              nullptr,
+                              hi - lo,
+                              nullptr,
+                              half_precision);
+        });
+
+#if defined(__ENABLE_CUDA__)
+    opt->SynchronizeStreams();
+#endif
+    return 0;
+}
+
+int ds_sgd_step_plus_copy(int optimizer_id,
+                          size_t step,
+                          float lr,
+                          float beta,
+                          float weight_decay,
+                          float dampening,
+                          bool nesterov,
+                          torch::Tensor& params,
+                          torch::Tensor& grads,
+                          torch::Tensor& exp_avg,
+                          torch::Tensor& gpu_params)
+{
+#if defined(__ENABLE_CUDA__)
+    auto params_c = params.contiguous();
+    auto gpu_params_c = gpu_params.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+    auto grads_c = grads.contiguous();
+
+    float* params_ptr = (float*)params_c.data_ptr();
+    float* grads_ptr = (float*)grads_c.data_ptr();
+    ds_half_precision_t* gpu_params_ptr = (ds_half_precision_t*)gpu_params_c.data_ptr();
+    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep_(step, beta);
+    opt->update_state(lr, 0.0, weight_decay, false);
+    opt->update_sgd_state(dampening, nesterov);
+    opt->Step_SGD_cpu(params_ptr,
+                      grads_ptr,
+                      exp_avg_ptr,
+                      nullptr,
+                      params_c.numel(),
+                      gpu_params_ptr,
+                      (params.options().dtype() == at::kHalf));
+
+    opt->SynchronizeStreams();
+#else
+    assert(false);
+#endif
+    return 0;
+}
+
+int ds_sgd_bf16_step(int optimizer_id,
+                     size_t step,
+                     float lr,
+                     float beta,
+                     float weight_decay,
+                     float dampening,
+                     bool nesterov,
+                     uint32_t chunk,
+                     torch::Tensor& params,
+                     torch::Tensor& grads,
+                     torch::Tensor& exp_avg)
+{
+    auto params_c = params.contiguous();
+    auto grads_c = grads.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+
+    uint16_t* params_ptr = (uint16_t*)params_c.data_ptr();
+    float* grads_ptr = (float*)grads_c.data_ptr();
+    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep_(step, beta);
+    opt->update_state(lr, 0.0, weight_decay, false);
+    opt->update_sgd_state(dampening, nesterov);
+
+    opt->Step_SGD_bf16_cpu(params_ptr, grads_ptr, exp_avg_ptr, params_c.numel(), sr_seed(step, chunk));
+
+    return 0;
+}
+
+int ds_lion_step(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float weight_decay,
+                 torch::Tensor& params,
+                 torch::Tensor& grads,
+                 torch::Tensor& exp_avg)
+{
+    auto params_c = params.contiguous();
+    auto grads_c = grads.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+
+    // params and grads are both fp32 or both fp16, the momentum is fp32
+    const bool half_precision = (params.options().dtype() == at::kHalf);
+    assert(half_precision == (grads.options().dtype() == at::kHalf));
+    assert(half_precision || params.options().dtype() == at::kFloat);
+    assert(exp_avg.options().dtype() == at::kFloat);
+
+    float* params_ptr = (float*)params_c.data_ptr();
+    float* grads_ptr = (float*)grads_c.data_ptr();
+    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, 0.0, weight_decay, false);
+	
+    opt->Step_Lion_cpu(params_ptr,
+                grads_ptr,
+                exp_avg_ptr,
+                nullptr,
+                params_c.numel(),
+                nullptr,
+                half_precision);
+
+#if defined(__ENABLE_CUDA__)
+    opt->SynchronizeStreams();
+#endif
+
+    return 0;
+}
+
+int ds_adafactor_step(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float epsilon,
+                 float weight_decay,
+                 torch::Tensor& params,
+                 torch::Tensor& grads,
+                 torch::Tensor& exp_avg,
+                 torch::Tensor& factors,
+                 torch::Tensor& segments,
+                 torch::Tensor& sums,
+                 int phase)
+{
+    auto params_c = params.contiguous();
+    auto grads_c = grads.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+
+    float* params_ptr = (float*)params_c.data_ptr();
+    float* grads_ptr = (float*)grads_c.data_ptr();
+    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, false);
+
+    opt->Step_Adafactor_cpu(params_ptr,
+                grads_ptr,
+                exp_avg_ptr,
+                (float*)factors.data_ptr(),
+                (int*)segments.data_ptr(),
+                segments.size(0),
+                (float*)sums.data_ptr(),
+                phase);
+
+    return 0;
+}
+
+int ds_lamb_step(int optimizer_id,
+                 size_t step,
+                 float lr,
+                 float beta1,
+                 float beta2,
+                 float epsilon,
+                 float weight_decay,
+                 float max_coeff,
+                 float min_coeff,
+                 torch::Tensor& params,
+                 torch::Tensor& grads,
+                 torch::Tensor& exp_avg,
+                 torch::Tensor& exp_avg_sq,
+                 torch::Tensor& segments,
+                 torch::Tensor& norms,
+                 int phase)
+{
+    auto params_c = params.contiguous();
+    auto grads_c = grads.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+    auto exp_avg_sq_c = exp_avg_sq.contiguous();
+
+    float* params_ptr = (float*)params_c.data_ptr();
+    float* grads_ptr = (float*)grads_c.data_ptr();
+    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+    float* exp_avg_sq_ptr = (float*)exp_avg_sq_c.data_ptr();
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, true);
+
+    opt->Step_Lamb_cpu(params_ptr,
+                grads_ptr,
+                exp_avg_ptr,
+                exp_avg_sq_ptr,
+                (int*)segments.data_ptr(),
+                segments.size(0),
+                max_coeff,
+                min_coeff,
+                (float*)norms.data_ptr(),
+                phase);
+
+    return 0;
+}
+
+
+int ds_adam_ema_step(int optimizer_id,
                  size_t step,
                  float lr,
                  float beta1,
+                 float beta2,
+                 float epsilon,
                  float weight_decay,
-				 float combined_unscale,
-				 std::string param_path,
-				 std::string exp_avg_path,
-				 std::string grad_path,
-				 size_t _param_size, 
-				 torch::Tensor& fp16_params,
-				 int device_id,
-				 int largest_numel,
-				 float compression_ratio,
-				 torch::Tensor& grad_idx
-				 )
+                 bool bias_correction,
+                 float ema_decay,
+                 torch::Tensor& params,
+                 torch::Tensor& grads,
+                 torch::Tensor& exp_avg,
+                 torch::Tensor& exp_avg_sq,
+                 torch::Tensor& ema)
 {
-    //auto fp32_params_c = fp32_params.contiguous();
-	//float* fp32_params_ptr = (float*)fp32_params_c.data_ptr();
-    
-	auto fp16_params_c = fp16_params.contiguous();
-	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
+    auto params_c = params.contiguous();
+    auto grads_c = grads.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+    auto exp_avg_sq_c = exp_avg_sq.contiguous();
+    auto ema_c = ema.contiguous();
 
-	std::shared_ptr<Adam_Optimizer> opt =
+    float* params_ptr = (float*)params_c.data_ptr();
+    float* grads_ptr = (float*)grads_c.data_ptr();
+    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+    float* exp_avg_sq_ptr = (float*)exp_avg_sq_c.data_ptr();
+    float* ema_ptr = (float*)ema_c.data_ptr();
+
+    std::shared_ptr<Adam_Optimizer> opt =
         std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
-    opt->IncrementStep_( step, beta1 );
-    opt->update_state(lr, 0.0, weight_decay, false);
-	
-	if (compression_ratio < 0.5){
-		int* grad_idx_ptr = (int*)grad_idx.data_ptr();
-		opt->Step_fpga_sgd_comp(
-				param_path,
-                exp_avg_path,
-                grad_path,
-                _param_size,
-				combined_unscale,
-				fp16_params_ptr,
-				device_id,
-				largest_numel,
-				compression_ratio,
-				grad_idx_ptr
-				);
-	}else{
-		opt->Step_fpga_sgd(
-				param_path,
-                exp_avg_path,
-                grad_path,
-                _param_size,
-				combined_unscale,
-				fp16_params_ptr,
-				device_id,
-				largest_numel
-				);
-	}
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
+
+    opt->Step_AdamEma_cpu(params_ptr, grads_ptr, exp_avg_ptr, exp_avg_sq_ptr, ema_ptr, ema_decay, params_c.numel());
+
     return 0;
 }
 
-
-int ds_adam_step_fpga(int optimizer_id,
+int ds_adam_bf16_step(int optimizer_id,
                  size_t step,
                  float lr,
                  float beta1,
                  float beta2,
                  float epsilon,
                  float weight_decay,
-                 bool bias_correction, 
-				 float combined_unscale,
-				 std::string param_path,
-				 std::string exp_avg_path,
-				 std::string exp_avg_sq_path,
-				 std::string grad_path,
-				 size_t _param_size, 
-				 //torch::Tensor& fp32_params,
-				 torch::Tensor& fp16_params,
-				 int device_id,
-				 int largest_numel,
-				 float compression_ratio,
-				 torch::Tensor& grad_idx
-				 )
+                 bool bias_correction,
+                 uint32_t chunk,
+                 torch::Tensor& params,
+                 torch::Tensor& grads,
+                 torch::Tensor& exp_avg,
+                 torch::Tensor& exp_avg_sq)
 {
-    //auto fp32_params_c = fp32_params.contiguous();
-	//float* fp32_params_ptr = (float*)fp32_params_c.data_ptr();
-    
-	auto fp16_params_c = fp16_params.contiguous();
-	half* fp16_params_ptr = (half*)fp16_params_c.data_ptr();
+    auto params_c = params.contiguous();
+    auto grads_c = grads.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+    auto exp_avg_sq_c = exp_avg_sq.contiguous();
 
-	std::shared_ptr<Adam_Optimizer> opt =
+    uint16_t* params_ptr = (uint16_t*)params_c.data_ptr();
+    float* grads_ptr = (float*)grads_c.data_ptr();
+    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+    float* exp_avg_sq_ptr = (float*)exp_avg_sq_c.data_ptr();
+
+    std::shared_ptr<Adam_Optimizer> opt =
         std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
     opt->IncrementStep(step, beta1, beta2);
     opt->update_state(lr, epsilon, weight_decay, bias_correction);
-	
-	if (compression_ratio < 0.5){
-		int* grad_idx_ptr = (int*)grad_idx.data_ptr();
-		opt->Step_fpga_comp(
-				param_path,
-                exp_avg_path,
-                exp_avg_sq_path,
-                grad_path,
-                _param_size,
-				combined_unscale,
-				fp16_params_ptr,
-				device_id,
-				largest_numel,
-				compression_ratio,
-				grad_idx_ptr
-				);
-	}else{
-		opt->Step_fpga(
-				param_path,
-                exp_avg_path,
-                exp_avg_sq_path,
-                grad_path,
-                _param_size,
-				combined_unscale,
-				fp16_params_ptr,
-				device_id,
-				largest_numel
-				);
-	}
+
+    opt->Step_Bf16_cpu(params_ptr, grads_ptr, exp_avg_ptr, exp_avg_sq_ptr, params_c.numel(), sr_seed(step, chunk));
+
     return 0;
 }
 
-int ds_sgd_step(int optimizer_id,
+// Adam with bf16 exp_avg/exp_avg_sq, updated in fp32. stochastic rounds the moments
+// stochastically, seeded like ds_adam_bf16_step. fp16 moments are not supported: exp_avg_sq
+// underflows to zero for realistic gradient magnitudes.
+int ds_adam_bf16_moments_step(int optimizer_id,
+                              size_t step,
+                              float lr,
+                              float beta1,
+                              float beta2,
+                              float epsilon,
+                              float weight_decay,
+                              bool bias_correction,
+                              bool stochastic,
+                              uint32_t chunk,
+                              torch::Tensor& params,
+                              torch::Tensor& grads,
+                              torch::Tensor& exp_avg,
+                              torch::Tensor& exp_avg_sq)
+{
+    auto params_c = params.contiguous();
+    auto grads_c = grads.contiguous();
+    auto exp_avg_c = exp_avg.contiguous();
+    auto exp_avg_sq_c = exp_avg_sq.contiguous();
+
+    assert(exp_avg.options().dtype() == at::kBFloat16);
+    assert(exp_avg_sq.options().dtype() == at::kBFloat16);
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
+
+    opt->Step_Bf16Moments_cpu((float*)params_c.data_ptr(),
+                              (float*)grads_c.data_ptr(),
+                              (uint16_t*)exp_avg_c.data_ptr(),
+                              (uint16_t*)exp_avg_sq_c.data_ptr(),
+                              params_c.numel(),
+                              (params.options().dtype() == at::kHalf),
+                              stochastic,
+                              sr_seed(step, chunk));
+
+    return 0;
+}
+
+// Lazy Adam over a sparse gradient: grad_idx holds increasing, distinct int64 flat indices
+// into params and grad_val their fp32 values. lazy_step is the int32 step of every lazy_block
+// elements of params, zero for a fresh state.
+int ds_adam_lazy_step(int optimizer_id,
+                      size_t step,
+                      float lr,
+                      float beta1,
+                      float beta2,
+                      float epsilon,
+                      float weight_decay,
+                      bool bias_correction,
+                      size_t lazy_block,
+                      torch::Tensor& params,
+                      torch::Tensor& grad_idx,
+                      torch::Tensor& grad_val,
+                      torch::Tensor& exp_avg,
+                      torch::Tensor& exp_avg_sq,
+                      torch::Tensor& lazy_step)
+{
+    auto grad_idx_c = grad_idx.contiguous();
+    auto grad_val_c = grad_val.contiguous();
+
+    assert(params.is_contiguous() && exp_avg.is_contiguous() && exp_avg_sq.is_contiguous());
+    assert(grad_idx.options().dtype() == at::kLong && grad_idx.numel() == grad_val.numel());
+    assert(lazy_block > 0 && lazy_step.numel() == (params.numel() + lazy_block - 1) / lazy_block);
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
+
+    opt->Step_Lazy_cpu((float*)params.data_ptr(),
+                       (const int64_t*)grad_idx_c.data_ptr(),
+                       (const float*)grad_val_c.data_ptr(),
+                       grad_idx_c.numel(),
+                       (float*)exp_avg.data_ptr(),
+                       (float*)exp_avg_sq.data_ptr(),
+                       (int*)lazy_step.data_ptr(),
+                       lazy_block,
+                       params.numel());
+
+    return 0;
+}
+
+// Applies the decays the lazy steps skipped up to step, see ds_adam_lazy_step
+int ds_adam_lazy_flush(int optimizer_id,
+                       size_t step,
+                       float lr,
+                       float beta1,
+                       float beta2,
+                       float weight_decay,
+                       size_t lazy_block,
+                       torch::Tensor& params,
+                       torch::Tensor& exp_avg,
+                       torch::Tensor& exp_avg_sq,
+                       torch::Tensor& lazy_step)
+{
+    assert(params.is_contiguous() && exp_avg.is_contiguous() && exp_avg_sq.is_contiguous());
+    assert(lazy_block > 0 && lazy_step.numel() == (params.numel() + lazy_block - 1) / lazy_block);
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, 0, weight_decay, false);
+
+    opt->Lazy_Flush_cpu((float*)params.data_ptr(),
+                        (float*)exp_avg.data_ptr(),
+                        (float*)exp_avg_sq.data_ptr(),
+                        (int*)lazy_step.data_ptr(),
+                        lazy_block,
+                        params.numel());
+
+    return 0;
+}
+
+int ds_adam8bit_step(int optimizer_id,
                  size_t step,
                  float lr,
-                 float beta,
+                 float beta1,
+                 float beta2,
+                 float epsilon,
                  float weight_decay,
+                 bool bias_correction,
                  torch::Tensor& params,
                  torch::Tensor& grads,
-                 torch::Tensor& exp_avg)
+                 torch::Tensor& exp_avg,
+                 torch::Tensor& exp_avg_sq)
 {
     auto params_c = params.contiguous();
     auto grads_c = grads.contiguous();
-    auto exp_avg_c = exp_avg.contiguous();
 
     float* params_ptr = (float*)params_c.data_ptr();
     float* grads_ptr = (float*)grads_c.data_ptr();
-    float* exp_avg_ptr = (float*)exp_avg_c.data_ptr();
+    // exp_avg/exp_avg_sq are fp32 tensors used as storage for the 8-bit layout
+    size_t n = params_c.numel();
+    size_t qbytes = quantized_scale_offset(n) + (n + QBLOCK - 1) / QBLOCK * sizeof(float);
+    if (std::min(exp_avg.numel(), exp_avg_sq.numel()) * sizeof(float) < qbytes)
+        throw std::invalid_argument("8-bit Adam states of " + std::to_string(n) + " elements need " +
+                                    std::to_string(qbytes) + " bytes");
+    float* exp_avg_ptr = (float*)exp_avg.data_ptr();
+    float* exp_avg_sq_ptr = (float*)exp_avg_sq.data_ptr();
 
     std::shared_ptr<Adam_Optimizer> opt =
         std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
-    opt->IncrementStep_(step, beta);
-    opt->update_state(lr, 0.0, weight_decay, false);
-	
-    opt->Step_SGD_cpu(params_ptr,
-                grads_ptr,
-                exp_avg_ptr,
-                nullptr,
-                params_c.numel(),
-                nullptr,
-                (params.options().dtype() == at::kHalf));
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
 
-#if defined(__ENABLE_CUDA__)
-    opt->SynchronizeStreams();
-#endif
+    opt->Step_Adam8bit_cpu(params_ptr, grads_ptr, exp_avg_ptr, exp_avg_sq_ptr, n);
 
     return 0;
 }
@@ -2175,6 +5895,197 @@ int ds_adam_step(int optimizer_id,
     return 0;
 }
 
+// Element k of a contiguous tensor of fp32 or fp16 values, as the float* the kernels take
+static inline float* tensor_at(torch::Tensor& t, size_t k, bool half_precision)
+{
+    return half_precision ? (float*)((ds_half_precision_t*)t.data_ptr() + k) : (float*)t.data_ptr() + k;
+}
+
+// Contiguous views of the tensors of a multi-tensor step. params_lp, if not empty, receives
+// an fp16 or bf16 copy of the updated params and is written in place, so it must be contiguous.
+struct adam_tensor_lists {
+    std::vector<torch::Tensor> params, grads, exp_avg, exp_avg_sq, params_lp;
+    std::vector<size_t> sizes;
+    bool half_precision = false;
+    bool lp_bf16 = false;
+
+    adam_tensor_lists(std::vector<torch::Tensor>& p,
+                      std::vector<torch::Tensor>& g,
+                      std::vector<torch::Tensor>& m,
+                      std::vector<torch::Tensor>& v)
+    {
+        assert(g.size() == p.size() && m.size() == p.size() && v.size() == p.size());
+        for (size_t i = 0; i < p.size(); i++) {
+            params.push_back(p[i].contiguous());
+            grads.push_back(g[i].contiguous());
+            exp_avg.push_back(m[i].contiguous());
+            exp_avg_sq.push_back(v[i].contiguous());
+            sizes.push_back(params[i].numel());
+        }
+        if (!p.empty()) half_precision = (p[0].options().dtype() == at::kHalf);
+    }
+
+    void set_params_lp(std::vector<torch::Tensor>& lp)
+    {
+        if (lp.empty()) return;
+        assert(lp.size() == params.size());
+        lp_bf16 = (lp[0].options().dtype() == at::kBFloat16);
+        for (size_t i = 0; i < lp.size(); i++) {
+            assert(lp[i].is_contiguous() && (size_t)lp[i].numel() == sizes[i]);
+            assert(lp[i].options().dtype() == (lp_bf16 ? at::kBFloat16 : at::kHalf));
+        }
+        params_lp = lp;
+    }
+
+    uint16_t* param_lp_at(size_t i, size_t k)
+    {
+        return params_lp.empty() ? nullptr : (uint16_t*)params_lp[i].data_ptr() + k;
+    }
+};
+
+// Updates all tensors in a single round of the thread pool. A slice runs on a pool worker,
+// where the kernel's own parallel_for runs inline.
+static void adam_step_lists(Adam_Optimizer* opt, adam_tensor_lists& t)
+{
+    const bool half_precision = t.half_precision;
+    size_t total = 0;
+    for (size_t size : t.sizes) total += size;
+    opt->set_stream(total >= ds_stream_min());
+    CPU_Thread_Pool::Instance().parallel_for_batch(
+        t.sizes.data(), t.sizes.size(), [&](size_t i, size_t lo, size_t hi) {
+            float* params = tensor_at(t.params[i], lo, half_precision);
+            float* grads = tensor_at(t.grads[i], lo, half_precision);
+            float* exp_avg = (float*)t.exp_avg[i].data_ptr() + lo;
+            float* exp_avg_sq = (float*)t.exp_avg_sq[i].data_ptr() + lo;
+#if ACC_TYPE == DS_CPU
+            opt->Step_8(params, grads, exp_avg, exp_avg_sq, hi - lo, nullptr, half_precision,
+                        t.param_lp_at(i, lo), t.lp_bf16);
+#elif ACC_TYPE == CPU
+            opt->Step_cpu(params, grads, exp_avg, exp_avg_sq, hi - lo, nullptr, half_precision);
+#elif ACC_TYPE == GPU
+            opt->Step_gpu(params, grads, exp_avg, exp_avg_sq, hi - lo, nullptr, half_precision);
+#endif
+        });
+    opt->set_stream(-1);
+#if ACC_TYPE != DS_CPU
+    for (size_t i = 0; i < t.params_lp.size(); i++) t.params_lp[i].copy_(t.params[i]);
+#endif
+}
+
+// One step over a list of tensors, the CPU counterpart of multi_tensor_adam.cu. The tensors are
+// cut into balanced slices of their concatenation and updated in a single round of the thread
+// pool, so small tensors share a dispatch. All tensors share the step and the dtype. A non-empty
+// params_lp gets the fp16/bf16 copy of the new params from the same pass, in place of a
+// separate copy_() over the fp32 params.
+int ds_adam_step_multi(int optimizer_id,
+                       size_t step,
+                       float lr,
+                       float beta1,
+                       float beta2,
+                       float epsilon,
+                       float weight_decay,
+                       bool bias_correction,
+                       std::vector<torch::Tensor>& params,
+                       std::vector<torch::Tensor>& grads,
+                       std::vector<torch::Tensor>& exp_avg,
+                       std::vector<torch::Tensor>& exp_avg_sq,
+                       std::vector<torch::Tensor>& params_lp)
+{
+    if (params.empty()) return 0;
+    adam_tensor_lists lists(params, grads, exp_avg, exp_avg_sq);
+    lists.set_params_lp(params_lp);
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
+    adam_step_lists(opt.get(), lists);
+
+#if defined(__ENABLE_CUDA__)
+    opt->SynchronizeStreams();
+#endif
+    return 0;
+}
+
+// Sum of squares of the gradients, multiplied by combined_unscale, into result[RESULT_SUMSQ],
+// and result[RESULT_OVERFLOW] set if any of them is inf or NaN. grads may mix fp32 and fp16
+// tensors, e.g. those of every batch of every param group, and are read in a single round of
+// the thread pool. It runs before ds_adam_step_multi_scaled updates any of them, so an
+// overflow can skip the whole step and the clip can come from the global norm.
+int ds_adam_grad_check_multi(int optimizer_id,
+                             float combined_unscale,
+                             std::vector<torch::Tensor>& grads,
+                             torch::Tensor& result)
+{
+    float* result_ptr = (float*)result.data_ptr();
+    result_ptr[RESULT_SUMSQ] = 0.0f;
+    result_ptr[RESULT_OVERFLOW] = 0.0f;
+    if (grads.empty()) return 0;
+    std::vector<torch::Tensor> grads_c;
+    std::vector<size_t> sizes;
+    for (auto& g : grads) {
+        assert(g.options().dtype() == at::kFloat || g.options().dtype() == at::kHalf);
+        grads_c.push_back(g.contiguous());
+        sizes.push_back(g.numel());
+    }
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->take_grad_overflow();
+    opt->set_grad_unscale(combined_unscale);
+    double sumsq = 0.0;
+    std::mutex sumsq_mutex;
+    CPU_Thread_Pool::Instance().parallel_for_batch(
+        sizes.data(), sizes.size(), [&](size_t i, size_t lo, size_t hi) {
+            bool half_precision = (grads_c[i].options().dtype() == at::kHalf);
+            double part =
+                opt->GradSumSq_cpu(tensor_at(grads_c[i], lo, half_precision), hi - lo, half_precision);
+            std::lock_guard<std::mutex> lock(sumsq_mutex);
+            sumsq += part;
+        });
+    result_ptr[RESULT_SUMSQ] = sumsq;
+    if (opt->take_grad_overflow()) result_ptr[RESULT_OVERFLOW] = 1.0f;
+    opt->set_grad_unscale(1.0f);
+    return 0;
+}
+
+// ds_adam_step_multi on gradients that are still loss scaled, the way the device kernels take
+// them: they are multiplied by combined_unscale, with any clip folded in, as they are loaded.
+// ds_adam_grad_check_multi must have found them finite.
+int ds_adam_step_multi_scaled(int optimizer_id,
+                              size_t step,
+                              float lr,
+                              float beta1,
+                              float beta2,
+                              float epsilon,
+                              float weight_decay,
+                              bool bias_correction,
+                              float combined_unscale,
+                              std::vector<torch::Tensor>& params,
+                              std::vector<torch::Tensor>& grads,
+                              std::vector<torch::Tensor>& exp_avg,
+                              std::vector<torch::Tensor>& exp_avg_sq,
+                              std::vector<torch::Tensor>& params_lp)
+{
+    if (params.empty()) return 0;
+    adam_tensor_lists lists(params, grads, exp_avg, exp_avg_sq);
+    lists.set_params_lp(params_lp);
+
+    std::shared_ptr<Adam_Optimizer> opt =
+        std::static_pointer_cast<Adam_Optimizer>(s_optimizers[optimizer_id]);
+    opt->set_grad_unscale(combined_unscale);
+    opt->IncrementStep(step, beta1, beta2);
+    opt->update_state(lr, epsilon, weight_decay, bias_correction);
+    adam_step_lists(opt.get(), lists);
+    opt->take_grad_overflow();
+    opt->set_grad_unscale(1.0f);
+
+#if defined(__ENABLE_CUDA__)
+    opt->SynchronizeStreams();
+#endif
+    return 0;
+}
+
 int ds_adam_step_plus_copy(int optimizer_id,
                            size_t step,
                            float lr,
@@ -2221,6 +6132,31 @@ int ds_adam_step_plus_copy(int optimizer_id,
     return 0;
 }
 
+// Sum of squares and inf/NaN flag of one gradient sub group, written to result[0:2]
+// once sync_thread() returns. Gradients are still loss scaled.
+void ds_grad_norm_fpga(std::string grad_path,
+				 size_t _param_size,
+				 size_t aligned_size,
+				 int device_id,
+				 torch::Tensor& result)
+{
+	float* result_ptr = (float*)result.data_ptr();
+
+	threads.push_back(std::thread(thread_work_grad_norm,
+		grad_path,
+		_param_size,
+		aligned_size,
+		device_id,
+		result_ptr
+		));
+}
+
+// Checksums the swapped Adam state on the device (krnl_crc) from the next step on
+void ds_set_crc(bool enable) { check_crc = enable; }
+
+// Sidecar mismatches seen by the steps since the last call
+long long ds_crc_errors() { return crc_errors.exchange(0); }
+
 int destroy_adam_optimizer(int optimizer_id)
 {
 	assert(false);	
@@ -2240,6 +6176,25 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 {
     m.def("adam_update", &ds_adam_step, "DeepSpeed CPU Adam update (C++)");
 	m.def("sgd_update", &ds_sgd_step, "SmartInfinity SGD update (C++)");
+    m.def("adam_update_multi", &ds_adam_step_multi, "DeepSpeed CPU Adam update of a list of tensors (C++)");
+    m.def("adam_grad_check_multi",
+          &ds_adam_grad_check_multi,
+          "DeepSpeed CPU Adam inf/NaN check and norm of loss scaled gradients (C++)");
+    m.def("adam_update_multi_scaled",
+          &ds_adam_step_multi_scaled,
+          "DeepSpeed CPU Adam update of loss scaled gradients (C++)");
+	m.def("sgd_update_multi", &ds_sgd_step_multi, "SmartInfinity SGD update of a list of tensors (C++)");
+	m.def("sgd_update_copy", &ds_sgd_step_plus_copy, "SmartInfinity SGD update and param copy (C++)");
+	m.def("sgd_bf16_update", &ds_sgd_bf16_step, "SmartInfinity SGD update with bf16 master weights (C++)");
+	m.def("lion_update", &ds_lion_step, "SmartInfinity Lion update (C++)");
+	m.def("adafactor_update", &ds_adafactor_step, "SmartInfinity Adafactor update (C++)");
+	m.def("lamb_update", &ds_lamb_step, "SmartInfinity LAMB update (C++)");
+	m.def("adam8bit_update", &ds_adam8bit_step, "SmartInfinity Adam update with 8-bit states (C++)");
+	m.def("adam_ema_update", &ds_adam_ema_step, "SmartInfinity Adam update with EMA weights (C++)");
+	m.def("adam_bf16_update", &ds_adam_bf16_step, "SmartInfinity Adam update with bf16 master weights (C++)");
+	m.def("adam_bf16_moments_update", &ds_adam_bf16_moments_step, "SmartInfinity Adam update with bf16 moments (C++)");
+	m.def("adam_lazy_update", &ds_adam_lazy_step, "SmartInfinity lazy Adam update of a sparse gradient (C++)");
+	m.def("adam_lazy_flush", &ds_adam_lazy_flush, "SmartInfinity lazy Adam decays up to the current step (C++)");
     m.def("adam_update_copy",
           &ds_adam_step_plus_copy,
           "DeepSpeed CPU Adam update and param copy (C++)");
@@ -2251,6 +6206,16 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 	m.def("adam_update_fpga", &ds_adam_step_fpga, "FPGA Adam update (C++)");
 	m.def("adagrad_update_fpga", &ds_adagrad_step_fpga, "FPGA Adagrad update (C++)");
 	m.def("sgd_update_fpga", &ds_sgd_step_fpga, "FPGA sgd update (C++)");
+	m.def("lion_update_fpga", &ds_lion_step_fpga, "FPGA lion update (C++)");
+	m.def("adafactor_update_fpga", &ds_adafactor_step_fpga, "FPGA adafactor update (C++)");
+	m.def("lamb_update_fpga", &ds_lamb_step_fpga, "FPGA lamb update (C++)");
+	m.def("adam8bit_update_fpga", &ds_adam8bit_step_fpga, "FPGA adam update with 8-bit states (C++)");
+	m.def("adam_ema_update_fpga", &ds_adam_ema_step_fpga, "FPGA adam update with EMA weights (C++)");
+	m.def("adam_bf16_update_fpga", &ds_adam_bf16_step_fpga, "FPGA adam update with bf16 master weights (C++)");
+	m.def("bf16_master_pack", &ds_bf16_master_pack, "Convert a param swap file to bf16 master weights (C++)");
+	m.def("grad_norm_fpga", &ds_grad_norm_fpga, "FPGA gradient sum of squares and inf/NaN check (C++)");
+	m.def("set_crc", &ds_set_crc, "FPGA CRC32C of the swapped Adam state (C++)");
+	m.def("crc_errors", &ds_crc_errors, "CRC32C sidecar mismatches since the last call (C++)");
 	
 	m.def("sync_thread", &sync_thread, "FPGA Threads Sync (C++)");
 }
@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+// The vector Adam steps compiled for AVX2 (with FMA and F16C), run through Step_SIMD when
+// ds_simd_isa() picks this level. Only the code between DS_SIMD_TARGET_PUSH and DS_SIMD_TARGET_POP uses the
+// wider instructions, the rest of the headers stays at the baseline.
+
+#if (__x86_64__ || __i386__)
+
+#undef __AVX512__
+#define __AVX256__
+#include "cpu_adam.h"
+
+template void Adam_Optimizer::Step_AVX<1, DS_SIMD_LEVEL>(
+    size_t*, float*, float*, float*, float*, size_t, ds_half_precision_t*, bool, uint16_t*, bool);
+template void Adam_Optimizer::Step_AVX<4, DS_SIMD_LEVEL>(
+    size_t*, float*, float*, float*, float*, size_t, ds_half_precision_t*, bool, uint16_t*, bool);
+template void Adam_Optimizer::Step_AVX<8, DS_SIMD_LEVEL>(
+    size_t*, float*, float*, float*, float*, size_t, ds_half_precision_t*, bool, uint16_t*, bool);
+template void Adam_Optimizer::GradSumSq_AVX<8, DS_SIMD_LEVEL>(size_t*, float*, size_t, bool, double*);
+template void Adam_Optimizer::Step_AVX_bf16<8, DS_SIMD_LEVEL>(
+    size_t*, uint16_t*, float*, float*, float*, size_t, uint32_t);
+template void Adam_Optimizer::Step_AVX_bf16_moments<8, DS_SIMD_LEVEL>(
+    size_t*, float*, float*, uint16_t*, uint16_t*, size_t, bool, bool, uint32_t);
+template void Adam_Optimizer::Step_AVX_SGD<8, DS_SIMD_LEVEL>(
+    size_t*, float*, float*, float*, size_t, ds_half_precision_t*, bool);
+template void Adam_Optimizer::Step_AVX_SGD_bf16<8, DS_SIMD_LEVEL>(
+    size_t*, uint16_t*, float*, float*, size_t, uint32_t);
+
+#endif
@@ -11,6 +11,7 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 */
 
 #include "deepspeed_py_aio_handle.h"
+#include "crc32c.h"
 
 using namespace std;
 
@@ -20,11 +21,13 @@ deepspeed_aio_handle_t::deepspeed_aio_handle_t(const int block_size,
                                                const int queue_depth,
                                                const bool single_submit,
                                                const bool overlap_events,
-                                               const int num_threads)
+                                               const int num_threads,
+                                               const bool crc)
     : _aio_ctxt(new aio_context(block_size, queue_depth)),
       _single_submit(single_submit),
       _overlap_events(overlap_events),
       _num_threads(num_threads),
+      _crc(crc),
       _aio_config(block_size, queue_depth, single_submit, overlap_events, false),
       _num_pending_ops(0),
       _pinned_tensor_mgr(new deepspeed_pin_tensor_t())
@@ -60,6 +63,8 @@ const bool deepspeed_aio_handle_t::get_overlap_events() const { return _overlap_
 
 const int deepspeed_aio_handle_t::get_thread_count() const { return _num_threads; }
 
+const bool deepspeed_aio_handle_t::get_crc() const { return _crc; }
+
 int deepspeed_aio_handle_t::read(torch::Tensor& buffer, const char* filename, const bool validate)
 {
     const auto start_time = std::chrono::high_resolution_clock::now();
@@ -189,13 +194,34 @@ int deepspeed_aio_handle_t::wait()
                                    completed_op->data_ptr(),
                                    _num_threads * completed_op->_num_bytes);
         }
+        // a read that fails its checksums is not counted as completed
+        const bool crc_ok = !_crc || _check_crc(completed_op);
         --_num_pending_ops;
-        ++num_completed_ops;
+        if (crc_ok) { ++num_completed_ops; }
     }
 
     return num_completed_ops;
 }
 
+// Writes record the chunk checksums of the buffer in the sidecar of the file, reads compare
+// against it. The data is already in memory, so no extra file bytes are read.
+bool deepspeed_aio_handle_t::_check_crc(std::shared_ptr<struct io_op_desc_t> completed_op)
+{
+    const auto num_bytes = _num_threads * completed_op->_num_bytes;
+    const auto filename = completed_op->_filename.c_str();
+
+    std::vector<uint32_t> crcs(crc_n_chunks(num_bytes));
+    crc32c_chunks(completed_op->data_ptr(), num_bytes, crcs.data());
+
+    if (completed_op->_read_op) { return verify_crc_sidecar(filename, crcs.data(), num_bytes) <= 0; }
+
+    if (!write_crc_sidecar(filename, crcs.data(), num_bytes)) {
+        const auto error_code = errno;
+        report_file_error(crc_sidecar_path(filename).c_str(), " write of checksums", error_code);
+    }
+    return true;
+}
+
 bool deepspeed_aio_handle_t::_is_valid_parallel_aio_op(const bool read_op,
                                                        const long long int num_bytes)
 {
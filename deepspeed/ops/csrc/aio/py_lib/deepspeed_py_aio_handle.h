@@ -17,6 +17,8 @@ struct deepspeed_aio_handle_t {
     const bool _single_submit;
     const bool _overlap_events;
     const int _num_threads;
+    // chunked CRC32C sidecars for pwrite/pread, see csrc/includes/crc32c.h
+    const bool _crc;
     deepspeed_aio_config_t _aio_config;
 
     std::vector<std::shared_ptr<struct deepspeed_aio_thread_t>> _thread_contexts;
@@ -28,7 +30,8 @@ struct deepspeed_aio_handle_t {
                            const int queue_depth,
                            const bool single_submit,
                            const bool overlap_events,
-                           const int num_threads);
+                           const int num_threads,
+                           const bool crc);
 
     ~deepspeed_aio_handle_t();
 
@@ -37,6 +40,7 @@ struct deepspeed_aio_handle_t {
     const bool get_single_submit() const;
     const bool get_overlap_events() const;
     const int get_thread_count() const;
+    const bool get_crc() const;
 
     int read(torch::Tensor& buffer, const char* filename, const bool validate);
 
@@ -74,4 +78,6 @@ struct deepspeed_aio_handle_t {
     std::shared_ptr<struct io_op_desc_t> _wait_for_aio_work();
 
     bool _is_valid_parallel_aio_op(const bool read_op, const long long int num_bytes);
+
+    bool _check_crc(std::shared_ptr<struct io_op_desc_t> completed_op);
 };
@@ -0,0 +1,188 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+// bf16 master weights with stochastic rounding.
+//
+// The update runs in fp32 and the new weight is rounded to bf16 by adding a 16-bit random
+// value to the fp32 bits before truncating, so the expected bf16 value equals the fp32 value.
+// The random bits come from a counter-based hash of (seed, element index): seed is derived
+// from the step and the chunk (sub group) the weights belong to, so the result does not depend
+// on threading or vector width and the device (hls_smartInfinity/src/kernel_cpp/bf16_round.h)
+// produces the same bits.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "simd.h"
+
+// lowbias32 integer hash
+static inline uint32_t sr_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline uint32_t sr_seed(uint32_t step, uint32_t chunk) { return sr_hash(step * 0x9e3779b9u ^ sr_hash(chunk)); }
+
+static inline float bf16_to_float(uint16_t b)
+{
+    uint32_t bits = (uint32_t)b << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// k is the index of the element within its chunk
+static inline uint16_t float_to_bf16_sr(float f, uint32_t seed, uint32_t k)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    if ((bits & 0x7fffffffu) > 0x7f800000u) return (uint16_t)((bits >> 16) | 0x0040);  // quiet NaN
+    return (uint16_t)((bits + (sr_hash(seed ^ k) & 0xffffu)) >> 16);
+}
+
+// Round to nearest even, used once to turn fp32 weights into the bf16 master
+static inline uint16_t float_to_bf16_rne(float f)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    if ((bits & 0x7fffffffu) > 0x7f800000u) return (uint16_t)((bits >> 16) | 0x0040);
+    return (uint16_t)((bits + 0x7fffu + ((bits >> 16) & 1)) >> 16);
+}
+
+#if defined(__AVX512__) or defined(__AVX256__)
+
+DS_SIMD_TARGET_PUSH
+inline namespace DS_SIMD_NS {
+
+#if defined(__AVX512__)
+#define SIMD_INT __m512i
+#define SIMD_SET_INT(x) _mm512_set1_epi32(x)
+#define SIMD_XOR_INT(x, y) _mm512_xor_si512(x, y)
+#define SIMD_AND_INT(x, y) _mm512_and_si512(x, y)
+#define SIMD_ADD_INT(x, y) _mm512_add_epi32(x, y)
+#define SIMD_MUL_INT(x, y) _mm512_mullo_epi32(x, y)
+#define SIMD_SRL_INT(x, n) _mm512_srli_epi32(x, n)
+#define SIMD_CAST_INT(x) _mm512_castps_si512(x)
+#define SIMD_IOTA _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+#else
+#define SIMD_INT __m256i
+#define SIMD_SET_INT(x) _mm256_set1_epi32(x)
+#define SIMD_XOR_INT(x, y) _mm256_xor_si256(x, y)
+#define SIMD_AND_INT(x, y) _mm256_and_si256(x, y)
+#define SIMD_ADD_INT(x, y) _mm256_add_epi32(x, y)
+#define SIMD_MUL_INT(x, y) _mm256_mullo_epi32(x, y)
+#define SIMD_SRL_INT(x, n) _mm256_srli_epi32(x, n)
+#define SIMD_CAST_INT(x) _mm256_castps_si256(x)
+#define SIMD_IOTA _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+#endif
+
+inline SIMD_INT simd_sr_hash(SIMD_INT x)
+{
+    x = SIMD_XOR_INT(x, SIMD_SRL_INT(x, 16));
+    x = SIMD_MUL_INT(x, SIMD_SET_INT(0x7feb352d));
+    x = SIMD_XOR_INT(x, SIMD_SRL_INT(x, 15));
+    x = SIMD_MUL_INT(x, SIMD_SET_INT((int)0x846ca68bu));
+    x = SIMD_XOR_INT(x, SIMD_SRL_INT(x, 16));
+    return x;
+}
+
+// n valid elements, as simd_load(..., n) in simd.h
+template <int span>
+inline void simd_load_bf16(AVX_Data* dst, const uint16_t* src, size_t n = SIMD_WIDTH * span)
+{
+#pragma unroll
+    for (size_t i = 0; i < span; ++i) {
+        const uint16_t* s = src + SIMD_WIDTH * i;
+        size_t lanes = simd_lanes(n, i);
+#if defined(__AVX512__)
+        __m256i h = (lanes == SIMD_WIDTH) ? _mm256_loadu_si256((const __m256i*)s)
+                                          : _mm256_maskz_loadu_epi16((__mmask16)((1u << lanes) - 1), s);
+        dst[i].data = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+#else
+        alignas(16) uint16_t buf[SIMD_WIDTH] = {0};
+        if (lanes < SIMD_WIDTH) {
+            memcpy(buf, s, lanes * sizeof(uint16_t));
+            s = buf;
+        }
+        __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)s));
+        dst[i].data = _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+#endif
+    }
+}
+
+// Stores the high halves of bits, the lanes where src is NaN as a quiet NaN. Only the first
+// lanes elements are written.
+inline void simd_pack_bf16(uint16_t* dst, SIMD_INT bits, const AVX_Data& src, size_t lanes)
+{
+    bits = SIMD_SRL_INT(bits, 16);
+#if defined(__AVX512__)
+    __mmask16 nan = _mm512_cmp_ps_mask(src.data, src.data, _CMP_UNORD_Q);
+    bits = _mm512_mask_or_epi32(bits, nan, SIMD_SRL_INT(SIMD_CAST_INT(src.data), 16), SIMD_SET_INT(0x0040));
+    __m256i h = _mm512_cvtepi32_epi16(bits);
+    if (lanes == SIMD_WIDTH)
+        _mm256_storeu_si256((__m256i*)dst, h);
+    else
+        _mm256_mask_storeu_epi16(dst, (__mmask16)((1u << lanes) - 1), h);
+#else
+    __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(src.data, src.data, _CMP_UNORD_Q));
+    __m256i qnan = _mm256_or_si256(SIMD_SRL_INT(SIMD_CAST_INT(src.data), 16), SIMD_SET_INT(0x0040));
+    bits = _mm256_blendv_epi8(bits, qnan, nan);
+    // pack within the 128-bit lanes, then gather the two low halves
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(bits, bits), 0xd8);
+    if (lanes == SIMD_WIDTH) {
+        _mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(packed));
+    } else {
+        alignas(16) uint16_t buf[SIMD_WIDTH];
+        _mm_store_si128((__m128i*)buf, _mm256_castsi256_si128(packed));
+        memcpy(dst, buf, lanes * sizeof(uint16_t));
+    }
+#endif
+}
+
+// Stores src[i] with stochastic rounding, element j of the span has index k + j. Only the first
+// n elements are written.
+template <int span>
+inline void simd_store_bf16_sr(uint16_t* dst,
+                               AVX_Data* src,
+                               uint32_t seed,
+                               uint32_t k,
+                               size_t n = SIMD_WIDTH * span)
+{
+#pragma unroll
+    for (size_t i = 0; i < span; ++i) {
+        size_t lanes = simd_lanes(n, i);
+        if (lanes == 0) continue;
+        SIMD_INT idx = SIMD_ADD_INT(SIMD_SET_INT((int)(k + SIMD_WIDTH * i)), SIMD_IOTA);
+        SIMD_INT rnd = SIMD_AND_INT(simd_sr_hash(SIMD_XOR_INT(idx, SIMD_SET_INT((int)seed))), SIMD_SET_INT(0xffff));
+        simd_pack_bf16(dst + SIMD_WIDTH * i, SIMD_ADD_INT(SIMD_CAST_INT(src[i].data), rnd), src[i], lanes);
+    }
+}
+
+// Stores src[i] rounded to nearest even, as float_to_bf16_rne
+template <int span>
+inline void simd_store_bf16(uint16_t* dst, AVX_Data* src, size_t n = SIMD_WIDTH * span)
+{
+#pragma unroll
+    for (size_t i = 0; i < span; ++i) {
+        size_t lanes = simd_lanes(n, i);
+        if (lanes == 0) continue;
+        SIMD_INT bits = SIMD_CAST_INT(src[i].data);
+        SIMD_INT rnd = SIMD_ADD_INT(SIMD_SET_INT(0x7fff), SIMD_AND_INT(SIMD_SRL_INT(bits, 16), SIMD_SET_INT(1)));
+        simd_pack_bf16(dst + SIMD_WIDTH * i, SIMD_ADD_INT(bits, rnd), src[i], lanes);
+    }
+}
+
+}  // namespace DS_SIMD_NS
+DS_SIMD_TARGET_POP
+
+#endif
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <cassert>
 #include "simd.h"
+#include "cpu_pool.h"
 
 #if defined(__ENABLE_CUDA__)
 #include <cuda_fp16.h>
@@ -51,8 +52,6 @@ public:
         cudaFreeHost(_doubled_buffer[1]);
 #endif
     }
-#if defined(__AVX512__) or defined(__AVX256__)
-	
 	void Step_cpu(
                   float* _params,
                   float* grads,
@@ -61,7 +60,18 @@ public:
                   ds_half_precision_t* dev_param = nullptr,
                   bool half_precision = false);
 
+    // Vector step at the level ds_simd_isa() picked. It covers the whole tensor, tails are
+    // masked; at the scalar level *rounded_size is 0 and the caller does the work
     template <int span>
+    void Step_SIMD(size_t* rounded_size,
+                   float* _params,
+                   float* grads,
+                   float* _exp_avg_sq,
+                   size_t param_size,
+                   ds_half_precision_t* dev_param = nullptr,
+                   bool half_precision = false);
+    // One instantiation per level, in csrc/adagrad/cpu_adagrad_<level>.cpp
+    template <int span, int isa>
     void Step_AVX(size_t* rounded_size,
                   float* _params,
                   float* grads,
@@ -69,7 +79,6 @@ public:
                   size_t param_size,
                   ds_half_precision_t* dev_param = nullptr,
                   bool half_precision = false);
-#endif
     STEP(1)
     STEP(4)
     STEP(8)
@@ -107,8 +116,34 @@ private:
 #endif
 };
 
-#if defined(__AVX512__) or defined(__AVX256__)
 template <int span>
+void Adagrad_Optimizer::Step_SIMD(size_t* rounded_size,
+                                  float* _params,
+                                  float* grads,
+                                  float* _exp_avg_sq,
+                                  size_t _param_size,
+                                  ds_half_precision_t* dev_params,
+                                  bool half_precision)
+{
+    *rounded_size = 0;
+    switch (ds_simd_isa()) {
+#if (__x86_64__ || __i386__)
+        case DS_ISA_AVX512:
+            Step_AVX<span, DS_ISA_AVX512>(
+                rounded_size, _params, grads, _exp_avg_sq, _param_size, dev_params, half_precision);
+            break;
+        case DS_ISA_AVX2:
+            Step_AVX<span, DS_ISA_AVX2>(
+                rounded_size, _params, grads, _exp_avg_sq, _param_size, dev_params, half_precision);
+            break;
+#endif
+        default: break;
+    }
+}
+
+#if defined(__AVX512__) or defined(__AVX256__)
+DS_SIMD_TARGET_PUSH
+template <int span, int isa>
 void Adagrad_Optimizer::Step_AVX(size_t* rounded_size,
                                  float* _params,
                                  float* grads,
@@ -127,7 +162,8 @@ void Adagrad_Optimizer::Step_AVX(size_t* rounded_size,
 
     AVX_Data weight_decay4;
     if (_weight_decay > 0) weight_decay4.data = SIMD_SET(_weight_decay);
-    new_rounded_size = ROUND_DOWN(_param_size, SIMD_WIDTH * span);
+    // the last block is masked, so one pass covers any length
+    new_rounded_size = _param_size;
     for (size_t t = 0; t < new_rounded_size; t += TILE) {
         size_t copy_size = TILE;
         if ((t + TILE) > new_rounded_size) copy_size = new_rounded_size - t;
@@ -135,36 +171,39 @@ void Adagrad_Optimizer::Step_AVX(size_t* rounded_size,
 #if defined(__ENABLE_CUDA__)
         if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
 #endif
-#pragma omp parallel for
-        for (size_t i = t; i < offset; i += SIMD_WIDTH * span) {
-            AVX_Data grad_4[span];
-            simd_load<span>(grad_4, grads + i, half_precision);
+        CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i += SIMD_WIDTH * span) {
+                size_t n = hi - i;
+                AVX_Data grad_4[span];
+                simd_load<span>(grad_4, grads + i, half_precision, n);
 
-            AVX_Data momentum_4[span];
-            simd_load<span>(momentum_4, grads + i, false);
+                AVX_Data momentum_4[span];
+                simd_load<span>(momentum_4, grads + i, false, n);
 
-            AVX_Data variance_4[span];
-            simd_load<span>(variance_4, _exp_avg_sq + i, false);
+                AVX_Data variance_4[span];
+                simd_load<span>(variance_4, _exp_avg_sq + i, false, n);
 
-            AVX_Data param_4[span];
-            simd_load<span>(param_4, _params + i, half_precision);
+                AVX_Data param_4[span];
+                simd_load<span>(param_4, _params + i, half_precision, n);
 
-            if (_weight_decay > 0) { simd_fma<span>(grad_4, param_4, weight_decay4, grad_4); }
+                if (_weight_decay > 0) { simd_fma<span>(grad_4, param_4, weight_decay4, grad_4); }
 
-            simd_fma<span>(variance_4, grad_4, grad_4, variance_4);
-            simd_sqrt<span>(grad_4, variance_4);
-            simd_add<span>(grad_4, grad_4, eps_4);
-            simd_div<span>(grad_4, momentum_4, grad_4);
-            simd_fma<span>(param_4, grad_4, step_size_4, param_4);
+                simd_fma<span>(variance_4, grad_4, grad_4, variance_4);
+                simd_sqrt<span>(grad_4, variance_4);
+                simd_add<span>(grad_4, grad_4, eps_4);
+                simd_div<span>(grad_4, momentum_4, grad_4);
+                simd_fma<span>(param_4, grad_4, step_size_4, param_4);
 
-            simd_store<span>(_params + i, param_4, half_precision);
+                simd_store<span>(_params + i, param_4, half_precision, n);
 #if defined(__ENABLE_CUDA__)
-            if (dev_params) {
-                simd_store<span>(_doubled_buffer[_buf_index] + (i - t), param_4, half_precision);
-            }
+                if (dev_params) {
+                    simd_store<span>(
+                        _doubled_buffer[_buf_index] + (i - t), param_4, half_precision, n);
+                }
 #endif
-            simd_store<span>(_exp_avg_sq + i, variance_4, false);
-        }
+                simd_store<span>(_exp_avg_sq + i, variance_4, false, n);
+            }
+        });
 #if defined(__ENABLE_CUDA__)
         if (dev_params) {
             if (half_precision)
@@ -180,4 +219,5 @@ void Adagrad_Optimizer::Step_AVX(size_t* rounded_size,
     }
     *rounded_size = new_rounded_size;
 }
+DS_SIMD_TARGET_POP
 #endif
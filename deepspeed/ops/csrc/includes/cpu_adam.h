@@ -27,10 +27,13 @@
 #include <fcntl.h>
 #include <CL/cl_ext.h>
 #include <thread>
+#include <atomic>
 
 #include <stdio.h>
 #include <cassert>
 #include "simd.h"
+#include "cpu_pool.h"
+#include "bf16_sr.h"
 
 #if defined(__ENABLE_CUDA__)
 #include <cuda_fp16.h>
@@ -43,7 +46,35 @@ typedef __half ds_half_precision_t;
 typedef unsigned short ds_half_precision_t;
 #endif
 
+// Blockwise 8-bit optimizer state (hls_smartInfinity/src/kernel_cpp/adam_8bit.cpp).
+// A state tensor holds n int8 codes, padded to QCODE_ALIGN bytes, then one fp32 absmax scale
+// per QBLOCK: signed codes of m in exp_avg, unsigned codes of s = sqrt(v) in exp_avg_sq. The
+// codes of s are square-root spaced, c = round(255 * sqrt(s / absmax)), so small entries keep
+// their resolution, and decode as at least code 1, so an entry rounded to 0 cannot turn
+// m / (s + eps) into m / eps. An all-zero tensor is a valid zero state.
+#define QBLOCK 256
+#define QCODE_ALIGN 64
 
+// Lazy Adam (Step_Lazy_cpu) looks the decays of up to LAZY_POWERS - 1 skipped steps up in a
+// table and prefetches the state LAZY_PREFETCH indices ahead
+#define LAZY_POWERS 64
+#define LAZY_PREFETCH 16
+
+// GradSumSq_AVX flushes its fp32 lane sums into a double every GRAD_SUMSQ_BLOCK vectors
+#define GRAD_SUMSQ_BLOCK 256
+
+// Byte offset of the scales in a quantized state, n for the kernel's multiples of 1024
+inline size_t quantized_scale_offset(size_t n)
+{
+    return (n + QCODE_ALIGN - 1) / QCODE_ALIGN * QCODE_ALIGN;
+}
+
+// Bytes of a quantized state, padded for O_DIRECT
+inline size_t quantized_state_bytes(size_t n)
+{
+    size_t nbytes = quantized_scale_offset(n) + (n + QBLOCK - 1) / QBLOCK * sizeof(float);
+    return ((nbytes - 1) / 4096 + 1) * 4096;
+}
 
 #define STEP(SPAN)                                             \
     void Step_##SPAN(float* _params,                           \
@@ -54,6 +85,19 @@ typedef unsigned short ds_half_precision_t;
                      ds_half_precision_t* dev_param = nullptr, \
                      bool half_precision = false);
 
+// Adam steps that can also write the updated fp32 params, rounded to nearest, to param_lp:
+// fp16 or, with lp_bf16, bf16
+#define STEP_LP(SPAN)                                          \
+    void Step_##SPAN(float* _params,                           \
+                     float* grads,                             \
+                     float* _exp_avg,                          \
+                     float* _exp_avg_sq,                       \
+                     size_t _param_size,                       \
+                     ds_half_precision_t* dev_param = nullptr, \
+                     bool half_precision = false,              \
+                     uint16_t* param_lp = nullptr,             \
+                     bool lp_bf16 = false);
+
 
 
 class Adam_Optimizer {
@@ -92,8 +136,63 @@ public:
 #endif
     }
 
-#if defined(__AVX512__) or defined(__AVX256__)
+    // Vector step at the level ds_simd_isa() picked. It covers the whole tensor, tails are
+    // masked; at the scalar level *rounded_size is 0 and the caller does the work
+    template <int span>
+    void Step_SIMD(size_t* rounded_size,
+                   float* _params,
+                   float* grads,
+                   float* _exp_avg,
+                   float* _exp_avg_sq,
+                   size_t param_size,
+                   ds_half_precision_t* dev_param = nullptr,
+                   bool half_precision = false,
+                   uint16_t* param_lp = nullptr,
+                   bool lp_bf16 = false);
+    // Sum of squares of grads * grad_unscale, non-finite values raise the overflow flag. Same
+    // levels as Step_SIMD
+    template <int span>
+    void GradSumSq_SIMD(size_t* rounded_size,
+                        float* grads,
+                        size_t param_size,
+                        bool half_precision,
+                        double* sumsq);
+    // Momentum SGD, see update_sgd_state()
+    template <int span>
+    void Step_SIMD_SGD(size_t* rounded_size,
+                       float* _params,
+                       float* grads,
+                       float* _exp_avg,
+                       size_t param_size,
+                       ds_half_precision_t* dev_param = nullptr,
+                       bool half_precision = false);
+    template <int span>
+    void Step_SIMD_SGD_bf16(size_t* rounded_size,
+                            uint16_t* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            size_t param_size,
+                            uint32_t seed);
+    template <int span>
+    void Step_SIMD_bf16(size_t* rounded_size,
+                        uint16_t* _params,
+                        float* grads,
+                        float* _exp_avg,
+                        float* _exp_avg_sq,
+                        size_t param_size,
+                        uint32_t seed);
     template <int span>
+    void Step_SIMD_bf16_moments(size_t* rounded_size,
+                                float* _params,
+                                float* grads,
+                                uint16_t* _exp_avg,
+                                uint16_t* _exp_avg_sq,
+                                size_t param_size,
+                                bool half_precision,
+                                bool stochastic,
+                                uint32_t seed);
+    // One instantiation per level, in csrc/adam/cpu_adam_<level>.cpp
+    template <int span, int isa>
     void Step_AVX(size_t* rounded_size,
                   float* _params,
                   float* grads,
@@ -101,14 +200,117 @@ public:
                   float* _exp_avg_sq,
                   size_t param_size,
                   ds_half_precision_t* dev_param = nullptr,
-                  bool half_precision = false);
-#endif
-    STEP(1)
-    STEP(4)
-    STEP(8)
+                  bool half_precision = false,
+                  uint16_t* param_lp = nullptr,
+                  bool lp_bf16 = false);
+    template <int span, int isa>
+    void GradSumSq_AVX(size_t* rounded_size,
+                       float* grads,
+                       size_t param_size,
+                       bool half_precision,
+                       double* sumsq);
+    template <int span, int isa>
+    void Step_AVX_SGD(size_t* rounded_size,
+                      float* _params,
+                      float* grads,
+                      float* _exp_avg,
+                      size_t param_size,
+                      ds_half_precision_t* dev_param = nullptr,
+                      bool half_precision = false);
+    template <int span, int isa>
+    void Step_AVX_SGD_bf16(size_t* rounded_size,
+                           uint16_t* _params,
+                           float* grads,
+                           float* _exp_avg,
+                           size_t param_size,
+                           uint32_t seed);
+    template <int span, int isa>
+    void Step_AVX_bf16(size_t* rounded_size,
+                       uint16_t* _params,
+                       float* grads,
+                       float* _exp_avg,
+                       float* _exp_avg_sq,
+                       size_t param_size,
+                       uint32_t seed);
+    template <int span, int isa>
+    void Step_AVX_bf16_moments(size_t* rounded_size,
+                               float* _params,
+                               float* grads,
+                               uint16_t* _exp_avg,
+                               uint16_t* _exp_avg_sq,
+                               size_t param_size,
+                               bool half_precision,
+                               bool stochastic,
+                               uint32_t seed);
+    STEP_LP(1)
+    STEP_LP(4)
+    STEP_LP(8)
     STEP(cpu)
     STEP(gpu)
 	STEP(SGD_cpu)
+	STEP(Lion_cpu)
+	STEP(Adam8bit_cpu)
+    void Step_Adafactor_cpu(float* _params,
+                            float* grads,
+                            float* _exp_avg,
+                            float* factors,
+                            int* segments,
+                            int n_segments,
+                            float* sums,
+                            int phase);
+    void Step_AdamEma_cpu(float* _params,
+                          float* grads,
+                          float* _exp_avg,
+                          float* _exp_avg_sq,
+                          float* _ema,
+                          float ema_decay,
+                          size_t _param_size);
+    void Step_Bf16_cpu(uint16_t* _params,
+                       float* grads,
+                       float* _exp_avg,
+                       float* _exp_avg_sq,
+                       size_t _param_size,
+                       uint32_t seed);
+    void Step_Bf16Moments_cpu(float* _params,
+                              float* grads,
+                              uint16_t* _exp_avg,
+                              uint16_t* _exp_avg_sq,
+                              size_t _param_size,
+                              bool half_precision,
+                              bool stochastic,
+                              uint32_t seed);
+    void Step_SGD_bf16_cpu(uint16_t* _params,
+                           float* grads,
+                           float* _exp_avg,
+                           size_t _param_size,
+                           uint32_t seed);
+    // Lazy Adam over a sparse gradient, last_step holds the step of every lazy_block elements
+    void Step_Lazy_cpu(float* _params,
+                       const int64_t* grad_idx,
+                       const float* grad_val,
+                       size_t n_grads,
+                       float* _exp_avg,
+                       float* _exp_avg_sq,
+                       int* last_step,
+                       size_t lazy_block,
+                       size_t _param_size);
+    void Lazy_Flush_cpu(float* _params,
+                        float* _exp_avg,
+                        float* _exp_avg_sq,
+                        int* last_step,
+                        size_t lazy_block,
+                        size_t _param_size);
+    double GradSumSq_cpu(float* grads, size_t _param_size, bool half_precision = false);
+    void Step_Lamb_cpu(float* _params,
+                       float* grads,
+                       float* _exp_avg,
+                       float* _exp_avg_sq,
+                       int* segments,
+                       int n_segments,
+                       float max_coeff,
+                       float min_coeff,
+                       float* norms,
+                       int phase);
 
 	// OpenCL related vaiables
 	std::thread thr;
@@ -144,7 +346,101 @@ public:
 				int device_id,
 				int largest_numel,
 				float compression_ratio,
-				int* grad_idx_ptr
+				int* grad_idx_ptr,
+				int topk_block,
+				int val_bits
+				);
+	void Step_fpga_lion( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string grad_path,
+				size_t _param_size,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel
+				);
+	void Step_fpga_adafactor( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string grad_path,
+				size_t _param_size,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float* factors_ptr,
+				size_t n_factors,
+				int* segments_ptr,
+				int n_segments
+				);
+	void Step_fpga_8bit( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel
+				);
+	void Step_fpga_ema( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string ema_path,
+                std::string grad_path,
+				size_t _param_size,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float ema_decay
+				);
+	void Step_fpga_bf16( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				bool bf16_params,
+				int device_id,
+				int largest_numel,
+				uint32_t seed
+				);
+	void Step_fpga_lamb( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string exp_avg_sq_path,
+                std::string grad_path,
+				size_t _param_size,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float max_coeff,
+				float min_coeff,
+				int* segments_ptr,
+				int n_segments,
+				int phase,
+				float* norms_ptr
+				);
+	void Step_fpga_lion_comp( 
+				std::string param_path,
+                std::string exp_avg_path,
+                std::string grad_path,
+				size_t _param_size,
+				float combined_unscale,
+				half* fp16_params_ptr,
+				int device_id,
+				int largest_numel,
+				float compression_ratio,
+				int* grad_idx_ptr,
+				int topk_block,
+				int val_bits
 				);
 
 
@@ -169,7 +465,9 @@ public:
 				half* fp16_params_ptr,
 				int device_id,
 				int largest_numel,
-				float compression_ratio
+				float compression_ratio,
+				int topk_block,
+				int val_bits
 				);
 
 	void Step_fpga_comp( 
@@ -183,7 +481,9 @@ public:
 				int device_id,
 				int largest_numel,
 				float compression_ratio,
-				int* grad_idx_ptr
+				int* grad_idx_ptr,
+				int topk_block,
+				int val_bits
 				);
 #if defined(__ENABLE_CUDA__)
     inline void SynchronizeStreams()
@@ -237,6 +537,27 @@ public:
             _bias_correction2 = 1 / sqrt(1 - _betta2_t);
         }
     }
+
+    // Step_AVX, Step_1 and Step_cpu multiply the gradients by grad_unscale as they load them,
+    // the combined_unscale of the device kernels. An inf or NaN gradient raises the overflow
+    // flag, which take_grad_overflow() returns and clears.
+    inline void set_grad_unscale(float grad_unscale) { _grad_unscale = grad_unscale; }
+
+    // Streaming mode of Step_AVX (1 or 0) for a call that is cut into slices before it reaches
+    // the kernel: the DS_CPU_STREAM_MIN threshold is meant for the whole call, and a slice only
+    // holds about total / workers elements. -1 decides from the size each Step_AVX call sees.
+    inline void set_stream(int stream) { _stream = stream; }
+
+    // Momentum SGD with the momentum in _betta1:
+    //   buf = momentum * buf + (1 - dampening) * grad
+    //   param -= lr * (nesterov ? grad + momentum * buf : buf)
+    // grad includes the L2 term weight_decay * param. The device kernel has dampening = momentum.
+    inline void update_sgd_state(float dampening, bool nesterov)
+    {
+        _sgd_dampening = dampening;
+        _sgd_nesterov = nesterov;
+    }
+    inline bool take_grad_overflow() { return _grad_overflow.exchange(0) != 0; }
 private:
 	float _alpha;
     float _betta1;
@@ -253,6 +574,24 @@ private:
 
     bool _adamw_mode;
 
+    float _grad_unscale = 1.0f;
+    std::atomic<int> _grad_overflow{0};
+    int _stream = -1;
+
+    float _sgd_dampening = 0.0f;
+    bool _sgd_nesterov = false;
+
+    // powers of the per-step lazy Adam decays for the skipped step counts below LAZY_POWERS
+    float _lazy_pow[LAZY_POWERS][3];
+    void Lazy_Powers();
+    void Lazy_CatchUp(float* _params,
+                      float* _exp_avg,
+                      float* _exp_avg_sq,
+                      int* last_step,
+                      size_t lazy_block,
+                      size_t _param_size,
+                      size_t block);
+
 #if defined(__ENABLE_CUDA__)
     float* _doubled_buffer[2];
     cudaStream_t _streams[2];
@@ -260,8 +599,163 @@ private:
 #endif
 };
 
-#if defined(__AVX512__) or defined(__AVX256__)
 template <int span>
+void Adam_Optimizer::Step_SIMD(size_t* rounded_size,
+                               float* _params,
+                               float* grads,
+                               float* _exp_avg,
+                               float* _exp_avg_sq,
+                               size_t _param_size,
+                               ds_half_precision_t* dev_params,
+                               bool half_precision,
+                               uint16_t* param_lp,
+                               bool lp_bf16)
+{
+    *rounded_size = 0;
+    switch (ds_simd_isa()) {
+#if (__x86_64__ || __i386__)
+        case DS_ISA_AVX512:
+            Step_AVX<span, DS_ISA_AVX512>(rounded_size, _params, grads, _exp_avg, _exp_avg_sq,
+                                          _param_size, dev_params, half_precision, param_lp, lp_bf16);
+            break;
+        case DS_ISA_AVX2:
+            Step_AVX<span, DS_ISA_AVX2>(rounded_size, _params, grads, _exp_avg, _exp_avg_sq,
+                                        _param_size, dev_params, half_precision, param_lp, lp_bf16);
+            break;
+#endif
+        default: break;
+    }
+}
+
+template <int span>
+void Adam_Optimizer::GradSumSq_SIMD(size_t* rounded_size,
+                                    float* grads,
+                                    size_t _param_size,
+                                    bool half_precision,
+                                    double* sumsq)
+{
+    *rounded_size = 0;
+    switch (ds_simd_isa()) {
+#if (__x86_64__ || __i386__)
+        case DS_ISA_AVX512:
+            GradSumSq_AVX<span, DS_ISA_AVX512>(
+                rounded_size, grads, _param_size, half_precision, sumsq);
+            break;
+        case DS_ISA_AVX2:
+            GradSumSq_AVX<span, DS_ISA_AVX2>(
+                rounded_size, grads, _param_size, half_precision, sumsq);
+            break;
+#endif
+        default: break;
+    }
+}
+
+template <int span>
+void Adam_Optimizer::Step_SIMD_SGD(size_t* rounded_size,
+                                   float* _params,
+                                   float* grads,
+                                   float* _exp_avg,
+                                   size_t _param_size,
+                                   ds_half_precision_t* dev_params,
+                                   bool half_precision)
+{
+    *rounded_size = 0;
+    switch (ds_simd_isa()) {
+#if (__x86_64__ || __i386__)
+        case DS_ISA_AVX512:
+            Step_AVX_SGD<span, DS_ISA_AVX512>(
+                rounded_size, _params, grads, _exp_avg, _param_size, dev_params, half_precision);
+            break;
+        case DS_ISA_AVX2:
+            Step_AVX_SGD<span, DS_ISA_AVX2>(
+                rounded_size, _params, grads, _exp_avg, _param_size, dev_params, half_precision);
+            break;
+#endif
+        default: break;
+    }
+}
+
+template <int span>
+void Adam_Optimizer::Step_SIMD_SGD_bf16(size_t* rounded_size,
+                                        uint16_t* _params,
+                                        float* grads,
+                                        float* _exp_avg,
+                                        size_t _param_size,
+                                        uint32_t seed)
+{
+    *rounded_size = 0;
+    switch (ds_simd_isa()) {
+#if (__x86_64__ || __i386__)
+        case DS_ISA_AVX512:
+            Step_AVX_SGD_bf16<span, DS_ISA_AVX512>(
+                rounded_size, _params, grads, _exp_avg, _param_size, seed);
+            break;
+        case DS_ISA_AVX2:
+            Step_AVX_SGD_bf16<span, DS_ISA_AVX2>(
+                rounded_size, _params, grads, _exp_avg, _param_size, seed);
+            break;
+#endif
+        default: break;
+    }
+}
+
+template <int span>
+void Adam_Optimizer::Step_SIMD_bf16(size_t* rounded_size,
+                                    uint16_t* _params,
+                                    float* grads,
+                                    float* _exp_avg,
+                                    float* _exp_avg_sq,
+                                    size_t _param_size,
+                                    uint32_t seed)
+{
+    *rounded_size = 0;
+    switch (ds_simd_isa()) {
+#if (__x86_64__ || __i386__)
+        case DS_ISA_AVX512:
+            Step_AVX_bf16<span, DS_ISA_AVX512>(
+                rounded_size, _params, grads, _exp_avg, _exp_avg_sq, _param_size, seed);
+            break;
+        case DS_ISA_AVX2:
+            Step_AVX_bf16<span, DS_ISA_AVX2>(
+                rounded_size, _params, grads, _exp_avg, _exp_avg_sq, _param_size, seed);
+            break;
+#endif
+        default: break;
+    }
+}
+
+template <int span>
+void Adam_Optimizer::Step_SIMD_bf16_moments(size_t* rounded_size,
+                                            float* _params,
+                                            float* grads,
+                                            uint16_t* _exp_avg,
+                                            uint16_t* _exp_avg_sq,
+                                            size_t _param_size,
+                                            bool half_precision,
+                                            bool stochastic,
+                                            uint32_t seed)
+{
+    *rounded_size = 0;
+    switch (ds_simd_isa()) {
+#if (__x86_64__ || __i386__)
+        case DS_ISA_AVX512:
+            Step_AVX_bf16_moments<span, DS_ISA_AVX512>(rounded_size, _params, grads, _exp_avg,
+                                                       _exp_avg_sq, _param_size, half_precision,
+                                                       stochastic, seed);
+            break;
+        case DS_ISA_AVX2:
+            Step_AVX_bf16_moments<span, DS_ISA_AVX2>(rounded_size, _params, grads, _exp_avg,
+                                                     _exp_avg_sq, _param_size, half_precision,
+                                                     stochastic, seed);
+            break;
+#endif
+        default: break;
+    }
+}
+
+#if defined(__AVX512__) or defined(__AVX256__)
+DS_SIMD_TARGET_PUSH
+template <int span, int isa>
 void Adam_Optimizer::Step_AVX(size_t* rounded_size,
                               float* _params,
                               float* grads,
@@ -269,7 +763,9 @@ void Adam_Optimizer::Step_AVX(size_t* rounded_size,
                               float* _exp_avg_sq,
                               size_t _param_size,
                               ds_half_precision_t* dev_params,
-                              bool half_precision)
+                              bool half_precision,
+                              uint16_t* param_lp,
+                              bool lp_bf16)
 {
     size_t new_rounded_size = 0;
     int rshft = half_precision ? 1 : 0;
@@ -300,7 +796,15 @@ void Adam_Optimizer::Step_AVX(size_t* rounded_size,
     AVX_Data weight_decay4;
     if (_weight_decay > 0)
         weight_decay4.data = (_adamw_mode ? SIMD_SET(w_decay) : SIMD_SET(_weight_decay));
-    new_rounded_size = ROUND_DOWN(_param_size, SIMD_WIDTH * span);
+
+    const bool unscale = (_grad_unscale != 1.0f);
+    AVX_Data unscale_4;
+    unscale_4.data = SIMD_SET(_grad_unscale);
+
+    const bool stream = (_stream < 0) ? (_param_size >= ds_stream_min()) : (_stream != 0);
+    const size_t prefetch = stream ? ds_prefetch_distance() : 0;
+    // the last block is masked, so one pass covers any length
+    new_rounded_size = _param_size;
     for (size_t t = 0; t < new_rounded_size; t += TILE) {
         size_t copy_size = TILE;
         if ((t + TILE) > new_rounded_size) copy_size = new_rounded_size - t;
@@ -308,48 +812,379 @@ void Adam_Optimizer::Step_AVX(size_t* rounded_size,
 #if defined(__ENABLE_CUDA__)
         if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
 #endif
-#pragma omp parallel for
-        for (size_t i = t; i < offset; i += SIMD_WIDTH * span) {
+        CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+            AVX_Data nonfinite;
+            nonfinite.data = SIMD_SET(0.0f);
+            for (size_t i = lo; i < hi; i += SIMD_WIDTH * span) {
+                size_t n = hi - i;
+                if (prefetch && i + prefetch < hi) {
+                    size_t k = i + prefetch;
+                    simd_prefetch<span>(grads + (k >> rshft), half_precision);
+                    simd_prefetch<span>(_params + (k >> rshft), half_precision);
+                    simd_prefetch<span>(_exp_avg + k, false);
+                    simd_prefetch<span>(_exp_avg_sq + k, false);
+                }
+                AVX_Data grad_4[span];
+                simd_load<span>(grad_4, grads + (i >> rshft), half_precision, n);
+                if (unscale) simd_mul<span>(grad_4, grad_4, unscale_4);
+                simd_nonfinite<span>(nonfinite, grad_4);
+
+                AVX_Data momentum_4[span];
+                simd_load<span>(momentum_4, _exp_avg + i, false, n);
+
+                AVX_Data variance_4[span];
+                simd_load<span>(variance_4, _exp_avg_sq + i, false, n);
+
+                AVX_Data param_4[span];
+                simd_load<span>(param_4, _params + (i >> rshft), half_precision, n);
+
+                if (_weight_decay > 0 && !_adamw_mode) {
+                    simd_fma<span>(grad_4, param_4, weight_decay4, grad_4);
+                }
+
+                simd_mul<span>(momentum_4, momentum_4, betta1_4);
+                simd_fma<span>(momentum_4, grad_4, betta1_minus1_4, momentum_4);
+                simd_mul<span>(variance_4, variance_4, betta2_4);
+                simd_mul<span>(grad_4, grad_4, grad_4);
+                simd_fma<span>(variance_4, grad_4, betta2_minus1_4, variance_4);
+                simd_sqrt<span>(grad_4, variance_4);
+                simd_fma<span>(grad_4, grad_4, bias2_sqrt, eps_4);
+                simd_div<span>(grad_4, momentum_4, grad_4);
+
+                if (_weight_decay > 0 && _adamw_mode) {
+                    simd_fma<span>(param_4, param_4, weight_decay4, param_4);
+                }
+
+                simd_fma<span>(param_4, grad_4, step_size_4, param_4);
+
+                if (stream && !half_precision)
+                    simd_stream<span>(_params + i, param_4, n);
+                else
+                    simd_store<span>(_params + (i >> rshft), param_4, half_precision, n);
+                if (param_lp) {
+                    if (lp_bf16)
+                        simd_store_bf16<span>(param_lp + i, param_4, n);
+                    else
+                        simd_store<span>((float*)(param_lp + i), param_4, true, n);
+                }
+#if defined(__ENABLE_CUDA__)
+                if (dev_params) {
+                    simd_store<span>(
+                        _doubled_buffer[_buf_index] + (i - t), param_4, half_precision, n);
+                }
+#endif
+                if (stream) {
+                    simd_stream<span>(_exp_avg + i, momentum_4, n);
+                    simd_stream<span>(_exp_avg_sq + i, variance_4, n);
+                } else {
+                    simd_store<span>(_exp_avg + i, momentum_4, false, n);
+                    simd_store<span>(_exp_avg_sq + i, variance_4, false, n);
+                }
+            }
+            if (stream) simd_stream_fence();
+            if (simd_has_nan(nonfinite)) _grad_overflow = 1;
+        });
+#if defined(__ENABLE_CUDA__)
+        if (dev_params) {
+            if (half_precision)
+                launch_param_update_half(
+                    _doubled_buffer[_buf_index], dev_params + t, copy_size, _streams[_buf_index]);
+            else
+                launch_param_update(
+                    _doubled_buffer[_buf_index], dev_params + t, copy_size, _streams[_buf_index]);
+
+            _buf_index = !_buf_index;
+        }
+#endif
+    }
+    *rounded_size = new_rounded_size;
+}
+
+template <int span, int isa>
+void Adam_Optimizer::GradSumSq_AVX(size_t* rounded_size,
+                                   float* grads,
+                                   size_t _param_size,
+                                   bool half_precision,
+                                   double* sumsq)
+{
+    int rshft = half_precision ? 1 : 0;
+    AVX_Data unscale_4;
+    unscale_4.data = SIMD_SET(_grad_unscale);
+
+    // the fp32 lanes take at most GRAD_SUMSQ_BLOCK squares each before they are flushed into
+    // the double sum, so the norm of a long slice keeps its precision
+    const size_t block = SIMD_WIDTH * span * GRAD_SUMSQ_BLOCK;
+    AVX_Data nonfinite;
+    nonfinite.data = SIMD_SET(0.0f);
+    double total = 0.0;
+    for (size_t t = 0; t < _param_size; t += block) {
+        size_t hi = std::min(_param_size, t + block);
+        AVX_Data sq_4[span];
+        for (size_t j = 0; j < span; ++j) sq_4[j].data = SIMD_SET(0.0f);
+        for (size_t i = t; i < hi; i += SIMD_WIDTH * span) {
             AVX_Data grad_4[span];
-            simd_load<span>(grad_4, grads + (i >> rshft), half_precision);
+            simd_load<span>(grad_4, grads + (i >> rshft), half_precision, hi - i);
+            simd_mul<span>(grad_4, grad_4, unscale_4);
+            simd_nonfinite<span>(nonfinite, grad_4);
+            simd_fma<span>(sq_4, grad_4, grad_4, sq_4);
+        }
+        total += simd_reduce_add<span>(sq_4);
+    }
+    if (simd_has_nan(nonfinite)) _grad_overflow = 1;
+    *sumsq = total;
+    *rounded_size = _param_size;
+}
 
-            AVX_Data momentum_4[span];
-            simd_load<span>(momentum_4, _exp_avg + i, false);
+// Step_AVX with bf16 master weights: the update runs in fp32 and the new weights are stored
+// with stochastic rounding (bf16_sr.h). Element i draws from index i of the seed's stream.
+template <int span, int isa>
+void Adam_Optimizer::Step_AVX_bf16(size_t* rounded_size,
+                                   uint16_t* _params,
+                                   float* grads,
+                                   float* _exp_avg,
+                                   float* _exp_avg_sq,
+                                   size_t _param_size,
+                                   uint32_t seed)
+{
+    size_t new_rounded_size = 0;
 
-            AVX_Data variance_4[span];
-            simd_load<span>(variance_4, _exp_avg_sq + i, false);
+    AVX_Data betta1_4;
+    betta1_4.data = SIMD_SET(_betta1);
+    AVX_Data betta2_4;
+    betta2_4.data = SIMD_SET(_betta2);
 
-            AVX_Data param_4[span];
-            simd_load<span>(param_4, _params + (i >> rshft), half_precision);
+    float betta1_minus1 = 1 - _betta1;
+    float betta2_minus1 = 1 - _betta2;
+    AVX_Data betta1_minus1_4;
+    betta1_minus1_4.data = SIMD_SET(betta1_minus1);
+    AVX_Data betta2_minus1_4;
+    betta2_minus1_4.data = SIMD_SET(betta2_minus1);
+
+    AVX_Data bias2_sqrt;
+    bias2_sqrt.data = SIMD_SET(_bias_correction2);
 
-            if (_weight_decay > 0 && !_adamw_mode) {
-                simd_fma<span>(grad_4, param_4, weight_decay4, grad_4);
+    AVX_Data eps_4;
+    eps_4.data = SIMD_SET(_eps);
+
+    float step_size = -1 * _alpha / _bias_correction1;
+    AVX_Data step_size_4;
+    step_size_4.data = SIMD_SET(step_size);
+
+    float w_decay = -1 * _alpha * _weight_decay;
+    AVX_Data weight_decay4;
+    if (_weight_decay > 0)
+        weight_decay4.data = (_adamw_mode ? SIMD_SET(w_decay) : SIMD_SET(_weight_decay));
+    // the last block is masked, so one pass covers any length
+    new_rounded_size = _param_size;
+    for (size_t t = 0; t < new_rounded_size; t += TILE) {
+        size_t copy_size = TILE;
+        if ((t + TILE) > new_rounded_size) copy_size = new_rounded_size - t;
+        size_t offset = copy_size + t;
+        CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i += SIMD_WIDTH * span) {
+                size_t n = hi - i;
+                AVX_Data grad_4[span];
+                simd_load<span>(grad_4, grads + i, false, n);
+
+                AVX_Data momentum_4[span];
+                simd_load<span>(momentum_4, _exp_avg + i, false, n);
+
+                AVX_Data variance_4[span];
+                simd_load<span>(variance_4, _exp_avg_sq + i, false, n);
+
+                AVX_Data param_4[span];
+                simd_load_bf16<span>(param_4, _params + i, n);
+
+                if (_weight_decay > 0 && !_adamw_mode) {
+                    simd_fma<span>(grad_4, param_4, weight_decay4, grad_4);
+                }
+
+                simd_mul<span>(momentum_4, momentum_4, betta1_4);
+                simd_fma<span>(momentum_4, grad_4, betta1_minus1_4, momentum_4);
+                simd_mul<span>(variance_4, variance_4, betta2_4);
+                simd_mul<span>(grad_4, grad_4, grad_4);
+                simd_fma<span>(variance_4, grad_4, betta2_minus1_4, variance_4);
+                simd_sqrt<span>(grad_4, variance_4);
+                simd_fma<span>(grad_4, grad_4, bias2_sqrt, eps_4);
+                simd_div<span>(grad_4, momentum_4, grad_4);
+
+                if (_weight_decay > 0 && _adamw_mode) {
+                    simd_fma<span>(param_4, param_4, weight_decay4, param_4);
+                }
+
+                simd_fma<span>(param_4, grad_4, step_size_4, param_4);
+
+                simd_store_bf16_sr<span>(_params + i, param_4, seed, (uint32_t)i, n);
+                simd_store<span>(_exp_avg + i, momentum_4, false, n);
+                simd_store<span>(_exp_avg_sq + i, variance_4, false, n);
             }
+        });
+    }
+    *rounded_size = new_rounded_size;
+}
 
-            simd_mul<span>(momentum_4, momentum_4, betta1_4);
-            simd_fma<span>(momentum_4, grad_4, betta1_minus1_4, momentum_4);
-            simd_mul<span>(variance_4, variance_4, betta2_4);
-            simd_mul<span>(grad_4, grad_4, grad_4);
-            simd_fma<span>(variance_4, grad_4, betta2_minus1_4, variance_4);
-            simd_sqrt<span>(grad_4, variance_4);
-            simd_fma<span>(grad_4, grad_4, bias2_sqrt, eps_4);
-            simd_div<span>(grad_4, momentum_4, grad_4);
-
-            if (_weight_decay > 0 && _adamw_mode) {
-                simd_fma<span>(param_4, param_4, weight_decay4, param_4);
+// Step_AVX with bf16 moments: they are widened to fp32 for the update and rounded to nearest on
+// the store, or with stochastic rounding, exp_avg drawing from the seed's stream and exp_avg_sq
+// from ~seed's. bf16 keeps the fp32 exponent range; fp16 would flush (1 - beta2) * grad^2 to
+// zero below |grad| ~ 7.7e-3 and leave the update divided by eps alone.
+template <int span, int isa>
+void Adam_Optimizer::Step_AVX_bf16_moments(size_t* rounded_size,
+                                           float* _params,
+                                           float* grads,
+                                           uint16_t* _exp_avg,
+                                           uint16_t* _exp_avg_sq,
+                                           size_t _param_size,
+                                           bool half_precision,
+                                           bool stochastic,
+                                           uint32_t seed)
+{
+    size_t new_rounded_size = 0;
+    int rshft = half_precision ? 1 : 0;
+
+    AVX_Data betta1_4;
+    betta1_4.data = SIMD_SET(_betta1);
+    AVX_Data betta2_4;
+    betta2_4.data = SIMD_SET(_betta2);
+
+    float betta1_minus1 = 1 - _betta1;
+    float betta2_minus1 = 1 - _betta2;
+    AVX_Data betta1_minus1_4;
+    betta1_minus1_4.data = SIMD_SET(betta1_minus1);
+    AVX_Data betta2_minus1_4;
+    betta2_minus1_4.data = SIMD_SET(betta2_minus1);
+
+    AVX_Data bias2_sqrt;
+    bias2_sqrt.data = SIMD_SET(_bias_correction2);
+
+    AVX_Data eps_4;
+    eps_4.data = SIMD_SET(_eps);
+
+    float step_size = -1 * _alpha / _bias_correction1;
+    AVX_Data step_size_4;
+    step_size_4.data = SIMD_SET(step_size);
+
+    float w_decay = -1 * _alpha * _weight_decay;
+    AVX_Data weight_decay4;
+    if (_weight_decay > 0)
+        weight_decay4.data = (_adamw_mode ? SIMD_SET(w_decay) : SIMD_SET(_weight_decay));
+    // the last block is masked, so one pass covers any length
+    new_rounded_size = _param_size;
+    for (size_t t = 0; t < new_rounded_size; t += TILE) {
+        size_t copy_size = TILE;
+        if ((t + TILE) > new_rounded_size) copy_size = new_rounded_size - t;
+        size_t offset = copy_size + t;
+        CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i += SIMD_WIDTH * span) {
+                size_t n = hi - i;
+                AVX_Data grad_4[span];
+                simd_load<span>(grad_4, grads + (i >> rshft), half_precision, n);
+
+                AVX_Data momentum_4[span];
+                AVX_Data variance_4[span];
+                simd_load_bf16<span>(momentum_4, _exp_avg + i, n);
+                simd_load_bf16<span>(variance_4, _exp_avg_sq + i, n);
+
+                AVX_Data param_4[span];
+                simd_load<span>(param_4, _params + (i >> rshft), half_precision, n);
+
+                if (_weight_decay > 0 && !_adamw_mode) {
+                    simd_fma<span>(grad_4, param_4, weight_decay4, grad_4);
+                }
+
+                simd_mul<span>(momentum_4, momentum_4, betta1_4);
+                simd_fma<span>(momentum_4, grad_4, betta1_minus1_4, momentum_4);
+                simd_mul<span>(variance_4, variance_4, betta2_4);
+                simd_mul<span>(grad_4, grad_4, grad_4);
+                simd_fma<span>(variance_4, grad_4, betta2_minus1_4, variance_4);
+                simd_sqrt<span>(grad_4, variance_4);
+                simd_fma<span>(grad_4, grad_4, bias2_sqrt, eps_4);
+                simd_div<span>(grad_4, momentum_4, grad_4);
+
+                if (_weight_decay > 0 && _adamw_mode) {
+                    simd_fma<span>(param_4, param_4, weight_decay4, param_4);
+                }
+
+                simd_fma<span>(param_4, grad_4, step_size_4, param_4);
+
+                simd_store<span>(_params + (i >> rshft), param_4, half_precision, n);
+                if (stochastic) {
+                    simd_store_bf16_sr<span>(_exp_avg + i, momentum_4, seed, (uint32_t)i, n);
+                    simd_store_bf16_sr<span>(_exp_avg_sq + i, variance_4, ~seed, (uint32_t)i, n);
+                } else {
+                    simd_store_bf16<span>(_exp_avg + i, momentum_4, n);
+                    simd_store_bf16<span>(_exp_avg_sq + i, variance_4, n);
+                }
             }
+        });
+    }
+    *rounded_size = new_rounded_size;
+}
 
-            simd_fma<span>(param_4, grad_4, step_size_4, param_4);
+template <int span, int isa>
+void Adam_Optimizer::Step_AVX_SGD(size_t* rounded_size,
+                                  float* _params,
+                                  float* grads,
+                                  float* _exp_avg,
+                                  size_t _param_size,
+                                  ds_half_precision_t* dev_params,
+                                  bool half_precision)
+{
+    size_t new_rounded_size = 0;
+    int rshft = half_precision ? 1 : 0;
+
+    AVX_Data betta1_4;
+    betta1_4.data = SIMD_SET(_betta1);
+    AVX_Data dampening_minus1_4;
+    dampening_minus1_4.data = SIMD_SET(1 - _sgd_dampening);
 
-            simd_store<span>(_params + (i >> rshft), param_4, half_precision);
+    float step_size = -1 * _alpha;
+    AVX_Data step_size_4;
+    step_size_4.data = SIMD_SET(step_size);
+
+    AVX_Data weight_decay4;
+    if (_weight_decay > 0) weight_decay4.data = SIMD_SET(_weight_decay);
+    // the last block is masked, so one pass covers any length
+    new_rounded_size = _param_size;
+    for (size_t t = 0; t < new_rounded_size; t += TILE) {
+        size_t copy_size = TILE;
+        if ((t + TILE) > new_rounded_size) copy_size = new_rounded_size - t;
+        size_t offset = copy_size + t;
 #if defined(__ENABLE_CUDA__)
-            if (dev_params) {
-                simd_store<span>(_doubled_buffer[_buf_index] + (i - t), param_4, half_precision);
-            }
+        if ((t / TILE) >= 2) { cudaStreamSynchronize(_streams[_buf_index]); }
 #endif
-            simd_store<span>(_exp_avg + i, momentum_4, false);
-            simd_store<span>(_exp_avg_sq + i, variance_4, false);
-        }
+        CPU_Thread_Pool::Instance().parallel_for(t, offset, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i += SIMD_WIDTH * span) {
+                size_t n = hi - i;
+                AVX_Data grad_4[span];
+                simd_load<span>(grad_4, grads + (i >> rshft), half_precision, n);
+
+                AVX_Data momentum_4[span];
+                simd_load<span>(momentum_4, _exp_avg + i, false, n);
+
+                AVX_Data param_4[span];
+                simd_load<span>(param_4, _params + (i >> rshft), half_precision, n);
+
+                if (_weight_decay > 0) { simd_fma<span>(grad_4, param_4, weight_decay4, grad_4); }
+
+                simd_mul<span>(momentum_4, momentum_4, betta1_4);
+                simd_fma<span>(momentum_4, grad_4, dampening_minus1_4, momentum_4);
+                if (_sgd_nesterov) {
+                    simd_fma<span>(grad_4, momentum_4, betta1_4, grad_4);
+                    simd_fma<span>(param_4, grad_4, step_size_4, param_4);
+                } else {
+                    simd_fma<span>(param_4, momentum_4, step_size_4, param_4);
+                }
+
+                simd_store<span>(_params + (i >> rshft), param_4, half_precision, n);
+#if defined(__ENABLE_CUDA__)
+                if (dev_params) {
+                    simd_store<span>(
+                        _doubled_buffer[_buf_index] + (i - t), param_4, half_precision, n);
+                }
+#endif
+                simd_store<span>(_exp_avg + i, momentum_4, false, n);
+            }
+        });
 #if defined(__ENABLE_CUDA__)
         if (dev_params) {
             if (half_precision)
@@ -365,4 +1200,56 @@ void Adam_Optimizer::Step_AVX(size_t* rounded_size,
     }
     *rounded_size = new_rounded_size;
 }
+
+// Step_AVX_SGD with bf16 master weights, stored with stochastic rounding as in Step_AVX_bf16
+template <int span, int isa>
+void Adam_Optimizer::Step_AVX_SGD_bf16(size_t* rounded_size,
+                                       uint16_t* _params,
+                                       float* grads,
+                                       float* _exp_avg,
+                                       size_t _param_size,
+                                       uint32_t seed)
+{
+    AVX_Data betta1_4;
+    betta1_4.data = SIMD_SET(_betta1);
+    AVX_Data dampening_minus1_4;
+    dampening_minus1_4.data = SIMD_SET(1 - _sgd_dampening);
+
+    float step_size = -1 * _alpha;
+    AVX_Data step_size_4;
+    step_size_4.data = SIMD_SET(step_size);
+
+    AVX_Data weight_decay4;
+    if (_weight_decay > 0) weight_decay4.data = SIMD_SET(_weight_decay);
+
+    CPU_Thread_Pool::Instance().parallel_for(0, _param_size, [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i += SIMD_WIDTH * span) {
+            size_t n = hi - i;
+            AVX_Data grad_4[span];
+            simd_load<span>(grad_4, grads + i, false, n);
+
+            AVX_Data momentum_4[span];
+            simd_load<span>(momentum_4, _exp_avg + i, false, n);
+
+            AVX_Data param_4[span];
+            simd_load_bf16<span>(param_4, _params + i, n);
+
+            if (_weight_decay > 0) { simd_fma<span>(grad_4, param_4, weight_decay4, grad_4); }
+
+            simd_mul<span>(momentum_4, momentum_4, betta1_4);
+            simd_fma<span>(momentum_4, grad_4, dampening_minus1_4, momentum_4);
+            if (_sgd_nesterov) {
+                simd_fma<span>(grad_4, momentum_4, betta1_4, grad_4);
+                simd_fma<span>(param_4, grad_4, step_size_4, param_4);
+            } else {
+                simd_fma<span>(param_4, momentum_4, step_size_4, param_4);
+            }
+
+            simd_store_bf16_sr<span>(_params + i, param_4, seed, (uint32_t)i, n);
+            simd_store<span>(_exp_avg + i, momentum_4, false, n);
+        }
+    });
+    *rounded_size = _param_size;
+}
+DS_SIMD_TARGET_POP
 #endif
@@ -0,0 +1,271 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+// Persistent worker pool for the CPU optimizer kernels.
+//
+// The workers start once and are pinned one per CPU, in NUMA node order, so worker w always
+// runs on the same core. A range is cut into one contiguous slice per worker at fixed,
+// CPU_POOL_GRAIN-aligned split points: a tensor slice goes to the same core on every step and
+// its pages stay on that core's node after the first touch. A range uses one worker per
+// CPU_POOL_MIN_WORK elements at most, and a range below that runs inline on the caller, so a
+// small tensor does not pay for waking the pool. parallel_for_batch() cuts the concatenation
+// of many tensors the same way and dispatches all of them in one round.
+//
+// DS_CPU_THREADS sets the number of workers (default: the OpenMP thread count) and
+// DS_CPU_POOL_PIN=0 leaves them unpinned.
+
+#pragma once
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#if (__x86_64__ || __i386__)
+#include <immintrin.h>
+#define CPU_POOL_PAUSE() _mm_pause()
+#else
+#define CPU_POOL_PAUSE() std::this_thread::yield()
+#endif
+
+// Split points are multiples of CPU_POOL_GRAIN elements: 512 bytes of fp32, whole cache lines
+// and whole Step_AVX<8> blocks at both vector levels
+#define CPU_POOL_GRAIN 128
+#define CPU_POOL_MIN_WORK (64 * 1024)
+// Polls before a worker or the caller blocks on its condition variable
+#define CPU_POOL_SPIN 20000
+
+class CPU_Thread_Pool {
+public:
+    static CPU_Thread_Pool& Instance()
+    {
+        static CPU_Thread_Pool _pool;
+        return _pool;
+    }
+
+    size_t size() const { return _workers.size(); }
+
+    // fn(lo, hi) over slices of [begin, end)
+    template <typename F>
+    void parallel_for(size_t begin,
+                      size_t end,
+                      F&& fn,
+                      size_t grain = CPU_POOL_GRAIN,
+                      size_t min_work = CPU_POOL_MIN_WORK)
+    {
+        if (end <= begin) return;
+        const size_t n = end - begin;
+        const size_t parts = slices(n, min_work);
+        if (parts <= 1 || !dispatchable()) {
+            fn(begin, end);
+            return;
+        }
+        const size_t chunk = slice_size(n, parts, grain);
+        run(parts, [&](size_t p) {
+            size_t lo = std::min(p * chunk, n);
+            size_t hi = std::min(lo + chunk, n);
+            if (lo < hi) fn(begin + lo, begin + hi);
+        });
+    }
+
+    // fn(i, lo, hi) over slices of tensors 0 .. n_tensors - 1, tensor i having sizes[i]
+    // elements. A slice never crosses a tensor boundary, split points are aligned in the
+    // concatenation.
+    template <typename F>
+    void parallel_for_batch(const size_t* sizes,
+                            size_t n_tensors,
+                            F&& fn,
+                            size_t grain = CPU_POOL_GRAIN,
+                            size_t min_work = CPU_POOL_MIN_WORK)
+    {
+        std::vector<size_t> start(n_tensors + 1, 0);
+        for (size_t i = 0; i < n_tensors; i++) start[i + 1] = start[i] + sizes[i];
+        const size_t n = start[n_tensors];
+        if (n == 0) return;
+
+        auto range = [&](size_t lo, size_t hi) {
+            size_t i = std::upper_bound(start.begin(), start.end(), lo) - start.begin() - 1;
+            for (; i < n_tensors && start[i] < hi; i++) {
+                size_t a = std::max(lo, start[i]);
+                size_t b = std::min(hi, start[i + 1]);
+                if (a < b) fn(i, a - start[i], b - start[i]);
+            }
+        };
+        const size_t parts = slices(n, min_work);
+        if (parts <= 1 || !dispatchable()) {
+            range(0, n);
+            return;
+        }
+        const size_t chunk = slice_size(n, parts, grain);
+        run(parts, [&](size_t p) {
+            size_t lo = std::min(p * chunk, n);
+            range(lo, std::min(lo + chunk, n));
+        });
+    }
+
+    ~CPU_Thread_Pool()
+    {
+        if (getpid() != _owner) return;  // the workers did not survive a fork
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _generation++;
+        }
+        _wake.notify_all();
+        for (auto& w : _workers) w.join();
+    }
+
+private:
+    CPU_Thread_Pool() : _owner(getpid())
+    {
+        size_t n_workers = 0;
+        if (const char* env = std::getenv("DS_CPU_THREADS")) n_workers = std::atoi(env);
+#if defined(_OPENMP)
+        if (n_workers == 0) n_workers = omp_get_max_threads();
+#endif
+        if (n_workers == 0) n_workers = std::max(1u, std::thread::hardware_concurrency());
+
+        const char* pin_env = std::getenv("DS_CPU_POOL_PIN");
+        const bool pin = !(pin_env && std::strcmp(pin_env, "0") == 0);
+        std::vector<int> cpus = numa_ordered_cpus();
+
+        for (size_t w = 0; w < n_workers; w++) {
+            int cpu = (pin && !cpus.empty()) ? cpus[w * cpus.size() / n_workers] : -1;
+            _workers.emplace_back(&CPU_Thread_Pool::worker, this, w, cpu);
+        }
+    }
+    CPU_Thread_Pool(const CPU_Thread_Pool&) = delete;
+    CPU_Thread_Pool& operator=(const CPU_Thread_Pool&) = delete;
+
+    static bool& in_worker()
+    {
+        thread_local bool w = false;
+        return w;
+    }
+
+    // A kernel called from a worker, or from a forked child that has no workers, runs inline
+    bool dispatchable() const { return !in_worker() && getpid() == _owner; }
+
+    size_t slices(size_t n, size_t min_work) const
+    {
+        return std::min(_workers.size(), (n + min_work - 1) / std::max(min_work, (size_t)1));
+    }
+
+    static size_t slice_size(size_t n, size_t parts, size_t grain)
+    {
+        return ((n + parts - 1) / parts + grain - 1) / grain * grain;
+    }
+
+    // The CPUs this process may run on, grouped by NUMA node
+    static std::vector<int> numa_ordered_cpus()
+    {
+        std::vector<std::pair<int, int>> node_cpu;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) return {};
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &set)) continue;
+            int node = 0;
+            char path[64];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+            if (DIR* dir = opendir(path)) {
+                while (struct dirent* e = readdir(dir)) {
+                    if (std::strncmp(e->d_name, "node", 4) == 0) node = std::atoi(e->d_name + 4);
+                }
+                closedir(dir);
+            }
+            node_cpu.emplace_back(node, cpu);
+        }
+        std::sort(node_cpu.begin(), node_cpu.end());
+        std::vector<int> cpus;
+        for (auto& nc : node_cpu) cpus.push_back(nc.second);
+        return cpus;
+    }
+
+    // Runs job(p) on worker p for p < parts, returns when all of them are done
+    void run(size_t parts, const std::function<void(size_t)>& job)
+    {
+        std::lock_guard<std::mutex> dispatch(_dispatch);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job = &job;
+            _parts = parts;
+            _pending.store(parts, std::memory_order_relaxed);
+            _generation++;
+        }
+        _wake.notify_all();
+
+        for (int s = 0; s < CPU_POOL_SPIN && _pending.load(std::memory_order_acquire); s++) {
+            CPU_POOL_PAUSE();
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [&] { return _pending.load(std::memory_order_acquire) == 0; });
+        _job = nullptr;
+    }
+
+    void worker(size_t w, int cpu)
+    {
+        if (cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        in_worker() = true;
+
+        size_t seen = 0;
+        while (true) {
+            for (int s = 0; s < CPU_POOL_SPIN && _generation.load(std::memory_order_acquire) == seen;
+                 s++) {
+                CPU_POOL_PAUSE();
+            }
+            const std::function<void(size_t)>* job;
+            size_t parts;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [&] { return _generation.load() != seen; });
+                seen = _generation.load();
+                if (_stop) return;
+                job = _job;
+                parts = _parts;
+            }
+            if (w >= parts) continue;
+
+            (*job)(w);
+            if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _done.notify_one();
+            }
+        }
+    }
+
+    const pid_t _owner;
+    std::vector<std::thread> _workers;
+
+    std::mutex _dispatch;  // one round at a time
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    std::atomic<size_t> _generation{0};
+    std::atomic<size_t> _pending{0};
+    const std::function<void(size_t)>* _job = nullptr;
+    size_t _parts = 0;
+    bool _stop = false;
+};
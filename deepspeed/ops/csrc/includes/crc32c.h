@@ -0,0 +1,168 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+// Chunked CRC32C of swapped tensors.
+//
+// A file is cut into CRC_CHUNK byte chunks, the last one possibly shorter. The checksum of a
+// chunk runs CRC_LANES CRC32C streams over its 32-bit words, word j going to lane
+// j % CRC_LANES, and folds the lane values with one more CRC32C. The lanes are independent, so
+// SSE4.2 crc32 keeps its pipeline full on the host, and the device computes one lane per
+// vector element (hls_smartInfinity/src/kernel_cpp/crc32c.cpp). SSE4.2 is not part of x86-64:
+// the crc32 instruction is only used from a target("sse4.2") copy of the chunk loop, at the
+// ds_simd_isa() levels that imply it, and the scalar level computes the CRC in software.
+//
+// The checksums of <file> live in the sidecar <file>.crc: the data bytes and the mtime of
+// <file> when they were taken, then one uint32 per chunk. A writer that does not update the
+// sidecar changes the mtime, so a stale sidecar is skipped instead of reported.
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "simd.h"
+
+#define CRC_CHUNK (1 << 20)
+#define CRC_LANES 16
+#define CRC32C_POLY 0x82f63b78u
+
+struct crc_sidecar_header {
+    uint64_t nbytes;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+static inline uint32_t crc32c_u32(uint32_t crc, uint32_t w)
+{
+    crc ^= w;
+    for (int b = 0; b < 32; b++) crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+    return crc;
+}
+
+static inline size_t crc_n_chunks(size_t nbytes) { return (nbytes + CRC_CHUNK - 1) / CRC_CHUNK; }
+
+// Checksum of one chunk of nbytes, step(crc, word) being one CRC32C update; a trailing partial
+// word is zero padded
+#define CRC32C_CHUNK_BODY(step)                                                               \
+    const uint32_t* w = (const uint32_t*)buf;                                                 \
+    size_t n_words = nbytes / 4;                                                              \
+                                                                                              \
+    uint32_t lane[CRC_LANES];                                                                 \
+    for (int l = 0; l < CRC_LANES; l++) lane[l] = 0xffffffffu;                                \
+                                                                                              \
+    size_t j = 0;                                                                             \
+    for (; j + CRC_LANES <= n_words; j += CRC_LANES) {                                        \
+        for (int l = 0; l < CRC_LANES; l++) lane[l] = step(lane[l], w[j + l]);                \
+    }                                                                                         \
+    for (; j < n_words; j++) lane[j % CRC_LANES] = step(lane[j % CRC_LANES], w[j]);           \
+    if (nbytes % 4) {                                                                         \
+        uint32_t tail = 0;                                                                    \
+        std::memcpy(&tail, w + n_words, nbytes % 4);                                          \
+        lane[n_words % CRC_LANES] = step(lane[n_words % CRC_LANES], tail);                    \
+    }                                                                                         \
+                                                                                              \
+    uint32_t crc = 0xffffffffu;                                                               \
+    for (int l = 0; l < CRC_LANES; l++) crc = step(crc, ~lane[l]);                            \
+    return ~crc;
+
+#if (__x86_64__ || __i386__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_chunk_sse42(const void* buf, size_t nbytes)
+{
+    CRC32C_CHUNK_BODY(_mm_crc32_u32)
+}
+#endif
+
+static inline uint32_t crc32c_chunk(const void* buf, size_t nbytes)
+{
+#if (__x86_64__ || __i386__)
+    if (ds_simd_isa() >= DS_ISA_AVX2) return crc32c_chunk_sse42(buf, nbytes);
+#endif
+    CRC32C_CHUNK_BODY(crc32c_u32)
+}
+
+// Checksums of all chunks of buf into crcs (crc_n_chunks(nbytes) entries)
+static void crc32c_chunks(const void* buf, size_t nbytes, uint32_t* crcs)
+{
+    const char* p = (const char*)buf;
+    const long long n_chunks = crc_n_chunks(nbytes);
+
+#pragma omp parallel for
+    for (long long c = 0; c < n_chunks; c++) {
+        size_t begin = (size_t)c * CRC_CHUNK;
+        size_t len = (nbytes - begin < CRC_CHUNK) ? nbytes - begin : CRC_CHUNK;
+        crcs[c] = crc32c_chunk(p + begin, len);
+    }
+}
+
+static inline std::string crc_sidecar_path(const std::string& path) { return path + ".crc"; }
+
+static bool crc_file_mtime(const char* path, int64_t* sec, int64_t* nsec)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    *sec = st.st_mtim.tv_sec;
+    *nsec = st.st_mtim.tv_nsec;
+    return true;
+}
+
+// Records the checksums of path, which must already hold the data they were taken from
+static bool write_crc_sidecar(const char* path, const uint32_t* crcs, size_t nbytes)
+{
+    crc_sidecar_header header;
+    header.nbytes = nbytes;
+    if (!crc_file_mtime(path, &header.mtime_sec, &header.mtime_nsec)) return false;
+
+    const std::string sidecar = crc_sidecar_path(path);
+    const int fd = open(sidecar.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return false;
+    const size_t crc_bytes = crc_n_chunks(nbytes) * sizeof(uint32_t);
+    bool ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+              write(fd, crcs, crc_bytes) == (ssize_t)crc_bytes;
+    close(fd);
+    return ok;
+}
+
+// Compares crcs, taken from the first nbytes of path, against its sidecar. Returns the number
+// of mismatching chunks, or -1 if there is no current sidecar for these bytes.
+static long long verify_crc_sidecar(const char* path, const uint32_t* crcs, size_t nbytes)
+{
+    const std::string sidecar = crc_sidecar_path(path);
+    const int fd = open(sidecar.c_str(), O_RDONLY);
+    if (fd == -1) return -1;
+
+    crc_sidecar_header header;
+    int64_t sec, nsec;
+    if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || header.nbytes != nbytes ||
+        !crc_file_mtime(path, &sec, &nsec) || header.mtime_sec != sec || header.mtime_nsec != nsec) {
+        close(fd);
+        return -1;
+    }
+
+    const size_t n_chunks = crc_n_chunks(nbytes);
+    std::vector<uint32_t> expected(n_chunks);
+    const ssize_t crc_bytes = n_chunks * sizeof(uint32_t);
+    const bool ok = read(fd, expected.data(), crc_bytes) == crc_bytes;
+    close(fd);
+    if (!ok) return -1;
+
+    long long n_bad = 0;
+    for (size_t c = 0; c < n_chunks; c++) {
+        if (crcs[c] == expected[c]) continue;
+        if (n_bad == 0) {
+            std::cerr << "CRC32C mismatch: " << path << " chunk " << c << " (bytes "
+                      << c * (size_t)CRC_CHUNK << "...)" << std::endl;
+        }
+        n_bad++;
+    }
+    if (n_bad > 1) std::cerr << "CRC32C mismatch: " << path << " " << n_bad << " chunks" << std::endl;
+    return n_bad;
+}
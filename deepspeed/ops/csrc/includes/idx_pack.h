@@ -0,0 +1,189 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+// Delta-encoded, bit-packed index stream for SmartComp gradients.
+//
+// Increasing indices are cut into blocks of IDX_BLOCK. The stream starts with two header words
+// per block: the first index of the block, and (payload word offset << IDX_WIDTH_BITS) | width.
+// Field j of a block holds idx[j] - idx[j - 1] - 1 (0 for j = 0) in `width` bits, packed LSB
+// first, so a block payload is exactly width * IDX_BLOCK / 32 words. Payloads follow the header
+// back to back. Same layout as hls_smartInfinity/src/kernel_cpp/idx_unpack.h.
+//
+// Decoders may read up to IDX_PAD_WORDS words past the last payload word.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if (__x86_64__ || __i386__)
+#include <x86intrin.h>
+#endif
+
+#define IDX_BLOCK 256
+#define IDX_HEADER_WORDS 2
+#define IDX_WIDTH_BITS 5
+#define IDX_WIDTH_MASK ((1u << IDX_WIDTH_BITS) - 1)
+#define IDX_MAX_OFFSET (UINT32_MAX >> IDX_WIDTH_BITS)
+#define IDX_PAD_WORDS 2
+
+static inline size_t idx_n_blocks(size_t n) { return (n + IDX_BLOCK - 1) / IDX_BLOCK; }
+
+// Upper bound of the stream length in words for n indices, padding included
+static inline size_t idx_packed_bound(size_t n)
+{
+    return idx_n_blocks(n) * (IDX_HEADER_WORDS + 31 * IDX_BLOCK / 32) + IDX_PAD_WORDS;
+}
+
+static inline uint32_t idx_block_len(size_t n, size_t b)
+{
+    return (uint32_t)((b + 1) * IDX_BLOCK <= n ? IDX_BLOCK : n - b * IDX_BLOCK);
+}
+
+// Packs n increasing indices into packed and returns the number of words used (without padding)
+static size_t pack_idx(const int32_t* idx, size_t n, uint32_t* packed)
+{
+    size_t n_blocks = idx_n_blocks(n);
+    uint32_t* header = packed;
+    uint32_t* payload = packed + IDX_HEADER_WORDS * n_blocks;
+
+#pragma omp parallel for
+    for (size_t b = 0; b < n_blocks; b++) {
+        const int32_t* blk = idx + b * IDX_BLOCK;
+        uint32_t len = idx_block_len(n, b);
+        uint32_t max_delta = 0;
+        for (uint32_t j = 1; j < len; j++) max_delta |= (uint32_t)(blk[j] - blk[j - 1] - 1);
+        header[IDX_HEADER_WORDS * b] = (uint32_t)blk[0];
+        header[IDX_HEADER_WORDS * b + 1] = max_delta ? 32 - __builtin_clz(max_delta) : 0;
+    }
+
+    size_t offset = 0;
+    for (size_t b = 0; b < n_blocks; b++) {
+        uint32_t width = header[IDX_HEADER_WORDS * b + 1];
+        header[IDX_HEADER_WORDS * b + 1] = ((uint32_t)offset << IDX_WIDTH_BITS) | width;
+        offset += width * IDX_BLOCK / 32;
+    }
+
+#pragma omp parallel for
+    for (size_t b = 0; b < n_blocks; b++) {
+        const int32_t* blk = idx + b * IDX_BLOCK;
+        uint32_t len = idx_block_len(n, b);
+        uint32_t width = header[IDX_HEADER_WORDS * b + 1] & IDX_WIDTH_MASK;
+        uint32_t* words = payload + (header[IDX_HEADER_WORDS * b + 1] >> IDX_WIDTH_BITS);
+
+        uint64_t acc = 0;
+        uint32_t bits = 0;
+        for (uint32_t j = 0; j < IDX_BLOCK; j++) {
+            uint32_t delta = (j == 0 || j >= len) ? 0 : (uint32_t)(blk[j] - blk[j - 1] - 1);
+            acc |= (uint64_t)delta << bits;
+            bits += width;
+            if (bits >= 32) {
+                *words++ = (uint32_t)acc;
+                acc >>= 32;
+                bits -= 32;
+            }
+        }
+    }
+
+    for (size_t p = 0; p < IDX_PAD_WORDS; p++) payload[offset + p] = 0;
+    return IDX_HEADER_WORDS * n_blocks + offset;
+}
+
+// Field j of a block: `width` bits from bit j * width of the payload
+static inline uint32_t idx_field(const uint32_t* words, uint32_t j, uint32_t width, uint32_t mask)
+{
+    uint32_t bit = j * width;
+    uint64_t window = ((uint64_t)words[bit / 32 + 1] << 32) | words[bit / 32];
+    return (uint32_t)(window >> (bit % 32)) & mask;
+}
+
+// Restores n indices from the stream written by pack_idx
+static void unpack_idx(const uint32_t* packed, size_t n, int32_t* idx)
+{
+    size_t n_blocks = idx_n_blocks(n);
+    const uint32_t* payload = packed + IDX_HEADER_WORDS * n_blocks;
+
+#pragma omp parallel for
+    for (size_t b = 0; b < n_blocks; b++) {
+        uint32_t base = packed[IDX_HEADER_WORDS * b];
+        uint32_t word1 = packed[IDX_HEADER_WORDS * b + 1];
+        uint32_t width = word1 & IDX_WIDTH_MASK;
+        uint32_t mask = width ? (UINT32_MAX >> (32 - width)) : 0;
+        const uint32_t* words = payload + (word1 >> IDX_WIDTH_BITS);
+        uint32_t len = idx_block_len(n, b);
+        int32_t* out = idx + b * IDX_BLOCK;
+
+        // the running sum is serial, extracting the fields is not
+        uint32_t delta[IDX_BLOCK];
+        uint32_t j = 0;
+#if defined(__AVX512__)
+        const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        const __m512i mask64 = _mm512_set1_epi64(mask);
+        for (; j + 16 <= len; j += 16) {
+            __m512i bit = _mm512_mullo_epi32(_mm512_add_epi32(_mm512_set1_epi32(j), lane),
+                                             _mm512_set1_epi32(width));
+            __m512i byte = _mm512_srli_epi32(bit, 3);
+            __m512i shift = _mm512_and_si512(bit, _mm512_set1_epi32(7));
+            __m512i lo = _mm512_i32gather_epi64(_mm512_castsi512_si256(byte), words, 1);
+            __m512i hi = _mm512_i32gather_epi64(_mm512_extracti64x4_epi64(byte, 1), words, 1);
+            lo = _mm512_and_si512(
+                _mm512_srlv_epi64(lo, _mm512_cvtepu32_epi64(_mm512_castsi512_si256(shift))), mask64);
+            hi = _mm512_and_si512(
+                _mm512_srlv_epi64(hi, _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(shift, 1))),
+                mask64);
+            _mm256_storeu_si256((__m256i*)(delta + j), _mm512_cvtepi64_epi32(lo));
+            _mm256_storeu_si256((__m256i*)(delta + j + 8), _mm512_cvtepi64_epi32(hi));
+        }
+#elif defined(__AVX256__)
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i mask64 = _mm256_set1_epi64x(mask);
+        const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+        for (; j + 8 <= len; j += 8) {
+            __m256i bit = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_set1_epi32(j), lane),
+                                             _mm256_set1_epi32(width));
+            __m256i byte = _mm256_srli_epi32(bit, 3);
+            __m256i shift = _mm256_and_si256(bit, _mm256_set1_epi32(7));
+            __m256i lo = _mm256_i32gather_epi64(
+                (const long long*)words, _mm256_castsi256_si128(byte), 1);
+            __m256i hi = _mm256_i32gather_epi64(
+                (const long long*)words, _mm256_extracti128_si256(byte, 1), 1);
+            lo = _mm256_and_si256(
+                _mm256_srlv_epi64(lo, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(shift))), mask64);
+            hi = _mm256_and_si256(
+                _mm256_srlv_epi64(hi, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(shift, 1))),
+                mask64);
+            // low halves of the 64 bit lanes, in order
+            lo = _mm256_permutevar8x32_epi32(lo, even);
+            hi = _mm256_permutevar8x32_epi32(hi, even);
+            _mm256_storeu_si256((__m256i*)(delta + j), _mm256_blend_epi32(lo, hi, 0xf0));
+        }
+#endif
+        for (; j < len; j++) delta[j] = idx_field(words, j, width, mask);
+
+        uint32_t run = base;
+        out[0] = (int32_t)run;
+        for (j = 1; j < len; j++) {
+            run += delta[j] + 1;
+            out[j] = (int32_t)run;
+        }
+    }
+}
+
+// Block-local top-k keeps topk_block_k(block, ratio) elements of every `block` elements, a
+// multiple of 16 so that each block fills whole kernel vectors. Their offsets inside the block
+// go out as 16-bit indices, so block can be at most 65536.
+#define TOPK_MAX_BLOCK 65536
+
+static inline size_t topk_block_k(size_t block, float ratio)
+{
+    size_t k = ((size_t)(int(block * ratio)) + 15) / 16 * 16;
+    if (k == 0) k = 16;
+    return k < block ? k : block;
+}
+
+static inline size_t topk_block_total(size_t n, size_t block, float ratio)
+{
+    return (n + block - 1) / block * topk_block_k(block, ratio);
+}
@@ -10,13 +10,226 @@
 #include <x86intrin.h>
 #endif
 
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
 #define TILE (128 * 1024 * 1024)
+
+// Vector ISA levels of the CPU optimizer kernels. The vector bodies (Step_AVX) are compiled once
+// per level, in translation units that define __AVX256__ or __AVX512__ before including this
+// header (csrc/adam/cpu_adam_avx2.cpp, ...). Everything else is built for the baseline ISA and
+// calls the level ds_simd_isa() picks at startup, so one binary runs on every node.
+enum ds_simd_isa_t { DS_ISA_SCALAR = 0, DS_ISA_AVX2 = 1, DS_ISA_AVX512 = 2 };
+
+static const char* ds_simd_isa_name(int isa)
+{
+    if (isa == DS_ISA_AVX512) return "AVX512";
+    if (isa == DS_ISA_AVX2) return "AVX2";
+    return "scalar";
+}
+
+// Extensions beyond the level that the kernels do not use yet, for the log
+static const char* ds_simd_isa_extras()
+{
+#if (__x86_64__ || __i386__)
+    unsigned int eax, ebx, ecx, edx;
+    bool bf16 = false, fp16 = false;
+    if (__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx)) bf16 = eax & (1 << 5);  // AVX512_BF16
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) fp16 = edx & (1 << 23);  // AVX512_FP16
+    if (bf16 && fp16) return " (CPU also has AVX512_BF16, AVX512_FP16)";
+    if (bf16) return " (CPU also has AVX512_BF16)";
+    if (fp16) return " (CPU also has AVX512_FP16)";
+#endif
+    return "";
+}
+
+// Highest level the CPU and the OS support: AVX2 needs FMA, F16C and SSE4.2 as well (the
+// baseline code converts fp16 and checksums with them at these levels), AVX512 needs BW and VL
+// for the 16-bit masked tails, and both levels need the OS to save the wider registers (XCR0).
+static int ds_simd_detect_isa()
+{
+#if (__x86_64__ || __i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return DS_ISA_SCALAR;
+    const bool fma = ecx & bit_FMA;
+    const bool f16c = ecx & bit_F16C;
+    const bool sse42 = ecx & bit_SSE4_2;
+    if (!(ecx & bit_OSXSAVE)) return DS_ISA_SCALAR;
+
+    unsigned int xcr0, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0 & 0x6) != 0x6) return DS_ISA_SCALAR;  // XMM and YMM state
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return DS_ISA_SCALAR;
+    if (!(fma && f16c && sse42 && (ebx & bit_AVX2))) return DS_ISA_SCALAR;
+    const bool avx512 = (ebx & bit_AVX512F) && (ebx & bit_AVX512BW) && (ebx & bit_AVX512VL);
+    if (avx512 && (xcr0 & 0xe0) == 0xe0) return DS_ISA_AVX512;  // opmask, ZMM state
+    return DS_ISA_AVX2;
+#else
+    return DS_ISA_SCALAR;
+#endif
+}
+
+// Level the kernels run at: the detected one, or a lower one set with
+// DS_SIMD_ISA=scalar|avx2|avx512. Decided on the first call.
+static int ds_simd_isa()
+{
+    static const int isa = [] {
+        const int detected = ds_simd_detect_isa();
+        const char* env = getenv("DS_SIMD_ISA");
+        if (env == nullptr || *env == '\0') return detected;
+
+        int requested = -1;
+        for (int l = DS_ISA_SCALAR; l <= DS_ISA_AVX512; l++) {
+            if (strcasecmp(env, ds_simd_isa_name(l)) == 0) requested = l;
+        }
+        if (requested < 0) {
+            fprintf(stderr, "DS_SIMD_ISA=%s is not one of scalar, avx2, avx512; using %s\n", env,
+                    ds_simd_isa_name(detected));
+            return detected;
+        }
+        if (requested > detected) {
+            fprintf(stderr, "DS_SIMD_ISA=%s is not supported by this CPU; using %s\n", env,
+                    ds_simd_isa_name(detected));
+            return detected;
+        }
+        return requested;
+    }();
+    return isa;
+}
+
+// fp16 <-> fp32 for the baseline code. F16C is not part of x86-64, so its instructions are only
+// reached through target("f16c") functions at the levels that imply it; the scalar level
+// converts in software. Both round to nearest even, like _cvtss_sh(f, 0).
+static inline float ds_half_to_float_sw(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t man = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (man << 13);
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (man << 13);
+    } else if (man == 0) {
+        bits = sign;
+    } else {
+        // subnormal, renormalize
+        exp = 113;
+        while (!(man & 0x400)) {
+            man <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((man & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t ds_float_to_half_sw(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+    if (bits >= 0x47800000) {
+        // inf, NaN (quieted) and magnitudes of 65536 and above
+        return sign | (bits > 0x7f800000 ? 0x7e00 | ((bits >> 13) & 0x3ff) : 0x7c00);
+    }
+    if (bits < 0x38800000) {
+        // below 2^-14: adding 0.5 aligns the subnormal mantissa and rounds it
+        float a;
+        memcpy(&a, &bits, sizeof(a));
+        a += 0.5f;
+        memcpy(&bits, &a, sizeof(bits));
+        return sign | (uint16_t)(bits - 0x3f000000);
+    }
+    // rebias the exponent and round the 13 dropped bits to nearest even; a carry moves into
+    // the exponent, up to inf
+    bits += 0xc8000fff + ((bits >> 13) & 1);
+    return sign | (uint16_t)(bits >> 13);
+}
+
+#if (__x86_64__ || __i386__)
+__attribute__((target("f16c"))) static inline float ds_half_to_float_f16c(uint16_t h)
+{
+    return _cvtsh_ss(h);
+}
+__attribute__((target("f16c"))) static inline uint16_t ds_float_to_half_f16c(float f)
+{
+    return _cvtss_sh(f, 0);
+}
+#endif
+
+static inline float ds_half_to_float(uint16_t h)
+{
+#if (__x86_64__ || __i386__)
+    if (ds_simd_isa() >= DS_ISA_AVX2) return ds_half_to_float_f16c(h);
+#endif
+    return ds_half_to_float_sw(h);
+}
+
+static inline uint16_t ds_float_to_half(float f)
+{
+#if (__x86_64__ || __i386__)
+    if (ds_simd_isa() >= DS_ISA_AVX2) return ds_float_to_half_f16c(f);
+#endif
+    return ds_float_to_half_sw(f);
+}
+
+// Loads the cache line at p ahead of a scattered read, on any target
+static inline void ds_prefetch(const void* p)
+{
+#if (__x86_64__ || __i386__)
+    _mm_prefetch((const char*)p, _MM_HINT_T0);
+#else
+    __builtin_prefetch(p, 0, 3);
+#endif
+}
+
+static size_t ds_env_size(const char* name, size_t default_value)
+{
+    const char* env = getenv(name);
+    if (env == nullptr || *env == '\0') return default_value;
+    return strtoull(env, nullptr, 10);
+}
+
+// Streaming mode of the vector Adam step: a call on at least DS_CPU_STREAM_MIN elements writes
+// the fp32 params and the moments with non-temporal stores, which skip the read for ownership
+// and leave the cache to the loads, and prefetches its loads DS_CPU_PREFETCH elements ahead
+// (0: no prefetch). At the default of 16M elements a call moves at least 256 MB of params and
+// moments, more than a last level cache holds, so the lines it writes are evicted before they
+// are read again anyway. Decided on the first call.
+static size_t ds_stream_min()
+{
+    static const size_t n = ds_env_size("DS_CPU_STREAM_MIN", 16 * 1024 * 1024);
+    return n;
+}
+static size_t ds_prefetch_distance()
+{
+    static const size_t n = ds_env_size("DS_CPU_PREFETCH", 1024);
+    return n;
+}
+
 #if defined(__AVX512__) or defined(__AVX256__)
 
 #define ROUND_DOWN(size, step) ((size) & ~((step)-1))
 
+// Code between DS_SIMD_TARGET_PUSH and DS_SIMD_TARGET_POP is compiled for this translation
+// unit's level. The helpers live in a per-level inline namespace so the copies of different
+// levels do not collide at link time.
+#define DS_SIMD_TARGET_POP _Pragma("GCC pop_options")
+
 #if defined(__AVX512__)
+#define DS_SIMD_LEVEL DS_ISA_AVX512
+#define DS_SIMD_NS simd_avx512
+#define DS_SIMD_TARGET_PUSH _Pragma("GCC push_options") _Pragma("GCC target(\"avx512f,avx512bw,avx512vl,avx2,fma,f16c\")")
+
 #define SIMD_STORE(a, d) _mm512_storeu_ps(a, d)
+#define SIMD_STREAM(a, d) _mm512_stream_ps(a, d)
 #define SIMD_LOAD(x) _mm512_loadu_ps(x)
 #define SIMD_SET(x) _mm512_set1_ps(x)
 #define SIMD_ADD(x, y) _mm512_add_ps(x, y)
@@ -28,13 +241,18 @@
 
 #define SIMD_LOAD2(x, h) \
     ((h) ? _mm512_cvtph_ps(_mm256_castps_si256(_mm256_loadu_ps(x))) : _mm512_loadu_ps(x))
-#define SIMD_STORE2(x, d, h)                                                                      \
-    ((h) ? _mm256_store_ps(x, _mm256_castsi256_ps(_mm512_cvtps_ph(d, _MM_FROUND_TO_NEAREST_INT))) \
+#define SIMD_STORE2(x, d, h)                                                                       \
+    ((h) ? _mm256_storeu_ps(x, _mm256_castsi256_ps(_mm512_cvtps_ph(d, _MM_FROUND_TO_NEAREST_INT))) \
          : _mm512_storeu_ps(x, d))
 
 #define INTV __m256i
 #elif defined(__AVX256__)
+#define DS_SIMD_LEVEL DS_ISA_AVX2
+#define DS_SIMD_NS simd_avx2
+#define DS_SIMD_TARGET_PUSH _Pragma("GCC push_options") _Pragma("GCC target(\"avx2,fma,f16c\")")
+
 #define SIMD_STORE(a, d) _mm256_storeu_ps(a, d)
+#define SIMD_STREAM(a, d) _mm256_stream_ps(a, d)
 #define SIMD_LOAD(x) _mm256_loadu_ps(x)
 #define SIMD_SET(x) _mm256_set1_ps(x)
 #define SIMD_ADD(x, y) _mm256_add_ps(x, y)
@@ -44,15 +262,18 @@
 #define SIMD_DIV(x, y) _mm256_div_ps(x, y)
 #define SIMD_WIDTH 8
 #define SIMD_LOAD2(x, h) \
-    ((h) ? _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)x)) : _mm256_loadu_ps(x))
+    ((h) ? _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(x))) : _mm256_loadu_ps(x))
 
-#define SIMD_STORE2(x, d, h)                                                                \
-    ((h) ? _mm_store_ps(x, _mm_castsi128_ps(_mm256_cvtps_ph(d, _MM_FROUND_TO_NEAREST_INT))) \
+#define SIMD_STORE2(x, d, h)                                                                 \
+    ((h) ? _mm_storeu_ps(x, _mm_castsi128_ps(_mm256_cvtps_ph(d, _MM_FROUND_TO_NEAREST_INT))) \
          : _mm256_storeu_ps(x, d))
 
 #define INTV __m128i
 #endif
 
+DS_SIMD_TARGET_PUSH
+inline namespace DS_SIMD_NS {
+
 union AVX_Data {
 #if defined(__AVX512__)
     __m512 data;
@@ -72,10 +293,105 @@ inline void simd_store(float* dst, AVX_Data* src, bool half_precision)
 template <int span>
 inline void simd_load(AVX_Data* dst, float* src, bool half_precision)
 {
-    size_t width = (half_precision ? 1 : SIMD_WIDTH);
+    size_t width = (half_precision ? SIMD_WIDTH / 2 : SIMD_WIDTH);
 #pragma unroll
     for (size_t i = 0; i < span; ++i) { dst[i].data = SIMD_LOAD2(src + width * i, half_precision); }
 }
+
+#if defined(__AVX256__)
+#define SIMD_LANE_IDX _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+#endif
+
+// Masked tails. Only lanes [0, n) of memory are read or written, the other lanes load as zero.
+// A tail runs the same vector arithmetic as a full block, so an element's result does not depend
+// on where its tensor ends. AVX2 has no 16-bit maskload, so its fp16 tails go through a buffer.
+inline void simd_load_n(AVX_Data& dst, const float* src, size_t n, bool half_precision)
+{
+#if defined(__AVX512__)
+    __mmask16 mask = (__mmask16)((1u << n) - 1);
+    dst.data = half_precision ? _mm512_cvtph_ps(_mm256_maskz_loadu_epi16(mask, src))
+                              : _mm512_maskz_loadu_ps(mask, src);
+#else
+    if (half_precision) {
+        alignas(16) uint16_t buf[SIMD_WIDTH] = {0};
+        memcpy(buf, src, n * sizeof(uint16_t));
+        dst.data = _mm256_cvtph_ps(_mm_load_si128((const __m128i*)buf));
+    } else {
+        __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)n), SIMD_LANE_IDX);
+        dst.data = _mm256_maskload_ps(src, mask);
+    }
+#endif
+}
+inline void simd_store_n(float* dst, const AVX_Data& src, size_t n, bool half_precision)
+{
+#if defined(__AVX512__)
+    __mmask16 mask = (__mmask16)((1u << n) - 1);
+    if (half_precision)
+        _mm256_mask_storeu_epi16(dst, mask, _mm512_cvtps_ph(src.data, _MM_FROUND_TO_NEAREST_INT));
+    else
+        _mm512_mask_storeu_ps(dst, mask, src.data);
+#else
+    if (half_precision) {
+        alignas(16) uint16_t buf[SIMD_WIDTH];
+        _mm_store_si128((__m128i*)buf, _mm256_cvtps_ph(src.data, _MM_FROUND_TO_NEAREST_INT));
+        memcpy(dst, buf, n * sizeof(uint16_t));
+    } else {
+        __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)n), SIMD_LANE_IDX);
+        _mm256_maskstore_ps(dst, mask, src.data);
+    }
+#endif
+}
+
+// Lanes of vector i when n elements of a span * SIMD_WIDTH block are valid
+inline size_t simd_lanes(size_t n, size_t i)
+{
+    if (n <= SIMD_WIDTH * i) return 0;
+    return (n - SIMD_WIDTH * i < SIMD_WIDTH) ? n - SIMD_WIDTH * i : SIMD_WIDTH;
+}
+
+// simd_load / simd_store of a block with n valid elements, masked when n < span * SIMD_WIDTH
+template <int span>
+inline void simd_load(AVX_Data* dst, float* src, bool half_precision, size_t n)
+{
+    if (n >= SIMD_WIDTH * span) return simd_load<span>(dst, src, half_precision);
+    size_t width = (half_precision ? SIMD_WIDTH / 2 : SIMD_WIDTH);
+#pragma unroll
+    for (size_t i = 0; i < span; ++i) {
+        simd_load_n(dst[i], src + width * i, simd_lanes(n, i), half_precision);
+    }
+}
+template <int span>
+inline void simd_store(float* dst, AVX_Data* src, bool half_precision, size_t n)
+{
+    if (n >= SIMD_WIDTH * span) return simd_store<span>(dst, src, half_precision);
+    size_t width = (half_precision ? SIMD_WIDTH / 2 : SIMD_WIDTH);
+#pragma unroll
+    for (size_t i = 0; i < span; ++i) {
+        size_t lanes = simd_lanes(n, i);
+        if (lanes) simd_store_n(dst + width * i, src[i], lanes, half_precision);
+    }
+}
+// Non-temporal simd_store of an fp32 block. A block that is not full or not vector aligned is
+// stored the regular way. The stores are weakly ordered: a thread ends its run of them with
+// simd_stream_fence() before another thread may read the data.
+template <int span>
+inline void simd_stream(float* dst, AVX_Data* src, size_t n)
+{
+    if (n < SIMD_WIDTH * span || ((uintptr_t)dst % (SIMD_WIDTH * sizeof(float))) != 0)
+        return simd_store<span>(dst, src, false, n);
+#pragma unroll
+    for (size_t i = 0; i < span; ++i) { SIMD_STREAM(dst + SIMD_WIDTH * i, src[i].data); }
+}
+inline void simd_stream_fence() { _mm_sfence(); }
+
+// Prefetches the cache lines of the block at src
+template <int span>
+inline void simd_prefetch(const float* src, bool half_precision)
+{
+    const size_t bytes = SIMD_WIDTH * span * (half_precision ? sizeof(uint16_t) : sizeof(float));
+    for (size_t b = 0; b < bytes; b += 64) { _mm_prefetch((const char*)src + b, _MM_HINT_T0); }
+}
+
 template <int span>
 inline void simd_fma(AVX_Data* dst, AVX_Data* src_m_l, AVX_Data src_m_r, AVX_Data* src_a)
 {
@@ -137,4 +453,37 @@ inline void simd_div(AVX_Data* dst, AVX_Data* src_a_l, AVX_Data* src_a_r)
     for (size_t i = 0; i < span; ++i) { dst[i].data = SIMD_DIV(src_a_l[i].data, src_a_r[i].data); }
 }
 
+// Inf/NaN check: acc collects x * 0, which is NaN only for the lanes where x is inf or NaN
+template <int span>
+inline void simd_nonfinite(AVX_Data& acc, AVX_Data* src)
+{
+#pragma unroll
+    for (size_t i = 0; i < span; ++i) {
+        acc.data = SIMD_ADD(acc.data, SIMD_MUL(src[i].data, SIMD_SET(0.0f)));
+    }
+}
+inline bool simd_has_nan(const AVX_Data& acc)
+{
+    float lanes[SIMD_WIDTH];
+    SIMD_STORE(lanes, acc.data);
+    for (int i = 0; i < SIMD_WIDTH; i++) {
+        if (lanes[i] != lanes[i]) return true;
+    }
+    return false;
+}
+template <int span>
+inline double simd_reduce_add(AVX_Data* src)
+{
+    double sum = 0.0;
+    float lanes[SIMD_WIDTH];
+    for (size_t i = 0; i < span; ++i) {
+        SIMD_STORE(lanes, src[i].data);
+        for (int j = 0; j < SIMD_WIDTH; j++) sum += lanes[j];
+    }
+    return sum;
+}
+
+}  // namespace DS_SIMD_NS
+DS_SIMD_TARGET_POP
+
 #endif
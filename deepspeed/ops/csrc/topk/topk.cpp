@@ -0,0 +1,433 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+// Linear time top-k by magnitude over fp16 gradients (SmartComp).
+//
+// For fp16, ordering by |x| is ordering of the 15 magnitude bits as unsigned integers, so a
+// threshold is a 16-bit value and an exact threshold can always be found with a 32K-bin
+// histogram. The fast path estimates the threshold from a strided sample and keeps every
+// element at or above it with a SIMD filter pass. A histogram over the candidates only then
+// gives the exact threshold, and the candidates are reduced to exactly k. If the estimate
+// keeps fewer than k elements or far too many, the exact histogram is built over the whole
+// input instead.
+//
+// Indices are returned in increasing order, so they can go straight into the delta-encoded
+// index stream of idx_pack.h.
+
+#include <torch/extension.h>
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if (__x86_64__ || __i386__)
+#include <x86intrin.h>
+#endif
+
+#include "idx_pack.h"
+#include "val_quant.h"
+
+#define MAG_MASK 0x7fff
+#define MAG_BINS (MAG_MASK + 1)
+#define CHUNK (1 << 20)
+#define SAMPLES (1 << 16)
+// candidates beyond this many times k are not worth a second pass over
+#define MAX_CANDIDATE_RATIO 4
+
+#if defined(__AVX512__) && defined(__AVX512BW__)
+#define U16_WIDTH 32
+#elif defined(__AVX256__) || defined(__AVX512__)
+#define U16_WIDTH 16
+#else
+#define U16_WIDTH 1
+#endif
+
+static inline uint16_t magnitude(uint16_t h) { return h & MAG_MASK; }
+
+// Bit i of the result is set when element i of p has magnitude >= threshold (i < U16_WIDTH).
+// For AVX2 every element owns two adjacent bits, see bit_step().
+static inline uint32_t ge_mask(const uint16_t* p, uint16_t threshold)
+{
+#if defined(__AVX512__) && defined(__AVX512BW__)
+    __m512i m = _mm512_and_si512(_mm512_loadu_si512((const void*)p), _mm512_set1_epi16(MAG_MASK));
+    return _mm512_cmpge_epu16_mask(m, _mm512_set1_epi16(threshold));
+#elif defined(__AVX256__) || defined(__AVX512__)
+    __m256i m = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi16(MAG_MASK));
+    // magnitudes fit in 15 bits, so the signed compare is safe
+    __m256i ge = _mm256_cmpgt_epi16(m, _mm256_set1_epi16((int16_t)threshold - 1));
+    return (uint32_t)_mm256_movemask_epi8(ge);
+#else
+    return magnitude(p[0]) >= threshold;
+#endif
+}
+
+static inline int bit_step()
+{
+#if !(defined(__AVX512__) && defined(__AVX512BW__)) && (defined(__AVX256__) || defined(__AVX512__))
+    return 2;
+#else
+    return 1;
+#endif
+}
+
+static size_t count_ge(const uint16_t* grad, size_t begin, size_t end, uint16_t threshold)
+{
+    size_t count = 0;
+    size_t k = begin;
+    for (; k + U16_WIDTH <= end; k += U16_WIDTH) {
+        count += __builtin_popcount(ge_mask(grad + k, threshold));
+    }
+    count /= bit_step();
+    for (; k < end; k++) count += magnitude(grad[k]) >= threshold;
+    return count;
+}
+
+template <typename Emit>
+static void filter_ge(const uint16_t* grad, size_t begin, size_t end, uint16_t threshold, Emit emit)
+{
+    const int step = bit_step();
+    size_t k = begin;
+    for (; k + U16_WIDTH <= end; k += U16_WIDTH) {
+        uint32_t mask = ge_mask(grad + k, threshold);
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            emit(k + bit / step);
+            mask &= ~(((1u << step) - 1) << bit);
+        }
+    }
+    for (; k < end; k++)
+        if (magnitude(grad[k]) >= threshold) emit(k);
+}
+
+// Exact threshold T and the number of elements equal to T that complete k
+static void exact_threshold(const std::vector<size_t>& hist, size_t k, uint16_t* threshold, size_t* ties)
+{
+    size_t above = 0;
+    int t = MAG_MASK;
+    for (; t > 0; t--) {
+        if (above + hist[t] >= k) break;
+        above += hist[t];
+    }
+    *threshold = (uint16_t)t;
+    *ties = k - above;
+}
+
+static uint16_t sampled_threshold(const uint16_t* grad, size_t n, size_t k)
+{
+    size_t stride = n / SAMPLES;
+    std::vector<uint16_t> sample(SAMPLES);
+    for (size_t s = 0; s < SAMPLES; s++) sample[s] = magnitude(grad[s * stride]);
+
+    // aim a little below the k-th largest so that the estimate rarely keeps fewer than k
+    size_t rank = std::min((size_t)SAMPLES - 1, (size_t)(1.25 * k * SAMPLES / n) + 16);
+    std::nth_element(sample.begin(), sample.begin() + rank, sample.end(), std::greater<uint16_t>());
+    return sample[rank];
+}
+
+// Histogram of grad[at(j)] for j < n
+template <typename At>
+static void histogram(const uint16_t* grad, size_t n, At at, std::vector<size_t>& hist)
+{
+#pragma omp parallel
+    {
+        std::vector<size_t> local(MAG_BINS, 0);
+#pragma omp for nowait
+        for (size_t j = 0; j < n; j++) local[magnitude(grad[at(j)])]++;
+#pragma omp critical
+        for (size_t b = 0; b < MAG_BINS; b++) hist[b] += local[b];
+    }
+}
+
+// Hands the ties out to the blocks in order and returns the output offset of every block
+static std::vector<size_t> block_offsets(const std::vector<size_t>& n_above,
+                                         const std::vector<size_t>& n_equal,
+                                         size_t ties,
+                                         std::vector<size_t>& tie_quota)
+{
+    std::vector<size_t> out_offset(n_above.size());
+    size_t offset = 0;
+    for (size_t c = 0; c < n_above.size(); c++) {
+        tie_quota[c] = std::min(n_equal[c], ties);
+        ties -= tie_quota[c];
+        out_offset[c] = offset;
+        offset += n_above[c] + tie_quota[c];
+    }
+    return out_offset;
+}
+
+// Exact-k selection straight from grad: everything above threshold and the first `ties`
+// elements equal to it, in index order.
+static void collect(const uint16_t* grad,
+                    size_t n,
+                    uint16_t threshold,
+                    size_t ties,
+                    int32_t* idx,
+                    uint16_t* val)
+{
+    size_t n_chunks = (n + CHUNK - 1) / CHUNK;
+    std::vector<size_t> n_above(n_chunks), n_equal(n_chunks), tie_quota(n_chunks);
+
+#pragma omp parallel for
+    for (size_t c = 0; c < n_chunks; c++) {
+        size_t end = std::min(n, (c + 1) * CHUNK);
+        size_t ge = count_ge(grad, c * CHUNK, end, threshold);
+        n_above[c] = (threshold == MAG_MASK) ? 0 : count_ge(grad, c * CHUNK, end, threshold + 1);
+        n_equal[c] = ge - n_above[c];
+    }
+    std::vector<size_t> out_offset = block_offsets(n_above, n_equal, ties, tie_quota);
+
+#pragma omp parallel for
+    for (size_t c = 0; c < n_chunks; c++) {
+        size_t out = out_offset[c];
+        size_t quota = tie_quota[c];
+        filter_ge(grad, c * CHUNK, std::min(n, (c + 1) * CHUNK), threshold, [&](size_t k) {
+            if (magnitude(grad[k]) == threshold) {
+                if (quota == 0) return;
+                quota--;
+            }
+            idx[out] = (int32_t)k;
+            val[out] = grad[k];
+            out++;
+        });
+    }
+}
+
+// Same selection over an index-ordered candidate list
+static void compact(const uint16_t* grad,
+                    const std::vector<int32_t>& cand,
+                    uint16_t threshold,
+                    size_t ties,
+                    int32_t* idx,
+                    uint16_t* val)
+{
+    size_t n = cand.size();
+    size_t n_blocks = (n + CHUNK - 1) / CHUNK;
+    std::vector<size_t> n_above(n_blocks, 0), n_equal(n_blocks, 0), tie_quota(n_blocks);
+
+#pragma omp parallel for
+    for (size_t c = 0; c < n_blocks; c++) {
+        for (size_t j = c * CHUNK; j < std::min(n, (c + 1) * CHUNK); j++) {
+            uint16_t m = magnitude(grad[cand[j]]);
+            n_above[c] += m > threshold;
+            n_equal[c] += m == threshold;
+        }
+    }
+    std::vector<size_t> out_offset = block_offsets(n_above, n_equal, ties, tie_quota);
+
+#pragma omp parallel for
+    for (size_t c = 0; c < n_blocks; c++) {
+        size_t out = out_offset[c];
+        size_t quota = tie_quota[c];
+        for (size_t j = c * CHUNK; j < std::min(n, (c + 1) * CHUNK); j++) {
+            int32_t k = cand[j];
+            uint16_t m = magnitude(grad[k]);
+            if (m < threshold) continue;
+            if (m == threshold) {
+                if (quota == 0) continue;
+                quota--;
+            }
+            idx[out] = k;
+            val[out] = grad[k];
+            out++;
+        }
+    }
+}
+
+// Returns (int32 indices, fp16 values) of the k largest magnitudes of the fp16 tensor grad
+std::vector<torch::Tensor> ds_topk(torch::Tensor& grad, size_t k)
+{
+    auto grad_c = grad.contiguous();
+    const uint16_t* grad_ptr = (const uint16_t*)grad_c.data_ptr();
+    size_t n = grad_c.numel();
+    TORCH_CHECK(grad_c.scalar_type() == at::kHalf, "topk expects an fp16 tensor");
+    TORCH_CHECK(k <= n, "topk: k is larger than the tensor");
+
+    auto idx = torch::empty({(int64_t)k}, torch::dtype(torch::kInt32));
+    auto val = torch::empty({(int64_t)k}, torch::dtype(torch::kHalf));
+    int32_t* idx_ptr = (int32_t*)idx.data_ptr();
+    uint16_t* val_ptr = (uint16_t*)val.data_ptr();
+    if (k == 0) return {idx, val};
+
+    std::vector<size_t> hist(MAG_BINS, 0);
+    uint16_t threshold;
+    size_t ties;
+
+    if (n >= (size_t)SAMPLES * 4) {
+        uint16_t estimate = sampled_threshold(grad_ptr, n, k);
+
+        size_t n_chunks = (n + CHUNK - 1) / CHUNK;
+        std::vector<size_t> n_cand(n_chunks);
+#pragma omp parallel for
+        for (size_t c = 0; c < n_chunks; c++) {
+            n_cand[c] = count_ge(grad_ptr, c * CHUNK, std::min(n, (c + 1) * CHUNK), estimate);
+        }
+        std::vector<size_t> cand_offset(n_chunks);
+        size_t total = 0;
+        for (size_t c = 0; c < n_chunks; c++) {
+            cand_offset[c] = total;
+            total += n_cand[c];
+        }
+
+        if (total >= k && total <= MAX_CANDIDATE_RATIO * k) {
+            std::vector<int32_t> cand(total);
+#pragma omp parallel for
+            for (size_t c = 0; c < n_chunks; c++) {
+                size_t out = cand_offset[c];
+                filter_ge(grad_ptr, c * CHUNK, std::min(n, (c + 1) * CHUNK), estimate, [&](size_t j) {
+                    cand[out++] = (int32_t)j;
+                });
+            }
+
+            histogram(grad_ptr, total, [&](size_t j) { return cand[j]; }, hist);
+            exact_threshold(hist, k, &threshold, &ties);
+            compact(grad_ptr, cand, threshold, ties, idx_ptr, val_ptr);
+            return {idx, val};
+        }
+    }
+
+    // exact fallback: the estimate kept too few or too many, or the input is too small to sample
+    histogram(grad_ptr, n, [](size_t j) { return j; }, hist);
+    exact_threshold(hist, k, &threshold, &ties);
+    collect(grad_ptr, n, threshold, ties, idx_ptr, val_ptr);
+    return {idx, val};
+}
+
+// Exact threshold of a short block by radix select, 256 bins of the high magnitude bits and
+// then 128 bins of the low bits inside the boundary bin
+static void block_threshold(const uint16_t* blk, size_t len, size_t k, uint16_t* threshold, size_t* ties)
+{
+    uint32_t hist_hi[256] = {0};
+    for (size_t j = 0; j < len; j++) hist_hi[magnitude(blk[j]) >> 7]++;
+    size_t above = 0;
+    int hi = 255;
+    for (; hi > 0; hi--) {
+        if (above + hist_hi[hi] >= k) break;
+        above += hist_hi[hi];
+    }
+
+    uint32_t hist_lo[128] = {0};
+    for (size_t j = 0; j < len; j++) {
+        uint16_t m = magnitude(blk[j]);
+        if ((m >> 7) == hi) hist_lo[m & 127]++;
+    }
+    int lo = 127;
+    for (; lo > 0; lo--) {
+        if (above + hist_lo[lo] >= k) break;
+        above += hist_lo[lo];
+    }
+    *threshold = (uint16_t)((hi << 7) | lo);
+    *ties = k - above;
+}
+
+// Block-local top-k: the block_k largest magnitudes of every block of `block` elements, as
+// 16-bit offsets into the block (int16 tensor) and fp16 values, block after block, each block in
+// index order. Blocks are independent, so they are spread over the threads. A short last block
+// repeats its first pick to fill block_k, rewriting the same value is harmless.
+std::vector<torch::Tensor> ds_topk_blocks(torch::Tensor& grad, size_t block, size_t block_k)
+{
+    auto grad_c = grad.contiguous();
+    const uint16_t* grad_ptr = (const uint16_t*)grad_c.data_ptr();
+    size_t n = grad_c.numel();
+    TORCH_CHECK(grad_c.scalar_type() == at::kHalf, "topk_blocks expects an fp16 tensor");
+    TORCH_CHECK(block > 0 && block <= TOPK_MAX_BLOCK, "topk_blocks: block must be in (0, 65536]");
+    TORCH_CHECK(block_k > 0 && block_k <= block, "topk_blocks: block_k must be in (0, block]");
+
+    size_t n_blocks = (n + block - 1) / block;
+    auto idx = torch::empty({(int64_t)(n_blocks * block_k)}, torch::dtype(torch::kInt16));
+    auto val = torch::empty({(int64_t)(n_blocks * block_k)}, torch::dtype(torch::kHalf));
+    uint16_t* idx_ptr = (uint16_t*)idx.data_ptr();
+    uint16_t* val_ptr = (uint16_t*)val.data_ptr();
+
+#pragma omp parallel for
+    for (size_t b = 0; b < n_blocks; b++) {
+        const uint16_t* blk = grad_ptr + b * block;
+        size_t len = std::min(block, n - b * block);
+        size_t k = std::min(block_k, len);
+        uint16_t* out_idx = idx_ptr + b * block_k;
+        uint16_t* out_val = val_ptr + b * block_k;
+
+        uint16_t threshold;
+        size_t ties;
+        block_threshold(blk, len, k, &threshold, &ties);
+
+        size_t out = 0;
+        filter_ge(blk, 0, len, threshold, [&](size_t j) {
+            if (magnitude(blk[j]) == threshold) {
+                if (ties == 0) return;
+                ties--;
+            }
+            out_idx[out] = (uint16_t)j;
+            out_val[out] = blk[j];
+            out++;
+        });
+        for (; out < block_k; out++) {
+            out_idx[out] = out_idx[0];
+            out_val[out] = out_val[0];
+        }
+    }
+    return {idx, val};
+}
+
+// Packs increasing int32 indices into the stream of idx_pack.h. The returned tensor is padded
+// with IDX_PAD_WORDS for the decoders.
+torch::Tensor ds_pack_idx(torch::Tensor& idx)
+{
+    auto idx_c = idx.contiguous();
+    TORCH_CHECK(idx_c.scalar_type() == at::kInt, "pack_idx expects an int32 tensor");
+    size_t n = idx_c.numel();
+    TORCH_CHECK(idx_packed_bound(n) <= IDX_MAX_OFFSET, "pack_idx: too many indices");
+
+    auto packed = torch::empty({(int64_t)idx_packed_bound(n)}, torch::dtype(torch::kInt32));
+    size_t words = pack_idx((const int32_t*)idx_c.data_ptr(), n, (uint32_t*)packed.data_ptr());
+    return packed.narrow(0, 0, words + IDX_PAD_WORDS);
+}
+
+torch::Tensor ds_unpack_idx(torch::Tensor& packed, size_t n)
+{
+    auto packed_c = packed.contiguous();
+    TORCH_CHECK(packed_c.scalar_type() == at::kInt, "unpack_idx expects an int32 tensor");
+
+    auto idx = torch::empty({(int64_t)n}, torch::dtype(torch::kInt32));
+    unpack_idx((const uint32_t*)packed_c.data_ptr(), n, (int32_t*)idx.data_ptr());
+    return idx;
+}
+
+// Quantizes fp16 values into the stream of val_quant.h, bits 8 or 4
+torch::Tensor ds_quant_val(torch::Tensor& val, int bits, bool stochastic, int64_t seed)
+{
+    auto val_c = val.contiguous();
+    TORCH_CHECK(val_c.scalar_type() == at::kHalf, "quant_val expects an fp16 tensor");
+    TORCH_CHECK(bits == 8 || bits == 4, "quant_val: bits must be 8 or 4");
+    size_t n = val_c.numel();
+    TORCH_CHECK(n % 16 == 0, "quant_val: the number of values must be a multiple of 16");
+
+    auto q = torch::empty({(int64_t)val_quant_words(n, bits)}, torch::dtype(torch::kInt32));
+    quant_val((const uint16_t*)val_c.data_ptr(), n, bits, stochastic, (uint32_t)seed, (uint32_t*)q.data_ptr());
+    return q;
+}
+
+torch::Tensor ds_dequant_val(torch::Tensor& q, size_t n, int bits)
+{
+    auto q_c = q.contiguous();
+    TORCH_CHECK(q_c.scalar_type() == at::kInt, "dequant_val expects an int32 tensor");
+    TORCH_CHECK(bits == 8 || bits == 4, "dequant_val: bits must be 8 or 4");
+    TORCH_CHECK(n % 16 == 0 && (size_t)q_c.numel() >= val_quant_words(n, bits), "dequant_val: stream too short");
+
+    auto val = torch::empty({(int64_t)n}, torch::dtype(torch::kFloat));
+    dequant_val((const uint32_t*)q_c.data_ptr(), n, bits, (float*)val.data_ptr());
+    return val;
+}
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
+{
+    m.def("topk", &ds_topk, "SmartComp fp16 top-k by magnitude, returns (int32 idx, fp16 val) (C++)");
+    m.def("topk_blocks",
+          &ds_topk_blocks,
+          "SmartComp block-local fp16 top-k, returns (int16 offsets, fp16 val) (C++)");
+    m.def("pack_idx", &ds_pack_idx, "SmartComp delta-encoded, bit-packed index stream (C++)");
+    m.def("unpack_idx", &ds_unpack_idx, "SmartComp index stream decoder (C++)");
+    m.def("quant_val", &ds_quant_val, "SmartComp int8/int4 value quantization, per-block steps (C++)");
+    m.def("dequant_val", &ds_dequant_val, "SmartComp quantized value decoder (C++)");
+}
@@ -722,14 +722,24 @@ class TorchCPUOpBuilder(CUDAOpBuilder):
                 '-g',
             ]
 
-        CPU_ARCH = self.cpu_arch()
-        SIMD_WIDTH = self.simd_width()
         CUDA_ENABLE = self.is_cuda_enable()
+        args += self.simd_dispatch_args()
         args += [
-            CPU_ARCH,
             '-fopenmp',
-            SIMD_WIDTH,
             CUDA_ENABLE,
         ]
 
         return args
+
+    def simd_dispatch_args(self):
+        '''
+        The vector kernels of the CPU optimizers are compiled once per ISA level and picked at
+        runtime (csrc/includes/simd.h), so the rest of the op is built for plain x86-64. The
+        F16C conversions and the SSE4.2 CRC32C of swapped tensors are target("f16c"/"sse4.2")
+        functions that only run at the levels implying them, the scalar level has software
+        fallbacks.
+        '''
+        import platform
+        if platform.machine().lower() in ('x86_64', 'amd64', 'i386', 'i686'):
+            return ['-march=x86-64']
+        return [self.cpu_arch()]
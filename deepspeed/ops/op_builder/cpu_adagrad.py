@@ -18,10 +18,11 @@ class CPUAdagradBuilder(TorchCPUOpBuilder):
         return f'deepspeed.ops.adagrad.{self.NAME}_op'
 
     def sources(self):
+        simd_srcs = ['csrc/adagrad/cpu_adagrad_avx2.cpp', 'csrc/adagrad/cpu_adagrad_avx512.cpp']
         if self.build_for_cpu:
-            return ['csrc/adagrad/cpu_adagrad.cpp']
+            return ['csrc/adagrad/cpu_adagrad.cpp'] + simd_srcs
 
-        return ['csrc/adagrad/cpu_adagrad.cpp', 'csrc/common/custom_cuda_kernel.cu']
+        return ['csrc/adagrad/cpu_adagrad.cpp', 'csrc/common/custom_cuda_kernel.cu'] + simd_srcs
 
     def libraries_args(self):
         args = super().libraries_args()
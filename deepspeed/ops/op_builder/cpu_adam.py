@@ -18,11 +18,12 @@ class CPUAdamBuilder(TorchCPUOpBuilder):
         return f'deepspeed.ops.adam.{self.NAME}_op'
 
     def sources(self):
+        simd_srcs = ['csrc/adam/cpu_adam_avx2.cpp', 'csrc/adam/cpu_adam_avx512.cpp']
         if self.build_for_cpu:
-            return ['csrc/adam/cpu_adam.cpp']
+            return ['csrc/adam/cpu_adam.cpp'] + simd_srcs
 
         #return ['csrc/adam/cpu_adam.cpp', 'csrc/common/custom_cuda_kernel.cu']
-        srcs = ['csrc/adam/cpu_adam.cpp', 'csrc/common/custom_cuda_kernel.cu']
+        srcs = ['csrc/adam/cpu_adam.cpp', 'csrc/common/custom_cuda_kernel.cu'] + simd_srcs
         srcs += ['csrc/adam/opencl/adam/vadd.cpp']
         return srcs
 
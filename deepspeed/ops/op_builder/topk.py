@@ -0,0 +1,39 @@
+# Copyright (c) Microsoft Corporation.
+# SPDX-License-Identifier: Apache-2.0
+
+# DeepSpeed Team
+
+from .builder import OpBuilder
+
+
+class TopKBuilder(OpBuilder):
+    BUILD_VAR = "DS_BUILD_TOPK"
+    NAME = "topk"
+
+    def __init__(self):
+        super().__init__(name=self.NAME)
+
+    def absolute_name(self):
+        return f'deepspeed.ops.topk.{self.NAME}_op'
+
+    def sources(self):
+        return ['csrc/topk/topk.cpp']
+
+    def include_paths(self):
+        return ['csrc/includes']
+
+    def cxx_args(self):
+        CPU_ARCH = self.cpu_arch()
+        SIMD_WIDTH = self.simd_width()
+        return [
+            '-O3',
+            '-std=c++17',
+            '-g',
+            '-Wno-reorder',
+            CPU_ARCH,
+            '-fopenmp',
+            SIMD_WIDTH,
+        ]
+
+    def extra_ldflags(self):
+        return ['-fopenmp']
@@ -1504,7 +1504,11 @@ class DeepSpeedEngine(Module):
                     
                     use_fpga = args.use_fpga,
                     num_ssds = args.num_ssds,
-                    comp_ratio = args.comp_ratio
+                    comp_ratio = args.comp_ratio,
+                    error_feedback = args.error_feedback,
+                    topk_block = args.topk_block,
+                    grad_bits = args.grad_bits,
+                    grad_stochastic_round = args.grad_stochastic_round
                     )
 
         else:
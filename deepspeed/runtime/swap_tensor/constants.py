@@ -11,7 +11,8 @@ AIO_FORMAT = '''
   "queue_depth": 8,
   "thread_count": 1,
   "single_submit": false,
-  "overlap_events": true
+  "overlap_events": true,
+  "crc": false
 }
 '''
 AIO = "aio"
@@ -25,3 +26,5 @@ AIO_SINGLE_SUBMIT = "single_submit"
 AIO_SINGLE_SUBMIT_DEFAULT = False
 AIO_OVERLAP_EVENTS = "overlap_events"
 AIO_OVERLAP_EVENTS_DEFAULT = True
+AIO_CRC = "crc"
+AIO_CRC_DEFAULT = False
@@ -11,6 +11,8 @@ import torch
 
 from deepspeed import comm as dist
 from deepspeed.utils.logging import logger
+from deepspeed.accelerator import get_accelerator
+from deepspeed.ops.op_builder import TopKBuilder
 from deepspeed.runtime.swap_tensor.constants import *
 from deepspeed.runtime.swap_tensor.utils import swap_in_tensors, swap_out_tensors, \
     MIN_AIO_BYTES, AIO_ALIGNED_BYTES, get_sized_buffers
@@ -48,6 +50,10 @@ class OptimizerStateSwapInfo(object):
         self.swap_paths = []
         self.swapped_gradients = {}
         self.unswapped_gradients = {}
+        # gradient mass dropped by top-k compression, added back before the next selection. It
+        # holds loss scaled gradients, at residual_scale.
+        self.residual = None
+        self.residual_scale = 1.
         self.tensor_numel = numel
         
         self.tensor_dtype = parameter.dtype
@@ -174,6 +180,8 @@ class OptimizerSwapper(object):
         if use_fpga: 
             self.swap_gradient_manager = None
             self.swap_idx_manager = None
+            self.topk_op = None
+            self.quant_seed = 0
         else:
             self.swap_gradient_manager = None
 
@@ -235,7 +243,48 @@ class OptimizerSwapper(object):
                 self.timer_names.add(SWAP_OUT_GRADIENT_TIMER)
                 self.timer_names.update(gradient_swapper.get_timer_names())
 
-    def _swap_out_gradients(self, parameter, gradient_offsets, gradient_tensors, gradient_swapper, gradient_idx_swapper, use_fpga=False, comp_ratio = 1. ):
+    def _get_topk_op(self):
+        if self.topk_op is None:
+            self.topk_op = TopKBuilder().load()
+        return self.topk_op
+
+    def _get_residual(self, swap_info, aligned_numel, loss_scale):
+        if swap_info.residual is None:
+            swap_info.residual = get_accelerator().pin_memory(
+                torch.zeros(aligned_numel, device='cpu', dtype=torch.float16))
+            swap_info.residual_scale = loss_scale
+        elif loss_scale != swap_info.residual_scale:
+            # the loss scale moved since the residual was kept, bring it to the new one
+            swap_info.residual.mul_(loss_scale / swap_info.residual_scale)
+            swap_info.residual_scale = loss_scale
+        return swap_info.residual
+
+    def residual_state_dict(self, parameters):
+        """Error feedback residuals of parameters, None where there is none, for checkpoints."""
+        state = []
+        for parameter in parameters:
+            swap_info = self.swap_params_info.get(id(parameter), None)
+            if swap_info is None or swap_info.residual is None:
+                state.append(None)
+            else:
+                state.append({'residual': swap_info.residual.clone(), 'loss_scale': swap_info.residual_scale})
+        return state
+
+    def load_residual_state_dict(self, parameters, state):
+        for parameter, saved in zip(parameters, state):
+            swap_info = self.swap_params_info.get(id(parameter), None)
+            if swap_info is None or saved is None:
+                continue
+            swap_info.residual = None
+            residual = self._get_residual(swap_info, saved['residual'].numel(), saved['loss_scale'])
+            residual.copy_(saved['residual'])
+
+    def _topk_block_k(self, topk_block, comp_ratio):
+        # same rounding as topk_block_k() in csrc/includes/idx_pack.h
+        block_k = max((int(topk_block * comp_ratio) + 15) // 16 * 16, 16)
+        return min(block_k, topk_block)
+
+    def _swap_out_gradients(self, parameter, gradient_offsets, gradient_tensors, gradient_swapper, gradient_idx_swapper, use_fpga=False, comp_ratio = 1., error_feedback = False, topk_block = 0, grad_bits = 16, grad_stochastic_round = False, loss_scale = 1. ):
         if not id(parameter) in self.swap_params_info.keys():
             return
 
@@ -247,6 +296,9 @@ class OptimizerSwapper(object):
             return
         else:
             max_top_size = ( int (comp_ratio * self.largest_numel ) )
+            if topk_block > 0:
+                block_k = self._topk_block_k(topk_block, comp_ratio)
+                max_top_size = max(max_top_size, -(-self.largest_numel // topk_block) * block_k)
             max_aligned_top_size = self._io_aligned_numel( max_top_size )
             
             src_tensors  = sorted(swap_info.unswapped_gradients.items())
@@ -295,18 +347,41 @@ class OptimizerSwapper(object):
                         
                     
                     # Do compression, offset= 0: value, offset1: idx
-                    contiguous_grad = gradient_tensors[0].to('cuda')
+                    contiguous_grad = gradient_tensors[0]
                     top_size = ( int (comp_ratio * contiguous_grad.numel()) )
                     aligned_top_size = self._io_aligned_numel( top_size )
-                    
-                    #_, positions = torch.topk(contiguous_grad.abs(), aligned_top_size, sorted= True )
-                    #_, positions = torch.topk(contiguous_grad.abs(), aligned_top_size, sorted= True )
-                    _, idx = contiguous_grad.abs().sort(descending=True)
 
-                    positions = idx[:aligned_top_size] 
-
-                    values = contiguous_grad[positions].to('cpu')
-                    ipositions = positions.to(torch.int32).to('cpu')
+                    if error_feedback:
+                        residual = self._get_residual(swap_info, aligned_numel, loss_scale)
+                        contiguous_grad[swap_info.numel():].zero_()
+                        contiguous_grad.add_(residual)
+
+                    if topk_block > 0:
+                        # top block_k of every topk_block elements, blocks selected in parallel;
+                        # each block keeps 16-bit offsets and its values contiguous
+                        ioffsets, values = self._get_topk_op().topk_blocks(contiguous_grad, topk_block, block_k)
+                        aligned_top_size = self._io_aligned_numel(values.numel())
+                        ipositions = torch.arange(0, contiguous_grad.numel(), topk_block).repeat_interleave(block_k) + \
+                                     (ioffsets.long() & 0xffff)
+                    else:
+                        # linear time selection on the pinned host buffer, no device round trip or sort
+                        ipositions, values = self._get_topk_op().topk(contiguous_grad, aligned_top_size)
+
+                    if grad_bits < 16:
+                        # int8/int4 codes with per-block steps go to storage instead of fp16 values
+                        self.quant_seed += 1
+                        qvalues = self._get_topk_op().quant_val(values, grad_bits, grad_stochastic_round, self.quant_seed)
+
+                    if error_feedback:
+                        # keep what was not selected
+                        contiguous_grad.index_fill_(0, ipositions.long(), 0)
+                        residual.copy_(contiguous_grad)
+                        if grad_bits < 16:
+                            # the rounding error of the kept values is carried over as well
+                            dequant = self._get_topk_op().dequant_val(qvalues, values.numel(), grad_bits)
+                            residual.index_put_((ipositions.long(),), (values.float() - dequant).half())
+                        # an overflowed element must not poison later steps, the others are kept
+                        residual.masked_fill_(~torch.isfinite(residual), 0)
 
                     #swap_info.ipositions = ipositions 
 
@@ -325,8 +400,23 @@ class OptimizerSwapper(object):
                     gradient_tensors.append( gradient_tensors_fp16[0] )
                     
                     gradient_offsets = [ 0, 1 ]
-                    gradient_tensors[0].copy_(ipositions)
-                    gradient_tensors[1].copy_(values)
+                    val_numel = None
+                    if grad_bits < 16:
+                        val_numel = self._io_aligned_numel(2 * qvalues.numel())
+                        gradient_tensors[1].view(torch.int32).narrow(0, 0, qvalues.numel()).copy_(qvalues)
+                    elif topk_block > 0:
+                        gradient_tensors[1].narrow(0, 0, values.numel()).copy_(values)
+                    else:
+                        gradient_tensors[1].copy_(values)
+                    if topk_block > 0:
+                        # two 16-bit offsets per int32 word
+                        packed_numel = self._io_aligned_numel(-(-ioffsets.numel() // 2))
+                        gradient_tensors[0].view(torch.int16).narrow(0, 0, ioffsets.numel()).copy_(ioffsets)
+                    else:
+                        # delta-encoded, bit-packed index stream; the kernels decode it on the device
+                        packed_idx = self._get_topk_op().pack_idx(ipositions)
+                        packed_numel = self._io_aligned_numel(packed_idx.numel())
+                        gradient_tensors[0].narrow(0, 0, packed_idx.numel()).copy_(packed_idx)
 
                 else:
                     # This is for sanity check for Topk compression ( Not Used )
@@ -355,6 +445,12 @@ class OptimizerSwapper(object):
             self.allocated_swap_buffers = gradient_tensors.copy()
             swap_info.unswapped_gradients = {}
 
+            if use_fpga and comp_ratio < 0.5:
+                # only the used part of the index stream goes to storage
+                gradient_tensors[0] = gradient_tensors[0].narrow(0, 0, packed_numel)
+                if val_numel is not None:
+                    gradient_tensors[1] = gradient_tensors[1].narrow(0, 0, val_numel)
+
         swappable_tensors = []
         swappable_offsets = []
         swappable_lengths = []
@@ -34,7 +34,7 @@ class PartitionedOptimizerSwapper(OptimizerSwapper):
         aio_op = AsyncIOBuilder().load()
         self.aio_handle = aio_op.aio_handle(aio_config[AIO_BLOCK_SIZE], aio_config[AIO_QUEUE_DEPTH],
                                             aio_config[AIO_SINGLE_SUBMIT], aio_config[AIO_OVERLAP_EVENTS],
-                                            aio_config[AIO_THREAD_COUNT])
+                                            aio_config[AIO_THREAD_COUNT], aio_config[AIO_CRC])
         
         # Overlap swapping out
         self.gradient_swapper = AsyncTensorSwapper(aio_handle=self.aio_handle,
@@ -169,12 +169,12 @@ class PartitionedOptimizerSwapper(OptimizerSwapper):
         if DEBUG_MODE and dist.get_rank() == 0:
             logger.info(f'optimizer_param_swap_out: {(swap_bytes/(1024**3)):5.2f} GB')
 
-    def swap_out_gradients(self, parameter, gradient_offsets, gradient_tensors, use_fpga=False, comp_ratio = 2. ):
+    def swap_out_gradients(self, parameter, gradient_offsets, gradient_tensors, use_fpga=False, comp_ratio = 2., error_feedback = False, topk_block = 0, grad_bits = 16, grad_stochastic_round = False, loss_scale = 1. ):
         if comp_ratio < 0.5 and self.gradient_idx_swapper is None:
             idx_aio_op = AsyncIOBuilder().load()
             self.idx_aio_handle = idx_aio_op.aio_handle(self.aio_config[AIO_BLOCK_SIZE], self.aio_config[AIO_QUEUE_DEPTH],
                                             self.aio_config[AIO_SINGLE_SUBMIT], self.aio_config[AIO_OVERLAP_EVENTS],
-                                            self.aio_config[AIO_THREAD_COUNT])
+                                            self.aio_config[AIO_THREAD_COUNT], self.aio_config[AIO_CRC])
 
             self.gradient_idx_swapper = AsyncTensorSwapper(aio_handle=self.idx_aio_handle,
             #self.gradient_idx_swapper = AsyncTensorSwapper(aio_handle=self.aio_handle,
@@ -187,7 +187,12 @@ class PartitionedOptimizerSwapper(OptimizerSwapper):
                                  gradient_swapper=self.gradient_swapper,
                                  gradient_idx_swapper = self.gradient_idx_swapper,
                                  use_fpga=use_fpga, 
-                                 comp_ratio = comp_ratio
+                                 comp_ratio = comp_ratio,
+                                 error_feedback = error_feedback,
+                                 topk_block = topk_block,
+                                 grad_bits = grad_bits,
+                                 grad_stochastic_round = grad_stochastic_round,
+                                 loss_scale = loss_scale
                                  )
 
     def _swap_in_parameter(self, aio_handle, parameter, dest_buffers, use_fpga =False):
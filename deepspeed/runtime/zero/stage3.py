@@ -21,6 +21,7 @@ from deepspeed.ops.adam import DeepSpeedCPUAdam
 from deepspeed.runtime.swap_tensor.partitioned_param_swapper import PartitionedParamStatus
 from deepspeed.runtime.swap_tensor.partitioned_optimizer_swapper import PartitionedOptimizerSwapper
 from deepspeed.runtime.swap_tensor.pipelined_optimizer_swapper import PipelinedOptimizerSwapper
+from deepspeed.runtime.swap_tensor.constants import AIO_CRC
 from deepspeed.checkpoint.constants import OPTIMIZER_STATE_DICT, FP32_FLAT_GROUPS, PARTITION_COUNT, ZERO_STAGE
 from deepspeed.accelerator import get_accelerator
 from deepspeed.ops.op_builder import UtilsBuilder
@@ -106,7 +107,11 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
                  aio_config=None,
                  use_fpga = False,
                  num_ssds = 1,
-                 comp_ratio = 1.0
+                 comp_ratio = 1.0,
+                 error_feedback = False,
+                 topk_block = 0,
+                 grad_bits = 16,
+                 grad_stochastic_round = False
                  ):
         if use_fpga == 1:
             self.use_fpga = True
@@ -116,6 +121,12 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
             raise NotImplementedError
         self.num_ssds = num_ssds
         self.comp_ratio = comp_ratio
+        self.error_feedback = bool(error_feedback)
+        self.topk_block = topk_block
+        self.grad_bits = grad_bits
+        self.grad_stochastic_round = bool(grad_stochastic_round)
+        if self.grad_bits not in (16, 8, 4):
+            raise NotImplementedError
         see_memory_usage("Stage 3 initialize beginning", force=True)
 
         print_rank_0(f"initialized {__class__.__name__} with args: {locals()}", force=False)
@@ -182,6 +193,8 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
                                                       requires_grad=False)
 
         self.deepspeed_adam_offload = (self.offload_optimizer and type(init_optimizer) == DeepSpeedCPUAdam)
+        # sub groups whose fp16 partition the last CPU Adam step wrote along with the fp32 one
+        self.fp16_written_by_step = set()
 
         self.device = get_accelerator().current_device_name() if not self.offload_optimizer else OffloadDeviceEnum.cpu
         ### streams used for overlapping computation with communication
@@ -236,6 +249,9 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
         self.fp16_partitioned_groups_flat = []
         self.fp16_partitioned_groups_flat_numel = []
 
+        # Per-parameter (offset, numel, cols, col0) inside each flat sub group
+        self.sub_group_segments = {}
+
         #defragmented pinned memory
         self.param_groups_fp16_flat_cpu_memory = []
 
@@ -395,6 +411,15 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
         #print('Dist[', dist.get_rank(),'] comes here (1)')
         self._create_next_swappable_fp32_groups()
 
+        # Optimizers with per-parameter state (Adafactor, LAMB) need the layout of each flat sub group
+        if hasattr(self.optimizer, 'set_param_segments'):
+            for i, fp32_param in enumerate(self.fp32_partitioned_groups_flat):
+                self.optimizer.set_param_segments(fp32_param, self._get_sub_group_segments(i))
+        # LAMB's trust ratio and Adafactor's column factors need the statistics of whole
+        # parameters, not of this rank's partitions
+        if hasattr(self.optimizer, 'set_norm_reduce') and dist.get_world_size(group=self.dp_process_group) > 1:
+            self.optimizer.set_norm_reduce(self._all_reduce_segment_norms)
+
         see_memory_usage("Before initializing optimizer states", force=True)
 
         #print('Dist[', dist.get_rank(),'] comes here (2)')
@@ -525,6 +550,9 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
                                               use_fpga = self.use_fpga,
                                               num_ssds = self.num_ssds)
 
+        if aio_config[AIO_CRC] and isinstance(self.optimizer, DeepSpeedCPUAdam):
+            self.optimizer.enable_crc()
+
     @property
     def elements_in_ipg_bucket(self):
         return sum(p.ds_numel for p in self.params_in_ipg_bucket)
@@ -716,6 +744,32 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
 
         return sub_group_partitions
 
+    def _get_sub_group_segments(self, sub_group_id):
+        if sub_group_id not in self.sub_group_segments:
+            rank = dist.get_rank(self.dp_process_group)
+            segments = []
+            offset = 0
+            for param, padding in zip(self.fp16_groups[sub_group_id], self.groups_padding[sub_group_id]):
+                partition_numel = param.partition_numel()
+                # partitions are slices of the row-major parameter, col0 is where ours starts in a row
+                cols = param.ds_shape[-1] if len(param.ds_shape) > 1 else 0
+                col0 = (rank * partition_numel) % cols if cols > 0 else 0
+                segments.append((offset, partition_numel - padding, cols, col0))
+                offset += partition_numel
+            self.sub_group_segments[sub_group_id] = segments
+
+        return self.sub_group_segments[sub_group_id]
+
+    def _all_reduce_segment_norms(self, norms):
+        """Sum the per-segment norms or column sums of a sub group over the data parallel group.
+
+        Every rank lists the same parameters in _get_sub_group_segments, in the same order, so
+        row i holds partitions of the same parameter everywhere.
+        """
+        norms_cuda = norms.to(get_accelerator().current_device_name())
+        dist.all_reduce(norms_cuda, op=dist.ReduceOp.SUM, group=self.dp_process_group)
+        norms.copy_(norms_cuda)
+
     def _create_fp32_partitions(self):
         cpu_memory_usage = 0
         cpu_memory_sub_groups = 0
@@ -852,10 +906,36 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
             target_device_id = s_id % self.num_ssds
             
             #print("Start C++ codes here")
-            self.optimizer.step_with_fpga( target_device_id, self.optimizer_swapper, combined_unscale, largest_numel, self.comp_ratio )
+            self.optimizer.step_with_fpga( target_device_id, self.optimizer_swapper, combined_unscale, largest_numel, self.comp_ratio, self.topk_block, self.grad_bits )
             
             self.optimizer.param_groups[param_group_id]['params'] = []
-        
+
+    def _get_global_norm_with_fpga(self):
+        """Gradient norm from the per sub group sum of squares computed next to the SSDs.
+
+        Returns -1 on inf/NaN, like complete_grad_norm_calculation_for_cpu_offload. Only the
+        data parallel group is reduced: a flattened sub group mixes model parallel and replicated
+        parameters, so this assumes a model parallel size of 1.
+        """
+        self.optimizer_swapper.flush_gradients(use_fpga=True)
+
+        num_sub_groups = len(self.fp16_groups)
+        partials = torch.zeros(num_sub_groups, 2, dtype=torch.float32)
+        for sub_group_id in range(0, num_sub_groups, self.num_ssds):
+            for s_id in range(sub_group_id, min(sub_group_id + self.num_ssds, num_sub_groups)):
+                fp32_param = self.fp32_partitioned_groups_flat[s_id]
+                self.optimizer.grad_norm_with_fpga(fp32_param, s_id % self.num_ssds, self.optimizer_swapper,
+                                                   partials[s_id])
+            self.optimizer.sync_thread()
+
+        total_norm_cuda = get_accelerator().FloatTensor(
+            [partials[:, 0].double().sum().item(), partials[:, 1].max().item()])
+        dist.all_reduce(total_norm_cuda, op=dist.ReduceOp.SUM, group=self.dp_process_group)
+
+        total_sumsq, overflow = total_norm_cuda.tolist()
+        if overflow > 0 or total_sumsq == float('inf') or total_sumsq != total_sumsq:
+            return -1
+        return total_sumsq**0.5
     
     def _optimizer_step_with_fpga(self, sub_group_id, combined_unscale):
         param_group_id = self.sub_group_to_group_id[sub_group_id]
@@ -873,9 +953,29 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
         fp32_param = self.fp32_partitioned_groups_flat[sub_group_id]
         self.optimizer.param_groups[param_group_id]['params'] = [fp32_param]
 
-        self.optimizer.step()
+        fp16_param = self._fp16_step_target(sub_group_id)
+        if fp16_param is not None:
+            fp16_param_groups = [[fp16_param] if i == param_group_id else []
+                                 for i in range(len(self.optimizer.param_groups))]
+            self.optimizer.step(fp16_param_groups=fp16_param_groups)
+            self.fp16_written_by_step.add(sub_group_id)
+        else:
+            self.optimizer.step()
+            self.fp16_written_by_step.discard(sub_group_id)
         self.optimizer.param_groups[param_group_id]['params'] = []
 
+    def _fp16_step_target(self, sub_group_id):
+        """The fp16 partition of the sub group when the CPU Adam step can write it in its update pass."""
+        if not (self.deepspeed_adam_offload and self.optimizer.copies_lp_params()):
+            return None
+        fp16_param = self.fp16_partitioned_groups_flat[sub_group_id]
+        fp32_param = self.fp32_partitioned_groups_flat[sub_group_id]
+        if fp16_param is None or fp16_param.device.type != 'cpu' or not fp16_param.is_contiguous():
+            return None
+        if fp16_param.dtype not in (torch.half, torch.bfloat16) or fp16_param.numel() != fp32_param.numel():
+            return None
+        return fp16_param
+
 
     def _swappable_optimizer_subgroup(self, sub_group_id):
         if not self.swap_optimizer:
@@ -1327,7 +1427,12 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
                                                           gradient_offsets=offload_fp32_offsets[i],
                                                           gradient_tensors=offload_fp32_gradients[i],
                                                           use_fpga = self.use_fpga,
-                                                          comp_ratio = self.comp_ratio
+                                                          comp_ratio = self.comp_ratio,
+                                                          error_feedback = self.error_feedback,
+                                                          topk_block = self.topk_block,
+                                                          grad_bits = self.grad_bits,
+                                                          grad_stochastic_round = self.grad_stochastic_round,
+                                                          loss_scale = self.loss_scale
                                                           )
         return buffers
 
@@ -1843,7 +1948,7 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
     @instrument_w_nvtx
     def _reassign_or_swap_out_partitioned_parameters(self, sub_group_id):
         if self.fp16_partitioned_groups_flat[sub_group_id] is not None:
-            if self.use_fpga:
+            if self.use_fpga or sub_group_id in self.fp16_written_by_step:
                 pass
             else:
                 self.fp16_partitioned_groups_flat[sub_group_id].data.copy_(
@@ -1883,6 +1988,19 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
         #scaled_global_grad_norm = get_global_norm(norm_list=norm_groups)
         scaled_global_grad_norm = 1
 
+        # Only pay for the extra gradient pass when clipping or loss scaling needs it.
+        # Top-k compressed gradients are not stored densely, so they are not covered.
+        if self.use_fpga and self.comp_ratio >= 0.5 and (self.clip_grad > 0. or self.dynamic_loss_scale):
+            scaled_global_grad_norm = self._get_global_norm_with_fpga()
+            self.overflow = scaled_global_grad_norm == -1
+
+            prev_scale = self.loss_scale
+            self._update_scale(self.overflow)
+            if self.overflow:
+                self._overflow_clean_up(prev_scale)
+                self._post_step(set())
+                return
+
         # Stash unscaled gradient norm
         self._global_grad_norm = scaled_global_grad_norm / self.loss_scale
 
@@ -2305,6 +2423,9 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
         state_dict[OPTIMIZER_STATE_DICT] = self.optimizer.state_dict()
         state_dict[FP32_FLAT_GROUPS] = self.fp32_partitioned_groups_flat
         self._clear_fp32_optimizer_param_groups()
+        if self.swap_optimizer and self.error_feedback:
+            state_dict['error_feedback_residuals'] = self.optimizer_swapper.residual_state_dict(
+                self.fp32_partitioned_groups_flat)
 
         return state_dict
 
@@ -2413,6 +2534,10 @@ class DeepSpeedZeroOptimizer_Stage3(ZeROOptimizer):
         for curr_param, saved_param in zip(self.fp32_partitioned_groups_flat, state_dict[FP32_FLAT_GROUPS]):
             curr_param.data.copy_(saved_param.data)
 
+        if self.swap_optimizer and 'error_feedback_residuals' in state_dict:
+            self.optimizer_swapper.load_residual_state_dict(self.fp32_partitioned_groups_flat,
+                                                            state_dict['error_feedback_residuals'])
+
         # restore fp16 partitions from fp32
         for sub_group_id in range(len(self.fp32_partitioned_groups_flat)):
             fp32_param = self.fp32_partitioned_groups_flat[sub_group_id]
@@ -26,6 +26,8 @@
 #include <numeric> // std::iota
 #include <algorithm> // std:;sort, std::stable_sort
 
+#include "idx_pack.h"
+
 static const float scale = 0.3;
 static const int DATA_SIZE = 4096*4096;
 float compression_ratio = 0.01;
@@ -218,6 +220,10 @@ int adam_fpga( cl::Context context, cl::CommandQueue q, cl::Kernel krnl_adam, in
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, grad_idx));
     OCL_CHECK(err, err = krnl_adam.setArg(cnt++, grad_val));
 	krnl_adam.setArg(cnt++, int(padded_comp_grad_size));
+	krnl_adam.setArg(cnt++, 0); // topk_block, 0: packed global top-k indices
+	krnl_adam.setArg(cnt++, 0); // topk_block_k
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, grad_val)); // grad_val_q
+	krnl_adam.setArg(cnt++, 16); // val_bits, 16: values as is
 
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, grad));
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, param16));
@@ -489,11 +495,18 @@ int main(int argc, char* argv[]) {
 	std::vector<int, aligned_allocator<int>> grad_idx(padded_comp_grad_size);
 	std::vector<half, aligned_allocator<half>> grad_val(padded_comp_grad_size);
 	
-	for (unsigned int i=0; i< comp_grad_size; i++) {
+	// the index stream takes increasing indices, as the DeepSpeed side emits them
+	std::sort(idx.begin(), idx.begin() + padded_comp_grad_size);
+	for (unsigned int i=0; i< padded_comp_grad_size; i++) {
 		grad_idx[i] = int(idx[i]);
 		grad_val[i] = grad_src[idx[i]];
 	}
 
+	std::vector<uint32_t, aligned_allocator<uint32_t>> grad_idx_packed(comp_nbytes / sizeof(uint32_t));
+	size_t packed_words = pack_idx(&grad_idx[0], padded_comp_grad_size, &grad_idx_packed[0]);
+	size_t packed_nbytes = (((packed_words + IDX_PAD_WORDS) * sizeof(uint32_t) - 1) / 4096 + 1) * 4096;
+	std::cout << " [ Packed index bytes: " << packed_nbytes << " / " << comp_nbytes << " ]" << std::endl;
+
 	ret = pwrite(nvmeFd,  &param_src[0], nbytes, 0);
 	if (ret == -1) {
 		std::cout << strerror(errno) << std::endl;
@@ -507,7 +520,7 @@ int main(int argc, char* argv[]) {
 		std::cerr << "ERROR: open " << grad_idx_name << " failed with " << nvmeFd << std::endl;
 		return EXIT_FAILURE;
 	}
-	ret = pwrite(nvmeFd,  &grad_idx[0], comp_nbytes, 0);
+	ret = pwrite(nvmeFd,  &grad_idx_packed[0], packed_nbytes, 0);
 	if (ret == -1) {
 		std::cout << strerror(errno) << std::endl;
 		std::cout << "grad_idx pwrite() failed, err: " << ret << ", line: " << __LINE__ << std::endl;
@@ -584,7 +597,10 @@ int main(int argc, char* argv[]) {
 	//Verify the result
     int match = 0;
 	std::cout << "CPU adam start..." << std::endl;
-	AdamCPU( &param_ref[0], &grad_ref[0], &grad_idx[0], &grad_val[0],  &exp_avg_ref[0], &exp_avg_sq_ref[0], padded_size, padded_comp_grad_size);
+	// reference decompression goes through the host decoder
+	std::vector<int, aligned_allocator<int>> grad_idx_ref(padded_comp_grad_size);
+	unpack_idx(&grad_idx_packed[0], padded_comp_grad_size, &grad_idx_ref[0]);
+	AdamCPU( &param_ref[0], &grad_ref[0], &grad_idx_ref[0], &grad_val[0],  &exp_avg_ref[0], &exp_avg_sq_ref[0], padded_size, padded_comp_grad_size);
 	std::cout << "CPU adam done!" << std::endl;
 
 	nvmeFd = open(param_name.c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
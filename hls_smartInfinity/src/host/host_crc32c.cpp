@@ -0,0 +1,280 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+#define CL_HPP_CL_1_2_DEFAULT_BUILD
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_ENABLE_PROGRAM_CONSTRUCTION_FROM_ARRAY_COMPATIBILITY 1
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#include <vector>
+#include <CL/cl2.hpp>
+#include <iostream>
+#include <fstream>
+#include <CL/cl_ext_xilinx.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <cmath>
+#include <iomanip>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cassert>
+#include <CL/cl_ext.h>
+
+
+
+// Not a multiple of CRC_CHUNK, the last chunk is a partial one
+static const int DATA_SIZE = 4096* 4096*2 + 1000;
+
+std::string param_name = "/mnt/smartssd1/param.tensor.swp";
+
+#include "crc32c.h"
+
+//Some Library functions to be used.
+template <typename T>
+struct aligned_allocator
+{
+  using value_type = T;
+  T* allocate(std::size_t num)
+  {
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr,4096,num*sizeof(T)))
+      throw std::bad_alloc();
+    return reinterpret_cast<T*>(ptr);
+  }
+  void deallocate(T* p, std::size_t num)
+  {
+    free(p);
+  }
+};
+
+
+#define OCL_CHECK(error,call)                                       \
+    call;                                                           \
+    if (error != CL_SUCCESS) {                                      \
+      printf("%s:%d Error calling " #call ", error code is: %d\n",  \
+              __FILE__,__LINE__, error);                            \
+      exit(EXIT_FAILURE);                                           \
+    }                                       
+	
+namespace xcl {
+	std::vector<cl::Device> get_devices(const std::string& vendor_name) {
+		size_t i;
+		cl_int err;
+		std::vector<cl::Platform> platforms;
+		OCL_CHECK(err, err = cl::Platform::get(&platforms));
+		cl::Platform platform;
+		for (i  = 0 ; i < platforms.size(); i++){
+			platform = platforms[i];
+			OCL_CHECK(err, std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(&err));
+			if (platformName == vendor_name){
+				std::cout << "Found Platform" << std::endl;
+				std::cout << "Platform Name: " << platformName.c_str() << std::endl;
+				break;
+			}
+		}
+		if (i == platforms.size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	   
+		//Getting ACCELERATOR Devices and selecting 1st such device 
+		std::vector<cl::Device> devices;
+		OCL_CHECK(err, err = platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices));
+		return devices;
+	}
+	   
+	std::vector<cl::Device> get_xil_devices() {
+		return get_devices("Xilinx");
+	}
+
+	char* read_binary_file(const std::string &xclbin_file_name, unsigned &nb) 
+	{
+		std::cout << "INFO: Reading " << xclbin_file_name << std::endl;
+
+		if(access(xclbin_file_name.c_str(), R_OK) != 0) {
+			printf("ERROR: %s xclbin not available please build\n", xclbin_file_name.c_str());
+			exit(EXIT_FAILURE);
+		}
+		//Loading XCL Bin into char buffer 
+		std::cout << "Loading: '" << xclbin_file_name.c_str() << "'\n";
+		std::ifstream bin_file(xclbin_file_name.c_str(), std::ifstream::binary);
+		bin_file.seekg (0, bin_file.end);
+		nb = bin_file.tellg();
+		bin_file.seekg (0, bin_file.beg);
+		char *buf = new char [nb];
+		bin_file.read(buf, nb);
+		return buf;
+	}
+};
+
+int crc_fpga(size_t nbytes, cl::Context context, cl::CommandQueue q, cl::Kernel krnl_crc, uint32_t* crcs){
+	int err;
+
+	int nvmeFd_param = -1;
+	int ret;
+
+	nvmeFd_param = open(param_name.c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
+
+	cl_mem_ext_ptr_t outExt = {0};
+	outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+	size_t n_chunks = crc_n_chunks(nbytes);
+	cl::Buffer param(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, nullptr);
+	cl::Buffer crc(context, CL_MEM_READ_WRITE, n_chunks * sizeof(uint32_t), nullptr, nullptr);
+
+	unsigned int cnt = 0;
+	OCL_CHECK(err, err = krnl_crc.setArg(cnt++, param));
+	OCL_CHECK(err, err = krnl_crc.setArg(cnt++, crc));
+	OCL_CHECK(err, err = krnl_crc.setArg(cnt++, uint32_t(nbytes / sizeof(float))));
+
+	float* p2p_param = (float*)q.enqueueMapBuffer(param,						// buffer
+									  CL_TRUE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, nullptr,
+									  &err);
+	OCL_CHECK(err, err =q.finish());
+
+	std::chrono::high_resolution_clock::time_point total_start = std::chrono::high_resolution_clock::now();
+	ret = pread(nvmeFd_param, (void*)p2p_param, nbytes, 0);
+	if (ret == -1) {
+		std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl;
+		return EXIT_FAILURE;
+	}
+
+    //Launch the Kernel
+	q.enqueueTask(krnl_crc, nullptr, nullptr);
+	q.enqueueReadBuffer(crc, CL_TRUE, 0, n_chunks * sizeof(uint32_t), crcs);
+	q.finish();
+	std::chrono::high_resolution_clock::time_point total_end = std::chrono::high_resolution_clock::now();
+    cl_ulong total_time = std::chrono::duration_cast<std::chrono::microseconds>(total_end - total_start).count();
+	double dsduration = (double)total_time / ((double)1000000);
+	double gbpersec = (nbytes / dsduration) / ((double)1024 * 1024 * 1024);
+	std::cout << "Total : Buffer = " << nbytes << " Throughput = " << std::setprecision(2)
+			  << std::fixed << gbpersec << "GB/s\n";
+
+	(void)close(nvmeFd_param);
+
+	return 0;
+}
+
+
+int write_params(std::vector<float, aligned_allocator<float>>& param_src, size_t nbytes)
+{
+	int nvmeFd = open(param_name.c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
+	if (nvmeFd < 0){
+		std::cerr << "ERROR: open " << param_name << " failed with " << nvmeFd << std::endl;
+		return EXIT_FAILURE;
+	}
+	int ret = pwrite(nvmeFd,  &param_src[0], nbytes, 0);
+	if (ret == -1) {
+		std::cout << strerror(errno) << std::endl;
+		std::cout << "normal pwrite() failed, err: " << ret << ", line: " << __LINE__ << std::endl;
+		return EXIT_FAILURE;
+	}
+	(void)close(nvmeFd);
+	return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+
+	cl_int err;
+	// any optimizer binary linked with CRC=1 carries krnl_crc
+	const char* xclbinFilename = "adam.xclbin";
+	//const char* xclbinFilename = argv[1];
+
+	std::vector<cl::Device> devices = xcl::get_xil_devices();
+    cl::Device device = devices[0];
+	
+    devices.resize(1);
+	
+    // Creating Context and Command Queue for selected device
+	cl::Context* ctx_ptr = new cl::Context(devices[0]);
+	cl::Context context = *ctx_ptr;
+    cl::CommandQueue q = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+    // Load xclbin 
+    std::cout << "Loading: '" << xclbinFilename << "'\n";
+    std::ifstream bin_file(xclbinFilename, std::ifstream::binary);
+    bin_file.seekg (0, bin_file.end);
+    unsigned nb = bin_file.tellg(); // print out #bits of file
+    bin_file.seekg (0, bin_file.beg);
+    char *buf = new char [nb];
+    bin_file.read(buf, nb);
+	bin_file.close();
+
+    // Creating Program from Binary File
+    cl::Program::Binaries bins;
+    bins.push_back({buf,nb}); //Multiple bin files is possible
+
+	cl::Program program = cl::Program(context, devices, bins);
+
+    cl::Kernel krnl_crc(program,"krnl_crc");
+	delete[] buf;
+
+    std::cout << "Loading Success!: '" << xclbinFilename << "'\n";
+
+	// P2P reads are whole 4 KiB blocks, the checksums only cover DATA_SIZE params
+	int blksize = 1024;
+	size_t padded_size = ((DATA_SIZE-1)/blksize + 1 ) * blksize;
+	size_t nbytes = DATA_SIZE * sizeof(float);
+
+	std::vector<float, aligned_allocator<float>> param_src(padded_size, 0);
+
+	float rand_scale = 8;
+	float rand_max = float(RAND_MAX);
+
+	for (unsigned int i=0; i< DATA_SIZE; i++) {
+		param_src[i] = static_cast<float>((rand() - rand_max / 2) / rand_max) * rand_scale;
+	}
+
+	size_t n_chunks = crc_n_chunks(nbytes);
+	std::vector<uint32_t> crcs(n_chunks);
+	std::vector<uint32_t> crcs_ref(n_chunks);
+	int match = 0;
+
+	// Clean file: every chunk must agree with the host checksum
+	if (write_params(param_src, padded_size * sizeof(float)) == EXIT_FAILURE) return EXIT_FAILURE;
+	if (crc_fpga(nbytes, context, q, krnl_crc, &crcs[0]) == EXIT_FAILURE){
+		std::cout<< "FPGA crc failed ... " << std::endl;
+		return EXIT_FAILURE;
+	}
+	crc32c_chunks(&param_src[0], nbytes, &crcs_ref[0]);
+
+	for (size_t c = 0; c < n_chunks; c++) {
+		if (crcs[c] != crcs_ref[c]) {
+			std::cout << "chunk " << c << " failed ref: " << std::hex << crcs_ref[c] << ", device: " << crcs[c] << std::dec << std::endl;
+			match = 1;
+		}
+	}
+
+	// One flipped bit in the middle and one in the partial last chunk must only change their chunks
+	size_t bad_idx[] = { CRC_CHUNK / sizeof(float) + 17, DATA_SIZE - 1 };
+	for (int b = 0; b < 2; b++) {
+		uint32_t* word = (uint32_t*)&param_src[bad_idx[b]];
+		*word ^= 1u << 9;
+		if (write_params(param_src, padded_size * sizeof(float)) == EXIT_FAILURE) return EXIT_FAILURE;
+		if (crc_fpga(nbytes, context, q, krnl_crc, &crcs[0]) == EXIT_FAILURE){
+			std::cout<< "FPGA crc failed ... " << std::endl;
+			return EXIT_FAILURE;
+		}
+		size_t bad_chunk = bad_idx[b] * sizeof(float) / CRC_CHUNK;
+		for (size_t c = 0; c < n_chunks; c++) {
+			if ((crcs[c] != crcs_ref[c]) != (c == bad_chunk)) {
+				std::cout << "["<< bad_idx[b] << "] chunk " << c << " mismatch " << (c == bad_chunk ? "missed" : "reported") << std::endl;
+				match = 1;
+			}
+		}
+		*word ^= 1u << 9;
+	}
+
+    std::cout << "TEST WITH ONE KERNEL " << (match ? "FAILED" : "PASSED") << std::endl; 
+
+    return (match ? EXIT_FAILURE :  EXIT_SUCCESS);
+}
@@ -0,0 +1,302 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+#define CL_HPP_CL_1_2_DEFAULT_BUILD
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_ENABLE_PROGRAM_CONSTRUCTION_FROM_ARRAY_COMPATIBILITY 1
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#include <vector>
+#include <CL/cl2.hpp>
+#include <iostream>
+#include <fstream>
+#include <CL/cl_ext_xilinx.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <cmath>
+#include <iomanip>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cassert>
+#include <CL/cl_ext.h>
+
+
+
+static const int DATA_SIZE = 4096* 4096*2;
+
+std::string grad_name = "/mnt/smartssd1/grad.tensor.swp";
+
+#include <x86intrin.h>
+typedef ushort  half;
+
+// Result layout, see src/kernel_cpp/grad_norm.cpp
+#define HALF_MAX 65504.0f
+#define RESULT_SUMSQ 0
+#define RESULT_OVERFLOW 1
+
+//Some Library functions to be used.
+template <typename T>
+struct aligned_allocator
+{
+  using value_type = T;
+  T* allocate(std::size_t num)
+  {
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr,4096,num*sizeof(T)))
+      throw std::bad_alloc();
+    return reinterpret_cast<T*>(ptr);
+  }
+  void deallocate(T* p, std::size_t num)
+  {
+    free(p);
+  }
+};
+
+
+#define OCL_CHECK(error,call)                                       \
+    call;                                                           \
+    if (error != CL_SUCCESS) {                                      \
+      printf("%s:%d Error calling " #call ", error code is: %d\n",  \
+              __FILE__,__LINE__, error);                            \
+      exit(EXIT_FAILURE);                                           \
+    }                                       
+	
+namespace xcl {
+	std::vector<cl::Device> get_devices(const std::string& vendor_name) {
+		size_t i;
+		cl_int err;
+		std::vector<cl::Platform> platforms;
+		OCL_CHECK(err, err = cl::Platform::get(&platforms));
+		cl::Platform platform;
+		for (i  = 0 ; i < platforms.size(); i++){
+			platform = platforms[i];
+			OCL_CHECK(err, std::string platformName = platform.getInfo<CL_PLATFORM_NAME>(&err));
+			if (platformName == vendor_name){
+				std::cout << "Found Platform" << std::endl;
+				std::cout << "Platform Name: " << platformName.c_str() << std::endl;
+				break;
+			}
+		}
+		if (i == platforms.size()) {
+			std::cout << "Error: Failed to find Xilinx platform" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	   
+		//Getting ACCELERATOR Devices and selecting 1st such device 
+		std::vector<cl::Device> devices;
+		OCL_CHECK(err, err = platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices));
+		return devices;
+	}
+	   
+	std::vector<cl::Device> get_xil_devices() {
+		return get_devices("Xilinx");
+	}
+
+	char* read_binary_file(const std::string &xclbin_file_name, unsigned &nb) 
+	{
+		std::cout << "INFO: Reading " << xclbin_file_name << std::endl;
+
+		if(access(xclbin_file_name.c_str(), R_OK) != 0) {
+			printf("ERROR: %s xclbin not available please build\n", xclbin_file_name.c_str());
+			exit(EXIT_FAILURE);
+		}
+		//Loading XCL Bin into char buffer 
+		std::cout << "Loading: '" << xclbin_file_name.c_str() << "'\n";
+		std::ifstream bin_file(xclbin_file_name.c_str(), std::ifstream::binary);
+		bin_file.seekg (0, bin_file.end);
+		nb = bin_file.tellg();
+		bin_file.seekg (0, bin_file.beg);
+		char *buf = new char [nb];
+		bin_file.read(buf, nb);
+		return buf;
+	}
+};
+
+void grad_norm_CPU(half* grads, size_t n_elements, float* result)
+{
+	double sumsq = 0.0;
+	float overflow = 0.0f;
+	for (size_t k = 0; k < n_elements; k++) {
+		float grad = _cvtsh_ss(grads[k]);
+		if (!(std::abs(grad) <= HALF_MAX)) overflow = 1.0f;
+		sumsq += grad * grad;
+	}
+	result[RESULT_SUMSQ] = sumsq;
+	result[RESULT_OVERFLOW] = overflow;
+}
+
+int grad_norm_fpga(size_t nbytes, size_t n_elements, cl::Context context, cl::CommandQueue q, cl::Kernel krnl_norm, float* result){
+	int err;
+
+	int nvmeFd_grad = -1;
+	int ret;
+
+	nvmeFd_grad = open(grad_name.c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
+
+	cl_mem_ext_ptr_t outExt = {0};
+	outExt.flags = XCL_MEM_EXT_P2P_BUFFER;
+
+	cl::Buffer grad(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, nbytes, &outExt, nullptr);
+	cl::Buffer norm(context, CL_MEM_READ_WRITE, 2 * sizeof(float), nullptr, nullptr);
+
+	unsigned int cnt = 0;
+	OCL_CHECK(err, err = krnl_norm.setArg(cnt++, grad));
+	OCL_CHECK(err, err = krnl_norm.setArg(cnt++, norm));
+	OCL_CHECK(err, err = krnl_norm.setArg(cnt++, uint32_t(n_elements)));
+
+	half* p2p_grad = (half*)q.enqueueMapBuffer(grad,						// buffer
+									  CL_TRUE,						// blocking call
+									  CL_MAP_WRITE | CL_MAP_READ,	//Indicates we will write
+									  0,							// buffer offset
+									  nbytes,			// size in bytes
+									  nullptr, nullptr,
+									  &err);
+	OCL_CHECK(err, err =q.finish());
+
+	std::chrono::high_resolution_clock::time_point total_start = std::chrono::high_resolution_clock::now();
+	ret = pread(nvmeFd_grad, (void*)p2p_grad, nbytes, 0);
+	if (ret == -1) {
+		std::cout << "P2P: read() failed, err: " << ret << ", line: " << __LINE__ << std::endl;
+		return EXIT_FAILURE;
+	}
+
+    //Launch the Kernel
+	q.enqueueTask(krnl_norm, nullptr, nullptr);
+	q.enqueueReadBuffer(norm, CL_TRUE, 0, 2 * sizeof(float), result);
+	q.finish();
+	std::chrono::high_resolution_clock::time_point total_end = std::chrono::high_resolution_clock::now();
+    cl_ulong total_time = std::chrono::duration_cast<std::chrono::microseconds>(total_end - total_start).count();
+	double dsduration = (double)total_time / ((double)1000000);
+	double gbpersec = (nbytes / dsduration) / ((double)1024 * 1024 * 1024);
+	std::cout << "Total : Buffer = " << nbytes << " Throughput = " << std::setprecision(2)
+			  << std::fixed << gbpersec << "GB/s\n";
+
+	(void)close(nvmeFd_grad);
+
+	return 0;
+}
+
+
+int write_grads(std::vector<half, aligned_allocator<half>>& grad_src, size_t nbytes)
+{
+	int nvmeFd = open(grad_name.c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
+	if (nvmeFd < 0){
+		std::cerr << "ERROR: open " << grad_name << " failed with " << nvmeFd << std::endl;
+		return EXIT_FAILURE;
+	}
+	int ret = pwrite(nvmeFd,  &grad_src[0], nbytes, 0);
+	if (ret == -1) {
+		std::cout << strerror(errno) << std::endl;
+		std::cout << "normal pwrite() failed, err: " << ret << ", line: " << __LINE__ << std::endl;
+		return EXIT_FAILURE;
+	}
+	(void)close(nvmeFd);
+	return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+
+	cl_int err;
+	// any optimizer binary linked with NORM=1 carries krnl_norm
+	const char* xclbinFilename = "adam.xclbin";
+	//const char* xclbinFilename = argv[1];
+
+	std::vector<cl::Device> devices = xcl::get_xil_devices();
+    cl::Device device = devices[0];
+	
+    devices.resize(1);
+	
+    // Creating Context and Command Queue for selected device
+	cl::Context* ctx_ptr = new cl::Context(devices[0]);
+	cl::Context context = *ctx_ptr;
+    cl::CommandQueue q = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+    // Load xclbin 
+    std::cout << "Loading: '" << xclbinFilename << "'\n";
+    std::ifstream bin_file(xclbinFilename, std::ifstream::binary);
+    bin_file.seekg (0, bin_file.end);
+    unsigned nb = bin_file.tellg(); // print out #bits of file
+    bin_file.seekg (0, bin_file.beg);
+    char *buf = new char [nb];
+    bin_file.read(buf, nb);
+	bin_file.close();
+
+    // Creating Program from Binary File
+    cl::Program::Binaries bins;
+    bins.push_back({buf,nb}); //Multiple bin files is possible
+
+	cl::Program program = cl::Program(context, devices, bins);
+
+    cl::Kernel krnl_norm(program,"krnl_norm");
+	delete[] buf;
+
+    std::cout << "Loading Success!: '" << xclbinFilename << "'\n";
+
+	int blksize = 128;
+	size_t padded_size = ((DATA_SIZE-1)/blksize + 1 ) * blksize;
+	size_t nbytes = padded_size * sizeof(half);
+
+	std::vector<half, aligned_allocator<half>> grad_src(padded_size, 0);
+
+	float rand_scale = 8;
+	float rand_max = float(RAND_MAX);
+
+	for (unsigned int i=0; i< DATA_SIZE; i++) {
+		float grad32 = static_cast<float>((rand() - rand_max / 2) / rand_max) * rand_scale;
+		grad_src[i] = _cvtss_sh(grad32, 0);
+	}
+
+	// Element count that is not a multiple of the vector width, the tail must be ignored
+	size_t n_elements = DATA_SIZE - 5;
+	float result[2];
+	float result_ref[2];
+	int match = 0;
+
+	// Finite gradients: sums must agree to fp32 accumulation error
+	if (write_grads(grad_src, nbytes) == EXIT_FAILURE) return EXIT_FAILURE;
+	if (grad_norm_fpga(nbytes, n_elements, context, q, krnl_norm, result) == EXIT_FAILURE){
+		std::cout<< "FPGA grad norm failed ... " << std::endl;
+		return EXIT_FAILURE;
+	}
+	grad_norm_CPU(&grad_src[0], n_elements, result_ref);
+
+	std::cout << std::setprecision(8) <<std::fixed;
+	if (std::abs(result[RESULT_SUMSQ] - result_ref[RESULT_SUMSQ]) > 1e-4 * result_ref[RESULT_SUMSQ]) {
+		std::cout << "sumsq failed ref: " << result_ref[RESULT_SUMSQ] << ", device: " << result[RESULT_SUMSQ] << std::endl;
+		match = 1;
+	}
+	if (result[RESULT_OVERFLOW] != 0.0f) {
+		std::cout << "overflow flag set on finite gradients" << std::endl;
+		match = 1;
+	}
+
+	// One inf and one NaN gradient must both raise the flag
+	const half half_inf = 0x7c00;
+	const half half_nan = 0x7e00;
+	size_t bad_idx[] = { 17, n_elements - 1 };
+	half bad_val[] = { half_inf, half_nan };
+	for (int b = 0; b < 2; b++) {
+		half saved = grad_src[bad_idx[b]];
+		grad_src[bad_idx[b]] = bad_val[b];
+		if (write_grads(grad_src, nbytes) == EXIT_FAILURE) return EXIT_FAILURE;
+		if (grad_norm_fpga(nbytes, n_elements, context, q, krnl_norm, result) == EXIT_FAILURE){
+			std::cout<< "FPGA grad norm failed ... " << std::endl;
+			return EXIT_FAILURE;
+		}
+		grad_norm_CPU(&grad_src[0], n_elements, result_ref);
+		if (result[RESULT_OVERFLOW] != 1.0f || result_ref[RESULT_OVERFLOW] != 1.0f) {
+			std::cout << "["<< bad_idx[b] << "] overflow flag missed ref: " << result_ref[RESULT_OVERFLOW] << ", device: " << result[RESULT_OVERFLOW] << std::endl;
+			match = 1;
+		}
+		grad_src[bad_idx[b]] = saved;
+	}
+
+    std::cout << "TEST WITH ONE KERNEL " << (match ? "FAILED" : "PASSED") << std::endl; 
+
+    return (match ? EXIT_FAILURE :  EXIT_SUCCESS);
+}
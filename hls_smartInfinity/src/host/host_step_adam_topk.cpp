@@ -26,9 +26,14 @@
 #include <numeric> // std::iota
 #include <algorithm> // std:;sort, std::stable_sort
 
+#include "idx_pack.h"
+#include "val_quant.h"
+
 static const float scale = 0.3;
 static const int DATA_SIZE = 4096*4096;
 float compression_ratio = 0.01;
+int topk_block = 0; // > 0: block-local top-k over blocks of topk_block elements
+int val_bits = 16; // 8 or 4: values quantized with per-block steps
 
 float _alpha = 1e-3;
 float _betta1 = 0.9;
@@ -218,6 +223,10 @@ int adam_fpga( cl::Context context, cl::CommandQueue q, cl::Kernel krnl_adam, in
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, grad_idx));
     OCL_CHECK(err, err = krnl_adam.setArg(cnt++, grad_val));
 	krnl_adam.setArg(cnt++, int(padded_comp_grad_size));
+	krnl_adam.setArg(cnt++, topk_block);
+	krnl_adam.setArg(cnt++, topk_block ? int(topk_block_k(topk_block, compression_ratio)) : 0);
+	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, grad_val)); // grad_val_q
+	krnl_adam.setArg(cnt++, val_bits);
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, grad));
 	OCL_CHECK(err, err = krnl_adam.setArg(cnt++, param));
     OCL_CHECK(err, err = krnl_adam.setArg(cnt++, exp_avg));
@@ -470,6 +479,7 @@ int main(int argc, char* argv[]) {
 
 	int comp_grad_size = int (padded_size * compression_ratio);
 	int padded_comp_grad_size = ((comp_grad_size -1)/blksize + 1  ) * blksize;
+	if (topk_block) padded_comp_grad_size = topk_block_total(padded_size, topk_block, compression_ratio);
 	int comp_nbytes = padded_comp_grad_size * sizeof(float);
 	
 	std::vector<float, aligned_allocator<float>> grad_abs(DATA_SIZE);
@@ -487,9 +497,52 @@ int main(int argc, char* argv[]) {
 	std::vector<int, aligned_allocator<int>> grad_idx(padded_comp_grad_size);
 	std::vector<float, aligned_allocator<float>> grad_val(padded_comp_grad_size);
 	
-	for (unsigned int i=0; i< comp_grad_size; i++) {
-		grad_idx[i] = int(idx[i]);
-		grad_val[i] = grad_src[idx[i]];
+	std::vector<uint32_t, aligned_allocator<uint32_t>> grad_idx_packed(comp_nbytes / sizeof(uint32_t));
+	size_t packed_nbytes;
+	if (topk_block) {
+		// top block_k of every block, 16-bit offsets inside the block; a short last block
+		// repeats its first pick, which the kernel applies twice with the same value
+		size_t block_k = topk_block_k(topk_block, compression_ratio);
+		uint16_t* offsets = (uint16_t*)&grad_idx_packed[0];
+		for (size_t b = 0; b * topk_block < padded_size; b++) {
+			size_t start = b * topk_block;
+			size_t len = std::min((size_t)topk_block, padded_size - start);
+			std::vector<size_t> order(len);
+			std::iota(order.begin(), order.end(), start);
+			std::stable_sort(order.begin(), order.end(), [&grad_src](size_t i1, size_t i2) { return std::abs(grad_src[i1]) > std::abs(grad_src[i2]);});
+			size_t k = std::min(block_k, len);
+			std::sort(order.begin(), order.begin() + k);
+			for (size_t j = 0; j < block_k; j++) {
+				size_t i = order[j < k ? j : 0];
+				offsets[b * block_k + j] = uint16_t(i - start);
+				grad_idx[b * block_k + j] = int(i);
+				grad_val[b * block_k + j] = grad_src[i];
+			}
+		}
+		packed_nbytes = ((padded_comp_grad_size * sizeof(uint16_t) - 1) / 4096 + 1) * 4096;
+	} else {
+		// the index stream takes increasing indices, as the DeepSpeed side emits them
+		std::sort(idx.begin(), idx.begin() + padded_comp_grad_size);
+		for (unsigned int i=0; i< padded_comp_grad_size; i++) {
+			grad_idx[i] = int(idx[i]);
+			grad_val[i] = grad_src[idx[i]];
+		}
+
+		size_t packed_words = pack_idx(&grad_idx[0], padded_comp_grad_size, &grad_idx_packed[0]);
+		packed_nbytes = (((packed_words + IDX_PAD_WORDS) * sizeof(uint32_t) - 1) / 4096 + 1) * 4096;
+	}
+	std::cout << " [ Packed index bytes: " << packed_nbytes << " / " << comp_nbytes << " ]" << std::endl;
+
+	// quantized values go out instead of grad_val, the reference takes them dequantized
+	std::vector<uint32_t, aligned_allocator<uint32_t>> grad_val_q(comp_nbytes / sizeof(uint32_t));
+	size_t val_nbytes = comp_nbytes;
+	if (val_bits < 16) {
+		std::vector<uint16_t> grad_val16(padded_comp_grad_size);
+		for (size_t j = 0; j < padded_comp_grad_size; j++) grad_val16[j] = _cvtss_sh(grad_val[j], 0);
+		quant_val(&grad_val16[0], padded_comp_grad_size, val_bits, false, 0, &grad_val_q[0]);
+		dequant_val(&grad_val_q[0], padded_comp_grad_size, val_bits, &grad_val[0]);
+		val_nbytes = std::min(val_nbytes, ((val_quant_words(padded_comp_grad_size, val_bits) * sizeof(uint32_t) - 1) / 4096 + 1) * 4096);
+		std::cout << " [ Quantized value bytes: " << val_nbytes << " / " << comp_nbytes << " ]" << std::endl;
 	}
 
 	ret = pwrite(nvmeFd,  &param_src[0], nbytes, 0);
@@ -505,7 +558,7 @@ int main(int argc, char* argv[]) {
 		std::cerr << "ERROR: open " << grad_idx_name << " failed with " << nvmeFd << std::endl;
 		return EXIT_FAILURE;
 	}
-	ret = pwrite(nvmeFd,  &grad_idx[0], comp_nbytes, 0);
+	ret = pwrite(nvmeFd,  &grad_idx_packed[0], packed_nbytes, 0);
 	if (ret == -1) {
 		std::cout << strerror(errno) << std::endl;
 		std::cout << "grad_idx pwrite() failed, err: " << ret << ", line: " << __LINE__ << std::endl;
@@ -518,7 +571,7 @@ int main(int argc, char* argv[]) {
 		std::cerr << "ERROR: open " << grad_val_name << " failed with " << nvmeFd << std::endl;
 		return EXIT_FAILURE;
 	}
-	ret = pwrite(nvmeFd,  &grad_val[0], comp_nbytes, 0);
+	ret = pwrite(nvmeFd,  val_bits < 16 ? (void*)&grad_val_q[0] : (void*)&grad_val[0], val_nbytes, 0);
 	if (ret == -1) {
 		std::cout << strerror(errno) << std::endl;
 		std::cout << "grad_val pwrite() failed, err: " << ret << ", line: " << __LINE__ << std::endl;
@@ -582,7 +635,17 @@ int main(int argc, char* argv[]) {
 	//Verify the result
     int match = 0;
 	std::cout << "CPU adam start..." << std::endl;
-	AdamCPU( &param_ref[0], &grad_ref[0], &grad_idx[0], &grad_val[0],  &exp_avg_ref[0], &exp_avg_sq_ref[0], padded_size, padded_comp_grad_size);
+	// reference decompression goes through the host decoder
+	std::vector<int, aligned_allocator<int>> grad_idx_ref(padded_comp_grad_size);
+	if (topk_block) {
+		size_t block_k = topk_block_k(topk_block, compression_ratio);
+		uint16_t* offsets = (uint16_t*)&grad_idx_packed[0];
+		for (size_t j = 0; j < padded_comp_grad_size; j++)
+			grad_idx_ref[j] = int(j / block_k * topk_block + offsets[j]);
+	} else {
+		unpack_idx(&grad_idx_packed[0], padded_comp_grad_size, &grad_idx_ref[0]);
+	}
+	AdamCPU( &param_ref[0], &grad_ref[0], &grad_idx_ref[0], &grad_val[0],  &exp_avg_ref[0], &exp_avg_sq_ref[0], padded_size, padded_comp_grad_size);
 	std::cout << "CPU adam done!" << std::endl;
 
 	nvmeFd = open(param_name.c_str(), O_RDWR | O_SYNC | O_CREAT | O_DIRECT, 0644);
@@ -0,0 +1,129 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+// Host quantizer / decoder of the quantized gradient values, a copy of
+// deepspeed/ops/csrc/includes/val_quant.h for the checkers.
+//
+// n values (n a multiple of 16) become signed `bits`-bit codes (8 or 4), packed LSB first into
+// n * bits / 32 words, followed by one fp32 step per VAL_QBLOCK values: value = code * step,
+// step = absmax / VAL_QMAX(bits) of the block. Codes are rounded to nearest or stochastically.
+// The kernel side decoder is src/kernel_cpp/val_dequant.h.
+
+#ifndef VAL_QUANT_H
+#define VAL_QUANT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (__x86_64__ || __i386__)
+#include <x86intrin.h>
+#endif
+
+#define VAL_QBLOCK 128
+#define VAL_QMAX(bits) ((1 << ((bits) - 1)) - 1)
+
+static inline size_t val_n_blocks(size_t n) { return (n + VAL_QBLOCK - 1) / VAL_QBLOCK; }
+
+// Words of the stream for n values, steps included
+static inline size_t val_quant_words(size_t n, int bits) { return n * bits / 32 + val_n_blocks(n); }
+
+static inline float val_half_to_float(uint16_t h)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t man = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (man << 13);
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (man << 13);
+    } else if (man == 0) {
+        bits = sign;
+    } else {
+        // subnormal, renormalize
+        exp = 113;
+        while (!(man & 0x400)) {
+            man <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((man & 0x3ff) << 13);
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+#endif
+}
+
+// Quantizes n fp16 values into out (val_quant_words(n, bits) words). With stochastic rounding
+// every block draws from its own xorshift stream, so the result only depends on seed.
+static void quant_val(const uint16_t* val, size_t n, int bits, bool stochastic, uint32_t seed, uint32_t* out)
+{
+    const size_t n_blocks = val_n_blocks(n);
+    const int qmax = VAL_QMAX(bits);
+    const uint32_t code_mask = (1u << bits) - 1;
+    const int per_word = 32 / bits;
+    float* steps = (float*)(out + n * bits / 32);
+
+#pragma omp parallel for
+    for (size_t b = 0; b < n_blocks; b++) {
+        size_t begin = b * VAL_QBLOCK;
+        size_t end = std::min(n, begin + VAL_QBLOCK);
+        float x[VAL_QBLOCK];
+        float absmax = 0.0f;
+        for (size_t j = begin; j < end; j++) {
+            x[j - begin] = val_half_to_float(val[j]);
+            absmax = std::max(absmax, std::fabs(x[j - begin]));
+        }
+        // an overflowed step keeps its inf/nan in the step, so the update still sees it
+        float step = absmax / qmax;
+        float inv = (absmax > 0.0f && std::isfinite(absmax)) ? qmax / absmax : 0.0f;
+        steps[b] = step;
+
+        uint32_t state = (seed ^ (uint32_t)(b * 0x9e3779b9u)) | 1;
+        for (size_t w = begin / per_word; w < end / per_word; w++) {
+            uint32_t word = 0;
+            for (int l = 0; l < per_word; l++) {
+                float q = inv > 0.0f ? x[w * per_word + l - begin] * inv : 0.0f;
+                if (stochastic) {
+                    state ^= state << 13;
+                    state ^= state >> 17;
+                    state ^= state << 5;
+                    q = std::floor(q + (state >> 8) * (1.0f / (1 << 24)));
+                } else {
+                    q = std::nearbyint(q);
+                }
+                int code = (int)std::min(std::max(q, (float)-qmax), (float)qmax);
+                word |= ((uint32_t)code & code_mask) << (l * bits);
+            }
+            out[w] = word;
+        }
+    }
+}
+
+// Restores n values from the stream written by quant_val
+static void dequant_val(const uint32_t* q, size_t n, int bits, float* val)
+{
+    const float* steps = (const float*)(q + n * bits / 32);
+    const int per_word = 32 / bits;
+
+#pragma omp parallel for
+    for (size_t w = 0; w < n / per_word; w++) {
+        uint32_t word = q[w];
+        for (int l = 0; l < per_word; l++) {
+            size_t j = w * per_word + l;
+            // sign extend the field
+            int32_t code = (int32_t)(word << (32 - bits * (l + 1))) >> (32 - bits);
+            val[j] = code * steps[j / VAL_QBLOCK];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,219 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// kernel:  vadd
+//
+// Purpose: Demonstrate Vector Add in OpenCL
+//
+
+#include "hls_vector.h"
+#include <cmath>
+#include "fast_math.h"
+#include "hls_half.h"
+#define VEC_SIZE 16
+#define D_VEC_SIZE 2* VEC_SIZE
+#define DATA_SIZE 4096
+
+// Segment table (one entry per parameter partition in the flattened sub group)
+#define SEG_FIELDS 8
+#define SEG_BEGIN 0		// first element of the segment
+#define SEG_END 1		// one past the last element
+#define SEG_COLS 2		// row length, 0 for an unfactored segment
+#define SEG_COL0 3		// column of the first element
+#define SEG_ROWS 4		// number of (partial) rows covered by the segment
+#define SEG_ROW_BASE 5	// row factor offset in factor
+#define SEG_COL_BASE 6	// column factor offset in factor (full second moment if unfactored)
+
+#define MAX_COLS 16384
+
+typedef unsigned int uint;
+
+typedef hls::vector<float, VEC_SIZE> vec; // 512 bits
+
+static void factored_reduce( half* grad16, float* factor, uint* seg, float col_acc[MAX_COLS],
+			float betta2, float eps, float combined_unscale )
+{
+	uint begin = seg[SEG_BEGIN];
+	uint end = seg[SEG_END];
+	uint cols = seg[SEG_COLS];
+	uint rows = seg[SEG_ROWS];
+	uint row_base = seg[SEG_ROW_BASE];
+	uint col_base = seg[SEG_COL_BASE];
+
+	float _betta2 = betta2;
+	float _betta2_minus1 = (1.0f - _betta2);
+
+	init_col: for (uint c = 0 ; c < cols; ++c)
+	{
+		#pragma HLS PIPELINE II=1
+		col_acc[c] = 0.0f;
+	}
+
+	uint vb = begin / VEC_SIZE;
+	uint ve = (end + VEC_SIZE - 1) / VEC_SIZE;
+
+	// (r, c) of lane 0, which may sit before the segment begins
+	int c_base = int(seg[SEG_COL0]) - int(begin - vb * VEC_SIZE);
+	int r_base = 0;
+	if (c_base < 0) { c_base += cols; r_base = -1; }
+
+	float row_sum = 0.0f;
+	reduce_g: for (uint x = vb ; x < ve; ++x)
+	{
+		#pragma HLS PIPELINE II=1
+		float lo = 0.0f;
+		float hi = 0.0f;
+		inner_reduce_g: for (uint y = 0 ; y < VEC_SIZE; ++y)
+		{
+		#pragma HLS UNROLL
+			uint k = x * VEC_SIZE + y;
+			int c = c_base + y;
+			bool wrap = (c >= int(cols));
+			if (wrap) c -= cols;
+			if (k >= begin && k < end) {
+				float g = grad16[k] * combined_unscale;
+				float g2 = g * g + eps;
+				col_acc[c] += g2;
+				if (wrap) hi += g2; else lo += g2;
+			}
+		}
+		row_sum += lo;
+		c_base += VEC_SIZE;
+		if (c_base >= int(cols)) {
+			if (r_base >= 0 && r_base < int(rows)) factor[row_base + r_base] = _betta2 * factor[row_base + r_base] + _betta2_minus1 * row_sum / cols;
+			row_sum = hi;
+			c_base -= cols;
+			r_base++;
+		}
+	}
+	if (r_base >= 0 && r_base < int(rows)) factor[row_base + r_base] = _betta2 * factor[row_base + r_base] + _betta2_minus1 * row_sum / cols;
+
+	// col_acc keeps the updated column factor for the update pass
+	update_col: for (uint c = 0 ; c < cols; ++c)
+	{
+		#pragma HLS PIPELINE II=1
+		float col = _betta2 * factor[col_base + c] + _betta2_minus1 * col_acc[c] / rows;
+		factor[col_base + c] = col;
+		col_acc[c] = col;
+	}
+}
+
+void adafactor( half* grad16, half* param16, vec* param, vec* exp_avg, float* factor, uint* segment, uint n_segments,
+			float betta1, float betta2, float eps, float w_decay, float step_size, float combined_unscale )
+{
+	float col_acc[MAX_COLS];
+	#pragma HLS ARRAY_PARTITION variable=col_acc cyclic factor=16
+
+	float _betta1 = betta1;
+	float _betta2 = betta2;
+	float _betta1_minus1 = (1.0f - _betta1);
+	float _betta2_minus1 = (1.0f - _betta2);
+	float _eps = eps;
+	float _w_decay_plus1 = (1.0f + w_decay);
+	float _step_size = step_size;
+	float _combined_unscale = combined_unscale;
+
+	segments: for (uint s = 0 ; s < n_segments; ++s)
+	{
+		uint* seg = segment + s * SEG_FIELDS;
+		uint begin = seg[SEG_BEGIN];
+		uint end = seg[SEG_END];
+		uint cols = seg[SEG_COLS];
+		uint rows = seg[SEG_ROWS];
+		uint row_base = seg[SEG_ROW_BASE];
+		uint col_base = seg[SEG_COL_BASE];
+		bool factored = (cols != 0);
+
+		float inv_row_mean = 0.0f;
+		if (factored) {
+			factored_reduce( grad16, factor, seg, col_acc, betta2, eps, combined_unscale );
+
+			float row_total = 0.0f;
+			mean_row: for (uint r = 0 ; r < rows; ++r)
+			{
+				#pragma HLS PIPELINE II=1
+				row_total += factor[row_base + r];
+			}
+			inv_row_mean = rows / row_total;
+		}
+
+		uint vb = begin / VEC_SIZE;
+		uint ve = (end + VEC_SIZE - 1) / VEC_SIZE;
+
+		int c_base = int(seg[SEG_COL0]) - int(begin - vb * VEC_SIZE);
+		int r_base = 0;
+		if (factored && c_base < 0) { c_base += cols; r_base = -1; }
+
+		compute_p: for (uint x = vb ; x < ve; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			vec p = param[x];
+			vec m = exp_avg[x];
+			float r_lo = (factored && r_base >= 0 && r_base < int(rows)) ? factor[row_base + r_base] : 0.0f;
+			float r_hi = (factored && r_base + 1 < int(rows)) ? factor[row_base + r_base + 1] : 0.0f;
+			inner_compute_p: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				uint k = x * VEC_SIZE + y;
+				if (k >= begin && k < end) {
+					float g = grad16[k] * _combined_unscale;
+					float v;
+					if (factored) {
+						int c = c_base + y;
+						bool wrap = (c >= int(cols));
+						if (wrap) c -= cols;
+						v = (wrap ? r_hi : r_lo) * col_acc[c] * inv_row_mean;
+					} else {
+						v = _betta2 * factor[col_base + k - begin] + _betta2_minus1 * (g * g + _eps);
+						factor[col_base + k - begin] = v;
+					}
+					m[y] = _betta1 * m[y] + _betta1_minus1 * kernel_div_sqrt(g, v);
+					p[y] = p[y] * _w_decay_plus1 + _step_size * m[y];
+					param16[k] = p[y];
+				}
+			}
+			param[x] = p;
+			exp_avg[x] = m;
+			if (factored) {
+				c_base += VEC_SIZE;
+				if (c_base >= int(cols)) { c_base -= cols; r_base++; }
+			}
+		}
+	}
+}
+
+
+extern "C"{
+	void krnl_vadd(
+				half* grad16,
+				half* param16,
+				vec* param,
+				vec* exp_avg,
+				float* factor,
+				uint* segment,
+				uint  n_segments,
+				float betta1,
+				float betta2,
+				float eps,
+				float w_decay,
+				float step_size,
+				float combined_unscale
+			)
+	{
+	#pragma HLS interface m_axi port=grad16 offset=slave bundle=half256 max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=param16 offset=slave bundle=half512 max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=param offset=slave bundle=single max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg offset=slave bundle=single max_read_burst_length=256  max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=factor offset=slave bundle=factor max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=segment offset=slave bundle=factor max_read_burst_length=16
+
+	adafactor ( grad16, param16, param, exp_avg, factor, segment, n_segments,
+				   betta1, betta2, eps, w_decay, step_size, combined_unscale );
+	}
+}
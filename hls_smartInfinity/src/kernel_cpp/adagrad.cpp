@@ -12,6 +12,7 @@
 
 #include "hls_vector.h"
 #include <cmath>
+#include "fast_math.h"
 #include "hls_half.h" 
 #define VEC_SIZE 16
 #define D_VEC_SIZE 2* VEC_SIZE
@@ -88,7 +89,7 @@ void adagrad (	dhvec* grad16, dhvec* param16, vec* param, vec* exp_avg_sq, uint
 			inner_compute_p: for ( uint y= 0 ; y< VEC_SIZE; y++)
 		    {
 			#pragma HLS UNROLL
-				p[x][y] = p[x][y] +  (m[x][y] / ( sqrtf(v[x][y])  + _eps ))  * _step_size;
+				p[x][y] = p[x][y] +  kernel_div( m[x][y], kernel_sqrt(v[x][y]) + _eps )  * _step_size;
 		    }
 			param[i + x] = p[x];
 		}
@@ -12,7 +12,10 @@
 
 #include "hls_vector.h"
 #include <cmath>
+#include "fast_math.h"
 #include "hls_half.h" 
+#include "idx_unpack.h"
+#include "val_dequant.h"
 #define VEC_SIZE 16
 #define D_VEC_SIZE 2* VEC_SIZE
 #define DATA_SIZE 4096
@@ -50,12 +53,13 @@ static void initialize( half* grad16, uint n_elements )
     }
 }
 
-void decompressor( ivec* grad_idx, hvec* grad_val, uint n_elements_compressed, half* grad16 )
+void decompressor( uint* grad_idx, hvec* grad_val, uint n_elements_compressed, uint topk_block, uint topk_block_k, uint* grad_val_q, uint val_bits, half* grad16 )
 {
 	ivec g_idx[DATA_SIZE];
 	hvec g_val[DATA_SIZE];
 
 	uint iteration = n_elements_compressed / VEC_SIZE;
+	uint n_blocks = n_elements_compressed / IDX_BLOCK;
 
 	decompressor : for ( uint i = 0 ; i < iteration ; i+= DATA_SIZE )
 	{
@@ -64,15 +68,18 @@ void decompressor( ivec* grad_idx, hvec* grad_val, uint n_elements_compressed, h
 		//boundary check
 		if (i + size > iteration) size = iteration - i;
 
-		read_grad_idx: for (uint x = 0 ; x < size; ++x)
+		// indices arrive delta-encoded and bit-packed, or as block-local offsets, see idx_unpack.h
+		if (topk_block == 0) unpack_idx( grad_idx, n_blocks, i / IDX_BLOCK_VECS, size / IDX_BLOCK_VECS, g_idx );
+		else unpack_local_idx( grad_idx, topk_block, topk_block_k, i, size, g_idx );
+		// values arrive as is, or as int8/int4 codes with per-block steps, see val_dequant.h
+		if (val_bits == 8 || val_bits == 4) dequant_val( grad_val_q, val_bits, n_elements_compressed, i, size, g_val );
+		else
 		{
-			#pragma HLS PIPELINE II=1
-			g_idx[x] = grad_idx[i + x];		
-		}
-		read_grad_val: for (uint x = 0 ; x < size ; ++x)
-		{
-			#pragma HLS PIPELINE II=1
-			g_val[x] = grad_val[i + x];		
+			read_grad_val: for (uint x = 0 ; x < size ; ++x)
+			{
+				#pragma HLS PIPELINE II=1
+				g_val[x] = grad_val[i + x];
+			}
 		}
 		write_grad: for (uint x = 0 ; x < size; ++x)
 		{
@@ -146,7 +153,7 @@ void adagrad (	half* grad16, dhvec* param16, vec* param, vec* exp_avg_sq, uint n
 			inner_compute_p: for ( uint y= 0 ; y< VEC_SIZE; y++)
 		    {
 			#pragma HLS UNROLL
-				p[x][y] = p[x][y] +  (m[x][y] / ( sqrtf(v[x][y])  + _eps ))  * _step_size;
+				p[x][y] = p[x][y] +  kernel_div( m[x][y], kernel_sqrt(v[x][y]) + _eps )  * _step_size;
 		    }
 			param[i + x] = p[x];
 		}
@@ -174,9 +181,13 @@ void adagrad (	half* grad16, dhvec* param16, vec* param, vec* exp_avg_sq, uint n
 extern "C"{
 	void krnl_vadd(
 #if TOPK
-				ivec* grad_idx,
+				uint* grad_idx,
 				hvec* grad_val,
 				uint n_elements_compressed,
+				uint topk_block,
+				uint topk_block_k,
+				uint* grad_val_q,
+				uint val_bits,
 #endif
 				half* grad16,
 				dhvec* param16,
@@ -197,11 +208,13 @@ extern "C"{
 
 	#pragma HLS interface m_axi port=grad_idx offset=slave bundle=single_comp max_read_burst_length=256 
 	#pragma HLS interface m_axi port=grad_val offset=slave bundle=half_comp max_read_burst_length=256 
+	// quantized values alias grad_val (same cl::Buffer), on their own bundle
+	#pragma HLS interface m_axi port=grad_val_q offset=slave bundle=quant_comp max_read_burst_length=256
 
 
 #if TOPK
 		initialize(grad16, n_elements);
-		decompressor( grad_idx, grad_val, n_elements_compressed, grad16 );
+		decompressor( grad_idx, grad_val, n_elements_compressed, topk_block, topk_block_k, grad_val_q, val_bits, grad16 );
 #endif
 		adagrad ( grad16, param16, param, exp_avg_sq,  n_elements, 
 					 eps, w_decay, step_size, combined_unscale );
@@ -13,6 +13,7 @@
 #include "hls_vector.h"
 #include "hls_half.h" 
 #include <cmath>
+#include "fast_math.h"
 #define VEC_SIZE 16
 #define D_VEC_SIZE 2* VEC_SIZE
 #define DATA_SIZE 4096
@@ -81,7 +82,7 @@ void adam (	vec* grad, vec* param, vec* exp_avg, vec* exp_avg_sq, hvec* param16,
 			#pragma HLS PIPELINE II=1
 			inner_read_p: for (uint y = 0 ; y < VEC_SIZE; ++y)
 			{
-				p[x][y] = _w_decay_plus1 * param[i + x][y] + ( m[x][y] / ( sqrtf(v[x][y])*_bias_correction2+_eps) ) * _step_size;
+				p[x][y] = _w_decay_plus1 * param[i + x][y] + kernel_div( m[x][y], kernel_sqrt(v[x][y])*_bias_correction2+_eps ) * _step_size;
 			}
 		}
 		write_p: for ( uint x = 0; x < size; ++x)
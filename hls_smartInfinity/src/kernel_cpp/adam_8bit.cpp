@@ -0,0 +1,149 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// kernel:  vadd
+//
+// Purpose: Demonstrate Vector Add in OpenCL
+//
+
+#include "hls_vector.h"
+#include <cmath>
+#include "fast_math.h"
+#include "hls_half.h"
+#define VEC_SIZE 16
+#define D_VEC_SIZE 2* VEC_SIZE
+#define DATA_SIZE 4096
+
+// Blockwise 8-bit optimizer state. A state buffer of n_elements floats holds n_elements
+// 8-bit codes followed by n_elements / QBLOCK fp32 absmax scales. exp_avg is stored as
+// signed codes of m, exp_avg_sq as unsigned codes of s = sqrt(v), square-root spaced:
+// c = round(255 * sqrt(s / absmax)). A code of 0 decodes as 1, see cpu_adam.h.
+#define QBLOCK 256
+#define QVECS (QBLOCK / VEC_SIZE)
+
+typedef unsigned int uint;
+
+typedef hls::vector<float, VEC_SIZE> vec; // 512 bits
+typedef hls::vector<signed char, VEC_SIZE> mqvec; // 128 bits
+typedef hls::vector<unsigned char, VEC_SIZE> vqvec; // 128 bits
+
+void adam_8bit( half* grad16, half* param16, vec* param, mqvec* exp_avg, float* exp_avg_scale, vqvec* exp_avg_sq, float* exp_avg_sq_scale,
+			uint n_elements, float betta1, float betta2, float bias_correction2, float eps, float w_decay, float step_size, float combined_unscale )
+{
+	vec m[QVECS];
+	vec v[QVECS];
+
+	float _betta1 = betta1;
+	float _betta2 = betta2;
+	float _betta1_minus1 = (1.0f - _betta1);
+	float _betta2_minus1 = (1.0f - _betta2);
+	float _bias_correction2 = bias_correction2;
+	float _eps = eps;
+	float _w_decay_plus1 = (1.0f + w_decay);
+	float _step_size = step_size;
+	float _combined_unscale = combined_unscale;
+
+	// scales start right after the codes, n_elements bytes into the buffer
+	uint scale_base = n_elements / sizeof(float);
+	uint n_blocks = n_elements / QBLOCK;
+	blocks: for (uint b = 0 ; b < n_blocks; ++b)
+	{
+		float m_step = exp_avg_scale[scale_base + b] / 127.0f;
+		float v_step = exp_avg_sq_scale[scale_base + b] / (255.0f * 255.0f);
+
+		vec m_max = 0.0f;
+		vec v_max = 0.0f;
+		update_block: for (uint x = 0 ; x < QVECS; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			uint i = b * QVECS + x;
+			vec p = param[i];
+			mqvec mq = exp_avg[i];
+			vqvec vq = exp_avg_sq[i];
+			inner_update: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				float g = grad16[i * VEC_SIZE + y] * _combined_unscale;
+				float v_code = fmaxf((float)vq[y], 1.0f);
+				float s_old = v_code * v_code * v_step;
+				float m_new = _betta1 * (mq[y] * m_step) + _betta1_minus1 * g;
+				float s_new = kernel_sqrt(_betta2 * s_old * s_old + _betta2_minus1 * g * g);
+				p[y] = _w_decay_plus1 * p[y] + kernel_div( m_new, s_new * _bias_correction2 + _eps ) * _step_size;
+				param16[i * VEC_SIZE + y] = p[y];
+				m[x][y] = m_new;
+				v[x][y] = s_new;
+				m_max[y] = fmaxf(m_max[y], fabsf(m_new));
+				v_max[y] = fmaxf(v_max[y], s_new);
+			}
+			param[i] = p;
+		}
+
+		float m_absmax = 0.0f;
+		float v_absmax = 0.0f;
+		reduce_max: for (uint y = 0 ; y < VEC_SIZE; ++y)
+		{
+		#pragma HLS UNROLL
+			m_absmax = fmaxf(m_absmax, m_max[y]);
+			v_absmax = fmaxf(v_absmax, v_max[y]);
+		}
+		exp_avg_scale[scale_base + b] = m_absmax;
+		exp_avg_sq_scale[scale_base + b] = v_absmax;
+
+		float m_inv = (m_absmax > 0.0f) ? 127.0f / m_absmax : 0.0f;
+		float v_inv = (v_absmax > 0.0f) ? (255.0f * 255.0f) / v_absmax : 0.0f;
+		requant_block: for (uint x = 0 ; x < QVECS; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			mqvec mq;
+			vqvec vq;
+			inner_requant: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				mq[y] = (signed char)roundf(m[x][y] * m_inv);
+				vq[y] = (unsigned char)roundf(kernel_sqrt(v[x][y] * v_inv));
+			}
+			exp_avg[b * QVECS + x] = mq;
+			exp_avg_sq[b * QVECS + x] = vq;
+		}
+	}
+}
+
+
+extern "C"{
+	void krnl_vadd(
+				half* grad16,
+				half* param16,
+				vec* param,
+				mqvec* exp_avg,
+				float* exp_avg_scale,
+				vqvec* exp_avg_sq,
+				float* exp_avg_sq_scale,
+				uint  n_elements,
+				float betta1,
+				float betta2,
+				float bias_correction2,
+				float eps,
+				float w_decay,
+				float step_size,
+				float combined_unscale
+			)
+	{
+	#pragma HLS interface m_axi port=grad16 offset=slave bundle=half256 max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=param16 offset=slave bundle=half512 max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=param offset=slave bundle=single max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg offset=slave bundle=quant max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg_sq offset=slave bundle=quant max_read_burst_length=256  max_write_burst_length=256
+
+	// scale pointers alias the code buffers (same cl::Buffer), on their own bundle
+	#pragma HLS interface m_axi port=exp_avg_scale offset=slave bundle=scale max_read_burst_length=16 max_write_burst_length=16
+	#pragma HLS interface m_axi port=exp_avg_sq_scale offset=slave bundle=scale max_read_burst_length=16 max_write_burst_length=16
+
+	adam_8bit ( grad16, param16, param, exp_avg, exp_avg_scale, exp_avg_sq, exp_avg_sq_scale, n_elements,
+				   betta1, betta2, bias_correction2, eps, w_decay, step_size, combined_unscale );
+	}
+}
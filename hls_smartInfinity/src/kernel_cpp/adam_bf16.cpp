@@ -0,0 +1,159 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// kernel:  vadd
+//
+// Purpose: Adam on bf16 master weights. The update runs in fp32 and the new weights are
+//          written back as bf16 with stochastic rounding; the host reads them back as the
+//          forward copy, so there is no separate param16 output.
+//
+
+#include "hls_vector.h"
+#include <cmath>
+#include "fast_math.h"
+#include "bf16_round.h"
+#include "hls_half.h" 
+#define VEC_SIZE 16
+#define D_VEC_SIZE 2* VEC_SIZE
+#define DATA_SIZE 4096
+
+typedef unsigned int uint;
+
+typedef hls::vector<float, VEC_SIZE> vec; // 512 bits
+typedef hls::vector<half, D_VEC_SIZE> hvec; // 256 bits
+typedef hls::vector<unsigned short, D_VEC_SIZE> bvec; // 512 bits
+
+void adam_bf16 ( hvec* grad16, bvec* param, vec* exp_avg, vec* exp_avg_sq, uint n_elements, 
+			float betta1, float betta2, float bias_correction2, float eps, float w_decay, float step_size, float combined_unscale, uint seed )
+{
+	vec g[DATA_SIZE];
+	vec p[DATA_SIZE];
+	vec v[DATA_SIZE];
+	vec m[DATA_SIZE];
+	
+	float _betta1 = betta1;
+	float _betta2 = betta2;
+	float _betta1_minus1 = (1.0f - _betta1);
+	float _betta2_minus1 = (1.0f - _betta2);
+	float _bias_correction2 = bias_correction2;
+	float _eps = eps;
+	float _w_decay_plus1 = (1.0f + w_decay);
+	float _step_size = step_size;
+	float _combined_unscale = combined_unscale;
+	uint _seed = seed;
+
+	uint iteration = n_elements / VEC_SIZE;
+	vadd_pipeline: for (uint i = 0 ; i < iteration ; i += DATA_SIZE)
+	{
+		#pragma HLS PIPELINE rewind
+		uint size = DATA_SIZE;
+		//boundary check
+		if (i + size > iteration) size = iteration - i;
+		
+		uint size_h = size / 2;
+		uint i_h = i / 2;
+
+		read_g: for ( uint x = 0; x < size_h; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			inner_read_g1: for (uint y = 0 ; y < VEC_SIZE;  ++y)
+			{
+			#pragma HLS UNROLL
+				g[ 2*x ][y ] = grad16[ i_h + x][y] * _combined_unscale;
+			}
+			inner_read_g2: for (uint y = 0 ; y < VEC_SIZE;  ++y)
+			{
+			#pragma HLS UNROLL
+				g[ 2*x + 1 ][y ] = grad16[ i_h + x][VEC_SIZE + y] * _combined_unscale;
+			}
+		}
+		read_v: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			v[x] =  g[x] * g[x] * _betta2_minus1 + exp_avg_sq[i + x] * _betta2;
+		}
+		write_v: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			exp_avg_sq[i + x] = v[x];
+		}
+		read_m: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			m[x] = g[x] * _betta1_minus1 + exp_avg[i + x] * _betta1;
+		}
+		write_m: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			exp_avg[i + x] = m[x];
+		}
+		read_p: for (uint x = 0 ; x < size_h; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			bvec b = param[i_h + x];
+			inner_read_p1: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				p[2*x][y] = bf16_to_float(b[y]);
+			}
+			inner_read_p2: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				p[2*x + 1][y] = bf16_to_float(b[VEC_SIZE + y]);
+			}
+		}
+		update_p: for (uint x = 0 ; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			inner_update_p: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+				p[x][y] = _w_decay_plus1 * p[x][y] + kernel_div( m[x][y], kernel_sqrt(v[x][y])*_bias_correction2+_eps ) * _step_size;
+			}
+		}
+		write_p: for ( uint x = 0; x < size_h; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			bvec b;
+			uint k = (i + 2*x) * VEC_SIZE;
+			inner_write_p: for (uint y = 0 ; y < D_VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				b[y] = float_to_bf16_sr(p[2*x + y / VEC_SIZE][y % VEC_SIZE], _seed, k + y);
+			}
+			param[i_h + x] = b;
+		}
+	}
+}
+
+
+extern "C"{
+	void krnl_vadd(
+				hvec* grad16,
+				bvec* param,
+				vec* exp_avg,
+				vec* exp_avg_sq,
+				uint  n_elements,
+				float betta1,
+				float betta2,
+				float bias_correction2,
+				float eps,
+				float w_decay,
+				float step_size,
+				float combined_unscale,
+				uint  seed
+			)
+	{
+	#pragma HLS interface m_axi port=grad16 offset=slave bundle=half max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=param offset=slave bundle=half max_read_burst_length=256 max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=exp_avg offset=slave bundle=single max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg_sq offset=slave bundle=single max_read_burst_length=256  max_write_burst_length=256
+
+		adam_bf16 ( grad16, param, exp_avg, exp_avg_sq, n_elements, 
+					betta1, betta2, bias_correction2, eps, w_decay, step_size, combined_unscale, seed );
+	}
+}
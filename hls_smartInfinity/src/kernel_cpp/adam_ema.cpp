@@ -0,0 +1,166 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// kernel:  vadd
+//
+// Purpose: Adam with an exponential moving average of the weights
+//          (ema = ema_decay * ema + (1 - ema_decay) * param) kept in the same pass
+//
+
+#include "hls_vector.h"
+#include <cmath>
+#include "fast_math.h"
+#include "hls_half.h" 
+#define VEC_SIZE 16
+#define D_VEC_SIZE 2* VEC_SIZE
+#define DATA_SIZE 4096
+
+typedef unsigned int uint;
+
+typedef hls::vector<float, VEC_SIZE> vec; // 512 bits
+typedef hls::vector<half, D_VEC_SIZE> hvec; // 256 bits
+
+void adam_ema (	hvec* grad16, hvec* param16, vec* param, vec* exp_avg, vec* exp_avg_sq, vec* ema, uint n_elements, 
+			float betta1, float betta2, float bias_correction2, float eps, float w_decay, float step_size, float combined_unscale, float ema_decay )
+{
+	hvec g16[DATA_SIZE];
+	vec g[DATA_SIZE];
+	vec p[DATA_SIZE];
+	vec v[DATA_SIZE];
+	vec m[DATA_SIZE];
+	
+	float _betta1 = betta1;
+	float _betta2 = betta2;
+	float _betta1_minus1 = (1.0f - _betta1);
+	float _betta2_minus1 = (1.0f - _betta2);
+	float _bias_correction2 = bias_correction2;
+	float _eps = eps;
+	float _w_decay_plus1 = (1.0f + w_decay);
+	float _step_size = step_size;
+	float _combined_unscale = combined_unscale;
+	float _ema_decay = ema_decay;
+	float _ema_decay_minus1 = (1.0f - _ema_decay);
+
+	uint iteration = n_elements / VEC_SIZE;
+	vadd_pipeline: for (uint i = 0 ; i < iteration ; i += DATA_SIZE)
+	{
+		#pragma HLS PIPELINE rewind
+		uint size = DATA_SIZE;
+		//boundary check
+		if (i + size > iteration) size = iteration - i;
+		
+		uint size_h = size / 2;
+		uint i_h = i / 2;
+
+		read_g: for ( uint x = 0; x < size_h; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			inner_read_g1: for (uint y = 0 ; y < VEC_SIZE;  ++y)
+			{
+			#pragma HLS UNROLL
+				g[ 2*x ][y ] = grad16[ i_h + x][y] * _combined_unscale;
+			}
+			inner_read_g2: for (uint y = 0 ; y < VEC_SIZE;  ++y)
+			{
+			#pragma HLS UNROLL
+				g[ 2*x + 1 ][y ] = grad16[ i_h + x][VEC_SIZE + y] * _combined_unscale;
+			}
+		}
+		read_v: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			v[x] =  g[x] * g[x] * _betta2_minus1 + exp_avg_sq[i + x] * _betta2;
+		}
+		write_v: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			exp_avg_sq[i + x] = v[x];
+		}
+		read_m: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			m[x] = g[x] * _betta1_minus1 + exp_avg[i + x] * _betta1;
+		}
+		write_m: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			exp_avg[i + x] = m[x];
+		}
+		read_p: for (uint x = 0 ; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			inner_read_p: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+				p[x][y] = _w_decay_plus1 * param[i + x][y] + kernel_div( m[x][y], kernel_sqrt(v[x][y])*_bias_correction2+_eps ) * _step_size;
+			}
+		}
+		write_p: for ( uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			param[i + x] = p[x];
+		}
+		// g is free once the moments are updated, it holds the new ema
+		read_e: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			g[x] = p[x] * _ema_decay_minus1 + ema[i + x] * _ema_decay;
+		}
+		write_e: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			ema[i + x] = g[x];
+		}
+		float_to_half: for ( uint x = 0; x < size_h; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			inner_f_to_h1:for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				param16[(i_h + x)][y] = half(p[2*x][y]);
+			}
+			inner_f_to_h2:for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				param16[(i_h + x)][VEC_SIZE + y] = half(p[2*x + 1][y]);
+			}
+
+		}
+	}
+}
+
+
+extern "C"{
+	void krnl_vadd(
+				hvec* grad16,
+				hvec* param16,
+				vec* param,
+				vec* exp_avg,
+				vec* exp_avg_sq,
+				vec* ema,
+				uint  n_elements,
+				float betta1,
+				float betta2,
+				float bias_correction2,
+				float eps,
+				float w_decay,
+				float step_size,
+				float combined_unscale,
+				float ema_decay
+			)
+	{
+	#pragma HLS interface m_axi port=grad16 offset=slave bundle=half max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=param16 offset=slave bundle=half max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=param offset=slave bundle=single max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg offset=slave bundle=single max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg_sq offset=slave bundle=single max_read_burst_length=256  max_write_burst_length=256
+	#pragma HLS interface m_axi port=ema offset=slave bundle=single max_read_burst_length=256  max_write_burst_length=256
+
+		adam_ema ( grad16, param16, param, exp_avg, exp_avg_sq, ema, n_elements, 
+					betta1, betta2, bias_correction2, eps, w_decay, step_size, combined_unscale, ema_decay );
+	}
+}
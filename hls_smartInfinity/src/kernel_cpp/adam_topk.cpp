@@ -12,7 +12,10 @@
 
 #include "hls_vector.h"
 #include <cmath>
+#include "fast_math.h"
 #include "hls_half.h" 
+#include "idx_unpack.h"
+#include "val_dequant.h"
 #define VEC_SIZE 16
 #define D_VEC_SIZE 2* VEC_SIZE
 #define DATA_SIZE 4096
@@ -51,12 +54,13 @@ static void initialize( float* grad, uint n_elements )
     }
 }
 
-void decompressor( ivec* grad_idx, vec* grad_val, uint n_elements_compressed, float* grad )
+void decompressor( uint* grad_idx, vec* grad_val, uint n_elements_compressed, uint topk_block, uint topk_block_k, uint* grad_val_q, uint val_bits, float* grad )
 {
 	ivec g_idx[DATA_SIZE];
 	vec g_val[DATA_SIZE];
 
 	uint iteration = n_elements_compressed / VEC_SIZE;
+	uint n_blocks = n_elements_compressed / IDX_BLOCK;
 
 	decompressor : for ( uint i = 0 ; i < iteration ; i+= DATA_SIZE )
 	{
@@ -64,16 +68,19 @@ void decompressor( ivec* grad_idx, vec* grad_val, uint n_elements_compressed, fl
 		//boundary check
 		if (i + size > iteration) size = iteration - i;
 
-		read_grad_idx: for (uint x = 0 ; x < size; ++x)
-		{
-			#pragma HLS PIPELINE II=1
-			g_idx[x] = grad_idx[i + x];		
-		}
+		// indices arrive delta-encoded and bit-packed, or as block-local offsets, see idx_unpack.h
+		if (topk_block == 0) unpack_idx( grad_idx, n_blocks, i / IDX_BLOCK_VECS, size / IDX_BLOCK_VECS, g_idx );
+		else unpack_local_idx( grad_idx, topk_block, topk_block_k, i, size, g_idx );
 
-		read_grad_val: for (uint x = 0 ; x < size ; ++x)
+		// values arrive as is, or as int8/int4 codes with per-block steps, see val_dequant.h
+		if (val_bits == 8 || val_bits == 4) dequant_val( grad_val_q, val_bits, n_elements_compressed, i, size, g_val );
+		else
 		{
-			#pragma HLS PIPELINE II=1
-			g_val[x] = grad_val[i + x];		
+			read_grad_val: for (uint x = 0 ; x < size ; ++x)
+			{
+				#pragma HLS PIPELINE II=1
+				g_val[x] = grad_val[i + x];
+			}
 		}
 
 		write_grad: for (uint x = 0 ; x < size; ++x)
@@ -154,7 +161,7 @@ void adam (	float* grad,  vec* param, vec* exp_avg, vec* exp_avg_sq, hvec* param
 			inner_read_p: for (uint y = 0 ; y < VEC_SIZE; ++y)
 			{
 			#pragma HLS UNROLL
-				p[x][y] = _w_decay_plus1 * param[i + x][y] + ( m[x][y] / ( sqrtf(v[x][y])*_bias_correction2+_eps) ) * _step_size;
+				p[x][y] = _w_decay_plus1 * param[i + x][y] + kernel_div( m[x][y], kernel_sqrt(v[x][y])*_bias_correction2+_eps ) * _step_size;
 			}
 		}
 		write_p: for ( uint x = 0; x < size; ++x)
@@ -183,9 +190,13 @@ void adam (	float* grad,  vec* param, vec* exp_avg, vec* exp_avg_sq, hvec* param
 extern "C"{
 	void krnl_vadd(
 #if TOPK
-				ivec* grad_idx,
+				uint* grad_idx,
 				vec* grad_val,
 				uint n_elements_compressed,
+				uint topk_block,
+				uint topk_block_k,
+				uint* grad_val_q,
+				uint val_bits,
 #endif
 				float* grad,
 				vec* param,
@@ -212,11 +223,13 @@ extern "C"{
 
 	#pragma HLS interface m_axi port=grad_idx offset=slave bundle=single_comp max_read_burst_length=256 
 	#pragma HLS interface m_axi port=grad_val offset=slave bundle=single_comp max_read_burst_length=256 
+	// quantized values alias grad_val (same cl::Buffer), on their own bundle
+	#pragma HLS interface m_axi port=grad_val_q offset=slave bundle=quant_comp max_read_burst_length=256
 
 
 #if TOPK
 		initialize(grad, n_elements);
-		decompressor( grad_idx, grad_val, n_elements_compressed, grad );
+		decompressor( grad_idx, grad_val, n_elements_compressed, topk_block, topk_block_k, grad_val_q, val_bits, grad );
 #endif
 		adam ( grad, param, exp_avg, exp_avg_sq, param16, n_elements,
 					betta1, betta2, bias_correction2, eps, w_decay, step_size, combined_unscale );
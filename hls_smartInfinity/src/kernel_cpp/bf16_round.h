@@ -0,0 +1,46 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// bf16 conversions of the master weights, bit-exact with the host
+// (deepspeed/ops/csrc/includes/bf16_sr.h).
+//
+// Stochastic rounding adds the low 16 bits of sr_hash(seed ^ k) to the fp32 bits before
+// truncating, k being the element index within the tensor, so any lane order gives the
+// same result as the CPU update.
+//
+
+#ifndef BF16_ROUND_H
+#define BF16_ROUND_H
+
+union bf16_word { unsigned int u; float f; };
+
+static inline unsigned int sr_hash( unsigned int x )
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline float bf16_to_float( unsigned short b )
+{
+	bf16_word w;
+	w.u = (unsigned int)b << 16;
+	return w.f;
+}
+
+static inline unsigned short float_to_bf16_sr( float f, unsigned int seed, unsigned int k )
+{
+	bf16_word w;
+	w.f = f;
+	if ((w.u & 0x7fffffffu) > 0x7f800000u) return (unsigned short)((w.u >> 16) | 0x0040); // quiet NaN
+	return (unsigned short)((w.u + (sr_hash(seed ^ k) & 0xffffu)) >> 16);
+}
+
+#endif
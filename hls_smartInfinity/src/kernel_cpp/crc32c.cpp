@@ -0,0 +1,84 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// kernel:  crc
+//
+// Purpose: Chunked CRC32C of a swapped tensor, to check it against the sidecar
+//          written with it (layout in deepspeed/ops/csrc/includes/crc32c.h).
+//
+// Every CRC_CHUNK bytes get one checksum. Vector element y of a chunk is lane y, so the 16
+// lanes advance together at II=1 and are folded with one more CRC32C at the end of the chunk.
+// n_words counts 32-bit words, the tensors checked here are fp32.
+//
+
+#include "hls_vector.h"
+#define CRC_CHUNK (1 << 20)
+#define CRC_LANES 16
+#define CRC_CHUNK_WORDS (CRC_CHUNK / 4)
+#define CRC_CHUNK_VECS (CRC_CHUNK_WORDS / CRC_LANES)
+#define CRC32C_POLY 0x82f63b78u
+
+typedef unsigned int uint;
+
+typedef hls::vector<uint, CRC_LANES> uvec; // 512 bits
+
+static uint crc32c_word( uint crc, uint w )
+{
+	crc ^= w;
+	crc_bits: for (int b = 0 ; b < 32; ++b)
+	{
+	#pragma HLS UNROLL
+		crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+	}
+	return crc;
+}
+
+void crc_chunks( uvec* data, uint n_words, uint* crcs )
+{
+	uint n_chunks = (n_words + CRC_CHUNK_WORDS - 1) / CRC_CHUNK_WORDS;
+	chunks: for (uint c = 0 ; c < n_chunks; ++c)
+	{
+		uint words = n_words - c * CRC_CHUNK_WORDS;
+		if (words > CRC_CHUNK_WORDS) words = CRC_CHUNK_WORDS;
+		uint n_vecs = (words + CRC_LANES - 1) / CRC_LANES;
+
+		uvec lane = 0xffffffffu;
+		compute_crc: for (uint x = 0 ; x < n_vecs; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			uvec w = data[c * CRC_CHUNK_VECS + x];
+			inner_compute_crc: for (uint y = 0 ; y < CRC_LANES; ++y)
+			{
+			#pragma HLS UNROLL
+				if (x * CRC_LANES + y < words) lane[y] = crc32c_word(lane[y], w[y]);
+			}
+		}
+
+		uint crc = 0xffffffffu;
+		fold_crc: for (uint y = 0 ; y < CRC_LANES; ++y)
+		{
+			#pragma HLS PIPELINE II=1
+			crc = crc32c_word(crc, ~lane[y]);
+		}
+		crcs[c] = ~crc;
+	}
+}
+
+
+extern "C"{
+	void krnl_crc(
+				uvec* data,
+				uint* crcs,
+				uint  n_words
+			)
+	{
+	#pragma HLS interface m_axi port=data offset=slave bundle=single max_read_burst_length=256
+	#pragma HLS interface m_axi port=crcs offset=slave bundle=factor max_write_burst_length=16
+
+	crc_chunks ( data, n_words, crcs );
+	}
+}
@@ -0,0 +1,71 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// Arithmetic of the update stages. RSQRT_NEWTON 0 keeps sqrtf and the divide. 1 or 2 replaces
+// both with a bit-trick reciprocal square root refined by that many Newton iterations, which
+// only needs multiplies and adds: sqrt(x) = x * rsqrt(x) and a / b = a * rsqrt(b)^2.
+// Error bounds against the CPU reference are listed in the README.
+//
+
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <cfloat>
+#include <cmath>
+
+#ifndef RSQRT_NEWTON
+#define RSQRT_NEWTON 0
+#endif
+
+union fast_math_word { unsigned int u; float f; };
+
+static inline float rsqrt_newton( float x )
+{
+	fast_math_word w;
+	w.f = x;
+	w.u = 0x5f375a86 - (w.u >> 1);
+	float y = w.f;
+	float half_x = 0.5f * x;
+	newton: for (int k = 0 ; k < RSQRT_NEWTON; ++k)
+	{
+	#pragma HLS UNROLL
+		y = y * (1.5f - half_x * y * y);
+	}
+	return y;
+}
+
+static inline float kernel_sqrt( float x )
+{
+#if RSQRT_NEWTON
+	return x * rsqrt_newton(fmaxf(x, FLT_MIN));
+#else
+	return sqrtf(x);
+#endif
+}
+
+// a / b for b > 0
+static inline float kernel_div( float a, float b )
+{
+#if RSQRT_NEWTON
+	float r = rsqrt_newton(b);
+	return a * r * r;
+#else
+	return a / b;
+#endif
+}
+
+// a / sqrt(x) for x > 0
+static inline float kernel_div_sqrt( float a, float x )
+{
+#if RSQRT_NEWTON
+	return a * rsqrt_newton(x);
+#else
+	return a / sqrtf(x);
+#endif
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// kernel:  norm
+//
+// Purpose: Sum of squares and inf/NaN check of a gradient sub group
+//
+
+#include "hls_vector.h"
+#include <cmath>
+#include "hls_half.h"
+#define VEC_SIZE 16
+#define D_VEC_SIZE 2* VEC_SIZE
+#define DATA_SIZE 4096
+
+// Largest finite fp16 value. NaN fails the comparison as well.
+#define HALF_MAX 65504.0f
+
+// result[RESULT_SUMSQ] is the sum of squared (still loss scaled) gradients,
+// result[RESULT_OVERFLOW] is 1.0f if any gradient is inf or NaN.
+#define RESULT_SUMSQ 0
+#define RESULT_OVERFLOW 1
+
+typedef unsigned int uint;
+
+typedef hls::vector<float, VEC_SIZE> vec; // 512 bits
+
+void grad_norm( half* grad16, float* result, uint n_elements )
+{
+	vec acc = 0.0f;
+	vec bad = 0.0f;
+
+	uint n_vecs = (n_elements + VEC_SIZE - 1) / VEC_SIZE;
+	compute_norm: for (uint x = 0 ; x < n_vecs; ++x)
+	{
+		#pragma HLS PIPELINE II=1
+		inner_compute_norm: for (uint y = 0 ; y < VEC_SIZE; ++y)
+		{
+		#pragma HLS UNROLL
+			uint k = x * VEC_SIZE + y;
+			if (k < n_elements) {
+				float g = grad16[k];
+				acc[y] += g * g;
+				if (!(fabsf(g) <= HALF_MAX)) bad[y] = 1.0f;
+			}
+		}
+	}
+
+	float sumsq = 0.0f;
+	float overflow = 0.0f;
+	reduce_norm: for (uint y = 0 ; y < VEC_SIZE; ++y)
+	{
+	#pragma HLS UNROLL
+		sumsq += acc[y];
+		overflow = fmaxf(overflow, bad[y]);
+	}
+	result[RESULT_SUMSQ] = sumsq;
+	result[RESULT_OVERFLOW] = overflow;
+}
+
+
+extern "C"{
+	void krnl_norm(
+				half* grad16,
+				float* result,
+				uint  n_elements
+			)
+	{
+	#pragma HLS interface m_axi port=grad16 offset=slave bundle=half256 max_read_burst_length=256
+	#pragma HLS interface m_axi port=result offset=slave bundle=factor max_write_burst_length=16
+
+	grad_norm ( grad16, result, n_elements );
+	}
+}
@@ -0,0 +1,98 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// Decoder stages for the gradient index formats of SmartComp
+// (layouts in deepspeed/ops/csrc/includes/idx_pack.h).
+//
+// Blocks of IDX_BLOCK increasing indices. Two header words per block: the first index,
+// and (payload word offset << IDX_WIDTH_BITS) | width. Field j holds idx[j] - idx[j - 1] - 1
+// in `width` bits, LSB first, so a payload is width * IDX_BLOCK / 32 words.
+//
+
+#ifndef IDX_UNPACK_H
+#define IDX_UNPACK_H
+
+#include "hls_vector.h"
+
+#define IDX_BLOCK 256
+#define IDX_LANES 16
+#define IDX_BLOCK_VECS (IDX_BLOCK / IDX_LANES)
+#define IDX_HEADER_WORDS 2
+#define IDX_WIDTH_BITS 5
+#define IDX_WIDTH_MASK ((1u << IDX_WIDTH_BITS) - 1)
+#define IDX_MAX_WORDS (31 * IDX_BLOCK / 32)
+
+typedef hls::vector<unsigned int, IDX_LANES> idx_vec; // 512 bits
+
+// Decodes blocks [block, block + n) of the stream into g_idx, IDX_BLOCK_VECS vectors per block
+static void unpack_idx( unsigned int* grad_idx, unsigned int n_blocks, unsigned int block, unsigned int n, idx_vec* g_idx )
+{
+	unsigned int words[IDX_MAX_WORDS + 1];
+	#pragma HLS ARRAY_PARTITION variable=words cyclic factor=32
+
+	unpack_block: for (unsigned int b = 0 ; b < n; ++b)
+	{
+		unsigned int base = grad_idx[IDX_HEADER_WORDS * (block + b)];
+		unsigned int word1 = grad_idx[IDX_HEADER_WORDS * (block + b) + 1];
+		unsigned int width = word1 & IDX_WIDTH_MASK;
+		unsigned int payload = IDX_HEADER_WORDS * n_blocks + (word1 >> IDX_WIDTH_BITS);
+		unsigned int n_words = width * IDX_BLOCK / 32;
+		unsigned int mask = width ? (0xffffffffu >> (32 - width)) : 0;
+
+		read_words: for (unsigned int w = 0 ; w < n_words; ++w)
+		{
+			#pragma HLS PIPELINE II=1
+			words[w] = grad_idx[payload + w];
+		}
+		words[n_words] = 0;
+
+		// running index of the previous field, so field 0 (always 0) lands on base
+		unsigned int run = base - 1;
+		decode: for (unsigned int x = 0 ; x < IDX_BLOCK_VECS; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			idx_vec idx;
+			inner_decode: for (unsigned int y = 0 ; y < IDX_LANES; ++y)
+			{
+			#pragma HLS UNROLL
+				unsigned int bit = (x * IDX_LANES + y) * width;
+				unsigned long long window = ((unsigned long long)words[bit / 32 + 1] << 32) | words[bit / 32];
+				run += ((unsigned int)(window >> (bit % 32)) & mask) + 1;
+				idx[y] = run;
+			}
+			g_idx[b * IDX_BLOCK_VECS + x] = idx;
+		}
+	}
+}
+
+// Block-local top-k: every block of topk_block elements contributes block_k 16-bit offsets, two
+// per word. Decodes vectors [vec, vec + n) of the selection into global indices.
+static void unpack_local_idx( unsigned int* grad_idx, unsigned int topk_block, unsigned int block_k, unsigned int vec, unsigned int n, idx_vec* g_idx )
+{
+	// block_k is a multiple of IDX_LANES, so a vector never straddles two blocks
+	unsigned int blk = vec * IDX_LANES / block_k;
+	unsigned int j = vec * IDX_LANES - blk * block_k;
+
+	decode_local: for (unsigned int x = 0 ; x < n; ++x)
+	{
+		#pragma HLS PIPELINE II=1
+		unsigned int base = blk * topk_block;
+		idx_vec idx;
+		inner_decode_local: for (unsigned int y = 0 ; y < IDX_LANES / 2; ++y)
+		{
+		#pragma HLS UNROLL
+			unsigned int word = grad_idx[(vec + x) * (IDX_LANES / 2) + y];
+			idx[2 * y] = base + (word & 0xffff);
+			idx[2 * y + 1] = base + (word >> 16);
+		}
+		g_idx[x] = idx;
+		j += IDX_LANES;
+		if (j == block_k) { j = 0; blk++; }
+	}
+}
+
+#endif
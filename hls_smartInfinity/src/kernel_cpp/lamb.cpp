@@ -0,0 +1,154 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// kernel:  vadd
+//
+// Purpose: Demonstrate Vector Add in OpenCL
+//
+
+#include "hls_vector.h"
+#include <cmath>
+#include "fast_math.h"
+#include "hls_half.h"
+#define VEC_SIZE 16
+#define D_VEC_SIZE 2* VEC_SIZE
+#define DATA_SIZE 4096
+
+// Segment table, same layout as adafactor.cpp (only begin/end are used here)
+#define SEG_FIELDS 8
+#define SEG_BEGIN 0		// first element of the segment
+#define SEG_END 1		// one past the last element
+
+// Phase 0 updates the moments and writes squared norms of w and of the update per segment
+// into norm[2s], norm[2s + 1]. The host turns them into trust ratios in norm[2s] and
+// launches phase 1, which applies the scaled update.
+#define PHASE_NORM 0
+#define PHASE_UPDATE 1
+
+typedef unsigned int uint;
+
+typedef hls::vector<float, VEC_SIZE> vec; // 512 bits
+
+void lamb( half* grad16, half* param16, vec* param, vec* exp_avg, vec* exp_avg_sq, float* norm, uint* segment, uint n_segments,
+			uint phase, float betta1, float betta2, float bias_correction1, float bias_correction2,
+			float eps, float weight_decay, float step_size, float combined_unscale )
+{
+	float _betta1 = betta1;
+	float _betta2 = betta2;
+	float _betta1_minus1 = (1.0f - _betta1);
+	float _betta2_minus1 = (1.0f - _betta2);
+	float _inv_bias_correction1 = 1.0f / bias_correction1;
+	float _bias_correction2 = bias_correction2;
+	float _eps = eps;
+	float _weight_decay = weight_decay;
+	float _step_size = step_size;
+	float _combined_unscale = combined_unscale;
+
+	segments: for (uint s = 0 ; s < n_segments; ++s)
+	{
+		uint* seg = segment + s * SEG_FIELDS;
+		uint begin = seg[SEG_BEGIN];
+		uint end = seg[SEG_END];
+
+		uint vb = begin / VEC_SIZE;
+		uint ve = (end + VEC_SIZE - 1) / VEC_SIZE;
+
+		if (phase == PHASE_NORM) {
+			vec w_acc = 0.0f;
+			vec u_acc = 0.0f;
+			compute_norm: for (uint x = vb ; x < ve; ++x)
+			{
+				#pragma HLS PIPELINE II=1
+				vec p = param[x];
+				vec m = exp_avg[x];
+				vec v = exp_avg_sq[x];
+				inner_compute_norm: for (uint y = 0 ; y < VEC_SIZE; ++y)
+				{
+				#pragma HLS UNROLL
+					uint k = x * VEC_SIZE + y;
+					if (k >= begin && k < end) {
+						float g = grad16[k] * _combined_unscale;
+						m[y] = _betta1 * m[y] + _betta1_minus1 * g;
+						v[y] = _betta2 * v[y] + _betta2_minus1 * g * g;
+						float u = kernel_div( m[y] * _inv_bias_correction1, kernel_sqrt(v[y]) * _bias_correction2 + _eps ) + _weight_decay * p[y];
+						w_acc[y] += p[y] * p[y];
+						u_acc[y] += u * u;
+					}
+				}
+				exp_avg[x] = m;
+				exp_avg_sq[x] = v;
+			}
+			float w_norm = 0.0f;
+			float u_norm = 0.0f;
+			reduce_norm: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				w_norm += w_acc[y];
+				u_norm += u_acc[y];
+			}
+			norm[2 * s] = w_norm;
+			norm[2 * s + 1] = u_norm;
+		} else {
+			float trust_step = _step_size * norm[2 * s];
+			compute_p: for (uint x = vb ; x < ve; ++x)
+			{
+				#pragma HLS PIPELINE II=1
+				vec p = param[x];
+				vec m = exp_avg[x];
+				vec v = exp_avg_sq[x];
+				inner_compute_p: for (uint y = 0 ; y < VEC_SIZE; ++y)
+				{
+				#pragma HLS UNROLL
+					uint k = x * VEC_SIZE + y;
+					if (k >= begin && k < end) {
+						float u = kernel_div( m[y] * _inv_bias_correction1, kernel_sqrt(v[y]) * _bias_correction2 + _eps ) + _weight_decay * p[y];
+						p[y] = p[y] + trust_step * u;
+						param16[k] = p[y];
+					}
+				}
+				param[x] = p;
+			}
+		}
+	}
+}
+
+
+extern "C"{
+	void krnl_vadd(
+				half* grad16,
+				half* param16,
+				vec* param,
+				vec* exp_avg,
+				vec* exp_avg_sq,
+				float* norm,
+				uint* segment,
+				uint  n_segments,
+				uint  phase,
+				float betta1,
+				float betta2,
+				float bias_correction1,
+				float bias_correction2,
+				float eps,
+				float weight_decay,
+				float step_size,
+				float combined_unscale
+			)
+	{
+	#pragma HLS interface m_axi port=grad16 offset=slave bundle=half256 max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=param16 offset=slave bundle=half512 max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=param offset=slave bundle=single max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg offset=slave bundle=single max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg_sq offset=slave bundle=single max_read_burst_length=256  max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=norm offset=slave bundle=factor max_read_burst_length=16 max_write_burst_length=16
+	#pragma HLS interface m_axi port=segment offset=slave bundle=factor max_read_burst_length=16
+
+	lamb ( grad16, param16, param, exp_avg, exp_avg_sq, norm, segment, n_segments,
+				   phase, betta1, betta2, bias_correction1, bias_correction2, eps, weight_decay, step_size, combined_unscale );
+	}
+}
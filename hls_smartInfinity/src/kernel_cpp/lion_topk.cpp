@@ -0,0 +1,226 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// kernel:  vadd
+//
+// Purpose: Demonstrate Vector Add in OpenCL
+//
+
+#include "hls_vector.h"
+#include <cmath>
+#include "hls_half.h" 
+#include "idx_unpack.h"
+#include "val_dequant.h"
+#define VEC_SIZE 16
+#define D_VEC_SIZE 2* VEC_SIZE
+#define DATA_SIZE 4096
+
+#define TOPK 1
+
+typedef unsigned int uint;
+
+typedef hls::vector<float, VEC_SIZE> vec; // 512 bits
+typedef hls::vector<uint, VEC_SIZE> ivec; // 512 bits
+typedef hls::vector<half, VEC_SIZE> hvec; // 256 bits
+typedef hls::vector<half, D_VEC_SIZE> dhvec; // 256 bits
+
+static void initialize( half* grad16, uint n_elements )
+{
+	hvec z = 0.0f;
+
+	uint iteration = n_elements / VEC_SIZE;
+	vadd_pipeline: for (uint i = 0 ; i < iteration ; i += DATA_SIZE)
+    {
+		#pragma HLS PIPELINE rewind
+		uint size = DATA_SIZE;
+		//boundary check
+		if (i + size > iteration) size = iteration - i;
+
+		init_grad: for ( uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			for (uint y = 0 ; y < VEC_SIZE;  ++y)
+			{
+			#pragma HLS UNROLL
+				grad16[(i+x) * VEC_SIZE + y] = z[y];
+			}
+		}
+    }
+}
+
+void decompressor( uint* grad_idx, hvec* grad_val, uint n_elements_compressed, uint topk_block, uint topk_block_k, uint* grad_val_q, uint val_bits, half* grad16 )
+{
+	ivec g_idx[DATA_SIZE];
+	hvec g_val[DATA_SIZE];
+
+	uint iteration = n_elements_compressed / VEC_SIZE;
+	uint n_blocks = n_elements_compressed / IDX_BLOCK;
+
+	decompressor : for ( uint i = 0 ; i < iteration ; i+= DATA_SIZE )
+	{
+		#pragma HLS PIPELINE rewind
+		uint size = DATA_SIZE;
+		//boundary check
+		if (i + size > iteration) size = iteration - i;
+
+		// indices arrive delta-encoded and bit-packed, or as block-local offsets, see idx_unpack.h
+		if (topk_block == 0) unpack_idx( grad_idx, n_blocks, i / IDX_BLOCK_VECS, size / IDX_BLOCK_VECS, g_idx );
+		else unpack_local_idx( grad_idx, topk_block, topk_block_k, i, size, g_idx );
+		// values arrive as is, or as int8/int4 codes with per-block steps, see val_dequant.h
+		if (val_bits == 8 || val_bits == 4) dequant_val( grad_val_q, val_bits, n_elements_compressed, i, size, g_val );
+		else
+		{
+			read_grad_val: for (uint x = 0 ; x < size ; ++x)
+			{
+				#pragma HLS PIPELINE II=1
+				g_val[x] = grad_val[i + x];
+			}
+		}
+		write_grad: for (uint x = 0 ; x < size; ++x)
+		{
+			inner_write_grad: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+				#pragma HLS PIPELINE II=1
+				grad16[ g_idx[x][y] ] = g_val[x][y];		
+			}
+		}
+	}
+}
+
+
+void lion (	half* grad16, dhvec* param16, vec* param, vec* exp_avg, uint n_elements, 
+			float betta1, float betta2, float w_decay, float step_size, float combined_unscale )
+{
+	vec g[DATA_SIZE];
+	vec p[DATA_SIZE];
+	vec m[DATA_SIZE];
+
+	float _betta1 = betta1;
+	float _betta2 = betta2;
+	float _betta1_minus1 = (1.0f - _betta1);
+	float _betta2_minus1 = (1.0f - _betta2);
+	float _step_size = step_size;
+	float _w_decay_plus1 = (1.0f + w_decay);
+	float _combined_unscale = combined_unscale;
+
+	uint iteration = n_elements / VEC_SIZE;
+	vadd_pipeline: for (uint i = 0 ; i < iteration ; i += DATA_SIZE)
+	{
+		#pragma HLS PIPELINE rewind
+		uint size = DATA_SIZE;
+		//boundary check
+		if (i + size > iteration) size = iteration - i;
+		
+		uint size_h = size / 2;
+		uint i_h = i / 2;
+		
+		read_p: for (uint x = 0 ; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			p[x] = param[i + x];
+		}
+
+		read_g: for ( uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			inner_read_g: for (uint y = 0 ; y < VEC_SIZE;  ++y)
+			{
+			#pragma HLS UNROLL
+				g[ x ][y ] = grad16[ (i + x) * VEC_SIZE + y] * _combined_unscale;
+			}
+		}
+
+		// g is reused for the interpolated update direction (betta1), m keeps the momentum (betta2)
+		read_m: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			vec m_old = exp_avg[ i + x];
+			m[x] = _betta2_minus1 * g[x] + ( _betta2 ) * m_old;
+			g[x] = _betta1_minus1 * g[x] + ( _betta1 ) * m_old;
+		}
+
+		write_m: for (uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			exp_avg[i + x] = m[x];
+		}
+		
+		compute_p: for ( uint x = 0; x < size; ++x)
+		{
+			#pragma HLS PIPELINE II=1
+			inner_sign: for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				float s = (g[x][y] > 0.0f) ? 1.0f : ((g[x][y] < 0.0f) ? -1.0f : 0.0f);
+				p[x][y] = p[x][y] * _w_decay_plus1 + _step_size * s;
+			}
+			param[i + x] = p[x];
+		}
+
+		float_to_half: for ( uint x = 0; x < size_h; ++x)
+		{
+			uint a = 2* x;
+			uint b = i_h + x;
+			#pragma HLS PIPELINE II=1
+			inner_f_to_h1:for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				param16[b][y] = p[ a ][y];
+			}
+			inner_f_to_h2:for (uint y = 0 ; y < VEC_SIZE; ++y)
+			{
+			#pragma HLS UNROLL
+				param16[b][VEC_SIZE + y] = p[ a + 1][y];
+			}
+		}
+	}
+}
+
+
+extern "C"{
+	void krnl_vadd(
+#if TOPK
+				uint* grad_idx,
+				hvec* grad_val,
+				uint n_elements_compressed,
+				uint topk_block,
+				uint topk_block_k,
+				uint* grad_val_q,
+				uint val_bits,
+#endif
+				half* grad16,
+				dhvec* param16,
+				vec* param,
+				vec* exp_avg,
+				uint  n_elements,
+				float betta1,
+				float betta2,
+				float w_decay,
+				float step_size,
+				float combined_unscale
+			)
+	{
+	#pragma HLS interface m_axi port=grad16 offset=slave bundle=half256 max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=param16 offset=slave bundle=half512 max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=param offset=slave bundle=single max_read_burst_length=256 max_write_burst_length=256
+	#pragma HLS interface m_axi port=exp_avg offset=slave bundle=single max_read_burst_length=256  max_write_burst_length=256
+
+	#pragma HLS interface m_axi port=grad_idx offset=slave bundle=single_comp max_read_burst_length=256 
+	#pragma HLS interface m_axi port=grad_val offset=slave bundle=half_comp max_read_burst_length=256 
+	// quantized values alias grad_val (same cl::Buffer), on their own bundle
+	#pragma HLS interface m_axi port=grad_val_q offset=slave bundle=quant_comp max_read_burst_length=256
+
+
+#if TOPK
+		initialize(grad16, n_elements);
+		decompressor( grad_idx, grad_val, n_elements_compressed, topk_block, topk_block_k, grad_val_q, val_bits, grad16 );
+#endif
+		lion( grad16, param16, param, exp_avg,  n_elements, 
+					 betta1, betta2, w_decay, step_size, combined_unscale );
+	}
+}
@@ -0,0 +1,66 @@
+/*
+# Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+# SPDX-License-Identifier: X11
+*/
+
+//------------------------------------------------------------------------------
+//
+// Decoder stage for the quantized gradient values of SmartComp
+// (layout in deepspeed/ops/csrc/includes/val_quant.h).
+//
+// n_values signed val_bits-bit codes (8 or 4), LSB first, then one fp32 step per VAL_QBLOCK
+// values. value = code * step.
+//
+
+#ifndef VAL_DEQUANT_H
+#define VAL_DEQUANT_H
+
+#define VAL_QBLOCK 128
+#define VAL_LANES 16
+#define VAL_CHUNK 4096
+#define VAL_MAX_WORDS (8 * VAL_LANES / 32)
+
+union val_word { unsigned int u; float f; };
+
+// Decodes vectors [vec, vec + n) of VAL_LANES values into g_val, n <= VAL_CHUNK
+template <typename T>
+static void dequant_val( unsigned int* grad_q, unsigned int val_bits, unsigned int n_values, unsigned int vec, unsigned int n, T* g_val )
+{
+	unsigned int codes[VAL_CHUNK][VAL_MAX_WORDS];
+	#pragma HLS ARRAY_PARTITION variable=codes complete dim=2
+	float steps[VAL_CHUNK * VAL_LANES / VAL_QBLOCK];
+
+	unsigned int words_per_vec = val_bits * VAL_LANES / 32;
+	unsigned int step_base = n_values * val_bits / 32;
+
+	read_codes: for (unsigned int w = 0 ; w < n * words_per_vec; ++w)
+	{
+		#pragma HLS PIPELINE II=1
+		codes[w / words_per_vec][w % words_per_vec] = grad_q[vec * words_per_vec + w];
+	}
+	read_steps: for (unsigned int s = 0 ; s < (n * VAL_LANES + VAL_QBLOCK - 1) / VAL_QBLOCK; ++s)
+	{
+		#pragma HLS PIPELINE II=1
+		val_word w;
+		w.u = grad_q[step_base + vec * VAL_LANES / VAL_QBLOCK + s];
+		steps[s] = w.f;
+	}
+
+	dequant: for (unsigned int x = 0 ; x < n; ++x)
+	{
+		#pragma HLS PIPELINE II=1
+		float step = steps[x * VAL_LANES / VAL_QBLOCK];
+		T val;
+		inner_dequant: for (unsigned int y = 0 ; y < VAL_LANES; ++y)
+		{
+		#pragma HLS UNROLL
+			int code;
+			if (val_bits == 8) code = (int)(codes[x][y / 4] << (24 - 8 * (y % 4))) >> 24;
+			else code = (int)(codes[x][y / 8] << (28 - 4 * (y % 8))) >> 28;
+			val[y] = code * step;
+		}
+		g_val[x] = val;
+	}
+}
+
+#endif
@@ -0,0 +1,140 @@
+#!/usr/bin/env python
+# Accuracy of the host Adam variants that differ from the dense fp32 step, against it.
+#
+# bf16 moments: the params after --steps steps with gradients of standard deviation --sigma
+# must stay within --tol of the fp32 trajectory, relative to how far fp32 Adam moved them.
+# The default sigma is a realistic gradient magnitude, at which fp16 moments underflow.
+#
+# Lazy Adam: after flush_lazy_states() a sparse run must match dense Adam fed the same gradients
+# zero-filled. The moments must be equal; the weights of the elements a step did not select are
+# held, so they are checked against dense Adam's moments applied to the selected ones only. At
+# density 1 the weights must equal dense Adam's as well.
+#
+# Loss scaled gradients: an inf in one param group must skip the update of every group, and
+# the clip must come from the norm over all groups.
+
+import argparse
+import math
+
+import torch
+
+from deepspeed.ops.adam import DeepSpeedCPUAdam
+from deepspeed.ops.op_builder import CPUAdamBuilder
+
+LR, BETA1, BETA2, EPS, WD = 1e-3, 0.9, 0.999, 1e-8, 0.0
+
+
+def bf16_moments(ds_opt_adam, n, steps, sigma, stochastic):
+    torch.manual_seed(0)
+    p0 = torch.randn(n)
+    ref, p = p0.clone(), p0.clone()
+    m, v = torch.zeros(n), torch.zeros(n)
+    m16, v16 = torch.zeros(n, dtype=torch.bfloat16), torch.zeros(n, dtype=torch.bfloat16)
+    for step in range(1, steps + 1):
+        grad = torch.randn(n) * sigma
+        ds_opt_adam.adam_update(0, step, LR, BETA1, BETA2, EPS, WD, True, ref, grad, m, v)
+        ds_opt_adam.adam_bf16_moments_update(0, step, LR, BETA1, BETA2, EPS, WD, True, stochastic, 0, p, grad,
+                                             m16, v16)
+    assert v16.float().count_nonzero() == n, "exp_avg_sq underflowed"
+    return ((p - ref).norm() / (ref - p0).norm()).item()
+
+
+def lazy_then_flush(n, steps, density, weight_decay):
+    torch.manual_seed(0)
+    p_lazy = torch.nn.Parameter(torch.randn(n))
+    p_dense = torch.nn.Parameter(p_lazy.detach().clone())
+    ref = p_lazy.detach().clone()
+    lazy = DeepSpeedCPUAdam([p_lazy], lr=LR, betas=(BETA1, BETA2), eps=EPS, weight_decay=weight_decay)
+    dense = DeepSpeedCPUAdam([p_dense], lr=LR, betas=(BETA1, BETA2), eps=EPS, weight_decay=weight_decay)
+    k = max(int(n * density), 1)
+    for step in range(1, steps + 1):
+        idx = torch.randperm(n)[:k].sort()[0]
+        val = torch.randn(k)
+        p_lazy.grad = torch.sparse_coo_tensor(idx.unsqueeze(0), val, (n, ))
+        p_dense.grad = torch.zeros(n).index_put_((idx, ), val)
+        lazy.step()
+        dense.step()
+        m, v = dense.state[p_dense]['exp_avg'], dense.state[p_dense]['exp_avg_sq']
+        ref.mul_(1 - LR * weight_decay)
+        denom = v[idx].sqrt() / math.sqrt(1 - BETA2**step) + EPS
+        ref[idx] -= LR / (1 - BETA1**step) * m[idx] / denom
+
+    # saving must not flush, and a loaded optimizer must carry on from the lazy state
+    state = lazy.state[p_lazy]
+    before = [t.clone() for t in (p_lazy.data, state['exp_avg'], state['exp_avg_sq'])]
+    saved = lazy.state_dict()
+    assert all(torch.equal(a, b) for a, b in zip(before, (p_lazy.data, state['exp_avg'], state['exp_avg_sq'])))
+    assert density == 1 or 'lazy_step' in saved['state'][0]
+    p_loaded = torch.nn.Parameter(p_lazy.detach().clone())
+    loaded = DeepSpeedCPUAdam([p_loaded], lr=LR, betas=(BETA1, BETA2), eps=EPS, weight_decay=weight_decay)
+    loaded.load_state_dict(saved)
+
+    lazy.flush_lazy_states()
+    loaded.flush_lazy_states()
+    close = lambda a, b: torch.allclose(a, b, rtol=1e-4, atol=1e-6)
+    assert close(state['exp_avg'], dense.state[p_dense]['exp_avg'])
+    assert close(state['exp_avg_sq'], dense.state[p_dense]['exp_avg_sq'])
+    assert close(p_lazy.data, ref)
+    assert density < 1 or close(p_lazy.data, p_dense.data)
+    assert torch.equal(p_loaded.data, p_lazy.data)
+
+
+def scaled_step(n, scale=1024., clip_grad=1.):
+    torch.manual_seed(0)
+    params = [torch.nn.Parameter(torch.randn(n)) for _ in range(2)]
+    refs = [torch.nn.Parameter(p.detach().clone()) for p in params]
+    groups = lambda ps: [{'params': [ps[0]]}, {'params': [ps[1]], 'lr': 2 * LR}]
+    opt, ref_opt = DeepSpeedCPUAdam(groups(params), lr=LR), DeepSpeedCPUAdam(groups(refs), lr=LR)
+    grads = [torch.randn(n) for _ in params]
+
+    for p, g in zip(params, grads):
+        p.grad = g * scale
+    params[1].grad[0] = float('inf')
+    before = [p.detach().clone() for p in params]
+    opt.step(combined_unscale=1. / scale, clip_grad=clip_grad)
+    assert opt.grad_overflow and all(torch.equal(a, b) for a, b in zip(before, params))
+    assert all(opt.state[p]['step'] == 0 for p in params)
+
+    params[1].grad[0] = grads[1][0] * scale
+    opt.step(combined_unscale=1. / scale, clip_grad=clip_grad)
+    norm = torch.cat(grads).norm().item()
+    for p, g in zip(refs, grads):
+        p.grad = g / max((norm + 1e-6) / clip_grad, 1.)
+    ref_opt.step()
+    assert not opt.grad_overflow and abs(opt.grad_norm - norm) < 1e-4 * norm
+    assert all(torch.allclose(p.data, r.data, rtol=1e-5, atol=1e-6) for p, r in zip(params, refs))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--n', type=int, default=1 << 16)
+    parser.add_argument('--steps', type=int, default=300)
+    parser.add_argument('--sigma', type=float, default=1e-4)
+    parser.add_argument('--tol', type=float, default=0.05)
+    args = parser.parse_args()
+
+    ds_opt_adam = CPUAdamBuilder().load()
+    ds_opt_adam.create_adam(0, LR, BETA1, BETA2, EPS, WD, True, False)
+
+    try:
+        DeepSpeedCPUAdam([torch.nn.Parameter(torch.zeros(1))], moment_dtype=torch.float16)
+        raise AssertionError("fp16 moments must be rejected")
+    except NotImplementedError:
+        pass
+
+    for stochastic in (False, True):
+        err = bf16_moments(ds_opt_adam, args.n, args.steps, args.sigma, stochastic)
+        print(f"bf16 moments{' (stochastic)' if stochastic else ''}: relative error {err:.4f}")
+        assert err < args.tol, f"bf16 moments drift {err:.4f} from fp32 Adam"
+
+    for density in (0.01, 0.1, 1.):
+        for weight_decay in (0., 0.01):
+            lazy_then_flush(args.n, 50, density, weight_decay)
+            print(f"lazy Adam, density {density}, weight decay {weight_decay}: matches dense Adam")
+
+    scaled_step(args.n)
+    print("loss scaled step: overflow skips every group, clip uses the global norm")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,88 @@
+#!/usr/bin/env python
+# Memory traffic of the host Adam step with regular and with streaming stores (DS_CPU_STREAM_MIN).
+#
+# Each mode runs in its own process, since the kernels read the environment once. The model
+# column counts the bytes the step has to move per fp32 element: params, grads and both moments
+# are read (16 B) and params and moments written (12 B); a regular store also reads the line for
+# ownership first (12 B). With --perf the DRAM bytes are measured with the memory controller
+# counters (Intel uncore IMC, needs perf and access to uncore events), as the difference of a
+# run with and one without the timed steps.
+
+import argparse
+import os
+import subprocess
+import sys
+import time
+
+MODES = {'regular': {'DS_CPU_STREAM_MIN': str(1 << 62)}, 'streaming': {'DS_CPU_STREAM_MIN': '0'}}
+MODEL_BYTES = {'regular': 40, 'streaming': 28}
+IMC_EVENTS = 'uncore_imc/cas_count_read/,uncore_imc/cas_count_write/'
+
+
+def worker(n, iters):
+    import torch
+    from deepspeed.ops.op_builder import CPUAdamBuilder
+
+    ds_opt_adam = CPUAdamBuilder().load()
+    ds_opt_adam.create_adam(0, 1e-3, 0.9, 0.999, 1e-8, 0.0, True, False)
+    params = torch.randn(n)
+    grads = torch.randn(n)
+    exp_avg = torch.zeros(n)
+    exp_avg_sq = torch.zeros(n)
+
+    def step(i):
+        ds_opt_adam.adam_update(0, i, 1e-3, 0.9, 0.999, 1e-8, 0.0, True, params, grads, exp_avg, exp_avg_sq)
+
+    step(1)
+    start = time.perf_counter()
+    for i in range(iters):
+        step(i + 2)
+    print((time.perf_counter() - start) / max(iters, 1))
+
+
+def run(mode, n, iters, perf):
+    env = dict(os.environ, **MODES[mode])
+    cmd = [sys.executable, __file__, '--worker', str(n), '--iters', str(iters)]
+    if perf:
+        cmd = ['perf', 'stat', '-a', '-x', ',', '-e', IMC_EVENTS, '--'] + cmd
+    out = subprocess.run(cmd, env=env, check=True, capture_output=True, text=True)
+    seconds = float(out.stdout.split()[-1])
+    dram = 0.
+    for line in out.stderr.splitlines() if perf else []:
+        fields = line.split(',')
+        if len(fields) < 3 or 'cas_count' not in fields[2]:
+            continue
+        # perf scales the CAS counts to MiB, a raw count is one 64 byte line
+        dram += float(fields[0]) * ((1 << 20) if fields[1] == 'MiB' else 64)
+    return seconds, dram
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--sizes', type=str, default='1M,16M,64M', help='comma separated element counts (K/M suffix)')
+    parser.add_argument('--iters', type=int, default=10)
+    parser.add_argument('--perf', action='store_true', help='measure DRAM bytes with the uncore IMC counters')
+    parser.add_argument('--worker', type=int, default=0, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+    if args.worker:
+        worker(args.worker, args.iters)
+        return
+
+    scale = {'K': 1 << 10, 'M': 1 << 20}
+    print("|Elements  |Mode      |  step(ms)| ns/elem|model B/elem| GB/s|DRAM B/elem|")
+    print("|----------|----------|----------|--------|------------|-----|-----------|")
+    for size in args.sizes.split(','):
+        n = int(size[:-1]) * scale[size[-1]] if size[-1] in scale else int(size)
+        for mode in MODES:
+            seconds, dram = run(mode, n, args.iters, args.perf)
+            measured = float('nan')
+            if args.perf:
+                _, idle = run(mode, n, 0, True)
+                measured = (dram - idle) / (n * args.iters)
+            gbs = MODEL_BYTES[mode] * n / seconds / 1e9
+            print(f"|{size:<10}|{mode:<10}|{seconds * 1e3:10.2f}|{seconds / n * 1e9:8.3f}|"
+                  f"{MODEL_BYTES[mode]:12d}|{gbs:5.1f}|{measured:11.1f}|")
+
+
+if __name__ == '__main__':
+    main()
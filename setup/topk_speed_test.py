@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+# Compare the SmartComp top-k op against torch.sort / torch.topk on host fp16 gradients.
+
+import argparse
+import time
+
+import torch
+
+from deepspeed.ops.op_builder import TopKBuilder
+
+
+def timeit(fn, iters):
+    fn()
+    start = time.perf_counter()
+    for _ in range(iters):
+        fn()
+    return (time.perf_counter() - start) / iters * 1e3
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--sizes', type=str, default='1M,16M,64M', help='comma separated element counts (K/M suffix)')
+    parser.add_argument('--ratios', type=str, default='0.01,0.05,0.1,0.3', help='comma separated compression ratios')
+    parser.add_argument('--iters', type=int, default=5)
+    parser.add_argument('--no-sort', action='store_true', help='skip the torch.sort baseline')
+    args = parser.parse_args()
+
+    topk_op = TopKBuilder().load()
+    scale = {'K': 1 << 10, 'M': 1 << 20}
+
+    print(f"threads: {torch.get_num_threads()}")
+    print("|Elements  |Ratio |   sort(ms)|   topk(ms)|  ds_topk(ms)|")
+    print("|----------|------|-----------|-----------|-------------|")
+    for size in args.sizes.split(','):
+        n = int(size[:-1]) * scale[size[-1]] if size[-1] in scale else int(size)
+        grad = torch.randn(n, dtype=torch.float16)
+        grad32 = grad.float()
+        for ratio in map(float, args.ratios.split(',')):
+            k = int(ratio * n)
+
+            # same selection size, the value sets must agree
+            ds_idx, _ = topk_op.topk(grad, k)
+            ref_val, _ = torch.topk(grad32.abs(), k, sorted=False)
+            assert torch.equal(grad32[ds_idx.long()].abs().sort()[0], ref_val.sort()[0])
+
+            t_sort = float('nan') if args.no_sort else timeit(lambda: grad.abs().sort(descending=True), args.iters)
+            # fp16 topk is not implemented on cpu for older torch, so time it in fp32
+            t_topk = timeit(lambda: torch.topk(grad32.abs(), k, sorted=False), args.iters)
+            t_ds = timeit(lambda: topk_op.topk(grad, k), args.iters)
+            print(f"|{size:<10}|{ratio:6.3f}|{t_sort:11.2f}|{t_topk:11.2f}|{t_ds:13.2f}|")
+
+
+if __name__ == '__main__':
+    main()